@@ -11,11 +11,14 @@
 #include "net.h"
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <sys/resource.h>
 #include "proxy.h"
+#include "param.h"
 
 struct bootstrapRootArgs {
   struct ncclSocket* listenSock;
-  uint64_t magic;
 };
 
 /* Init functions */
@@ -80,11 +83,17 @@ static ncclResult_t bootstrapNetRecv(struct ncclSocket* sock, void* data, int si
 struct extInfo {
   int rank;
   int nranks;
-  union ncclSocketAddress extAddressListenRoot;
   union ncclSocketAddress extAddressListen;
 };
 
-#include <sys/resource.h>
+// Ranks (or per-host sub-roots, on behalf of several ranks) send a stream of messages made of a count
+// followed by count extInfo to the root, on a connection they keep open. Once all ranks have checked in,
+// the root replies on each connection with a count followed by one bootstrapRootReply per rank it reported.
+#define BOOTSTRAP_MAX_BATCH 64 // Most extInfo in one message
+struct bootstrapRootReply {
+  int rank;
+  union ncclSocketAddress nextAddress;
+};
 
 static ncclResult_t setFilesLimit() {
   struct rlimit filesLimit;
@@ -94,72 +103,177 @@ static ncclResult_t setFilesLimit() {
   return ncclSuccess;
 }
 
+struct bootstrapRootConn {
+  struct ncclSocket sock;
+  int count;   // Number of extInfo in the message being received, -1 while receiving the count
+  int countBuf;
+  int offset;
+  struct extInfo* infos;
+  int maxInfos;
+  int* ranks;  // Ranks which checked in through this connection
+  int nRanks;
+  int maxRanks;
+};
+
+static void bootstrapRootConnFree(struct bootstrapRootConn* conn) {
+  if (conn == NULL) return;
+  ncclSocketClose(&conn->sock);
+  free(conn->infos);
+  free(conn->ranks);
+  free(conn);
+}
+
+struct bootstrapRootState {
+  int nranks;
+  int c;
+  union ncclSocketAddress *rankAddresses;
+  int* checkedIn;
+};
+
+static ncclResult_t bootstrapRootRegister(struct bootstrapRootState* root, struct bootstrapRootConn* conn, struct extInfo* info) {
+  if (root->c == 0 && root->nranks == 0) {
+    root->nranks = info->nranks;
+    NCCLCHECK(ncclCalloc(&root->rankAddresses, root->nranks));
+    NCCLCHECK(ncclCalloc(&root->checkedIn, root->nranks));
+  }
+
+  if (root->nranks != info->nranks) {
+    WARN("Bootstrap Root : mismatch in rank count from procs %d : %d", root->nranks, info->nranks);
+    return ncclInvalidUsage;
+  }
+
+  if (info->rank < 0 || info->rank >= root->nranks || root->checkedIn[info->rank]) {
+    WARN("Bootstrap Root : rank %d of %d ranks has already checked in", info->rank, root->nranks);
+    return ncclInvalidUsage;
+  }
+
+  // Save the connection handle for that rank
+  root->checkedIn[info->rank] = 1;
+  memcpy(root->rankAddresses+info->rank, &info->extAddressListen, sizeof(union ncclSocketAddress));
+  if (conn->nRanks == conn->maxRanks) {
+    conn->maxRanks = std::max(1, 2*conn->maxRanks);
+    NCCLCHECK(ncclRealloc(&conn->ranks, conn->nRanks, conn->maxRanks));
+  }
+  conn->ranks[conn->nRanks++] = info->rank;
+
+  ++root->c;
+  TRACE(NCCL_INIT, "Received connect from rank %d total %d/%d",  info->rank, root->c, root->nranks);
+  return ncclSuccess;
+}
+
+// Receive whatever is available on a connection, without blocking.
+static ncclResult_t bootstrapRootProgress(struct bootstrapRootState* root, struct bootstrapRootConn* conn) {
+  int ready;
+  NCCLCHECK(ncclSocketReady(&conn->sock, &ready));
+  if (!ready) return ncclSuccess;
+  while (1) {
+    if (conn->count == -1) {
+      NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_RECV, &conn->sock, &conn->countBuf, sizeof(int), &conn->offset));
+      if (conn->offset < sizeof(int)) return ncclSuccess;
+      // Until the first rank tells nranks, only the batch size bounds the count
+      if (conn->countBuf <= 0 || conn->countBuf > BOOTSTRAP_MAX_BATCH || (root->nranks && conn->countBuf > root->nranks - root->c)) {
+        WARN("Bootstrap Root : invalid check in message for %d ranks", conn->countBuf);
+        return ncclInternalError;
+      }
+      if (conn->countBuf > conn->maxInfos) {
+        NCCLCHECK(ncclRealloc(&conn->infos, conn->maxInfos, conn->countBuf));
+        conn->maxInfos = conn->countBuf;
+      }
+      conn->count = conn->countBuf;
+      conn->offset = 0;
+    }
+    int size = conn->count*sizeof(struct extInfo);
+    NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_RECV, &conn->sock, conn->infos, size, &conn->offset));
+    if (conn->offset < size) return ncclSuccess;
+    for (int i=0; i<conn->count; i++) NCCLCHECK(bootstrapRootRegister(root, conn, conn->infos+i));
+    conn->count = -1;
+    conn->offset = 0;
+  }
+}
+
 static void *bootstrapRoot(void* rargs) {
   struct bootstrapRootArgs* args = (struct bootstrapRootArgs*)rargs;
   struct ncclSocket* listenSock = args->listenSock;
-  uint64_t magic = args->magic;
   ncclResult_t res = ncclSuccess;
-  int nranks = 0, c = 0;
-  struct extInfo info;
-  union ncclSocketAddress *rankAddresses = NULL;
-  union ncclSocketAddress *rankAddressesRoot = NULL; // for initial rank <-> root information exchange
-  union ncclSocketAddress *zero = NULL;
-  NCCLCHECKGOTO(ncclCalloc(&zero, 1), res, out);
+  struct bootstrapRootState root = { 0 };
+  struct bootstrapRootConn** conns = NULL;
+  int nConns = 0, maxConns = 0;
+  struct bootstrapRootReply* reply = NULL;
+  int epollFd = -1;
+  struct epoll_event ev;
   setFilesLimit();
 
   TRACE(NCCL_INIT, "BEGIN");
-  /* Receive addresses from all ranks */
-  do {
-    struct ncclSocket sock;
-    NCCLCHECKGOTO(ncclSocketInit(&sock), res, out);
-    NCCLCHECKGOTO(ncclSocketAccept(&sock, listenSock), res, out);
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, &info, sizeof(info)), res, out);
-    NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
-
-    if (c == 0) {
-      nranks = info.nranks;
-      NCCLCHECKGOTO(ncclCalloc(&rankAddresses, nranks), res, out);
-      NCCLCHECKGOTO(ncclCalloc(&rankAddressesRoot, nranks), res, out);
-    }
+  SYSCHECKGOTO(epollFd = epoll_create1(EPOLL_CLOEXEC), res, out);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  SYSCHECKGOTO(epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSock->fd, &ev), res, out);
 
-    if (nranks != info.nranks) {
-      WARN("Bootstrap Root : mismatch in rank count from procs %d : %d", nranks, info.nranks);
+  /* Receive addresses from all ranks. Connections are kept open to send the replies. */
+  do {
+    struct epoll_event events[64];
+    int nEvents = epoll_wait(epollFd, events, 64, -1);
+    if (nEvents == -1) {
+      if (errno == EINTR) continue;
+      WARN("Bootstrap Root : epoll_wait failed : %s", strerror(errno));
       goto out;
     }
-
-    if (memcmp(zero, &rankAddressesRoot[info.rank], sizeof(union ncclSocketAddress)) != 0) {
-      WARN("Bootstrap Root : rank %d of %d ranks has already checked in", info.rank, nranks);
-      goto out;
+    for (int e=0; e<nEvents; e++) {
+      struct bootstrapRootConn* conn = (struct bootstrapRootConn*)events[e].data.ptr;
+      if (conn == NULL) {
+        // Accept all pending connections
+        while (1) {
+          NCCLCHECKGOTO(ncclCalloc(&conn, 1), res, out);
+          conn->count = -1;
+          NCCLCHECKGOTO(ncclSocketInit(&conn->sock), res, out);
+          NCCLCHECKGOTO(ncclSocketAccept(&conn->sock, listenSock), res, out);
+          if (conn->sock.state == ncclSocketStateAccepting) {
+            free(conn);
+            conn = NULL;
+            break;
+          }
+          if (nConns == maxConns) {
+            maxConns = std::max(64, 2*maxConns);
+            NCCLCHECKGOTO(ncclRealloc(&conns, nConns, maxConns), res, out);
+          }
+          conns[nConns++] = conn;
+          ev.events = EPOLLIN;
+          ev.data.ptr = conn;
+          SYSCHECKGOTO(epoll_ctl(epollFd, EPOLL_CTL_ADD, conn->sock.fd, &ev), res, out);
+          NCCLCHECKGOTO(bootstrapRootProgress(&root, conn), res, out);
+        }
+      } else {
+        NCCLCHECKGOTO(bootstrapRootProgress(&root, conn), res, out);
+      }
     }
-
-    // Save the connection handle for that rank
-    memcpy(rankAddressesRoot+info.rank, &info.extAddressListenRoot, sizeof(union ncclSocketAddress));
-    memcpy(rankAddresses+info.rank, &info.extAddressListen, sizeof(union ncclSocketAddress));
-
-    ++c;
-    TRACE(NCCL_INIT, "Received connect from rank %d total %d/%d",  info.rank, c, nranks);
-  } while (c < nranks);
-  TRACE(NCCL_INIT, "COLLECTED ALL %d HANDLES", nranks);
-
-  // Send the connect handle for the next rank in the AllGather ring
-  for (int r=0; r<nranks; ++r) {
-    int next = (r+1) % nranks;
-    struct ncclSocket sock;
-    NCCLCHECKGOTO(ncclSocketInit(&sock, rankAddressesRoot+r, magic, ncclSocketTypeBootstrap), res, out);
-    NCCLCHECKGOTO(ncclSocketConnect(&sock), res, out);
-    NCCLCHECKGOTO(bootstrapNetSend(&sock, rankAddresses+next, sizeof(union ncclSocketAddress)), res, out);
-    NCCLCHECKGOTO(ncclSocketClose(&sock), res, out);
+  } while (root.nranks == 0 || root.c < root.nranks);
+  TRACE(NCCL_INIT, "COLLECTED ALL %d HANDLES", root.nranks);
+
+  // Send the connect handle for the next rank in the AllGather ring, on the connection each rank came from
+  NCCLCHECKGOTO(ncclCalloc(&reply, root.nranks), res, out);
+  for (int i=0; i<nConns; i++) {
+    struct bootstrapRootConn* conn = conns[i];
+    if (conn->nRanks == 0) continue;
+    for (int r=0; r<conn->nRanks; r++) {
+      reply[r].rank = conn->ranks[r];
+      memcpy(&reply[r].nextAddress, root.rankAddresses+(conn->ranks[r]+1)%root.nranks, sizeof(union ncclSocketAddress));
+    }
+    NCCLCHECKGOTO(ncclSocketSend(&conn->sock, &conn->nRanks, sizeof(int)), res, out);
+    NCCLCHECKGOTO(ncclSocketSend(&conn->sock, reply, conn->nRanks*sizeof(struct bootstrapRootReply)), res, out);
   }
-  TRACE(NCCL_INIT, "SENT OUT ALL %d HANDLES", nranks);
+  TRACE(NCCL_INIT, "SENT OUT ALL %d HANDLES", root.nranks);
 
 out:
+  if (epollFd != -1) close(epollFd);
+  for (int i=0; i<nConns; i++) bootstrapRootConnFree(conns[i]);
+  free(conns);
   if (listenSock != NULL) {
     ncclSocketClose(listenSock);
     free(listenSock);
   }
-  if (rankAddresses) free(rankAddresses);
-  if (rankAddressesRoot) free(rankAddressesRoot);
-  if (zero) free(zero);
+  free(root.rankAddresses);
+  free(root.checkedIn);
+  free(reply);
   free(rargs);
 
   TRACE(NCCL_INIT, "DONE");
@@ -172,13 +286,13 @@ ncclResult_t bootstrapCreateRoot(struct ncclBootstrapHandle* handle, bool idFrom
   pthread_t thread;
 
   NCCLCHECK(ncclCalloc(&listenSock, 1));
-  NCCLCHECK(ncclSocketInit(listenSock, &handle->addr, handle->magic, ncclSocketTypeBootstrap, NULL, 0));
+  // Non-blocking, so that the root can accept and receive from many ranks at once
+  NCCLCHECK(ncclSocketInit(listenSock, &handle->addr, handle->magic, ncclSocketTypeBootstrap, NULL, 1));
   NCCLCHECK(ncclSocketListen(listenSock));
   NCCLCHECK(ncclSocketGetAddr(listenSock, &handle->addr));
 
   NCCLCHECK(ncclCalloc(&args, 1));
   args->listenSock = listenSock;
-  args->magic = handle->magic;
   NEQCHECK(pthread_create(&thread, NULL, bootstrapRoot, (void*)args), 0);
   ncclSetThreadName(thread, "NCCL BootstrapR");
   NEQCHECK(pthread_detach(thread), 0); // will not be pthread_join()'d
@@ -204,11 +318,234 @@ ncclResult_t bootstrapGetUniqueId(struct ncclBootstrapHandle* handle) {
   return ncclSuccess;
 }
 
-struct unexConn {
+NCCL_PARAM(BootstrapSubRoot, "BOOTSTRAP_SUBROOT", 0);
+
+struct bootstrapSubRootArgs {
+  int listenFd;
+  union ncclSocketAddress rootAddr;
+  uint64_t magic;
+};
+
+struct bootstrapSubRootClient {
+  int rank;
+  int fd;
+};
+
+// Send/recv on the local (AF_UNIX) sockets between ranks and their sub-root, through the socket calls so
+// that ranks can abort. Like the root, the sub-root has no abortFlag : it ends when its connections close.
+static ncclResult_t bootstrapLocalIo(int op, int fd, void* ptr, int size, volatile uint32_t* abortFlag) {
+  struct ncclSocket sock;
+  int offset = 0;
+  NCCLCHECK(ncclSocketInit(&sock, NULL, NCCL_SOCKET_MAGIC, ncclSocketTypeBootstrap, abortFlag));
+  NCCLCHECK(ncclSocketSetFd(fd, &sock));
+  NCCLCHECK(ncclSocketWait(op, &sock, ptr, size, &offset));
+  return ncclSuccess;
+}
+
+/* Per-host sub-root : gathers the extInfo of the local ranks, forwards them in batches to the root over
+ * a single connection, then dispatches the root reply. The root then only handles one connection per host.
+ */
+static void* bootstrapSubRoot(void* rargs) {
+  struct bootstrapSubRootArgs* args = (struct bootstrapSubRootArgs*)rargs;
+  ncclResult_t res = ncclSuccess;
+  struct ncclSocket rootSock;
+  struct bootstrapSubRootClient* clients = NULL;
+  int nClients = 0, maxClients = 0;
+  struct bootstrapRootReply* reply = NULL;
+  int nReplies;
+  int epollFd = -1;
+  struct epoll_event ev;
+
+  NCCLCHECKGOTO(ncclSocketInit(&rootSock, &args->rootAddr, args->magic, ncclSocketTypeBootstrap), res, out);
+  NCCLCHECKGOTO(ncclSocketConnect(&rootSock), res, out);
+  SYSCHECKGOTO(epollFd = epoll_create1(EPOLL_CLOEXEC), res, out);
+  ev.events = EPOLLIN;
+  ev.data.fd = args->listenFd;
+  SYSCHECKGOTO(epoll_ctl(epollFd, EPOLL_CTL_ADD, args->listenFd, &ev), res, out);
+  ev.data.fd = rootSock.fd;
+  SYSCHECKGOTO(epoll_ctl(epollFd, EPOLL_CTL_ADD, rootSock.fd, &ev), res, out);
+
+  while (1) {
+    struct epoll_event events[64];
+    struct extInfo batch[BOOTSTRAP_MAX_BATCH];
+    int nBatch = 0;
+    int nEvents = epoll_wait(epollFd, events, 64, -1);
+    if (nEvents == -1) {
+      if (errno == EINTR) continue;
+      WARN("Bootstrap SubRoot : epoll_wait failed : %s", strerror(errno));
+      goto out;
+    }
+    for (int e=0; e<nEvents; e++) {
+      int fd = events[e].data.fd;
+      if (fd == args->listenFd) {
+        int clientFd;
+        while ((clientFd = accept4(args->listenFd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+          if (nClients == maxClients) {
+            maxClients = std::max(8, 2*maxClients);
+            NCCLCHECKGOTO(ncclRealloc(&clients, nClients, maxClients), res, out);
+          }
+          clients[nClients].rank = -1;
+          clients[nClients++].fd = clientFd;
+          ev.data.fd = clientFd;
+          SYSCHECKGOTO(epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &ev), res, out);
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          WARN("Bootstrap SubRoot : accept failed : %s", strerror(errno));
+          goto out;
+        }
+      } else if (fd == rootSock.fd) {
+        // All ranks checked in, dispatch the root reply to local ranks
+        NCCLCHECKGOTO(ncclSocketRecv(&rootSock, &nReplies, sizeof(int)), res, out);
+        NCCLCHECKGOTO(ncclCalloc(&reply, nReplies), res, out);
+        NCCLCHECKGOTO(ncclSocketRecv(&rootSock, reply, nReplies*sizeof(struct bootstrapRootReply)), res, out);
+        for (int r=0; r<nReplies; r++) {
+          int c;
+          for (c=0; c<nClients && clients[c].rank != reply[r].rank; c++);
+          if (c == nClients) {
+            WARN("Bootstrap SubRoot : got reply for unknown rank %d", reply[r].rank);
+            goto out;
+          }
+          NCCLCHECKGOTO(bootstrapLocalIo(NCCL_SOCKET_SEND, clients[c].fd, &reply[r].nextAddress, sizeof(union ncclSocketAddress), NULL), res, out);
+        }
+        goto out;
+      } else {
+        struct extInfo* info = batch+nBatch;
+        int c;
+        for (c=0; c<nClients && clients[c].fd != fd; c++);
+        NCCLCHECKGOTO(bootstrapLocalIo(NCCL_SOCKET_RECV, fd, info, sizeof(struct extInfo), NULL), res, out);
+        SYSCHECKGOTO(epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL), res, out);
+        if (c < nClients) clients[c].rank = info->rank;
+        nBatch++;
+      }
+    }
+    if (nBatch) {
+      NCCLCHECKGOTO(ncclSocketSend(&rootSock, &nBatch, sizeof(int)), res, out);
+      NCCLCHECKGOTO(ncclSocketSend(&rootSock, batch, nBatch*sizeof(struct extInfo)), res, out);
+      TRACE(NCCL_INIT, "Forwarded %d ranks to root", nBatch);
+    }
+  }
+
+out:
+  if (epollFd != -1) close(epollFd);
+  for (int c=0; c<nClients; c++) close(clients[c].fd);
+  close(args->listenFd);
+  ncclSocketClose(&rootSock);
+  free(clients);
+  free(reply);
+  free(rargs);
+  return NULL;
+}
+
+// Check in with the root through the sub-root of this host, starting the sub-root if there isn't one yet.
+static ncclResult_t bootstrapSubRootCheckIn(struct ncclBootstrapHandle* handle, struct ncclComm* comm, struct extInfo* info, union ncclSocketAddress* nextAddr) {
+  ncclResult_t ret = ncclSuccess;
+  struct sockaddr_un addr;
+  int fd = -1, retries = 0;
+
+  // Abstract socket name, unique to this communicator
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  int len = snprintf(addr.sun_path+1, sizeof(addr.sun_path)-1, "nccl-bootstrap-%lx", handle->magic);
+  socklen_t addrLen = offsetof(struct sockaddr_un, sun_path)+1+len;
+
+  SYSCHECK(fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0), "socket");
+  if (bind(fd, (struct sockaddr*)&addr, addrLen) == 0) {
+    struct bootstrapSubRootArgs* args;
+    pthread_t thread;
+    SYSCHECKGOTO(listen(fd, 16384), ret, fail);
+    NCCLCHECKGOTO(ncclCalloc(&args, 1), ret, fail);
+    args->listenFd = fd;
+    args->magic = handle->magic;
+    memcpy(&args->rootAddr, &handle->addr, sizeof(union ncclSocketAddress));
+    NEQCHECKGOTO(pthread_create(&thread, NULL, bootstrapSubRoot, args), 0, ret, fail);
+    ncclSetThreadName(thread, "NCCL BootstrapS");
+    NEQCHECK(pthread_detach(thread), 0); // will not be pthread_join()'d
+    TRACE(NCCL_INIT, "rank %d started bootstrap sub-root", info->rank);
+  } else if (errno == EADDRINUSE) {
+    close(fd);
+  } else {
+    WARN("Bootstrap : bind of local socket failed : %s", strerror(errno));
+    ret = ncclSystemError;
+    goto fail;
+  }
+  fd = -1;
+
+  SYSCHECK(fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0), "socket");
+  // The sub-root may have bound the name but not be listening yet
+  while (connect(fd, (struct sockaddr*)&addr, addrLen) != 0) {
+    if ((errno != ECONNREFUSED && errno != EINTR && errno != EAGAIN) || ++retries == RETRY_REFUSED_TIMES) {
+      WARN("Bootstrap : connect to local sub-root failed : %s", strerror(errno));
+      ret = ncclSystemError;
+      goto fail;
+    }
+    if (*comm->abortFlag) {
+      ret = ncclInternalError;
+      goto fail;
+    }
+    usleep(SLEEP_INT);
+  }
+  NCCLCHECKGOTO(bootstrapLocalIo(NCCL_SOCKET_SEND, fd, info, sizeof(struct extInfo), comm->abortFlag), ret, fail);
+  // Returns once all ranks checked in with the root
+  NCCLCHECKGOTO(bootstrapLocalIo(NCCL_SOCKET_RECV, fd, nextAddr, sizeof(union ncclSocketAddress), comm->abortFlag), ret, fail);
+fail:
+  if (fd != -1) close(fd);
+  return ret;
+}
+
+// Check in directly with the root, and get the next rank address on the same connection.
+static ncclResult_t bootstrapRootCheckIn(struct ncclBootstrapHandle* handle, struct ncclComm* comm, struct extInfo* info, union ncclSocketAddress* nextAddr) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclSocket sock;
+  struct bootstrapRootReply reply;
+  int count = 1;
+
+  NCCLCHECK(ncclSocketInit(&sock, &handle->addr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
+  NCCLCHECKGOTO(ncclSocketConnect(&sock), ret, exit);
+  NCCLCHECKGOTO(ncclSocketSend(&sock, &count, sizeof(int)), ret, exit);
+  NCCLCHECKGOTO(ncclSocketSend(&sock, info, sizeof(struct extInfo)), ret, exit);
+  NCCLCHECKGOTO(ncclSocketRecv(&sock, &count, sizeof(int)), ret, exit);
+  if (count != 1) {
+    WARN("Bootstrap : unexpected root reply for %d ranks", count);
+    ret = ncclInternalError;
+    goto exit;
+  }
+  NCCLCHECKGOTO(ncclSocketRecv(&sock, &reply, sizeof(struct bootstrapRootReply)), ret, exit);
+  memcpy(nextAddr, &reply.nextAddress, sizeof(union ncclSocketAddress));
+exit:
+  ncclSocketClose(&sock);
+  return ret;
+}
+
+// Messages received from a peer before the matching bootstrapRecv was posted
+struct unexMsg {
   int peer;
   int tag;
+  int size;
+  char* data;
+  struct unexMsg* next;
+};
+
+// Header preceding each message on the persistent peer connections
+struct bootstrapMsgHeader {
+  int tag;
+  int size;
+};
+
+// Persistent connection to or from a peer
+struct bootstrapConn {
   struct ncclSocket sock;
-  struct unexConn* next;
+  int peer;
+  struct bootstrapConn* prev; // Send connections : LRU list, most recently used first
+  struct bootstrapConn* next; // Send connections : LRU list. Recv connections : next connection from the same peer
+};
+
+// Payload of a bootstrapSendRecv still being sent. The receive side progresses it whenever it waits,
+// so that the peer waiting for it can complete its own exchange.
+struct bootstrapPendingSend {
+  struct ncclSocket* sock;
+  void* data;
+  int size;
+  int offset;
 };
 
 struct bootstrapState {
@@ -217,7 +554,22 @@ struct bootstrapState {
   struct ncclSocket ringSendSocket;
   union ncclSocketAddress* peerCommAddresses;
   union ncclSocketAddress* peerProxyAddresses;
-  struct unexConn* unexpectedConnections;
+  // Send connections are opened on first use, and the least recently used one is closed beyond
+  // maxConns. The peer reads up to the close, then moves on to the next connection from us : it
+  // keeps a FIFO of connections per peer.
+  struct bootstrapConn** peerSendConns;
+  struct bootstrapConn** peerRecvConns;
+  struct bootstrapConn* sendLruHead;
+  struct bootstrapConn* sendLruTail;
+  int* reapPeers;                    // Peers with more than one recv connection
+  char* reapQueued;
+  int nReapPeers;
+  int nSendConns;
+  int nRecvConns;
+  int maxConns;
+  struct unexMsg** unexpectedMsgs;   // Hash table keyed by (peer, tag)
+  int nUnexpectedBuckets;
+  int nUnexpected;
   int cudaDev;
   int rank;
   int nranks;
@@ -225,13 +577,14 @@ struct bootstrapState {
   volatile uint32_t *abortFlag;
 };
 
+NCCL_PARAM(BootstrapMaxConns, "BOOTSTRAP_MAX_CONNS", 64);
+
 ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm* comm) {
   int rank = comm->rank;
   int nranks = comm->nRanks;
   struct bootstrapState* state;
   struct ncclSocket* proxySocket;
   ncclSocketAddress nextAddr;
-  struct ncclSocket sock, listenSockRoot;
   struct extInfo info = { 0 };
 
   NCCLCHECK(ncclCalloc(&state, 1));
@@ -240,6 +593,14 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   state->abortFlag = comm->abortFlag;
   comm->bootstrap = state;
   comm->magic = state->magic = handle->magic;
+  NCCLCHECK(ncclCalloc(&state->peerSendConns, nranks));
+  NCCLCHECK(ncclCalloc(&state->peerRecvConns, nranks));
+  state->maxConns = std::max(1, (int)ncclParamBootstrapMaxConns());
+  NCCLCHECK(ncclCalloc(&state->reapPeers, nranks));
+  NCCLCHECK(ncclCalloc(&state->reapQueued, nranks));
+  state->nUnexpectedBuckets = 64;
+  while (state->nUnexpectedBuckets < nranks) state->nUnexpectedBuckets *= 2;
+  NCCLCHECK(ncclCalloc(&state->unexpectedMsgs, state->nUnexpectedBuckets));
 
   TRACE(NCCL_INIT, "rank %d nranks %d", rank, nranks);
 
@@ -250,44 +611,36 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   NCCLCHECK(ncclSocketListen(&state->listenSock));
   NCCLCHECK(ncclSocketGetAddr(&state->listenSock, &info.extAddressListen));
 
-  // Create socket for root to contact me
-  NCCLCHECK(ncclSocketInit(&listenSockRoot, &bootstrapNetIfAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
-  NCCLCHECK(ncclSocketListen(&listenSockRoot));
-  NCCLCHECK(ncclSocketGetAddr(&listenSockRoot, &info.extAddressListenRoot));
+  if (ncclParamBootstrapSubRoot()) {
+    NCCLCHECK(bootstrapSubRootCheckIn(handle, comm, &info, &nextAddr));
+  } else {
+    // stagger connection times to avoid an overload of the root
+    if (nranks > 128) {
+      long msec = rank;
+      struct timespec tv;
+      tv.tv_sec = msec / 1000;
+      tv.tv_nsec = 1000000 * (msec % 1000);
+      TRACE(NCCL_INIT, "rank %d delaying connection to root by %ld msec", rank, msec);
+      (void) nanosleep(&tv, NULL);
+    }
 
-  // stagger connection times to avoid an overload of the root
-  if (nranks > 128) {
-    long msec = rank;
-    struct timespec tv;
-    tv.tv_sec = msec / 1000;
-    tv.tv_nsec = 1000000 * (msec % 1000);
-    TRACE(NCCL_INIT, "rank %d delaying connection to root by %ld msec", rank, msec);
-    (void) nanosleep(&tv, NULL);
+    // send info on my listening socket to root, and get info on my "next" rank in the bootstrap ring
+    NCCLCHECK(bootstrapRootCheckIn(handle, comm, &info, &nextAddr));
   }
 
-  // send info on my listening socket to root
-  NCCLCHECK(ncclSocketInit(&sock, &handle->addr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
-  NCCLCHECK(ncclSocketConnect(&sock));
-  NCCLCHECK(bootstrapNetSend(&sock, &info, sizeof(info)));
-  NCCLCHECK(ncclSocketClose(&sock));
-
-  // get info on my "next" rank in the bootstrap ring from root
-  NCCLCHECK(ncclSocketInit(&sock));
-  NCCLCHECK(ncclSocketAccept(&sock, &listenSockRoot));
-  NCCLCHECK(bootstrapNetRecv(&sock, &nextAddr, sizeof(union ncclSocketAddress)));
-  NCCLCHECK(ncclSocketClose(&sock));
-  NCCLCHECK(ncclSocketClose(&listenSockRoot));
-
   NCCLCHECK(ncclSocketInit(&state->ringSendSocket, &nextAddr, comm->magic, ncclSocketTypeBootstrap, comm->abortFlag));
   NCCLCHECK(ncclSocketConnect(&state->ringSendSocket));
   // Accept the connect request from the previous rank in the AllGather ring
   NCCLCHECK(ncclSocketInit(&state->ringRecvSocket));
   NCCLCHECK(ncclSocketAccept(&state->ringRecvSocket, &state->listenSock));
 
-  // AllGather all listen handlers
-  NCCLCHECK(ncclCalloc(&state->peerCommAddresses, nranks));
-  NCCLCHECK(ncclSocketGetAddr(&state->listenSock, state->peerCommAddresses+rank));
-  NCCLCHECK(bootstrapAllGather(state, state->peerCommAddresses, sizeof(union ncclSocketAddress)));
+  // AllGather all listen handlers. This one has to go through the ring; once peerCommAddresses
+  // is set, later AllGathers can talk to any peer directly.
+  union ncclSocketAddress* peerCommAddresses;
+  NCCLCHECK(ncclCalloc(&peerCommAddresses, nranks));
+  NCCLCHECK(ncclSocketGetAddr(&state->listenSock, peerCommAddresses+rank));
+  NCCLCHECK(bootstrapAllGather(state, peerCommAddresses, sizeof(union ncclSocketAddress)));
+  state->peerCommAddresses = peerCommAddresses;
 
   // Create the service proxy
   NCCLCHECK(ncclCalloc(&state->peerProxyAddresses, nranks));
@@ -305,6 +658,39 @@ ncclResult_t bootstrapInit(struct ncclBootstrapHandle* handle, struct ncclComm*
   return ncclSuccess;
 }
 
+NCCL_PARAM(BootstrapBruckThreshold, "BOOTSTRAP_BRUCK_THRESHOLD", 32);
+
+static ncclResult_t bootstrapSendRecv(struct bootstrapState* state, int sendPeer, int sendTag, void* sendData, int sendSize,
+    int recvPeer, int recvTag, void* recvData, int recvSize);
+
+#define BOOTSTRAP_TAG_ALLGATHER (-1)
+
+/* Bruck AllGather : ceil(log2(nranks)) steps instead of nranks-1.
+ * tmp holds slices in the order rank, rank+1, ... At step k, we receive k slices (or what is left)
+ * from rank+k, which holds exactly the slices we are missing, and send ours to rank-k.
+ */
+static ncclResult_t bootstrapBruckAllGather(struct bootstrapState* state, char* data, int size) {
+  ncclResult_t ret = ncclSuccess;
+  int rank = state->rank;
+  int nranks = state->nranks;
+  char* tmp;
+  NCCLCHECK(ncclCalloc(&tmp, (size_t)nranks*size));
+  memcpy(tmp, data+(size_t)rank*size, size);
+  for (int k=1; k<nranks; k<<=1) {
+    int n = std::min(k, nranks-k);
+    int dst = (rank - k + nranks) % nranks;
+    int src = (rank + k) % nranks;
+    NCCLCHECKGOTO(bootstrapSendRecv(state, dst, BOOTSTRAP_TAG_ALLGATHER, tmp, n*size,
+          src, BOOTSTRAP_TAG_ALLGATHER, tmp+(size_t)k*size, n*size), ret, exit);
+  }
+  for (int i=0; i<nranks; i++) {
+    memcpy(data+(size_t)((rank+i)%nranks)*size, tmp+(size_t)i*size, size);
+  }
+exit:
+  free(tmp);
+  return ret;
+}
+
 ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
   char* data = (char*)allData;
@@ -313,6 +699,12 @@ ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
 
   TRACE(NCCL_INIT, "rank %d nranks %d size %d", rank, nranks, size);
 
+  if (state->peerCommAddresses && nranks >= ncclParamBootstrapBruckThreshold()) {
+    NCCLCHECK(bootstrapBruckAllGather(state, data, size));
+    TRACE(NCCL_INIT, "rank %d nranks %d size %d - DONE", rank, nranks, size);
+    return ncclSuccess;
+  }
+
   /* Simple ring based AllGather
    * At each step i receive data from (rank-i-1) from left
    * and send previous step's data from (rank-i) to right
@@ -331,22 +723,144 @@ ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
   return ncclSuccess;
 }
 
-ncclResult_t bootstrapSend(void* commState, int peer, int tag, void* data, int size) {
-  ncclResult_t ret = ncclSuccess;
-  struct bootstrapState* state = (struct bootstrapState*)commState;
-  struct ncclSocket sock;
+static void bootstrapConnFree(struct bootstrapConn* conn) {
+  ncclSocketClose(&conn->sock);
+  free(conn);
+}
 
-  NCCLCHECKGOTO(ncclSocketInit(&sock, state->peerCommAddresses+peer, state->magic, ncclSocketTypeBootstrap, state->abortFlag), ret, fail);
-  NCCLCHECKGOTO(ncclSocketConnect(&sock), ret, fail);
-  NCCLCHECKGOTO(bootstrapNetSend(&sock, &state->rank, sizeof(int)), ret, fail);
-  NCCLCHECKGOTO(bootstrapNetSend(&sock, &tag, sizeof(int)), ret, fail);
-  NCCLCHECKGOTO(bootstrapNetSend(&sock, data, size), ret, fail);
+static void bootstrapSendLruRemove(struct bootstrapState* state, struct bootstrapConn* conn) {
+  if (conn->prev) conn->prev->next = conn->next; else state->sendLruHead = conn->next;
+  if (conn->next) conn->next->prev = conn->prev; else state->sendLruTail = conn->prev;
+  conn->prev = conn->next = NULL;
+}
 
-exit:
-  NCCLCHECK(ncclSocketClose(&sock));
+static void bootstrapSendLruPush(struct bootstrapState* state, struct bootstrapConn* conn) {
+  conn->next = state->sendLruHead;
+  if (conn->next) conn->next->prev = conn; else state->sendLruTail = conn;
+  state->sendLruHead = conn;
+}
+
+// Get the persistent connection to send to peer, connecting on first use.
+static ncclResult_t bootstrapGetSendSock(struct bootstrapState* state, int peer, struct ncclSocket** sock) {
+  ncclResult_t ret = ncclSuccess;
+  struct bootstrapConn* conn = state->peerSendConns[peer];
+  if (conn == NULL) {
+    if (state->nSendConns == state->maxConns) {
+      // Close the least recently used connection. Its data still reaches the peer before the close.
+      struct bootstrapConn* lru = state->sendLruTail;
+      bootstrapSendLruRemove(state, lru);
+      state->peerSendConns[lru->peer] = NULL;
+      state->nSendConns--;
+      bootstrapConnFree(lru);
+    }
+    NCCLCHECK(ncclCalloc(&conn, 1));
+    conn->peer = peer;
+    NCCLCHECKGOTO(ncclSocketInit(&conn->sock, state->peerCommAddresses+peer, state->magic, ncclSocketTypeBootstrap, state->abortFlag), ret, fail);
+    NCCLCHECKGOTO(ncclSocketConnect(&conn->sock), ret, fail);
+    NCCLCHECKGOTO(ncclSocketSend(&conn->sock, &state->rank, sizeof(int)), ret, fail);
+    state->peerSendConns[peer] = conn;
+    state->nSendConns++;
+  } else {
+    bootstrapSendLruRemove(state, conn);
+  }
+  bootstrapSendLruPush(state, conn);
+  *sock = &conn->sock;
+  return ncclSuccess;
+fail:
+  bootstrapConnFree(conn);
   return ret;
+}
+
+// Wait until fd has data, a connection or a close to read, progressing the pending send meanwhile.
+// Once the send completed, the caller blocks in its own receive instead.
+static ncclResult_t bootstrapWaitReadable(struct bootstrapState* state, int fd, struct bootstrapPendingSend* send) {
+  while (send && send->offset < send->size) {
+    struct pollfd pfd = { fd, POLLIN|POLLRDHUP, 0 };
+    SYSCHECK(poll(&pfd, 1, 0), "poll");
+    if (pfd.revents) return ncclSuccess;
+    NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_SEND, send->sock, send->data, send->size, &send->offset));
+    if (*state->abortFlag) return ncclInternalError;
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t unexpectedEnqueue(struct bootstrapState* state, int peer, int tag, int size, struct ncclSocket* sock,
+    struct bootstrapPendingSend* send);
+
+// Close the oldest connection from peer, which the peer closed
+static void bootstrapRecvConnPop(struct bootstrapState* state, int peer) {
+  struct bootstrapConn* conn = state->peerRecvConns[peer];
+  state->peerRecvConns[peer] = conn->next;
+  bootstrapConnFree(conn);
+  state->nRecvConns--;
+}
+
+// A peer has at most one connection open to us, so all its connections but the newest were closed
+// by the peer, and we hold more than maxConns mostly because of those. Move what is left on them to
+// the unexpected messages and close them, oldest first to keep messages in order.
+static ncclResult_t bootstrapRecvConnsReap(struct bootstrapState* state, struct bootstrapPendingSend* send) {
+  while (state->nReapPeers) {
+    int p = state->reapPeers[--state->nReapPeers];
+    state->reapQueued[p] = 0;
+    while (state->peerRecvConns[p] && state->peerRecvConns[p]->next) {
+      while (1) {
+        struct bootstrapMsgHeader header;
+        int closed;
+        NCCLCHECK(bootstrapWaitReadable(state, state->peerRecvConns[p]->sock.fd, send));
+        NCCLCHECK(ncclSocketTryRecv(&state->peerRecvConns[p]->sock, &header, sizeof(header), &closed));
+        if (closed) break;
+        NCCLCHECK(unexpectedEnqueue(state, p, header.tag, header.size, &state->peerRecvConns[p]->sock, send));
+      }
+      bootstrapRecvConnPop(state, p);
+    }
+  }
+  return ncclSuccess;
+}
+
+// Get the oldest open connection from peer. When there is none, accept one connection, which may be
+// from another peer : *sock is NULL until the one from peer shows up.
+static ncclResult_t bootstrapGetRecvSock(struct bootstrapState* state, int peer, struct ncclSocket** sock, struct bootstrapPendingSend* send) {
+  ncclResult_t ret = ncclSuccess;
+  struct bootstrapConn* conn = NULL;
+  if (state->peerRecvConns[peer] == NULL) {
+    int newPeer;
+    NCCLCHECK(ncclCalloc(&conn, 1));
+    NCCLCHECKGOTO(ncclSocketInit(&conn->sock), ret, fail);
+    NCCLCHECKGOTO(bootstrapWaitReadable(state, state->listenSock.fd, send), ret, fail);
+    NCCLCHECKGOTO(ncclSocketAccept(&conn->sock, &state->listenSock), ret, fail);
+    NCCLCHECKGOTO(ncclSocketRecv(&conn->sock, &newPeer, sizeof(int)), ret, fail);
+    if (newPeer < 0 || newPeer >= state->nranks) {
+      WARN("Bootstrap : unexpected connection from rank %d", newPeer);
+      ret = ncclInternalError;
+      goto fail;
+    }
+    conn->peer = newPeer;
+    struct bootstrapConn** last = state->peerRecvConns+newPeer;
+    while (*last) last = &(*last)->next;
+    *last = conn;
+    conn = NULL;
+    if (state->peerRecvConns[newPeer]->next && state->reapQueued[newPeer] == 0) {
+      state->reapQueued[newPeer] = 1;
+      state->reapPeers[state->nReapPeers++] = newPeer;
+    }
+    if (++state->nRecvConns > state->maxConns) NCCLCHECK(bootstrapRecvConnsReap(state, send));
+  }
+  *sock = state->peerRecvConns[peer] ? &state->peerRecvConns[peer]->sock : NULL;
+  return ncclSuccess;
 fail:
-  goto exit;
+  bootstrapConnFree(conn);
+  return ret;
+}
+
+ncclResult_t bootstrapSend(void* commState, int peer, int tag, void* data, int size) {
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  struct ncclSocket* sock;
+  struct bootstrapMsgHeader header = { tag, size };
+
+  NCCLCHECK(bootstrapGetSendSock(state, peer, &sock));
+  NCCLCHECK(ncclSocketSend(sock, &header, sizeof(header)));
+  NCCLCHECK(ncclSocketSend(sock, data, size));
+  return ncclSuccess;
 }
 
 ncclResult_t bootstrapBarrier(void* commState, int *ranks, int rank, int nranks, int tag) {
@@ -386,103 +900,249 @@ ncclResult_t bootstrapIntraNodeAllGather(void* commState, int *ranks, int rank,
   return ncclSuccess;
 }
 
-ncclResult_t unexpectedEnqueue(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock) {
-  // New unex
-  struct unexConn* unex;
+struct bootstrapRing {
+  struct ncclSocket listenSock;
+  struct ncclSocket sendSock;
+  struct ncclSocket recvSock;
+  int rank;
+  int nranks;
+};
+
+// A ring of sockets separate from the comm bootstrap state, so that a helper thread can run
+// allgathers while the comm keeps using bootstrapSend/Recv. Creating it is collective.
+ncclResult_t bootstrapRingCreate(void* commState, struct bootstrapRing** ringPtr) {
+  struct bootstrapState* state = (struct bootstrapState*)commState;
+  ncclResult_t ret = ncclSuccess;
+  union ncclSocketAddress* addrs = NULL;
+  struct bootstrapRing* ring;
+  NCCLCHECK(ncclCalloc(&ring, 1));
+  ring->listenSock.fd = ring->sendSock.fd = ring->recvSock.fd = -1;
+  ring->rank = state->rank;
+  ring->nranks = state->nranks;
+  NCCLCHECKGOTO(ncclSocketInit(&ring->listenSock, &bootstrapNetIfAddr, state->magic, ncclSocketTypeBootstrap, state->abortFlag), ret, fail);
+  NCCLCHECKGOTO(ncclSocketListen(&ring->listenSock), ret, fail);
+  NCCLCHECKGOTO(ncclCalloc(&addrs, state->nranks), ret, fail);
+  NCCLCHECKGOTO(ncclSocketGetAddr(&ring->listenSock, addrs+state->rank), ret, fail);
+  NCCLCHECKGOTO(bootstrapAllGather(state, addrs, sizeof(union ncclSocketAddress)), ret, fail);
+  NCCLCHECKGOTO(ncclSocketInit(&ring->sendSock, addrs+(state->rank+1)%state->nranks, state->magic, ncclSocketTypeBootstrap, state->abortFlag), ret, fail);
+  NCCLCHECKGOTO(ncclSocketConnect(&ring->sendSock), ret, fail);
+  NCCLCHECKGOTO(ncclSocketInit(&ring->recvSock), ret, fail);
+  NCCLCHECKGOTO(ncclSocketAccept(&ring->recvSock, &ring->listenSock), ret, fail);
+  free(addrs);
+  *ringPtr = ring;
+  return ncclSuccess;
+fail:
+  free(addrs);
+  bootstrapRingClose(ring);
+  return ret;
+}
+
+ncclResult_t bootstrapRingAllGather(struct bootstrapRing* ring, void* allData, int size) {
+  char* data = (char*)allData;
+  int rank = ring->rank;
+  int nranks = ring->nranks;
+  for (int i=0; i<nranks-1; i++) {
+    size_t rslice = (rank - i - 1 + nranks) % nranks;
+    size_t sslice = (rank - i + nranks) % nranks;
+    NCCLCHECK(bootstrapNetSend(&ring->sendSock, data+sslice*size, size));
+    NCCLCHECK(bootstrapNetRecv(&ring->recvSock, data+rslice*size, size));
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t bootstrapRingClose(struct bootstrapRing* ring) {
+  if (ring == NULL) return ncclSuccess;
+  ncclSocketClose(&ring->listenSock);
+  ncclSocketClose(&ring->sendSock);
+  ncclSocketClose(&ring->recvSock);
+  free(ring);
+  return ncclSuccess;
+}
+
+static inline int unexpectedBucket(struct bootstrapState* state, int peer, int tag) {
+  uint64_t key = ((uint64_t)(uint32_t)peer << 32) | (uint32_t)tag;
+  return (int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (state->nUnexpectedBuckets-1);
+}
+
+// Read the payload of an unexpected message from sock and save it for later.
+static ncclResult_t unexpectedEnqueue(struct bootstrapState* state, int peer, int tag, int size, struct ncclSocket* sock,
+    struct bootstrapPendingSend* send) {
+  struct unexMsg* unex;
   NCCLCHECK(ncclCalloc(&unex, 1));
   unex->peer = peer;
   unex->tag = tag;
-  memcpy(&unex->sock, sock, sizeof(struct ncclSocket));
-
-  // Enqueue
-  struct unexConn* list = state->unexpectedConnections;
-  if (list == NULL) {
-    state->unexpectedConnections = unex;
-    return ncclSuccess;
+  unex->size = size;
+  if (size) {
+    ncclResult_t ret = ncclSuccess;
+    int offset = 0;
+    NCCLCHECKGOTO(ncclCalloc(&unex->data, size), ret, fail);
+    while (offset < size) {
+      NCCLCHECKGOTO(bootstrapWaitReadable(state, sock->fd, send), ret, fail);
+      NCCLCHECKGOTO(ncclSocketProgress(NCCL_SOCKET_RECV, sock, unex->data, size, &offset), ret, fail);
+    }
+    goto enqueue;
+fail:
+    free(unex->data);
+    free(unex);
+    return ret;
   }
-  while (list->next) list = list->next;
-  list->next = unex;
+
+enqueue:
+  // Append, to keep messages with the same peer and tag in order
+  struct unexMsg** list = state->unexpectedMsgs+unexpectedBucket(state, peer, tag);
+  while (*list) list = &(*list)->next;
+  *list = unex;
+  state->nUnexpected++;
   return ncclSuccess;
 }
 
-ncclResult_t unexpectedDequeue(struct bootstrapState* state, int peer, int tag, struct ncclSocket* sock, int* found) {
-  struct unexConn* elem = state->unexpectedConnections;
-  struct unexConn* prev = NULL;
-  *found = 0;
-  while (elem) {
+static struct unexMsg* unexpectedDequeue(struct bootstrapState* state, int peer, int tag) {
+  struct unexMsg** list = state->unexpectedMsgs+unexpectedBucket(state, peer, tag);
+  while (*list) {
+    struct unexMsg* elem = *list;
     if (elem->peer == peer && elem->tag == tag) {
-      if (prev == NULL) {
-        state->unexpectedConnections = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-      memcpy(sock, &elem->sock, sizeof(struct ncclSocket));
-      free(elem);
-      *found = 1;
-      return ncclSuccess;
+      *list = elem->next;
+      state->nUnexpected--;
+      return elem;
     }
-    prev = elem;
-    elem = elem->next;
+    list = &elem->next;
   }
-  return ncclSuccess;
+  return NULL;
 }
 
 static void unexpectedFree(struct bootstrapState* state) {
-  struct unexConn* elem = state->unexpectedConnections;
-  struct unexConn* prev = NULL;
+  for (int b=0; b<state->nUnexpectedBuckets; b++) {
+    struct unexMsg* elem = state->unexpectedMsgs[b];
+    while (elem) {
+      struct unexMsg* next = elem->next;
+      free(elem->data);
+      free(elem);
+      elem = next;
+    }
+  }
+  free(state->unexpectedMsgs);
+  state->unexpectedMsgs = NULL;
+  state->nUnexpected = 0;
+}
+
+/* Find the next message from peer with the given tag. If it was already received, it is copied to data
+ * and *sock is set to NULL. Otherwise *sock is the connection to peer with the message header consumed,
+ * and the payload (*msgSize bytes) is still to be received. send, if not NULL, is progressed while waiting.
+ */
+static ncclResult_t bootstrapRecvMatch(struct bootstrapState* state, int peer, int tag, void* data, int size, struct ncclSocket** sock, int* msgSize,
+    struct bootstrapPendingSend* send) {
+  struct ncclSocket* peerSock = NULL;
+  *sock = NULL;
+  while (1) {
+    // Search unexpected messages first
+    struct unexMsg* unex = unexpectedDequeue(state, peer, tag);
+    if (unex) {
+      ncclResult_t ret = ncclSuccess;
+      if (unex->size > size) {
+        WARN("Message truncated : received %d bytes instead of %d", unex->size, size);
+        ret = ncclInternalError;
+      } else {
+        memcpy(data, unex->data, unex->size);
+        *msgSize = unex->size;
+      }
+      free(unex->data);
+      free(unex);
+      return ret;
+    }
+    if (peerSock == NULL) {
+      // Accepting a connection can move messages from peer to the unexpected ones : search them again.
+      NCCLCHECK(bootstrapGetRecvSock(state, peer, &peerSock, send));
+      continue;
+    }
 
-  while (elem) {
-    prev = elem;
-    elem = elem->next;
-    free(prev);
+    // Then read messages from the peer connections until we find ours
+    struct bootstrapMsgHeader header;
+    int closed;
+    NCCLCHECK(bootstrapWaitReadable(state, peerSock->fd, send));
+    NCCLCHECK(ncclSocketTryRecv(peerSock, &header, sizeof(header), &closed));
+    if (closed) {
+      // The peer moved on to a new connection
+      bootstrapRecvConnPop(state, peer);
+      peerSock = NULL;
+      continue;
+    }
+    if (header.tag == tag) {
+      if (header.size > size) {
+        WARN("Message truncated : received %d bytes instead of %d", header.size, size);
+        return ncclInternalError;
+      }
+      *msgSize = header.size;
+      *sock = peerSock;
+      return ncclSuccess;
+    }
+    // Unexpected message. Save for later.
+    NCCLCHECK(unexpectedEnqueue(state, peer, header.tag, header.size, peerSock, send));
   }
-  return;
 }
 
 // We can't know who we'll receive from, so we need to receive everything at once
 ncclResult_t bootstrapRecv(void* commState, int peer, int tag, void* data, int size) {
-  ncclResult_t ret = ncclSuccess;
   struct bootstrapState* state = (struct bootstrapState*)commState;
-  struct ncclSocket sock;
-  int newPeer, newTag;
+  struct ncclSocket* sock;
+  int msgSize;
 
-  // Search unexpected connections first
-  int found;
-  NCCLCHECK(unexpectedDequeue(state, peer, tag, &sock, &found));
-  if (found) {
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, ((char*)data), size), ret, fail);
-    goto exit;
+  NCCLCHECK(bootstrapRecvMatch(state, peer, tag, data, size, &sock, &msgSize, NULL));
+  if (sock) NCCLCHECK(ncclSocketRecv(sock, data, msgSize));
+  return ncclSuccess;
+}
+
+// Send to one peer while receiving from another. The payload we send is progressed during every wait of
+// the receive, including for unexpected messages, so that exchanges larger than the socket buffers cannot
+// deadlock when all ranks send before receiving.
+static ncclResult_t bootstrapSendRecv(struct bootstrapState* state, int sendPeer, int sendTag, void* sendData, int sendSize,
+    int recvPeer, int recvTag, void* recvData, int recvSize) {
+  struct ncclSocket *sendSock, *recvSock;
+  struct bootstrapMsgHeader header = { sendTag, sendSize };
+  struct bootstrapPendingSend send;
+  int recvBytes, recvOffset = 0;
+
+  NCCLCHECK(bootstrapGetSendSock(state, sendPeer, &sendSock));
+  NCCLCHECK(ncclSocketSend(sendSock, &header, sizeof(header)));
+  send.sock = sendSock;
+  send.data = sendData;
+  send.size = sendSize;
+  send.offset = 0;
+  NCCLCHECK(bootstrapRecvMatch(state, recvPeer, recvTag, recvData, recvSize, &recvSock, &recvBytes, &send));
+  if (recvSock == NULL) recvOffset = recvBytes;
+
+  while (send.offset < sendSize || recvOffset < recvBytes) {
+    if (send.offset < sendSize) NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_SEND, sendSock, sendData, sendSize, &send.offset));
+    if (recvOffset < recvBytes) NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_RECV, recvSock, recvData, recvBytes, &recvOffset));
   }
+  return ncclSuccess;
+}
 
-  // Then look for new connections
-  while (1) {
-    NCCLCHECKGOTO(ncclSocketInit(&sock), ret, fail);
-    NCCLCHECKGOTO(ncclSocketAccept(&sock, &state->listenSock), ret, fail);
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, &newPeer, sizeof(int)), ret, fail);
-    NCCLCHECKGOTO(bootstrapNetRecv(&sock, &newTag, sizeof(int)), ret, fail);
-    if (newPeer == peer && newTag == tag) {
-      NCCLCHECKGOTO(bootstrapNetRecv(&sock, ((char*)data), size), ret, fail);
-      goto exit;
+static void bootstrapPeerSocksFree(struct bootstrapState* state) {
+  for (int p=0; p<state->nranks; p++) {
+    if (state->peerSendConns && state->peerSendConns[p]) bootstrapConnFree(state->peerSendConns[p]);
+    while (state->peerRecvConns && state->peerRecvConns[p]) {
+      struct bootstrapConn* next = state->peerRecvConns[p]->next;
+      bootstrapConnFree(state->peerRecvConns[p]);
+      state->peerRecvConns[p] = next;
     }
-    // Unexpected connection. Save for later.
-    NCCLCHECKGOTO(unexpectedEnqueue(state, newPeer, newTag, &sock), ret, fail);
   }
-exit:
-  NCCLCHECK(ncclSocketClose(&sock));
-  return ret;
-fail:
-  goto exit;
+  free(state->peerSendConns);
+  free(state->peerRecvConns);
+  free(state->reapPeers);
+  free(state->reapQueued);
 }
 
 ncclResult_t bootstrapClose(void* commState) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
-  if (state->unexpectedConnections != NULL) {
+  if (state->nUnexpected != 0) {
     unexpectedFree(state);
     if (*state->abortFlag == 0) {
-      WARN("Unexpected connections are not empty");
+      WARN("Unexpected messages are not empty");
       return ncclInternalError;
     }
   }
+  unexpectedFree(state);
+  bootstrapPeerSocksFree(state);
 
   NCCLCHECK(ncclSocketClose(&state->listenSock));
   NCCLCHECK(ncclSocketClose(&state->ringSendSocket));
@@ -497,6 +1157,8 @@ ncclResult_t bootstrapClose(void* commState) {
 ncclResult_t bootstrapAbort(void* commState) {
   struct bootstrapState* state = (struct bootstrapState*)commState;
   if (commState == NULL) return ncclSuccess;
+  unexpectedFree(state);
+  bootstrapPeerSocksFree(state);
   NCCLCHECK(ncclSocketClose(&state->listenSock));
   NCCLCHECK(ncclSocketClose(&state->ringSendSocket));
   NCCLCHECK(ncclSocketClose(&state->ringRecvSocket));
@@ -11,6 +11,10 @@
 #include "bootstrap.h"
 #include "channel.h"
 #include "cudawrap.h"
+#include "autotune.h"
+#include "workfifo.h"
+#include "plancache.h"
+#include "tasks.h"
 
 #include <cstring> // std::memcpy
 #include <cinttypes> // PRIx64
@@ -464,13 +468,44 @@ fallback:
 NCCL_PARAM(GraphRegister, "GRAPH_REGISTER", 0);
 
 static ncclResult_t getCollNetSupport(struct ncclInfo* info, int* collNetTypeSupport);
-static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps);
+
+// Schedule a group found in the plan cache: everything computeColl() did for
+// each collective is reused, only the buffers differ.
+static ncclResult_t replayCollTasksToPlan(
+    struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget
+  ) {
+  struct ncclTasks* tasks = &comm->tasks;
+  while (tasks->nTasksColl != 0) {
+    struct ncclTaskColl* head = ncclIntruQueueHead(&tasks->collQueue);
+    struct ncclPlanCacheOp* op = ncclPlanCacheReplayPeek(comm->planCache);
+    if (*nWorkBudget < op->nChannels) return ncclSuccess; // Ensure room for addCollToPlan()
+
+    struct ncclWorkElem workElem = op->workElem;
+    workElem.sendbuff = head->sendbuff;
+    workElem.recvbuff = head->recvbuff;
+    NCCLCHECK(addCollToPlan(comm, plan, nWorkBudget, op->workFuncIndex, &workElem, &op->proxyOp,
+      op->nChannels, op->nBytes, /*regBufUsed=*/false, nullptr, nullptr));
+    ncclPlanCacheReplayPop(comm->planCache);
+    tasks->nTasksColl -= 1;
+    tasks->collBytesTotal -= op->nBytes;
+    ncclIntruQueueDequeue(&tasks->collQueue);
+
+    plan->threadPerBlock = std::max(plan->threadPerBlock, op->nThreads);
+    if (!plan->kernelSpecialized) {
+      plan->kernelFn = ncclKerns[op->workFuncIndex].kernelFn;
+      plan->kernelSpecialized = ncclKerns[op->workFuncIndex].specialized;
+    }
+  }
+  return ncclSuccess;
+}
 
 static ncclResult_t scheduleCollTasksToPlan(
     struct ncclComm* comm, struct ncclKernelPlan* plan, int* nWorkBudget
   ) {
   struct ncclTasks* tasks = &comm->tasks;
 
+  if (ncclPlanCacheReplayPeek(comm->planCache)) return replayCollTasksToPlan(comm, plan, nWorkBudget);
+
   size_t bytePerChannel[/*collNetSupport*/2];
   if (comm->channelSize > 0) {
     // Set by user
@@ -523,7 +558,7 @@ static ncclResult_t scheduleCollTasksToPlan(
       NCCLCHECK(ncclInfoSetDerived(&aggInfo, comm->nRanks));
       aggInfo.nChannels = std::min(comm->nChannels, nAggChannels);
       int opPerChannel = DIVUP(nAggChannels, aggInfo.nChannels);
-      NCCLCHECK(getAlgoInfo(&aggInfo, collNetSupport, opPerChannel));
+      NCCLCHECK(ncclTopoGetAlgoInfo(&aggInfo, collNetSupport, opPerChannel));
     }
 
     while (head != aggEnd) {
@@ -553,7 +588,11 @@ static ncclResult_t scheduleCollTasksToPlan(
       struct ncclProxyOp proxyOp = {};
       NCCLCHECK(computeColl(&info, &workFuncIndex, &workElem, &proxyOp));
 
-      if (*nWorkBudget < info.nChannels) return ncclSuccess; // Ensure room for addCollToPlan()
+      if (*nWorkBudget < info.nChannels) {
+        // The aggregation of the next plan will differ, which a replay would not see.
+        ncclPlanCacheAbort(comm);
+        return ncclSuccess; // Ensure room for addCollToPlan()
+      }
 
       bool regBufUsed = false;
       void* regBufSend[NCCL_MAX_LOCAL_RANKS];
@@ -567,6 +606,10 @@ static ncclResult_t scheduleCollTasksToPlan(
 
       NCCLCHECK(addCollToPlan(comm, plan, nWorkBudget, workFuncIndex, &workElem, &proxyOp,
         info.nChannels, info.nBytes, regBufUsed, regBufSend, regBufRecv));
+      NCCLCHECK(ncclPlanCacheRecord(comm, workFuncIndex, &workElem, &proxyOp, info.nChannels, info.nThreads, info.nBytes));
+      // Only plans made of a single operation can be timed for NCCL_AUTOTUNE
+      plan->autotuneTag = plan->collOpCount == 1 ? info.autotuneTag : 0;
+      plan->autotuneBytes = info.nBytes;
       tasks->nTasksColl -= 1;
       tasks->collBytesTotal -= info.nBytes;
       ncclIntruQueueDequeue(&tasks->collQueue);
@@ -618,128 +661,96 @@ static ncclResult_t scheduleP2pTasksToPlan(
   // Avoid overloading channels with 8+ operations as we loose the sync warp, hence a bit of bandwidth.
   while (nChannelsMax*nRanks > comm->p2pnChannels*4 && nChannelsMax > 1) nChannelsMax /= 2;
 
+  // Chunk sizes only depend on the operation size, which all-to-all patterns
+  // mostly share across peers : compute them once per distinct size.
+  ssize_t chunkSizeOf[2] = { -1, -1 }, chunkSize[2];
+
   while (tasks->nTasksP2p != 0) {
-    for (int i=0; i < nRanks; i++) {
-      int sendPeer = sendOrder[i];
-      int recvPeer = recvOrder[i];
-      struct ncclTaskP2p* send = ncclIntruQueueHead(&peers[sendPeer].sendQueue);
-      struct ncclTaskP2p* recv = ncclIntruQueueHead(&peers[recvPeer].recvQueue);
-      if (sendPeer == comm->rank) {
-        if (recvPeer != comm->rank) {
-          WARN("Sendrecv plan not aligned for self");
-          return ncclInternalError;
-        }
-        if (send && recv == nullptr) {
-          WARN("Trying to send to self without a matching recv");
-          return ncclInvalidUsage;
-        }
-        if (send == nullptr && recv) {
-          WARN("Trying to recv to self without a matching send");
-          return ncclInvalidUsage;
+    // Visit the steps with tasks queued only, still in step order
+    for (int w=0; w*64 < nRanks; w++) {
+      for (uint64_t bits = tasks->p2pActiveSteps[w]; bits != 0; bits &= bits-1) {
+        int i = w*64 + __builtin_ctzll(bits);
+        int sendPeer = sendOrder[i];
+        int recvPeer = recvOrder[i];
+        struct ncclTaskP2p* send = ncclIntruQueueHead(&peers[sendPeer].sendQueue);
+        struct ncclTaskP2p* recv = ncclIntruQueueHead(&peers[recvPeer].recvQueue);
+        if (sendPeer == comm->rank) {
+          if (recvPeer != comm->rank) {
+            WARN("Sendrecv plan not aligned for self");
+            return ncclInternalError;
+          }
+          if (send && recv == nullptr) {
+            WARN("Trying to send to self without a matching recv");
+            return ncclInvalidUsage;
+          }
+          if (send == nullptr && recv) {
+            WARN("Trying to recv to self without a matching send");
+            return ncclInvalidUsage;
+          }
         }
-      }
-      if (send != nullptr || recv != nullptr) {
-        char* recvPtr = recv ? (char*)recv->buff : nullptr;
-        char* sendPtr = send ? (char*)send->buff : nullptr;
-        ssize_t recvBytes = recv ? recv->bytes : 0;
-        ssize_t sendBytes = send ? send->bytes : 0;
-        ssize_t minSize = stepSize/8;
-        ssize_t maxSize = comm->nNodes > 1 ? stepSize : stepSize*32;
-        ssize_t recvChunkBytesMax = calcP2pChunkSize(recvBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
-        ssize_t sendChunkBytesMax = calcP2pChunkSize(sendBytes, nChannelsMin, nChannelsMax, minSize, maxSize);
-        // Zero size send/recv are syncs, encode here with -1.
-        recvBytes = recv && recvBytes == 0 ? -1 : recvBytes;
-        sendBytes = send && sendBytes == 0 ? -1 : sendBytes;
-        // Advance to current chunk. Syncs will always have chunk=0 so no effect on the -1.
-        if (recv) recvPtr   += recv->chunk*recvChunkBytesMax;
-        if (recv) recvBytes -= recv->chunk*recvChunkBytesMax;
-        if (send) sendPtr   += send->chunk*sendChunkBytesMax;
-        if (send) sendBytes -= send->chunk*sendChunkBytesMax;
-
-        do {
-          ssize_t recvChunkBytes = std::min(recvBytes, recvChunkBytesMax); // -1 preserved
-          ssize_t sendChunkBytes = std::min(sendBytes, sendChunkBytesMax);
-          if (recvChunkBytes != 0) {
-            if (recvChunkBytes == -1) recvChunkBytes = 0;
-            if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
-            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/false, recvPeer, recv->chunk, recvPtr, recvChunkBytes));
-            recvPtr += recvChunkBytes;
-            recvBytes -= recvChunkBytes;
-            recv->chunk += 1;
-            if (recvBytes <= 0) {
-              recvBytes = 0; // in case still -1
-              ncclIntruQueueDequeue(&peers[recvPeer].recvQueue);
-              tasks->nTasksP2p -= 1;
+        if (send != nullptr || recv != nullptr) {
+          char* recvPtr = recv ? (char*)recv->buff : nullptr;
+          char* sendPtr = send ? (char*)send->buff : nullptr;
+          ssize_t recvBytes = recv ? recv->bytes : 0;
+          ssize_t sendBytes = send ? send->bytes : 0;
+          ssize_t minSize = stepSize/8;
+          ssize_t maxSize = comm->nNodes > 1 ? stepSize : stepSize*32;
+          for (int k=0; k < 2; k++) {
+            ssize_t bytes = k == 0 ? recvBytes : sendBytes;
+            if (bytes != chunkSizeOf[k]) {
+              chunkSizeOf[k] = bytes;
+              chunkSize[k] = calcP2pChunkSize(bytes, nChannelsMin, nChannelsMax, minSize, maxSize);
             }
           }
-          if (sendChunkBytes != 0) {
-            if (sendChunkBytes == -1) sendChunkBytes = 0;
-            if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
-            NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/true, sendPeer, send->chunk, sendPtr, sendChunkBytes));
-            sendPtr += sendChunkBytes;
-            sendBytes -= sendChunkBytes;
-            send->chunk += 1;
-            if (sendBytes <= 0) {
-              sendBytes = 0; // in case still -1
-              ncclIntruQueueDequeue(&peers[sendPeer].sendQueue);
-              tasks->nTasksP2p -= 1;
+          ssize_t recvChunkBytesMax = chunkSize[0];
+          ssize_t sendChunkBytesMax = chunkSize[1];
+          // Zero size send/recv are syncs, encode here with -1.
+          recvBytes = recv && recvBytes == 0 ? -1 : recvBytes;
+          sendBytes = send && sendBytes == 0 ? -1 : sendBytes;
+          // Advance to current chunk. Syncs will always have chunk=0 so no effect on the -1.
+          if (recv) recvPtr   += recv->chunk*recvChunkBytesMax;
+          if (recv) recvBytes -= recv->chunk*recvChunkBytesMax;
+          if (send) sendPtr   += send->chunk*sendChunkBytesMax;
+          if (send) sendBytes -= send->chunk*sendChunkBytesMax;
+
+          do {
+            ssize_t recvChunkBytes = std::min(recvBytes, recvChunkBytesMax); // -1 preserved
+            ssize_t sendChunkBytes = std::min(sendBytes, sendChunkBytesMax);
+            if (recvChunkBytes != 0) {
+              if (recvChunkBytes == -1) recvChunkBytes = 0;
+              if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
+              NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/false, recvPeer, recv->chunk, recvPtr, recvChunkBytes));
+              recvPtr += recvChunkBytes;
+              recvBytes -= recvChunkBytes;
+              recv->chunk += 1;
+              if (recvBytes <= 0) {
+                recvBytes = 0; // in case still -1
+                ncclIntruQueueDequeue(&peers[recvPeer].recvQueue);
+                tasks->nTasksP2p -= 1;
+              }
             }
-          }
-        } while (sendBytes != 0 || recvBytes != 0);
-      }
-    }
-  }
-  return ncclSuccess;
-}
-
-// Comparison of monotonic rolling counters.
-static inline bool rollingLess32(uint32_t a, uint32_t b) {
-  constexpr uint32_t PositiveMax = uint32_t(-1)>>1;
-  return a-b > PositiveMax;
-}
-static inline uint32_t rollingMin32(uint32_t a, uint32_t b) {
-  constexpr uint32_t PositiveMax = uint32_t(-1)>>1;
-  return (b-a <= PositiveMax) ? a : b;
-}
-
-// Spin until its safe to increase comm->workFifoSent to desiredSent.
-static void waitWorkFifoAvailable(struct ncclComm* comm, uint32_t desiredSent) {
-  if (__builtin_expect(rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent), false)) {
-    while (1) {
-      // We have to poll for notifications from device.
-      uint32_t* doneLive = comm->workFifoDone;
-      uint32_t ackd[MAXCHANNELS];
-      for (int c=0; c < MAXCHANNELS; c++) {
-        ackd[c] = __atomic_load_n(&doneLive[c], __ATOMIC_RELAXED);
-      }
-      // Compiler-only fence to prevent fusion of loops to encourage dense loads.
-      __atomic_signal_fence(__ATOMIC_SEQ_CST);
-
-      uint32_t ackdAll = comm->workFifoSent;
-      for (int c=0; c < MAXCHANNELS; c++) {
-        // ackdAll is min over all non-quiesced channels
-        if (ackd[c] != comm->channels[c].workFifoSent)
-          ackdAll = rollingMin32(ackdAll, ackd[c]);
-      }
-
-      // Compiler only fence to prevent fusion of loops to encourage dense stores.
-      __atomic_signal_fence(__ATOMIC_SEQ_CST);
-
-      for (int c=0; c < MAXCHANNELS; c++) {
-        // Advance counter on quiesced channels so they don't lag behind
-        // too far where they could get lost in 32-bit wraparound.
-        if (ackd[c] == comm->channels[c].workFifoSent) {
-          comm->channels[c].workFifoSent = ackdAll;
-          __atomic_store_n(&doneLive[c], ackdAll, __ATOMIC_RELAXED);
+            if (sendChunkBytes != 0) {
+              if (sendChunkBytes == -1) sendChunkBytes = 0;
+              if (*nWorkBudget < 1) return ncclSuccess; // ensure room in budget
+              NCCLCHECK(addP2pToPlan(comm, plan, nWorkBudget, /*isSendNotRecv=*/true, sendPeer, send->chunk, sendPtr, sendChunkBytes));
+              sendPtr += sendChunkBytes;
+              sendBytes -= sendChunkBytes;
+              send->chunk += 1;
+              if (sendBytes <= 0) {
+                sendBytes = 0; // in case still -1
+                ncclIntruQueueDequeue(&peers[sendPeer].sendQueue);
+                tasks->nTasksP2p -= 1;
+              }
+            }
+          } while (sendBytes != 0 || recvBytes != 0);
+        }
+        if (ncclIntruQueueEmpty(&peers[sendPeer].sendQueue) && ncclIntruQueueEmpty(&peers[recvPeer].recvQueue)) {
+          ncclTaskP2pClearStep(tasks, i);
         }
       }
-      comm->workFifoAckdMin = ackdAll;
-
-      // See if that was enough.
-      if (!rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent)) break;
-      sched_yield();
     }
   }
+  return ncclSuccess;
 }
 
 static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* plan) {
@@ -765,12 +776,12 @@ static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* pla
     // if not doing so would incur crossing it.
     if (((ixSent + plan->channelCount-1) & ixMask) < (ixSent & ixMask)) {
       ixSent = (ixSent + ixMask) & ~ixMask;
-      // Need to update workFifoSent so waitWorkFifoAvailable() knows we've
+      // Need to update workFifoSent so ncclWorkFifoWaitAvailable() knows we've
       // skipped those elements. Consider if all the channels report quiesced,
       // this way the skipped slots will be considered consumed as well.
       comm->workFifoSent = ixSent;
     }
-    waitWorkFifoAvailable(comm, ixSent + nWork);
+    ncclWorkFifoWaitAvailable(comm, ixSent + nWork);
   }
   uint32_t ixHead = ixSent;
   ixSent += plan->channelCount;
@@ -779,6 +790,7 @@ static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* pla
     struct ncclWorkList* q = ncclIntruQueueHead(&plan->channels[c].workQueue);
     // Offset of first work equals number of channels below with work.
     uint32_t ix = ixHead + channelsWithWork;
+    uint32_t ixFirst = ix;
     channelsWithWork += q != nullptr ? 1 : 0;
     while (q != nullptr) {
       if (q->next != nullptr) {
@@ -788,7 +800,8 @@ static ncclResult_t uploadWork(struct ncclComm* comm, struct ncclKernelPlan* pla
         // Tell channel to ack us back ix+1 indicating that all slots up to and
         // including ix have been consumed.
         q->work.header.doneAcks = ix+1;
-        comm->channels[c].workFifoSent = ix+1;
+        // Persistent work is not in the fifo and is never acked
+        if (!persistent) ncclWorkFifoPost(comm, c, ixFirst, ix+1);
       }
       workHeap[ix & ixMask] = q->work; // C++ struct assignment
       q = q->next;
@@ -895,12 +908,15 @@ ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
   // Poll for callbacks sent to us from other threads. Typically these free
   // resources from to our memory pools.
   NCCLCHECK(ncclCommPollCallbacks(comm, /*waitSome=*/false));
+  NCCLCHECK(ncclAutotunePoll(comm));
 
   // We already have one frame present which holds all of our tasks (which we
   // are about to schedule). Now push an additional frame for allocating
   // work structs (see appendWorkElem() variants all use scoped allocation).
   ncclMemoryStackPush(&comm->memScoped);
 
+  if (tasks->nTasksColl != 0) NCCLCHECKGOTO(ncclPlanCacheBegin(comm, persistent), result, failure);
+
   if (tasks->nTasksColl + tasks->nTasksP2p != 0) {
     do {
       struct ncclKernelPlan* plan = ncclMemoryPoolAlloc<struct ncclKernelPlan>(&comm->memPool_ncclKernelPlan, &comm->memPermanent);
@@ -924,6 +940,7 @@ ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
       // And only drain p2p tasks once colls are depleted.
       if (tasks->nTasksColl == 0 && tasks->nTasksP2p != 0) {
         NCCLCHECKGOTO(scheduleP2pTasksToPlan(comm, plan, &nWorkBudget), result, failure);
+        plan->autotuneTag = 0;
       }
       if (nWorkBudget == nWorkBudgetOld) {
         // We weren't able to fit any tasks into our budget which means now we're
@@ -936,6 +953,7 @@ ncclResult_t ncclLaunchPrepare(struct ncclComm* comm) {
       }
       finishPlan(plan);
     } while (tasks->nTasksColl + tasks->nTasksP2p != 0);
+    ncclPlanCacheEnd(comm);
 
     struct ncclKernelPlan* planHead = ncclIntruQueueHead(&comm->planQueue);
     comm->unlaunchedPlansHead = planHead;
@@ -1023,6 +1041,7 @@ ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan
   dim3 grid = {(unsigned)plan->channelCount, 1, 1};
   dim3 block = {(unsigned)plan->threadPerBlock, 1, 1};
   void *args[3] = {&comm->devComm, &plan->channelMask, &plan->workHead};
+  NCCLCHECK(ncclAutotuneTimerStart(comm, plan, launchStream));
 
   #if CUDART_VERSION >= 11080
   int driverVersion;
@@ -1078,11 +1097,13 @@ ncclResult_t ncclLaunchKernel(struct ncclComm* comm, struct ncclKernelPlan* plan
     launchConfig.stream = launchStream;
 
     CUDACHECK(cudaLaunchKernelExC(&launchConfig, fn, args));
+    NCCLCHECK(ncclAutotuneTimerStop(comm, plan, launchStream));
     return ncclSuccess;
   }
   #endif
   // Standard kernel launch
   CUDACHECK(cudaLaunchKernel(fn, grid, block, args, 0, launchStream));
+  NCCLCHECK(ncclAutotuneTimerStop(comm, plan, launchStream));
   return ncclSuccess;
 }
 
@@ -1146,74 +1167,6 @@ static inline ncclResult_t getCollNetSupport(struct ncclInfo* info, int* collNet
   return ncclSuccess;
 }
 
-// numPipeOps: number of pipelined ops. Can be greater than 1 in aggregation mode. Used to adjust latency.
-static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps) {
-  struct ncclComm* comm = info->comm;
-  if (comm->nRanks == 1) {
-    info->algorithm = NCCL_ALGO_RING;
-    info->protocol = NCCL_PROTO_SIMPLE;
-  }
-  else {
-    float minTime = 3600000000.0; // Hopefully no operation will take an hour to complete.
-    // Find algorithm / protocol.
-    info->algorithm = -1;
-    info->protocol = -1;
-    int nAlgos = NCCL_NUM_ALGORITHMS;
-    for (int a=0; a<nAlgos; a++) {
-      if ((a == NCCL_ALGO_COLLNET_DIRECT || a == NCCL_ALGO_COLLNET_CHAIN) && collNetTypeSupport != 1) continue;
-      for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
-        float time;
-        NCCLCHECK(ncclTopoGetAlgoTime(info, a, p, numPipeOps, &time));
-        if (time >= 0 && time < minTime) {
-          info->algorithm = a;
-          info->protocol = p;
-          minTime = time;
-        }
-      }
-    }
-    if (info->algorithm == -1 || info->protocol == -1) {
-      WARN("Error : no algorithm/protocol available");
-      return ncclInternalError;
-    }
-    //if (comm->rank == 0) INFO(NCCL_TUNING, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
-    TRACE(NCCL_COLL, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
-  }
-
-  int nc = (info->nChannels > 0) ? info->nChannels : comm->nChannels;
-  int nt = comm->maxThreads[info->algorithm][info->protocol];
-  int threadThreshold = comm->threadThresholds[info->algorithm][info->protocol];
-  if (info->algorithm == NCCL_ALGO_COLLNET_DIRECT) {
-    // CollNet channel tuning
-    int ncSwitch = 16;
-    bool flag = true;
-    while (ncSwitch >= 1 && flag) {
-      while ((flag = info->nBytes < nc*nt*info->comm->channels[0].collnetDirect.nHeads*threadThreshold) && nc > ncSwitch) {
-        if (nc == ncSwitch+ncSwitch/2) threadThreshold /= 2;
-        nc--;
-      }
-      ncSwitch /= 2;
-    }
-  } else {
-    // Ring/Tree channel tuning
-    while (info->nBytes < nc*nt*threadThreshold) {
-      if (nc >= 2) nc--;
-      else if ((nt % 128) == 0) nt/=2;
-      else break;
-    }
-  }
-  if (info->protocol == NCCL_PROTO_SIMPLE) {
-    nt += WARP_SIZE; // Extra warp for sync
-    // More threads or sync warps needed due to split thread model
-    if (info->algorithm == NCCL_ALGO_TREE) nt += 3*WARP_SIZE;
-    if (info->algorithm == NCCL_ALGO_COLLNET_DIRECT) nt += 3*WARP_SIZE;
-    if (info->algorithm == NCCL_ALGO_COLLNET_CHAIN) nt += 3*WARP_SIZE;
-  }
-  nt = nt/WARP_SIZE < 3 ? 3*WARP_SIZE : nt;
-  info->nChannels = nc;
-  info->nThreads = nt;
-  return ncclSuccess;
-}
-
 static ncclResult_t getPatternInfo(struct ncclInfo* info) {
   switch (info->coll) {
     case ncclFuncBroadcast:
@@ -1264,7 +1217,11 @@ static ncclResult_t computeColl(struct ncclInfo* info /* input */, int* workFunc
   // If so, skip the calculation
   if (info->nChannels > 0 && info->nThreads > 0) goto comp_next;
   NCCLCHECK(getCollNetSupport(info, &collNetTypeSupport));
-  NCCLCHECK(getAlgoInfo(info, collNetTypeSupport, 1));
+  if (info->comm->autotune) {
+    NCCLCHECK(ncclAutotuneGetAlgoInfo(info, collNetTypeSupport));
+  } else {
+    NCCLCHECK(ncclTopoGetAlgoInfo(info, collNetTypeSupport, 1));
+  }
 
 comp_next:
   // Set nstepsPerLoop and nchunksPerLoop
@@ -1437,44 +1394,8 @@ static ncclResult_t hostToDevRedOp(
 static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* info) {
   ncclTasks *tasks = &comm->tasks;
   if (info->coll == ncclFuncSend || info->coll == ncclFuncRecv) {
-    int peer = info->root;
-    ssize_t nBytes = info->count*ncclTypeSize(info->datatype);
-    bool isSendNotRecv = info->coll == ncclFuncSend;
-
-    // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
-    ncclGroupCommJoin(info->comm);
-    struct ncclTaskP2p* p2p = ncclMemoryStackAlloc<struct ncclTaskP2p>(&comm->memScoped);
-    p2p->buff = (void*)info->recvbuff;
-    p2p->bytes = nBytes;
-    p2p->chunk = 0;
-    ncclIntruQueueEnqueue(
-      isSendNotRecv ? &tasks->peers[peer].sendQueue : &tasks->peers[peer].recvQueue,
-      p2p);
-    tasks->nTasksP2p += 1;
-
-    // Mark channels that need pre-connect
-    if (comm->rank != peer) {
-      int channelBaseId;
-      NCCLCHECK(ncclChannelComputeBase(comm, peer, info->coll, &channelBaseId));
-      if (!(isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen)) {
-        (isSendNotRecv ? tasks->peers[peer].sendSeen : tasks->peers[peer].recvSeen) = true;
-        for (int c=0; c < comm->p2pnChannelsPerPeer; c++) {
-          int channelId;
-          NCCLCHECK(ncclChannelComputeFromBase(comm, channelBaseId, c, &channelId));
-          if (isSendNotRecv) {
-            if (comm->channels[channelId].peers[peer].send[1].connected == 0) { // P2P uses only 1 connector
-              comm->connectSend[peer] |= (1UL<<channelId);
-              ncclGroupCommPreconnect(comm);
-            }
-          } else {
-            if (comm->channels[channelId].peers[peer].recv[1].connected == 0) { // P2P uses only 1 connector
-              comm->connectRecv[peer] |= (1UL<<channelId);
-              ncclGroupCommPreconnect(comm);
-            }
-          }
-        }
-      }
-    }
+    size_t nBytes = info->count*ncclTypeSize(info->datatype);
+    NCCLCHECK(ncclTaskP2pAppend(comm, info->coll, info->root, (void*)info->recvbuff, nBytes));
   } else {
     // Copy reduction op state from op handle into info struct here since the
     // op handle may be destroyed before ncclGroupEnd().
@@ -1489,21 +1410,7 @@ static ncclResult_t taskAppend(struct ncclComm* comm, struct ncclInfo const* inf
       }
       return ncclSuccess;
     } else {
-      // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
-      ncclGroupCommJoin(info->comm);
-      struct ncclTaskColl* t = ncclMemoryStackAlloc<struct ncclTaskColl>(&comm->memScoped);
-      t->func = info->coll;
-      t->sendbuff = info->sendbuff;
-      t->recvbuff = info->recvbuff;
-      t->count = info->count;
-      t->root = info->root;
-      t->datatype = info->datatype;
-      t->op = opFull; // C++ struct assignment
-      t->chunkSteps = info->chunkSteps;
-      t->sliceSteps = info->sliceSteps;
-      ncclIntruQueueEnqueue(&tasks->collQueue, t);
-      tasks->collBytesTotal += t->count*ncclTypeSize(t->datatype);
-      tasks->nTasksColl += 1;
+      NCCLCHECK(ncclTaskCollAppend(comm, info, opFull));
     }
   }
 
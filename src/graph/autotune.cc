@@ -0,0 +1,429 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "autotune.h"
+#include "comm.h"
+#include "info.h"
+#include "bootstrap.h"
+#include <pthread.h>
+
+NCCL_PARAM(Autotune, "AUTOTUNE", 0);
+NCCL_PARAM(AutotuneSamples, "AUTOTUNE_SAMPLES", 8);
+NCCL_PARAM(AutotuneCandidates, "AUTOTUNE_CANDIDATES", 4);
+NCCL_PARAM(AutotuneRange, "AUTOTUNE_RANGE", 200);
+NCCL_PARAM(AutotuneFileRank, "AUTOTUNE_FILE_RANK", 0);
+
+#define AUTOTUNE_MAX_CANDIDATES 4
+#define AUTOTUNE_TIMERS 64
+#define AUTOTUNE_NBUCKETS (NCCL_NUM_FUNCTIONS*2*NCCL_ALGO_TABLE_BUCKETS)
+
+// Sums for a least squares fit of time (us) against bytes
+struct autotuneStats {
+  double n;
+  double bytes;
+  double time;
+  double bytes2;
+  double bytesTime;
+};
+
+struct autotuneBucket {
+  int nCandidates;
+  int8_t algorithm[AUTOTUNE_MAX_CANDIDATES];
+  int8_t protocol[AUTOTUNE_MAX_CANDIDATES];
+  uint32_t active; // Candidates still explored
+  int pinned;      // -1 while exploring
+  // All ranks schedule the same operations, so these only depend on the operation count.
+  uint64_t ops;
+  uint64_t requestAt;
+  uint64_t applyAt;
+  uint64_t requestLaunch; // Launch which issued the pending request
+  int pending;
+  struct autotuneStats stats[AUTOTUNE_MAX_CANDIDATES];
+  // Shared with the agreement thread, under lock
+  struct autotuneStats request[AUTOTUNE_MAX_CANDIDATES];
+  int agreed;
+  uint32_t agreedActive;
+  float lat[AUTOTUNE_MAX_CANDIDATES]; // Fit of the slowest rank, for export
+  float bw[AUTOTUNE_MAX_CANDIDATES];
+};
+
+struct autotuneMsg {
+  int id;
+  struct autotuneStats stats[AUTOTUNE_MAX_CANDIDATES];
+};
+
+struct ncclAutotune {
+  struct ncclComm* comm;
+  struct autotuneBucket buckets[AUTOTUNE_NBUCKETS];
+  int samples;
+  // ncclLaunchPrepare calls. Ranks group the same operations, so this is the same on all ranks.
+  uint64_t launches;
+
+  // Timers in flight are [timerTail, timerHead)
+  cudaEvent_t timerStart[AUTOTUNE_TIMERS];
+  cudaEvent_t timerStop[AUTOTUNE_TIMERS];
+  int timerTag[AUTOTUNE_TIMERS];
+  size_t timerBytes[AUTOTUNE_TIMERS];
+  uint64_t timerHead;
+  uint64_t timerTail;
+
+  // Agreement thread
+  struct bootstrapRing* ring;
+  pthread_t thread;
+  int threadStarted;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int queue[AUTOTUNE_NBUCKETS];
+  uint64_t queueHead;
+  uint64_t queueTail;
+  int stop;
+  ncclResult_t error;
+};
+
+static int bucketId(int coll, int collNet, int b) { return (coll*2+collNet)*NCCL_ALGO_TABLE_BUCKETS+b; }
+
+static void autotuneFit(struct autotuneStats* s, float* lat, float* bw) {
+  double det = s->n*s->bytes2 - s->bytes*s->bytes;
+  double slope = det > 0 ? (s->n*s->bytesTime - s->bytes*s->time) / det : 0;
+  double l = (s->time - slope*s->bytes) / s->n;
+  if (slope <= 0) {
+    slope = 0; l = s->time / s->n;
+  } else if (l < 0) {
+    l = 0; slope = s->bytesTime / s->bytes2;
+  }
+  *lat = l;
+  *bw = slope > 0 ? 1.0 / (1000*slope) : 1e6;
+}
+
+// Keep the faster half of the active candidates, based on the slowest rank. Candidates nobody
+// could time go last, in the order of the model.
+static void autotuneAgree(struct autotuneBucket* bucket, struct autotuneMsg* msgs, int nRanks, uint32_t* active, float* lat, float* bw) {
+  double time[AUTOTUNE_MAX_CANDIDATES];
+  int order[AUTOTUNE_MAX_CANDIDATES], n = 0;
+  for (int c=0; c<bucket->nCandidates; c++) {
+    if ((bucket->active & (1U<<c)) == 0) continue;
+    time[c] = -1;
+    for (int r=0; r<nRanks; r++) {
+      struct autotuneStats* s = msgs[r].stats+c;
+      if (s->n == 0 || s->time/s->n <= time[c]) continue;
+      time[c] = s->time/s->n;
+      autotuneFit(s, lat+c, bw+c);
+    }
+    if (time[c] < 0) time[c] = 1e30;
+    int i = n++;
+    while (i > 0 && time[order[i-1]] > time[c]) { order[i] = order[i-1]; i--; }
+    order[i] = c;
+  }
+  *active = 0;
+  for (int i=0; i<(n+1)/2; i++) *active |= 1U<<order[i];
+}
+
+static void* autotuneThreadMain(void* arg) {
+  struct ncclAutotune* tune = (struct ncclAutotune*)arg;
+  int rank = tune->comm->rank;
+  int nRanks = tune->comm->nRanks;
+  ncclResult_t ret = ncclSuccess;
+  struct autotuneMsg* msgs = NULL;
+  NCCLCHECKGOTO(ncclCalloc(&msgs, nRanks), ret, exit);
+  while (1) {
+    pthread_mutex_lock(&tune->lock);
+    while (tune->queueTail == tune->queueHead && !tune->stop) pthread_cond_wait(&tune->cond, &tune->lock);
+    if (tune->queueTail == tune->queueHead) {
+      pthread_mutex_unlock(&tune->lock);
+      break;
+    }
+    int id = tune->queue[tune->queueTail++ % AUTOTUNE_NBUCKETS];
+    struct autotuneBucket* bucket = tune->buckets+id;
+    msgs[rank].id = id;
+    memcpy(msgs[rank].stats, bucket->request, sizeof(bucket->request));
+    pthread_mutex_unlock(&tune->lock);
+
+    NCCLCHECKGOTO(bootstrapRingAllGather(tune->ring, msgs, sizeof(struct autotuneMsg)), ret, exit);
+    for (int r=0; r<nRanks; r++) {
+      if (msgs[r].id != id) {
+        WARN("Autotune : rank %d agreeing on range %d while rank %d agrees on range %d, ranks did not issue the same operations", rank, id, r, msgs[r].id);
+        ret = ncclInvalidUsage;
+        goto exit;
+      }
+    }
+    uint32_t active;
+    float lat[AUTOTUNE_MAX_CANDIDATES], bw[AUTOTUNE_MAX_CANDIDATES];
+    pthread_mutex_lock(&tune->lock);
+    memcpy(lat, bucket->lat, sizeof(lat));
+    memcpy(bw, bucket->bw, sizeof(bw));
+    pthread_mutex_unlock(&tune->lock);
+    autotuneAgree(bucket, msgs, nRanks, &active, lat, bw);
+    pthread_mutex_lock(&tune->lock);
+    memcpy(bucket->lat, lat, sizeof(lat));
+    memcpy(bucket->bw, bw, sizeof(bw));
+    bucket->agreedActive = active;
+    bucket->agreed = 1;
+    pthread_cond_broadcast(&tune->cond);
+    pthread_mutex_unlock(&tune->lock);
+  }
+exit:
+  free(msgs);
+  if (ret != ncclSuccess) {
+    pthread_mutex_lock(&tune->lock);
+    tune->error = ret;
+    pthread_cond_broadcast(&tune->cond);
+    pthread_mutex_unlock(&tune->lock);
+  }
+  return NULL;
+}
+
+// Candidates are the algorithms/protocols the model predicts within NCCL_AUTOTUNE_RANGE percent
+// of the best one, in the middle of the size range.
+static ncclResult_t autotuneInitBucket(struct ncclAutotune* tune, int coll, int collNet, int b, struct autotuneBucket* bucket) {
+  struct ncclInfo info = {};
+  info.comm = tune->comm;
+  info.coll = (ncclFunc_t)coll;
+  info.nBytes = b == 0 ? 1 : (1UL<<b) + (1UL<<(b-1));
+  float times[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS];
+  int order[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS], n = 0;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    if ((a == NCCL_ALGO_COLLNET_DIRECT || a == NCCL_ALGO_COLLNET_CHAIN) && collNet == 0) continue;
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      float time;
+      NCCLCHECK(ncclTopoGetAlgoTime(&info, a, p, 1, &time));
+      if (time < 0) continue;
+      int ap = a*NCCL_NUM_PROTOCOLS+p;
+      times[ap] = time;
+      int i = n++;
+      while (i > 0 && times[order[i-1]] > time) { order[i] = order[i-1]; i--; }
+      order[i] = ap;
+    }
+  }
+  bucket->pinned = -1;
+  int maxCandidates = std::min((int)ncclParamAutotuneCandidates(), AUTOTUNE_MAX_CANDIDATES);
+  for (int i=0; i<n && bucket->nCandidates<maxCandidates; i++) {
+    if (times[order[i]] > times[order[0]]*ncclParamAutotuneRange()/100) break;
+    bucket->algorithm[bucket->nCandidates] = order[i]/NCCL_NUM_PROTOCOLS;
+    bucket->protocol[bucket->nCandidates] = order[i]%NCCL_NUM_PROTOCOLS;
+    bucket->nCandidates++;
+  }
+  bucket->active = (1U<<bucket->nCandidates)-1;
+  bucket->requestAt = bucket->nCandidates*tune->samples;
+  return ncclSuccess;
+}
+
+// Write the pinned choices in NCCL_TUNING_FILE format, so that a later run can use them
+// without exploring again.
+static void autotuneExport(struct ncclAutotune* tune, const char* path) {
+  struct ncclComm* comm = tune->comm;
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    WARN("Autotune : could not open %s : %s", path, strerror(errno));
+    return;
+  }
+  int nPinned = 0;
+  fprintf(file, "# Written by NCCL_AUTOTUNE for %d ranks\n", comm->nRanks);
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int b=0; b<NCCL_ALGO_TABLE_BUCKETS; b++) {
+      // The profile does not tell CollNet apart, keep the most used one
+      struct autotuneBucket* bucket = tune->buckets+bucketId(c, 0, b);
+      struct autotuneBucket* collNetBucket = tune->buckets+bucketId(c, 1, b);
+      if (collNetBucket->ops > bucket->ops) bucket = collNetBucket;
+      int p = bucket->pinned;
+      if (p < 0 || bucket->bw[p] == 0) continue;
+      size_t minBytes = b == 0 ? 0 : 1UL<<b;
+      size_t maxBytes = b == NCCL_ALGO_TABLE_BUCKETS-1 ? SIZE_MAX : (2UL<<b)-1;
+      fprintf(file, "%s %s %s %d %d %zu %zu %.2f %.2f\n", ncclFuncStr[c], ncclAlgoStr[bucket->algorithm[p]], ncclProtoStr[bucket->protocol[p]],
+          comm->nNodes, comm->nNodes, minBytes, maxBytes, bucket->lat[p], bucket->bw[p]);
+      fprintf(file, "%s * * %d %d %zu %zu 0 0\n", ncclFuncStr[c], comm->nNodes, comm->nNodes, minBytes, maxBytes);
+      nPinned++;
+    }
+  }
+  fclose(file);
+  INFO(NCCL_TUNING, "Autotune : wrote %d size ranges to %s", nPinned, path);
+}
+
+ncclResult_t ncclAutotuneInit(struct ncclComm* comm) {
+  comm->autotune = NULL;
+  if (ncclParamAutotune() == 0 || comm->nRanks == 1) return ncclSuccess;
+  ncclResult_t ret = ncclSuccess;
+  int nExplored = 0;
+  struct ncclAutotune* tune;
+  NCCLCHECK(ncclCalloc(&tune, 1));
+  tune->comm = comm;
+  tune->samples = std::max(1, (int)ncclParamAutotuneSamples());
+  pthread_mutex_init(&tune->lock, NULL);
+  pthread_cond_init(&tune->cond, NULL);
+  comm->autotune = tune;
+
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int collNet=0; collNet<2; collNet++) {
+      if (collNet && comm->collNetSupport <= 0) continue;
+      for (int b=0; b<NCCL_ALGO_TABLE_BUCKETS; b++) {
+        struct autotuneBucket* bucket = tune->buckets+bucketId(c, collNet, b);
+        NCCLCHECKGOTO(autotuneInitBucket(tune, c, collNet, b, bucket), ret, fail);
+        if (bucket->nCandidates > 1) nExplored++;
+      }
+    }
+  }
+  for (int i=0; i<AUTOTUNE_TIMERS; i++) {
+    CUDACHECKGOTO(cudaEventCreate(tune->timerStart+i), ret, fail);
+    CUDACHECKGOTO(cudaEventCreate(tune->timerStop+i), ret, fail);
+  }
+  NCCLCHECKGOTO(bootstrapRingCreate(comm->bootstrap, &tune->ring), ret, fail);
+  NEQCHECKGOTO(pthread_create(&tune->thread, NULL, autotuneThreadMain, tune), 0, ret, fail);
+  tune->threadStarted = 1;
+  ncclSetThreadName(tune->thread, "NCCL Autotune%2d", comm->cudaDev);
+  INFO(NCCL_INIT|NCCL_TUNING, "Autotune : exploring %d size ranges, %d samples per candidate", nExplored, tune->samples);
+  return ncclSuccess;
+fail:
+  ncclAutotuneFree(comm);
+  return ret;
+}
+
+ncclResult_t ncclAutotuneFree(struct ncclComm* comm) {
+  struct ncclAutotune* tune = comm->autotune;
+  if (tune == NULL) return ncclSuccess;
+  if (tune->threadStarted) {
+    pthread_mutex_lock(&tune->lock);
+    tune->stop = 1;
+    pthread_cond_broadcast(&tune->cond);
+    pthread_mutex_unlock(&tune->lock);
+    pthread_join(tune->thread, NULL);
+  }
+  if (tune->ring) {
+    NCCLCHECK(bootstrapRingClose(tune->ring));
+    const char* path = getenv("NCCL_AUTOTUNE_FILE");
+    if (path && comm->rank == ncclParamAutotuneFileRank()) autotuneExport(tune, path);
+  }
+  for (int i=0; i<AUTOTUNE_TIMERS; i++) {
+    if (tune->timerStart[i]) CUDACHECK(cudaEventDestroy(tune->timerStart[i]));
+    if (tune->timerStop[i]) CUDACHECK(cudaEventDestroy(tune->timerStop[i]));
+  }
+  pthread_mutex_destroy(&tune->lock);
+  pthread_cond_destroy(&tune->cond);
+  free(tune);
+  comm->autotune = NULL;
+  return ncclSuccess;
+}
+
+// Wait for the agreement requested one round ago, then drop the slower candidates. All ranks
+// issued the request in an earlier launch, so the wait only covers the exchange between the
+// agreement threads, not the progress of another communicator launched from this thread.
+static ncclResult_t autotuneApply(struct ncclAutotune* tune, struct autotuneBucket* bucket, int id) {
+  struct ncclComm* comm = tune->comm;
+  ncclResult_t ret = ncclSuccess;
+  pthread_mutex_lock(&tune->lock);
+  while (!bucket->agreed && tune->error == ncclSuccess && *comm->abortFlag == 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 1000000;
+    if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+    pthread_cond_timedwait(&tune->cond, &tune->lock, &ts);
+  }
+  if (bucket->agreed) {
+    bucket->active = bucket->agreedActive;
+    bucket->agreed = 0;
+  } else {
+    ret = tune->error != ncclSuccess ? tune->error : ncclInternalError;
+  }
+  pthread_mutex_unlock(&tune->lock);
+  if (ret != ncclSuccess) return ret;
+
+  bucket->pending = 0;
+  int nActive = __builtin_popcount(bucket->active);
+  if (nActive == 1) {
+    bucket->pinned = __builtin_ctz(bucket->active);
+    int c = id / (2*NCCL_ALGO_TABLE_BUCKETS);
+    int b = id % NCCL_ALGO_TABLE_BUCKETS;
+    INFO(NCCL_TUNING, "Autotune : %s size range 2^%d pinned to %s/%s after %lu operations", ncclFuncStr[c],
+        b, ncclAlgoStr[bucket->algorithm[bucket->pinned]], ncclProtoStr[bucket->protocol[bucket->pinned]], bucket->ops);
+  } else {
+    bucket->requestAt = bucket->ops + nActive*tune->samples;
+  }
+  return ncclSuccess;
+}
+
+// Hand the measurements of the round over to the agreement thread. Exploration goes on
+// with the same candidates until the next round completes.
+static void autotuneRequest(struct ncclAutotune* tune, struct autotuneBucket* bucket, int id) {
+  pthread_mutex_lock(&tune->lock);
+  memcpy(bucket->request, bucket->stats, sizeof(bucket->stats));
+  tune->queue[tune->queueHead++ % AUTOTUNE_NBUCKETS] = id;
+  pthread_cond_broadcast(&tune->cond);
+  pthread_mutex_unlock(&tune->lock);
+  bucket->pending = 1;
+  bucket->requestLaunch = tune->launches;
+  bucket->applyAt = bucket->ops + __builtin_popcount(bucket->active)*tune->samples;
+}
+
+ncclResult_t ncclAutotuneGetAlgoInfo(struct ncclInfo* info, int collNetTypeSupport) {
+  struct ncclAutotune* tune = info->comm->autotune;
+  info->autotuneTag = 0;
+  if (info->nChannels != 0) return ncclTopoGetAlgoInfo(info, collNetTypeSupport, 1);
+  int id = bucketId(info->coll, collNetTypeSupport == 1 ? 1 : 0, log2i(info->nBytes));
+  struct autotuneBucket* bucket = tune->buckets+id;
+  if (bucket->nCandidates < 2) return ncclTopoGetAlgoInfo(info, collNetTypeSupport, 1);
+
+  // Ranks switch at the same operation : the first one past applyAt in a later launch than the
+  // request. Until then the current candidates are explored further.
+  if (bucket->pending && bucket->ops >= bucket->applyAt && tune->launches > bucket->requestLaunch) NCCLCHECK(autotuneApply(tune, bucket, id));
+  int cand = bucket->pinned;
+  if (cand < 0) {
+    if (!bucket->pending && bucket->ops == bucket->requestAt) autotuneRequest(tune, bucket, id);
+    // Round robin over the active candidates
+    int n = bucket->ops % __builtin_popcount(bucket->active);
+    uint32_t active = bucket->active;
+    for (int i=0; i<n; i++) active &= active-1;
+    cand = __builtin_ctz(active);
+    info->autotuneTag = id*AUTOTUNE_MAX_CANDIDATES + cand + 1;
+  }
+  bucket->ops++;
+  info->algorithm = bucket->algorithm[cand];
+  info->protocol = bucket->protocol[cand];
+  return ncclTopoGetAlgoThreads(info);
+}
+
+ncclResult_t ncclAutotuneTimerStart(struct ncclComm* comm, struct ncclKernelPlan* plan, cudaStream_t stream) {
+  struct ncclAutotune* tune = comm->autotune;
+  plan->autotuneTimer = -1;
+  // Graph launches would replay the events, do not time them
+  if (tune == NULL || plan->autotuneTag == 0 || plan->persistent) return ncclSuccess;
+  if (tune->timerHead - tune->timerTail == AUTOTUNE_TIMERS) return ncclSuccess;
+  int slot = tune->timerHead % AUTOTUNE_TIMERS;
+  CUDACHECK(cudaEventRecord(tune->timerStart[slot], stream));
+  tune->timerTag[slot] = plan->autotuneTag;
+  tune->timerBytes[slot] = plan->autotuneBytes;
+  plan->autotuneTimer = slot;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclAutotuneTimerStop(struct ncclComm* comm, struct ncclKernelPlan* plan, cudaStream_t stream) {
+  struct ncclAutotune* tune = comm->autotune;
+  if (tune == NULL || plan->autotuneTimer < 0) return ncclSuccess;
+  CUDACHECK(cudaEventRecord(tune->timerStop[plan->autotuneTimer], stream));
+  tune->timerHead++;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclAutotunePoll(struct ncclComm* comm) {
+  struct ncclAutotune* tune = comm->autotune;
+  if (tune == NULL) return ncclSuccess;
+  tune->launches++;
+  while (tune->timerTail != tune->timerHead) {
+    int slot = tune->timerTail % AUTOTUNE_TIMERS;
+    cudaError_t res = cudaEventQuery(tune->timerStop[slot]);
+    if (res == cudaErrorNotReady) break;
+    CUDACHECK(res);
+    float ms;
+    CUDACHECK(cudaEventElapsedTime(&ms, tune->timerStart[slot], tune->timerStop[slot]));
+    int tag = tune->timerTag[slot]-1;
+    struct autotuneStats* s = tune->buckets[tag/AUTOTUNE_MAX_CANDIDATES].stats+tag%AUTOTUNE_MAX_CANDIDATES;
+    double bytes = tune->timerBytes[slot], time = ms*1000.0;
+    s->n++;
+    s->bytes += bytes;
+    s->time += time;
+    s->bytes2 += bytes*bytes;
+    s->bytesTime += bytes*time;
+    tune->timerTail++;
+  }
+  return ncclSuccess;
+}
@@ -18,22 +18,35 @@ struct ncclTopoNodeList {
   int count;
 };
 
-static ncclResult_t getPath(struct ncclTopoSystem* system, struct ncclTopoNode* node, int t, int64_t id, struct ncclTopoLinkList** path) {
-  for (int i=0; i<system->nodes[t].count; i++) {
-    if (system->nodes[t].nodes[i].id == id) {
-      *path = node->paths[t]+i;
-      return ncclSuccess;
-    }
-  }
-  WARN("Could not find node of type %d id %lx", t, id);
-  return ncclInternalError;
+ncclResult_t ncclTopoAllocPaths(struct ncclTopoSystem* system, int type, struct ncclTopoLinkList** paths) {
+  int count = system->nodes[type].count;
+  char* mem;
+  NCCLCHECK(ncclCalloc(&mem, count*(sizeof(struct ncclTopoLinkList)+system->maxHops*sizeof(struct ncclTopoLink*))));
+  struct ncclTopoLinkList* list = (struct ncclTopoLinkList*)mem;
+  struct ncclTopoLink** hops = (struct ncclTopoLink**)(list+count);
+  for (int i=0; i<count; i++) list[i].list = hops+i*system->maxHops;
+  *paths = list;
+  return ncclSuccess;
 }
 
 NCCL_PARAM(NvbDisable, "NVB_DISABLE", 0);
 
 static ncclResult_t ncclTopoSetPaths(struct ncclTopoNode* baseNode, struct ncclTopoSystem* system) {
-  if (baseNode->paths[baseNode->type] == NULL) {
-    NCCLCHECK(ncclCalloc(baseNode->paths+baseNode->type, system->nodes[baseNode->type].count));
+  const int baseType = baseNode->type;
+  const int baseIndex = baseNode - system->nodes[baseType].nodes;
+
+  // Reset paths to that node, in case we're re-computing them
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoLinkList* paths = system->nodes[t].nodes[n].paths[baseType];
+      if (paths == NULL) continue;
+      paths[baseIndex].count = 0;
+      paths[baseIndex].bw = 0;
+      paths[baseIndex].type = PATH_LOC;
+    }
+  }
+  if (baseNode->paths[baseType] == NULL) {
+    NCCLCHECK(ncclTopoAllocPaths(system, baseType, baseNode->paths+baseType));
   }
 
   // breadth-first search to set all paths to that node in the system
@@ -41,8 +54,7 @@ static ncclResult_t ncclTopoSetPaths(struct ncclTopoNode* baseNode, struct ncclT
   struct ncclTopoNodeList nextNodeList;
   nodeList.count = 1; nodeList.list[0] = baseNode;
   nextNodeList.count = 0;
-  struct ncclTopoLinkList* basePath;
-  NCCLCHECK(getPath(system, baseNode, baseNode->type, baseNode->id, &basePath));
+  struct ncclTopoLinkList* basePath = baseNode->paths[baseType]+baseIndex;
   basePath->count = 0;
   basePath->bw = LOC_BW;
   basePath->type = PATH_LOC;
@@ -51,16 +63,14 @@ static ncclResult_t ncclTopoSetPaths(struct ncclTopoNode* baseNode, struct ncclT
     nextNodeList.count = 0;
     for (int n=0; n<nodeList.count; n++) {
       struct ncclTopoNode* node = nodeList.list[n];
-      struct ncclTopoLinkList* path;
-      NCCLCHECK(getPath(system, node, baseNode->type, baseNode->id, &path));
+      struct ncclTopoLinkList* path = node->paths[baseType]+baseIndex;
       for (int l=0; l<node->nlinks; l++) {
         struct ncclTopoLink* link = node->links+l;
         struct ncclTopoNode* remNode = link->remNode;
-        if (remNode->paths[baseNode->type] == NULL) {
-          NCCLCHECK(ncclCalloc(remNode->paths+baseNode->type, system->nodes[baseNode->type].count));
+        if (remNode->paths[baseType] == NULL) {
+          NCCLCHECK(ncclTopoAllocPaths(system, baseType, remNode->paths+baseType));
         }
-        struct ncclTopoLinkList* remPath;
-        NCCLCHECK(getPath(system, remNode, baseNode->type, baseNode->id, &remPath));
+        struct ncclTopoLinkList* remPath = remNode->paths[baseType]+baseIndex;
         float bw = std::min(path->bw, link->bw);
 
         // allow routing through a GPU only as 1 hop
@@ -69,17 +79,23 @@ static ncclResult_t ncclTopoSetPaths(struct ncclTopoNode* baseNode, struct ncclT
 
         if ((remPath->bw == 0 || remPath->count > path->count) && remPath->bw < bw) {
           // Find reverse link
+          struct ncclTopoLink* revLink = NULL;
           for (int l=0; l<remNode->nlinks; l++) {
             if (remNode->links[l].remNode == node) {
-              remPath->list[0] = remNode->links+l;
+              revLink = remNode->links+l;
               break;
             }
           }
-          if (remPath->list[0] == NULL) {
+          if (revLink == NULL) {
             WARN("Failed to find reverse path from remNode %d/%lx nlinks %d to node %d/%lx",
                  remNode->type, remNode->id, remNode->nlinks, node->type, node->id);
             return ncclInternalError;
           }
+          if (path->count+1 > system->maxHops) {
+            WARN("Path from %d/%lx to %d/%lx exceeds %d hops", remNode->type, remNode->id, baseType, baseNode->id, system->maxHops);
+            return ncclInternalError;
+          }
+          remPath->list[0] = revLink;
           // Copy the rest of the path
           for (int i=0; i<path->count; i++) remPath->list[i+1] = path->list[i];
           remPath->count = path->count + 1;
@@ -175,6 +191,10 @@ static ncclResult_t addInterStep(struct ncclTopoSystem* system, int tx, int ix,
   struct ncclTopoNode* cpuNode = system->nodes[tx].nodes+ix;
   struct ncclTopoNode* srcNode = system->nodes[t1].nodes+i1;
 
+  if (srcNode->paths[tx][ix].count + cpuNode->paths[t2][i2].count > system->maxHops) {
+    WARN("Path from %d/%lx to %d/%lx through %d/%lx exceeds %d hops", t1, srcNode->id, t2, system->nodes[t2].nodes[i2].id, tx, cpuNode->id, system->maxHops);
+    return ncclInternalError;
+  }
   int l=0;
   // Node 1 -> CPU
   for (int i=0; i<srcNode->paths[tx][ix].count; i++) srcNode->paths[t2][i2].list[l++] = srcNode->paths[tx][ix].list[i];
@@ -207,6 +227,84 @@ static void ncclTopoRemovePathType(struct ncclTopoSystem* system, int nodeType)
   }
 }
 
+// Mark paths to all nodes of a type as needing to be recomputed.
+static void setDirty(struct ncclTopoSystem* system, int type) {
+  for (int i=0; i<system->nodes[type].count; i++) system->pathsDirty[type][i] = 1;
+}
+
+static int anyDirty(struct ncclTopoSystem* system, int type) {
+  for (int i=0; i<system->nodes[type].count; i++) if (system->pathsDirty[type][i]) return 1;
+  return 0;
+}
+
+// Called by ncclTopoRemoveNode before delNode is removed. Marks the paths
+// going through delNode as dirty and records in system->removedLinks, for
+// each node, which links will be removed.
+ncclResult_t ncclTopoInvalidatePaths(struct ncclTopoSystem* system, struct ncclTopoNode* delNode) {
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      uint32_t mask = 0;
+      for (int l=0; l<node->nlinks; l++) if (node->links[l].remNode == delNode) mask |= 1U<<l;
+      system->removedLinks[t][n] = mask;
+      if (node == delNode) continue;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        struct ncclTopoLinkList* paths = node->paths[p];
+        if (paths == NULL) continue;
+        for (int d=0; d<system->nodes[p].count; d++) {
+          for (int h=0; h<paths[d].count && system->pathsDirty[p][d] == 0; h++) {
+            if (paths[d].list[h]->remNode == delNode) system->pathsDirty[p][d] = 1;
+          }
+        }
+      }
+    }
+  }
+  // PXN relays depend on the set of GPUs and NICs
+  if (delNode->type == GPU || delNode->type == NET) setDirty(system, NET);
+  return ncclSuccess;
+}
+
+// Links are stored inside nodes, so removing a node moves the links of the
+// nodes after it, and removing links moves the links after them.
+static struct ncclTopoLink* rebaseLink(struct ncclTopoSystem* system, struct ncclTopoLink* link, int type, int index) {
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    struct ncclTopoNode* nodes = system->nodes[t].nodes;
+    intptr_t offset = (char*)link - (char*)nodes;
+    if (offset < 0 || offset >= (intptr_t)(NCCL_TOPO_MAX_NODES*sizeof(struct ncclTopoNode))) continue;
+    int n = offset / sizeof(struct ncclTopoNode);
+    int l = link - nodes[n].links;
+    l -= __builtin_popcount(system->removedLinks[t][n] & ((1U<<l)-1));
+    if (t == type && n > index) n--;
+    return nodes[n].links+l;
+  }
+  return link;
+}
+
+// Called by ncclTopoRemoveNode once node index of the given type has been
+// removed. Removes the paths to that node and fixes up the remaining ones.
+ncclResult_t ncclTopoRebasePaths(struct ncclTopoSystem* system, int type, int index) {
+  int count = system->nodes[type].count;
+  memmove(system->pathsDirty[type]+index, system->pathsDirty[type]+index+1, NCCL_TOPO_MAX_NODES-index-1);
+  system->pathsDirty[type][NCCL_TOPO_MAX_NODES-1] = 0;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        struct ncclTopoLinkList* paths = node->paths[p];
+        if (paths == NULL) continue;
+        if (p == type) memmove(paths+index, paths+index+1, (count-index)*sizeof(struct ncclTopoLinkList));
+        for (int d=0; d<system->nodes[p].count; d++) {
+          // Dirty paths will be recomputed and may reference removed links
+          if (system->pathsDirty[p][d]) continue;
+          for (int h=0; h<paths[d].count; h++) paths[d].list[h] = rebaseLink(system, paths[d].list[h], type, index);
+        }
+      }
+    }
+  }
+  if (count == 0) ncclTopoRemovePathType(system, type);
+  return ncclSuccess;
+}
+
 static const int levelsOldToNew[] = { PATH_LOC, PATH_PIX, PATH_PXB, PATH_PHB, PATH_SYS, PATH_SYS };
 ncclResult_t ncclGetLevel(int* level, const char* disableEnv, const char* levelEnv) {
   if (*level == -1) {
@@ -520,26 +618,41 @@ ncclResult_t ncclTopoGetPxnRanks(struct ncclComm* comm, int** intermediateRanks,
 ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm* comm) {
   // Precompute paths between GPUs/NICs.
 
-  // Remove everything in case we're re-computing
-  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) ncclTopoRemovePathType(system, t);
+  if (system->pathsValid == 0 || system->pathsComm != comm) {
+    // Remove everything in case we're re-computing
+    for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) ncclTopoRemovePathType(system, t);
+    // A path visits each node at most once, and an intermediate step
+    // concatenates two such paths.
+    int nNodes = 0;
+    for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) nNodes += system->nodes[t].count;
+    system->maxHops = std::min(2*nNodes, NCCL_TOPO_MAX_HOPS);
+    setDirty(system, CPU);
+  }
+  // Paths through the CPU depend on paths to CPUs, and PXN/GDR on paths to GPUs.
+  if (anyDirty(system, CPU)) setDirty(system, GPU);
+  if (anyDirty(system, GPU)) setDirty(system, NET);
 
   // Set direct paths to CPUs. We need them in many cases.
   for (int c=0; c<system->nodes[CPU].count; c++) {
+    if (system->pathsDirty[CPU][c] == 0) continue;
     NCCLCHECK(ncclTopoSetPaths(system->nodes[CPU].nodes+c, system));
   }
 
   // Set direct paths to GPUs.
   for (int g=0; g<system->nodes[GPU].count; g++) {
+    if (system->pathsDirty[GPU][g] == 0) continue;
     NCCLCHECK(ncclTopoSetPaths(system->nodes[GPU].nodes+g, system));
   }
 
   // Set direct paths to NICs.
   for (int n=0; n<system->nodes[NET].count; n++) {
+    if (system->pathsDirty[NET][n] == 0) continue;
     NCCLCHECK(ncclTopoSetPaths(system->nodes[NET].nodes+n, system));
   }
 
   // Update path for GPUs when we don't want to / can't use GPU Direct P2P
   for (int g=0; g<system->nodes[GPU].count; g++) {
+    if (system->pathsDirty[GPU][g] == 0) continue;
     for (int p=0; p<system->nodes[GPU].count; p++) {
       int p2p;
       NCCLCHECK(ncclTopoCheckP2p(system, system->nodes[GPU].nodes[p].id, system->nodes[GPU].nodes[g].id, &p2p, NULL, NULL));
@@ -572,6 +685,7 @@ ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm
 
   // Update paths for NICs (no GPU Direct, PXN, ...)
   for (int n=0; n<system->nodes[NET].count; n++) {
+    if (system->pathsDirty[NET][n] == 0) continue;
     struct ncclTopoNode* netNode = system->nodes[NET].nodes+n;
 
     for (int g=0; g<system->nodes[GPU].count; g++) {
@@ -618,6 +732,10 @@ ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclComm
       }
     }
   }
+
+  memset(system->pathsDirty, 0, sizeof(system->pathsDirty));
+  system->pathsValid = 1;
+  system->pathsComm = comm;
   return ncclSuccess;
 }
 
@@ -9,6 +9,9 @@
 #include "topo.h"
 #include "xml.h"
 #include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 
 // Initialize system->maxBw. This is the per-channel (i.e. per-SM)
 // max bw.
@@ -736,8 +739,405 @@ float sm90SpeedArrayInter[] = { 48.0, 45.0, 30.0, 24.0, 15.0, 12.0, 6.0, 3.0, 2.
 #define NSPEEDSINTRA_SM90 (sizeof(sm90SpeedArrayIntra)/sizeof(float))
 #define NSPEEDSINTER_SM90 (sizeof(sm90SpeedArrayInter)/sizeof(float))
 
+/* Graph cache : the search only depends on the system (nodes, links and
+ * paths) and on the graph input parameters. Hash those and keep the result
+ * in NCCL_GRAPH_CACHE_DIR, in the NCCL_GRAPH_FILE format. */
+
+static void hashAppend(uint64_t* hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i=0; i<size; i++) *hash = (*hash ^ bytes[i]) * 0x100000001b3ULL;
+}
+#define HASH_FIELD(hash, field) hashAppend(hash, &(field), sizeof(field))
+
 NCCL_PARAM(CrossNic, "CROSS_NIC", 2);
 
+static void ncclTopoGraphCacheHash(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, uint64_t* hashOut) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  int version = NCCL_VERSION_CODE;
+  HASH_FIELD(&hash, version);
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    HASH_FIELD(&hash, system->nodes[t].count);
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      HASH_FIELD(&hash, node->id);
+      if (t == GPU) {
+        // Not the rank : cached graphs refer to GPUs by dev, and ranks differ across jobs
+        HASH_FIELD(&hash, node->gpu.dev);
+        HASH_FIELD(&hash, node->gpu.cudaCompCap);
+        HASH_FIELD(&hash, node->gpu.gdrSupport);
+      } else if (t == NET) {
+        HASH_FIELD(&hash, node->net.asic);
+        HASH_FIELD(&hash, node->net.port);
+        HASH_FIELD(&hash, node->net.bw);
+        HASH_FIELD(&hash, node->net.latency);
+        HASH_FIELD(&hash, node->net.gdrSupport);
+        HASH_FIELD(&hash, node->net.collSupport);
+        HASH_FIELD(&hash, node->net.maxChannels);
+      } else if (t == CPU) {
+        HASH_FIELD(&hash, node->cpu.arch);
+        HASH_FIELD(&hash, node->cpu.vendor);
+        HASH_FIELD(&hash, node->cpu.model);
+      }
+      HASH_FIELD(&hash, node->nlinks);
+      for (int l=0; l<node->nlinks; l++) {
+        struct ncclTopoLink* link = node->links+l;
+        HASH_FIELD(&hash, link->type);
+        HASH_FIELD(&hash, link->bw);
+        HASH_FIELD(&hash, link->remNode->type);
+        HASH_FIELD(&hash, link->remNode->id);
+      }
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        if (node->paths[p] == NULL) continue;
+        for (int r=0; r<system->nodes[p].count; r++) {
+          struct ncclTopoLinkList* path = node->paths[p]+r;
+          HASH_FIELD(&hash, path->count);
+          HASH_FIELD(&hash, path->bw);
+          HASH_FIELD(&hash, path->type);
+        }
+      }
+    }
+  }
+  HASH_FIELD(&hash, system->maxBw);
+  HASH_FIELD(&hash, system->totalBw);
+  HASH_FIELD(&hash, graph->id);
+  HASH_FIELD(&hash, graph->pattern);
+  // graph->crossNic is 0 for both 0 and 2 by now, while 2 lets the search use crossNic
+  int64_t crossNic = ncclParamCrossNic();
+  HASH_FIELD(&hash, crossNic);
+  HASH_FIELD(&hash, graph->collNet);
+  HASH_FIELD(&hash, graph->minChannels);
+  HASH_FIELD(&hash, graph->maxChannels);
+  *hashOut = hash;
+}
+
+// Sets path to an empty string if the cache is disabled.
+static ncclResult_t ncclTopoGraphCacheGetPath(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, char* path) {
+  path[0] = '\0';
+  char* dir = getenv("NCCL_GRAPH_CACHE_DIR");
+  if (dir == NULL || dir[0] == '\0') return ncclSuccess;
+  INFO(NCCL_ENV, "NCCL_GRAPH_CACHE_DIR set by environment to %s", dir);
+  uint64_t hash;
+  ncclTopoGraphCacheHash(system, graph, &hash);
+  snprintf(path, PATH_MAX, "%s/nccl-graph-%016lx.xml", dir, hash);
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoGraphCacheLoad(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, const char* path, int* hit) {
+  *hit = 0;
+  if (access(path, R_OK) != 0) {
+    INFO(NCCL_GRAPH, "Search %d : no cached graph %s", graph->id, path);
+    return ncclSuccess;
+  }
+  // Load into a copy, so that a stale or corrupted entry leaves the graph untouched
+  ncclResult_t ret = ncclSuccess;
+  struct ncclXml* xml = NULL;
+  struct ncclTopoGraph* cached;
+  NCCLCHECK(ncclCalloc(&cached, 1));
+  memcpy(cached, graph, sizeof(struct ncclTopoGraph));
+  int nChannels = 0;
+  NCCLCHECKGOTO(ncclCalloc(&xml, 1), ret, exit);
+  NCCLCHECKGOTO(ncclTopoGetXmlGraphFromFile(path, xml), ret, exit);
+  if (xml->maxIndex > 0) NCCLCHECKGOTO(ncclTopoGetGraphFromXml(xml->nodes[0], system, cached, &nChannels), ret, exit);
+exit:
+  if (ret != ncclSuccess) {
+    INFO(NCCL_GRAPH, "Search %d : ignoring cached graph %s", graph->id, path);
+  } else if (cached->nChannels > 0) {
+    INFO(NCCL_GRAPH, "Search %d : %d channels loaded from cached graph %s", graph->id, nChannels, path);
+    memcpy(graph, cached, sizeof(struct ncclTopoGraph));
+    *hit = 1;
+  }
+  free(cached);
+  NCCLCHECK(xmlFree(xml));
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoGraphCacheSave(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, const char* path) {
+  char* dir = getenv("NCCL_GRAPH_CACHE_DIR");
+  if (access(dir, W_OK) != 0) {
+    INFO(NCCL_GRAPH, "Graph cache directory %s is not writable : %s", dir, strerror(errno));
+    return ncclSuccess;
+  }
+  // Write to a private file then rename, so that concurrent ranks never see a partial file
+  char tmpPath[PATH_MAX];
+  snprintf(tmpPath, PATH_MAX, "%s.%d.%lx", path, getpid(), (unsigned long)pthread_self());
+  ncclResult_t ret = ncclSuccess;
+  struct ncclXml* xml;
+  NCCLCHECK(ncclCalloc(&xml, 1));
+  NCCLCHECKGOTO(ncclTopoGetXmlFromGraphs(1, &graph, system, xml), ret, exit);
+  NCCLCHECKGOTO(ncclTopoDumpXmlToFile(tmpPath, xml), ret, exit);
+  if (rename(tmpPath, path) != 0) {
+    INFO(NCCL_GRAPH, "Could not store graph in cache %s : %s", path, strerror(errno));
+    unlink(tmpPath);
+  } else {
+    INFO(NCCL_GRAPH, "Search %d : stored graph in cache %s", graph->id, path);
+  }
+exit:
+  NCCLCHECK(xmlFree(xml));
+  return ret;
+}
+
+/* Parallel search : the pass 1 candidates (speed, pattern, crossNic) are
+ * searched concurrently, each on its own copy of the system. Each
+ * candidate explores sameChannels/typeIntra/typeInter like the serial
+ * search. What a candidate does depends on the best graph and on the
+ * NCCL_SEARCH_GLOBAL_TIMEOUT budget left by the candidates before it, so
+ * the search runs in rounds : all remaining candidates start from the
+ * graph and budget the serial search has at the first one. The merge then
+ * walks them in serial order and keeps a candidate only if the serial
+ * search would have run it the same way, i.e. the best graph did not
+ * change before it and the budget left is enough for every check it went
+ * through. Otherwise a new round starts at that candidate. The result is
+ * the serial result, whatever the number of threads and their timing. */
+
+NCCL_PARAM(SearchNThreads, "SEARCH_NTHREADS", 1);
+
+template <typename T>
+static T* rebasePtr(T* ptr, intptr_t offset) { return (T*)((char*)ptr+offset); }
+
+// Duplicate the parts of the system the search reads and writes : nodes,
+// links and the GPU/NET paths of GPU and NET nodes. Other paths are NULL.
+static ncclResult_t ncclTopoSearchSystemDup(struct ncclTopoSystem* system, struct ncclTopoSystem** dupPtr) {
+  struct ncclTopoSystem* dup;
+  NCCLCHECK(ncclCalloc(&dup, 1));
+  memcpy(dup, system, sizeof(struct ncclTopoSystem));
+  const intptr_t offset = (char*)dup - (char*)system;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<dup->nodes[t].count; n++) {
+      struct ncclTopoNode* node = dup->nodes[t].nodes+n;
+      for (int l=0; l<node->nlinks; l++) node->links[l].remNode = rebasePtr(node->links[l].remNode, offset);
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) node->paths[p] = NULL;
+      if (t != GPU && t != NET) continue;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        struct ncclTopoLinkList* paths = system->nodes[t].nodes[n].paths[p];
+        if ((p != GPU && p != NET) || paths == NULL) continue;
+        NCCLCHECK(ncclTopoAllocPaths(dup, p, node->paths+p));
+        for (int i=0; i<dup->nodes[p].count; i++) {
+          struct ncclTopoLinkList* path = node->paths[p]+i;
+          path->count = paths[i].count;
+          path->bw = paths[i].bw;
+          path->type = paths[i].type;
+          for (int h=0; h<path->count; h++) path->list[h] = rebasePtr(paths[i].list[h], offset);
+        }
+      }
+    }
+  }
+  *dupPtr = dup;
+  return ncclSuccess;
+}
+
+static void ncclTopoSearchSystemFree(struct ncclTopoSystem* system) {
+  if (system == NULL) return;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<system->nodes[t].count; n++) {
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) free(system->nodes[t].nodes[n].paths[p]);
+    }
+  }
+  free(system);
+}
+
+struct ncclTopoSearchCandidate {
+  int speedIndex;
+  int pattern;
+  int crossNic;
+  struct ncclTopoGraph* graph; // Best graph found, NULL if not searched
+  int done; // Found a solution which would end the serial search
+  int stopped; // Ran out of budget, which ends the serial search
+  int64_t used; // Budget used
+  int64_t needBudget; // Lowest budget which passes all the budget checks
+};
+
+struct ncclTopoSearchWork {
+  struct ncclTopoSystem* system;
+  struct ncclTopoGraph* baseGraph; // Search parameters at the start of pass 1
+  struct ncclTopoGraph* seedGraph; // Best graph at the start of the round
+  int64_t budget; // Budget left at the start of the round
+  float* speedArray;
+  struct ncclTopoSearchCandidate* candidates;
+  int nCandidates;
+  int next;
+  int stopIndex; // Lowest candidate index with done or stopped set
+  ncclResult_t result;
+};
+
+// Mirrors the sameChannels/typeIntra/typeInter part of the pass 1 loop in ncclTopoCompute.
+static ncclResult_t ncclTopoSearchCandidateRun(struct ncclTopoSystem* system, struct ncclTopoGraph* tmpGraph, struct ncclTopoGraph* graph,
+    int64_t budget, struct ncclTopoSearchCandidate* cand) {
+  int ngpus = system->nodes[GPU].count;
+  cand->done = cand->stopped = 0;
+  cand->used = 0;
+  cand->needBudget = INT64_MIN;
+  while (1) {
+    int time = tmpGraph->sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
+      tmpGraph->pattern == NCCL_TOPO_PATTERN_TREE ? NCCL_SEARCH_TIMEOUT_TREE : NCCL_SEARCH_TIMEOUT;
+    tmpGraph->nChannels = 0;
+    cand->used += time;
+    NCCLCHECK(ncclTopoSearchRec(system, tmpGraph, graph, &time));
+    if (time == -1 || graph->nChannels*graph->bwInter >= system->totalBw) {
+      cand->done = 1;
+      return ncclSuccess;
+    }
+    if (tmpGraph->sameChannels == 1) {
+      tmpGraph->sameChannels = 0;
+      continue;
+    }
+    tmpGraph->sameChannels = 1;
+
+    cand->used -= time;
+    if (graph->nChannels) {
+      if (budget - cand->used < 0) {
+        cand->stopped = 1;
+        return ncclSuccess;
+      }
+      cand->needBudget = std::max(cand->needBudget, cand->used);
+    }
+
+    int maxTypeIntra = system->nodes[NET].count > 0 ? tmpGraph->typeInter : PATH_SYS;
+    if (tmpGraph->typeIntra < maxTypeIntra && (graph->nChannels == 0 || tmpGraph->typeIntra < graph->typeIntra)) {
+      tmpGraph->typeIntra += 1;
+      continue;
+    }
+    tmpGraph->typeIntra = ngpus == 1 ? PATH_LOC : PATH_NVL;
+
+    if (system->nodes[NET].count > 0 && tmpGraph->typeInter < PATH_SYS && (graph->nChannels == 0 || tmpGraph->typeInter < graph->typeInter || tmpGraph->typeInter < PATH_PXN)) {
+      tmpGraph->typeInter += 1;
+      continue;
+    }
+    return ncclSuccess;
+  }
+}
+
+static ncclResult_t ncclTopoSearchWorkerRun(struct ncclTopoSearchWork* work) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclTopoSystem* system = NULL;
+  struct ncclTopoGraph* tmpGraph = NULL;
+  NCCLCHECKGOTO(ncclTopoSearchSystemDup(work->system, &system), ret, exit);
+  NCCLCHECKGOTO(ncclCalloc(&tmpGraph, 1), ret, exit);
+  while (1) {
+    int c = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+    if (c >= work->nCandidates) break;
+    // The merge never looks past a candidate which ended the search
+    if (c > __atomic_load_n(&work->stopIndex, __ATOMIC_ACQUIRE)) break;
+    struct ncclTopoSearchCandidate* cand = work->candidates+c;
+    struct ncclTopoGraph* graph;
+    NCCLCHECKGOTO(ncclCalloc(&graph, 1), ret, exit);
+    memcpy(graph, work->seedGraph, sizeof(struct ncclTopoGraph));
+    cand->graph = graph;
+    memcpy(tmpGraph, work->baseGraph, sizeof(struct ncclTopoGraph));
+    tmpGraph->pattern = cand->pattern;
+    tmpGraph->crossNic = cand->crossNic;
+    tmpGraph->bwIntra = tmpGraph->bwInter = work->speedArray[cand->speedIndex];
+    NCCLCHECKGOTO(ncclTopoSearchCandidateRun(system, tmpGraph, graph, work->budget, cand), ret, exit);
+    if (cand->done || cand->stopped) {
+      int stop = __atomic_load_n(&work->stopIndex, __ATOMIC_RELAXED);
+      while (c < stop && !__atomic_compare_exchange_n(&work->stopIndex, &stop, c, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+  }
+exit:
+  free(tmpGraph);
+  ncclTopoSearchSystemFree(system);
+  return ret;
+}
+
+static void* ncclTopoSearchWorker(void* arg) {
+  struct ncclTopoSearchWork* work = (struct ncclTopoSearchWork*)arg;
+  ncclResult_t ret = ncclTopoSearchWorkerRun(work);
+  if (ret != ncclSuccess) __atomic_store_n(&work->result, ret, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+// Search candidates from work->next on, starting from work->seedGraph and work->budget.
+static ncclResult_t ncclTopoSearchRound(struct ncclTopoSearchWork* work, pthread_t* threads, int nThreads) {
+  ncclResult_t ret = ncclSuccess;
+  int nStarted = 0;
+  work->stopIndex = work->nCandidates;
+  work->result = ncclSuccess;
+  for (; nStarted<nThreads; nStarted++) {
+    int err = pthread_create(threads+nStarted, NULL, ncclTopoSearchWorker, work);
+    if (err != 0) {
+      WARN("Could not create search thread : %s", strerror(err));
+      ret = ncclSystemError;
+      break;
+    }
+  }
+  for (int t=0; t<nStarted; t++) pthread_join(threads[t], NULL);
+  if (ret == ncclSuccess) ret = work->result;
+  return ret;
+}
+
+// Run pass 1 of the search on nThreads threads and return the best graph in graph.
+static ncclResult_t ncclTopoSearchParallel(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int crossNic,
+    float* speedArray, int nspeeds, int speedIndex, int nThreads) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclTopoSearchWork work;
+  memset(&work, 0, sizeof(work));
+  pthread_t* threads = NULL;
+  struct ncclTopoGraph* baseGraph = NULL;
+  int nSearched = 0, nRounds = 0;
+  int64_t budget = NCCL_SEARCH_GLOBAL_TIMEOUT;
+
+  // Candidates in the order of the serial search : decreasing speed, then
+  // simpler pattern, then crossNic. The serial search starts with the
+  // crossNic of the graph (1 with NCCL_CROSS_NIC=1), then tries crossNic
+  // only after 0.
+  int patterns[2] = { graph->pattern, NCCL_TOPO_PATTERN_TREE };
+  int nPatterns = graph->pattern == NCCL_TOPO_PATTERN_SPLIT_TREE ? 2 : 1;
+  NCCLCHECK(ncclCalloc(&work.candidates, (nspeeds-speedIndex)*nPatterns*2));
+  for (int s=speedIndex; s<nspeeds; s++) {
+    for (int p=0; p<nPatterns; p++) {
+      int firstCrossNic = work.nCandidates == 0 ? graph->crossNic : 0;
+      for (int x=firstCrossNic; x<=(crossNic ? 1 : firstCrossNic); x++) {
+        struct ncclTopoSearchCandidate* cand = work.candidates+work.nCandidates++;
+        cand->speedIndex = s;
+        cand->pattern = patterns[p];
+        cand->crossNic = x;
+      }
+    }
+  }
+  NCCLCHECKGOTO(ncclCalloc(&baseGraph, 1), ret, exit);
+  memcpy(baseGraph, graph, sizeof(struct ncclTopoGraph));
+  work.system = system;
+  work.baseGraph = baseGraph;
+  work.seedGraph = graph;
+  work.speedArray = speedArray;
+
+  if (nThreads > work.nCandidates) nThreads = work.nCandidates;
+  NCCLCHECKGOTO(ncclCalloc(&threads, nThreads), ret, exit);
+  for (int c=0; c<work.nCandidates; ) {
+    work.next = c;
+    work.budget = budget;
+    NCCLCHECKGOTO(ncclTopoSearchRound(&work, threads, nThreads), ret, exit);
+    nRounds++;
+    for (int r=c; r<work.nCandidates; r++) nSearched += work.candidates[r].graph ? 1 : 0;
+
+    // Merge in candidate order, stopping where the serial search would have stopped.
+    int start = c;
+    for (; c<work.nCandidates; c++) {
+      struct ncclTopoSearchCandidate* cand = work.candidates+c;
+      // Only decrease the speed further if it is worth it
+      if (c > 0 && cand->speedIndex != work.candidates[c-1].speedIndex &&
+          graph->nChannels && speedArray[cand->speedIndex]/graph->bwInter <= .49) goto exit;
+      // Not searched, or searched from another graph or budget : search it again in the next round
+      if (c > start && (cand->graph == NULL || budget < cand->needBudget)) break;
+      int changed = memcmp(cand->graph, graph, sizeof(struct ncclTopoGraph));
+      if (changed) memcpy(graph, cand->graph, sizeof(struct ncclTopoGraph));
+      budget -= cand->used;
+      if (cand->done || cand->stopped) goto exit;
+      if (changed) { c++; break; }
+    }
+    for (int r=c; r<work.nCandidates; r++) {
+      free(work.candidates[r].graph);
+      work.candidates[r].graph = NULL;
+    }
+  }
+exit:
+  if (ret == ncclSuccess) INFO(NCCL_GRAPH, "Search %d : %d candidate searches for %d candidates in %d rounds on %d threads", graph->id, nSearched, work.nCandidates, nRounds, nThreads);
+  for (int c=0; c<work.nCandidates; c++) free(work.candidates[c].graph);
+  free(work.candidates);
+  free(baseGraph);
+  free(threads);
+  return ret;
+}
+
 ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph) {
   int ngpus = system->nodes[GPU].count;
   graph->crossNic = ncclParamCrossNic();
@@ -756,13 +1156,21 @@ ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph
     struct ncclXml* xml;
     NCCLCHECK(ncclCalloc(&xml, 1));
     NCCLCHECK(ncclTopoGetXmlGraphFromFile(str, xml));
-    int nChannels;
-    NCCLCHECK(ncclTopoGetGraphFromXml(xml->nodes, system, graph, &nChannels));
+    int nChannels = 0;
+    if (xml->maxIndex > 0) NCCLCHECK(ncclTopoGetGraphFromXml(xml->nodes[0], system, graph, &nChannels));
     INFO(NCCL_GRAPH, "Search %d : %d channels loaded from XML graph", graph->id, nChannels);
-    free(xml);
+    NCCLCHECK(xmlFree(xml));
     if (graph->nChannels > 0) return ncclSuccess;
   }
 
+  char cachePath[PATH_MAX];
+  NCCLCHECK(ncclTopoGraphCacheGetPath(system, graph, cachePath));
+  if (cachePath[0]) {
+    int hit;
+    NCCLCHECK(ncclTopoGraphCacheLoad(system, graph, cachePath, &hit));
+    if (hit) return ncclSuccess;
+  }
+
   if (ngpus == 1) if (graph->pattern != NCCL_TOPO_PATTERN_RING) graph->pattern = NCCL_TOPO_PATTERN_TREE;
 
   // SPLIT_TREE works better on older archs.
@@ -783,13 +1191,20 @@ ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph
     speedArray = ccMin >= 90 ? sm90SpeedArrayInter : speedArrayInter;
   }
   int pass = 1;
+  int fallback = 0;
   int speedIndex = 0;
   while (speedArray[speedIndex] > system->maxBw && speedIndex < nspeeds-1) speedIndex++;
   tmpGraph.bwIntra = tmpGraph.bwInter = speedArray[speedIndex];
   int64_t globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
+  int time;
+
+  if (ncclParamSearchNThreads() > 1) {
+    NCCLCHECK(ncclTopoSearchParallel(system, graph, crossNic, speedArray, nspeeds, speedIndex, ncclParamSearchNThreads()));
+    goto done;
+  }
 
 search:
-  int time = tmpGraph.sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
+  time = tmpGraph.sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
     tmpGraph.pattern == NCCL_TOPO_PATTERN_TREE ? NCCL_SEARCH_TIMEOUT_TREE : NCCL_SEARCH_TIMEOUT;
   tmpGraph.nChannels = 0;
   globalTimeout -= time;
@@ -893,6 +1308,7 @@ done:
     graph->bwIntra = graph->bwInter = 0.1;
     graph->typeIntra = graph->typeInter = PATH_SYS;
     graph->nChannels = 1;
+    fallback = 1;
   }
 
   if ((ccMin <= 80 && graph->bwIntra >= 25.0) || (ccMin <= 90 && graph->bwIntra >= 50.0)) {
@@ -903,6 +1319,9 @@ done:
     graph->bwInter /= DIVUP(dupChannels, graph->nChannels);
     graph->nChannels = dupChannels;
   }
+
+  // Never cache the fallback : a later search may find a real solution
+  if (cachePath[0] && graph->nChannels > 0 && fallback == 0) NCCLCHECK(ncclTopoGraphCacheSave(system, graph, cachePath));
   return ncclSuccess;
 }
 
@@ -939,7 +1358,7 @@ ncclResult_t ncclTopoDumpGraphs(struct ncclTopoSystem* system, int ngraphs, stru
     NCCLCHECK(ncclCalloc(&xml, 1));
     NCCLCHECK(ncclTopoGetXmlFromGraphs(ngraphs, graphs, system, xml));
     NCCLCHECK(ncclTopoDumpXmlToFile(str, xml));
-    free(xml);
+    NCCLCHECK(xmlFree(xml));
   }
   return ncclSuccess;
 }
@@ -102,6 +102,8 @@ ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNo
   }
   struct ncclTopoNode* n = system->nodes[type].nodes+system->nodes[type].count;
   system->nodes[type].count++;
+  // Paths need to be fully recomputed
+  system->pathsValid = 0;
   n->type = type;
   n->id = id;
   if (type == GPU) {
@@ -129,6 +131,8 @@ ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNo
 
 ncclResult_t ncclTopoRemoveNode(struct ncclTopoSystem* system, int type, int index) {
   struct ncclTopoNode* delNode = system->nodes[type].nodes+index;
+  // Keep paths up to date so that only the paths through delNode need to be recomputed.
+  if (system->pathsValid) NCCLCHECK(ncclTopoInvalidatePaths(system, delNode));
   for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
     free(delNode->paths[t]);
     for (int n=0; n<system->nodes[t].count; n++) {
@@ -147,6 +151,7 @@ ncclResult_t ncclTopoRemoveNode(struct ncclTopoSystem* system, int type, int ind
   }
   memmove(delNode, delNode+1, (system->nodes[type].count-index-1)*sizeof(struct ncclTopoNode));
   system->nodes[type].count--;
+  if (system->pathsValid) NCCLCHECK(ncclTopoRebasePaths(system, type, index));
   return ncclSuccess;
 }
 
@@ -561,33 +566,21 @@ NCCL_PARAM(TopoDumpFileRank, "TOPO_DUMP_FILE_RANK", 0);
 
 // Only set values if not already set
 static ncclResult_t xmlInitAttrInt(struct ncclXmlNode* node, const char* attrName, const int value) {
-  int index;
-  NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
-  if (index == -1) {
-    index = node->nAttrs++;
-    strncpy(node->attrs[index].key, attrName, MAX_STR_LEN);
-    snprintf(node->attrs[index].value, MAX_STR_LEN, "%d", value);
-  }
+  char strValue[MAX_STR_LEN+1];
+  snprintf(strValue, MAX_STR_LEN, "%d", value);
+  NCCLCHECK(xmlSetAttrIfUnset(node, attrName, strValue));
   return ncclSuccess;
 }
 static ncclResult_t xmlInitAttrUint64(struct ncclXmlNode* node, const char* attrName, const uint64_t value) {
-  int index;
-  NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
-  if (index == -1) {
-    index = node->nAttrs++;
-    strncpy(node->attrs[index].key, attrName, MAX_STR_LEN);
-    snprintf(node->attrs[index].value, MAX_STR_LEN, "0x%lx", value);
-  }
+  char strValue[MAX_STR_LEN+1];
+  snprintf(strValue, MAX_STR_LEN, "0x%lx", value);
+  NCCLCHECK(xmlSetAttrIfUnset(node, attrName, strValue));
   return ncclSuccess;
 }
 static ncclResult_t xmlInitAttrFloat(struct ncclXmlNode* node, const char* attrName, const float value) {
-  int index;
-  NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
-  if (index == -1) {
-    index = node->nAttrs++;
-    strncpy(node->attrs[index].key, attrName, MAX_STR_LEN);
-    snprintf(node->attrs[index].value, MAX_STR_LEN, "%f", value);
-  }
+  char strValue[MAX_STR_LEN+1];
+  snprintf(strValue, MAX_STR_LEN, "%f", value);
+  NCCLCHECK(xmlSetAttrIfUnset(node, attrName, strValue));
   return ncclSuccess;
 }
 
@@ -675,7 +668,7 @@ ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** sy
   }
 
   NCCLCHECK(ncclTopoGetSystemFromXml(xml, system));
-  free(xml);
+  NCCLCHECK(xmlFree(xml));
   return ncclSuccess;
 }
 
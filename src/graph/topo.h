@@ -84,8 +84,11 @@ struct ncclTopoLink {
 #define NCCL_TOPO_MAX_LINKS 32
 #define NCCL_TOPO_MAX_HOPS (NCCL_TOPO_MAX_NODES*NCCL_TOPO_NODE_TYPES)
 
+// Paths from a node to all nodes of a given type are allocated as a single
+// block (see ncclTopoAllocPaths) : the ncclTopoLinkList array, followed by
+// system->maxHops hops for each path.
 struct ncclTopoLinkList {
-  struct ncclTopoLink* list[NCCL_TOPO_MAX_HOPS];
+  struct ncclTopoLink** list;
   int count;
   float bw;
   int type;
@@ -143,13 +146,26 @@ struct ncclTopoSystem {
   struct ncclTopoNodeSet nodes[NCCL_TOPO_NODE_TYPES];
   float maxBw;
   float totalBw;
+  // Path computation state. Once paths are valid, removing nodes only marks
+  // the destinations whose paths went through them as dirty, and the next
+  // ncclTopoComputePaths only recomputes those.
+  int pathsValid;
+  struct ncclComm* pathsComm;
+  int maxHops;
+  char pathsDirty[NCCL_TOPO_NODE_TYPES][NCCL_TOPO_MAX_NODES];
+  // Links of each node removed with the node being removed, one bit per link
+  uint32_t removedLinks[NCCL_TOPO_NODE_TYPES][NCCL_TOPO_MAX_NODES];
 };
+static_assert(NCCL_TOPO_MAX_LINKS <= 32, "removedLinks needs one bit per link");
 
 ncclResult_t ncclTopoGetNode(struct ncclTopoSystem* system, struct ncclTopoNode** node, int type, uint64_t id);
 ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNode** node, int type, uint64_t id);
 ncclResult_t ncclTopoRemoveNode(struct ncclTopoSystem* system, int type, int id);
 ncclResult_t ncclTopoConnectNodes(struct ncclTopoNode* node, struct ncclTopoNode* remNode, int type, float bw);
 ncclResult_t ncclTopoPrintPaths(struct ncclTopoSystem* system);
+ncclResult_t ncclTopoAllocPaths(struct ncclTopoSystem* system, int type, struct ncclTopoLinkList** paths);
+ncclResult_t ncclTopoInvalidatePaths(struct ncclTopoSystem* system, struct ncclTopoNode* delNode);
+ncclResult_t ncclTopoRebasePaths(struct ncclTopoSystem* system, int type, int index);
 ncclResult_t ncclTopoLoadSystem(const char* xmlTopoFile, struct ncclTopoSystem* system);
 ncclResult_t ncclTopoGetIntermediateRank(struct ncclTopoSystem* system, int rank, int netDev, int* intermediateRank);
 
@@ -91,6 +91,99 @@ static const double perChMaxTreeBws[3][3] = {
   /* Hopper (N1/N2/N4) */ {24.0, 23.6, 17.8},
 };
 
+// Tuning profile : one entry per line, '#' starts a comment.
+//   <coll> <algo> <proto> <minNodes> <maxNodes> <minBytes> <maxBytes> <latency (us)> <bandwidth (GB/s)>
+// coll, algo and proto can be '*' to match all, maxNodes and maxBytes can be '*' for no limit.
+// A bandwidth of 0 disables the algorithm/protocol for that range. Only the entries matching
+// the number of nodes are kept; when ranges overlap, the first entry in the file wins.
+static int tuningParseName(const char* str, const char* names[], int nNames, int* first, int* last) {
+  if (strcmp(str, "*") == 0) {
+    *first = 0; *last = nNames-1;
+    return 1;
+  }
+  for (int i=0; i<nNames; i++) {
+    if (strcasecmp(str, names[i]) == 0) {
+      *first = *last = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int tuningParseSize(const char* str, size_t* value) {
+  if (strcmp(str, "*") == 0) {
+    *value = SIZE_MAX;
+    return 1;
+  }
+  char* end;
+  *value = strtoull(str, &end, 0);
+  return end != str && *end == '\0';
+}
+
+static ncclResult_t tuningProfileAdd(struct ncclTuningProfile* profile, int c, int a, int p, struct ncclTuningBucket* bucket) {
+  int n = profile->nBuckets[c][a][p];
+  NCCLCHECK(ncclRealloc(profile->buckets[c][a]+p, n, n+1));
+  profile->buckets[c][a][p][n] = *bucket;
+  profile->nBuckets[c][a][p] = n+1;
+  return ncclSuccess;
+}
+
+static ncclResult_t tuningProfileLoad(const char* path, int nNodes, struct ncclTuningProfile* profile) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    WARN("Could not open tuning file %s : %s", path, strerror(errno));
+    return ncclSystemError;
+  }
+  ncclResult_t ret = ncclSuccess;
+  char line[1024];
+  int lineNum = 0, nEntries = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNum++;
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    char coll[32], algo[32], proto[32], minNodesStr[32], maxNodesStr[32], minBytesStr[32], maxBytesStr[32], extra[2];
+    struct ncclTuningBucket bucket;
+    int n = sscanf(line, "%31s %31s %31s %31s %31s %31s %31s %f %f %1s", coll, algo, proto,
+        minNodesStr, maxNodesStr, minBytesStr, maxBytesStr, &bucket.lat, &bucket.bw, extra);
+    if (n <= 0) continue; // Empty line
+    int c0, c1, a0, a1, p0, p1;
+    size_t minNodes, maxNodes;
+    if (n != 9 || bucket.lat < 0 || bucket.bw < 0 ||
+        !tuningParseName(coll, ncclFuncStr, NCCL_NUM_FUNCTIONS, &c0, &c1) ||
+        !tuningParseName(algo, ncclAlgoStr, NCCL_NUM_ALGORITHMS, &a0, &a1) ||
+        !tuningParseName(proto, ncclProtoStr, NCCL_NUM_PROTOCOLS, &p0, &p1) ||
+        !tuningParseSize(minNodesStr, &minNodes) || !tuningParseSize(maxNodesStr, &maxNodes) ||
+        !tuningParseSize(minBytesStr, &bucket.minBytes) || !tuningParseSize(maxBytesStr, &bucket.maxBytes)) {
+      WARN("Tuning file %s line %d : invalid entry", path, lineNum);
+      ret = ncclInvalidUsage;
+      goto exit;
+    }
+    if ((size_t)nNodes < minNodes || (size_t)nNodes > maxNodes) continue;
+    for (int c=c0; c<=c1; c++) for (int a=a0; a<=a1; a++) for (int p=p0; p<=p1; p++)
+      NCCLCHECKGOTO(tuningProfileAdd(profile, c, a, p, &bucket), ret, exit);
+    nEntries++;
+  }
+  INFO(NCCL_TUNING, "Loaded %d entries for %d nodes from tuning file %s", nEntries, nNodes, path);
+exit:
+  fclose(file);
+  return ret;
+}
+
+ncclResult_t ncclTopoTuningProfileFree(struct ncclTuningProfile* profile) {
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++)
+    free(profile->buckets[c][a][p]);
+  free(profile);
+  return ncclSuccess;
+}
+
+static struct ncclTuningBucket* tuningProfileGet(struct ncclTuningProfile* profile, int coll, int algorithm, int protocol, size_t nBytes) {
+  struct ncclTuningBucket* buckets = profile->buckets[coll][algorithm][protocol];
+  for (int b=0; b<profile->nBuckets[coll][algorithm][protocol]; b++) {
+    if (nBytes >= buckets[b].minBytes && nBytes <= buckets[b].maxBytes) return buckets+b;
+  }
+  return NULL;
+}
+
 ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCompCap, struct ncclTopoGraph* treeGraph, struct ncclTopoGraph* ringGraph, struct ncclTopoGraph* collNetGraph) {
   int simpleDefaultThreads = (ringGraph->bwIntra*ringGraph->nChannels <= PCI_BW) ? 256 : NCCL_SIMPLE_MAX_NTHREADS;
   comm->maxThreads[NCCL_ALGO_RING][NCCL_PROTO_SIMPLE] =
@@ -243,6 +336,19 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
     if (c == ncclFuncAllReduce && algoEnable[a] == 0) comm->bandwidths[c][a][p] = 0;
   }
 
+  const char* tuningFile = getenv("NCCL_TUNING_FILE");
+  if (tuningFile) {
+    INFO(NCCL_ENV, "NCCL_TUNING_FILE set by environment to %s", tuningFile);
+    struct ncclTuningProfile* profile;
+    NCCLCHECK(ncclCalloc(&profile, 1));
+    ncclResult_t ret = tuningProfileLoad(tuningFile, nNodes, profile);
+    if (ret != ncclSuccess) {
+      ncclTopoTuningProfileFree(profile);
+      return ret;
+    }
+    comm->tuningProfile = profile;
+  }
+
   if (comm->rank == 0) {
     char line[1024];
     sprintf(line, "Latency/AlgBw |");
@@ -319,13 +425,172 @@ ncclResult_t ncclTopoGetAlgoTime(struct ncclInfo* info, int algorithm, int proto
   if (bw == 0) {
     *time = -1.0; return ncclSuccess;
   }
-  int logSize = log2i(info->nBytes>>6);
-  if (algorithm == NCCL_ALGO_TREE && logSize < 23) bw *= treeCorrectionFactor[protocol][logSize];
+  struct ncclTuningBucket* bucket = info->comm->tuningProfile ?
+    tuningProfileGet(info->comm->tuningProfile, info->coll, algorithm, protocol, info->nBytes) : NULL;
+  if (bucket) {
+    // Measured values already account for the tree correction and ring plateau
+    if (bucket->bw == 0) {
+      *time = -1.0; return ncclSuccess;
+    }
+    bw = bucket->bw;
+    lat = bucket->lat;
+  } else {
+    int logSize = log2i(info->nBytes>>6);
+    if (algorithm == NCCL_ALGO_TREE && logSize < 23) bw *= treeCorrectionFactor[protocol][logSize];
+    if (algorithm == NCCL_ALGO_RING && protocol == NCCL_PROTO_SIMPLE && info->comm->nNodes > 1
+        && info->coll == ncclFuncAllReduce && info->nBytes >= info->comm->nRanks/16.0*65536) lat *= 1.9; // Plateau effect of ring
+  }
   if (info->nChannels != 0) bw = bw / info->comm->nChannels * info->nChannels;
-  if (algorithm == NCCL_ALGO_RING && protocol == NCCL_PROTO_SIMPLE && info->comm->nNodes > 1
-      && info->coll == ncclFuncAllReduce && info->nBytes >= info->comm->nRanks/16.0*65536) lat *= 1.9; // Plateau effect of ring
   // Tree pipelining saves latency in aggregation cases
   int latCount = algorithm == NCCL_ALGO_RING ? numPipeOps : DIVUP(numPipeOps, NCCL_MAX_WORK_ELEMENTS);
   *time = lat * latCount + (info->nBytes) / (1000 * bw);
   return ncclSuccess;
 }
+
+// numPipeOps: number of pipelined ops. Can be greater than 1 in aggregation mode. Used to adjust latency.
+static ncclResult_t computeAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps) {
+  struct ncclComm* comm = info->comm;
+  if (comm->nRanks == 1) {
+    info->algorithm = NCCL_ALGO_RING;
+    info->protocol = NCCL_PROTO_SIMPLE;
+  }
+  else {
+    float minTime = 3600000000.0; // Hopefully no operation will take an hour to complete.
+    // Find algorithm / protocol.
+    info->algorithm = -1;
+    info->protocol = -1;
+    int nAlgos = NCCL_NUM_ALGORITHMS;
+    for (int a=0; a<nAlgos; a++) {
+      if ((a == NCCL_ALGO_COLLNET_DIRECT || a == NCCL_ALGO_COLLNET_CHAIN) && collNetTypeSupport != 1) continue;
+      for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+        float time;
+        NCCLCHECK(ncclTopoGetAlgoTime(info, a, p, numPipeOps, &time));
+        if (time >= 0 && time < minTime) {
+          info->algorithm = a;
+          info->protocol = p;
+          minTime = time;
+        }
+      }
+    }
+    // No algorithm fits, the caller decides whether it is an error
+    if (info->algorithm == -1 || info->protocol == -1) return ncclSuccess;
+    //if (comm->rank == 0) INFO(NCCL_TUNING, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
+    TRACE(NCCL_COLL, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
+  }
+  return ncclTopoGetAlgoThreads(info);
+}
+
+ncclResult_t ncclTopoGetAlgoThreads(struct ncclInfo* info) {
+  struct ncclComm* comm = info->comm;
+  int nc = (info->nChannels > 0) ? info->nChannels : comm->nChannels;
+  int nt = comm->maxThreads[info->algorithm][info->protocol];
+  int threadThreshold = comm->threadThresholds[info->algorithm][info->protocol];
+  if (info->algorithm == NCCL_ALGO_COLLNET_DIRECT) {
+    // CollNet channel tuning
+    int ncSwitch = 16;
+    bool flag = true;
+    while (ncSwitch >= 1 && flag) {
+      while ((flag = info->nBytes < nc*nt*info->comm->channels[0].collnetDirect.nHeads*threadThreshold) && nc > ncSwitch) {
+        if (nc == ncSwitch+ncSwitch/2) threadThreshold /= 2;
+        nc--;
+      }
+      ncSwitch /= 2;
+    }
+  } else {
+    // Ring/Tree channel tuning
+    while (info->nBytes < nc*nt*threadThreshold) {
+      if (nc >= 2) nc--;
+      else if ((nt % 128) == 0) nt/=2;
+      else break;
+    }
+  }
+  if (info->protocol == NCCL_PROTO_SIMPLE) {
+    nt += WARP_SIZE; // Extra warp for sync
+    // More threads or sync warps needed due to split thread model
+    if (info->algorithm == NCCL_ALGO_TREE) nt += 3*WARP_SIZE;
+    if (info->algorithm == NCCL_ALGO_COLLNET_DIRECT) nt += 3*WARP_SIZE;
+    if (info->algorithm == NCCL_ALGO_COLLNET_CHAIN) nt += 3*WARP_SIZE;
+  }
+  nt = nt/WARP_SIZE < 3 ? 3*WARP_SIZE : nt;
+  info->nChannels = nc;
+  info->nThreads = nt;
+  return ncclSuccess;
+}
+
+// Whether the times computed by ncclTopoGetAlgoTime are linear in nBytes over [minBytes, maxBytes],
+// i.e. no correction factor, plateau or tuning profile range changes within it.
+static int algoTimeLinear(struct ncclComm* comm, int coll, size_t minBytes, size_t maxBytes) {
+  if (log2i(minBytes>>6) != log2i(maxBytes>>6)) return 0;
+  if (coll == ncclFuncAllReduce && comm->nNodes > 1) {
+    double plateau = comm->nRanks/16.0*65536;
+    if (minBytes < plateau && maxBytes >= plateau) return 0;
+  }
+  struct ncclTuningProfile* profile = comm->tuningProfile;
+  if (profile == NULL) return 1;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+    for (int b=0; b<profile->nBuckets[coll][a][p]; b++) {
+      struct ncclTuningBucket* bucket = profile->buckets[coll][a][p]+b;
+      if (bucket->minBytes > minBytes && bucket->minBytes <= maxBytes) return 0;
+      if (bucket->maxBytes >= minBytes && bucket->maxBytes < maxBytes) return 0;
+    }
+  }
+  return 1;
+}
+
+// Precompute the choice of getAlgoInfo for each power-of-two size range. Within a range
+// where all times are linear, the fastest algorithm/protocol is the same over the whole
+// range if it is the same at both ends, and nChannels/nThreads only grow with the size,
+// so a range is only kept when both ends agree.
+ncclResult_t ncclTopoInitAlgoTable(struct ncclComm* comm) {
+  int nValid = 0, nRanges = 0;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (int collNet=0; collNet<2; collNet++) {
+      for (int b=0; b<NCCL_ALGO_TABLE_BUCKETS; b++) {
+        struct ncclAlgoDecision* decision = comm->algoTable[c][collNet]+b;
+        decision->valid = 0;
+        if (collNet && comm->collNetSupport <= 0) continue;
+        nRanges++;
+        size_t minBytes = b == 0 ? 0 : 1UL<<b;
+        size_t maxBytes = b == NCCL_ALGO_TABLE_BUCKETS-1 ? SIZE_MAX : (2UL<<b)-1;
+        if (!algoTimeLinear(comm, c, minBytes, maxBytes)) continue;
+        struct ncclInfo lo = {}, hi = {};
+        lo.comm = hi.comm = comm;
+        lo.coll = hi.coll = (ncclFunc_t)c;
+        lo.nBytes = minBytes;
+        hi.nBytes = maxBytes;
+        NCCLCHECK(computeAlgoInfo(&lo, collNet, 1));
+        NCCLCHECK(computeAlgoInfo(&hi, collNet, 1));
+        if (lo.algorithm == -1 || lo.algorithm != hi.algorithm || lo.protocol != hi.protocol ||
+            lo.nChannels != hi.nChannels || lo.nThreads != hi.nThreads) continue;
+        decision->algorithm = lo.algorithm;
+        decision->protocol = lo.protocol;
+        decision->nChannels = lo.nChannels;
+        decision->nThreads = lo.nThreads;
+        decision->valid = 1;
+        nValid++;
+      }
+    }
+  }
+  INFO(NCCL_TUNING, "Algorithm table : %d/%d size ranges precomputed", nValid, nRanges);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTopoGetAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps) {
+  // Aggregated operations and preset channel counts change the times, use the full search
+  if (numPipeOps == 1 && info->nChannels == 0) {
+    struct ncclAlgoDecision* decision = info->comm->algoTable[info->coll][collNetTypeSupport == 1 ? 1 : 0]+log2i(info->nBytes);
+    if (decision->valid) {
+      info->algorithm = decision->algorithm;
+      info->protocol = decision->protocol;
+      info->nChannels = decision->nChannels;
+      info->nThreads = decision->nThreads;
+      return ncclSuccess;
+    }
+  }
+  NCCLCHECK(computeAlgoInfo(info, collNetTypeSupport, numPipeOps));
+  if (info->algorithm == -1 || info->protocol == -1) {
+    WARN("Error : no algorithm/protocol available");
+    return ncclInternalError;
+  }
+  return ncclSuccess;
+}
@@ -9,80 +9,350 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <sys/mman.h>
 #include "core.h"
 #include "nvmlwrap.h"
 #include "xml.h"
 
+/***************/
+/* XML Storage */
+/***************/
+
+#define XML_ARENA_CHUNK_SIZE 16384
+
+ncclResult_t xmlArenaAlloc(struct ncclXml* xml, size_t size, void** ptr) {
+  size = (size+7) & ~((size_t)7);
+  struct ncclXmlArenaChunk* chunk = xml->arena;
+  if (chunk == NULL || chunk->used+size > chunk->size) {
+    size_t chunkSize = size > XML_ARENA_CHUNK_SIZE ? size : XML_ARENA_CHUNK_SIZE;
+    char* mem;
+    NCCLCHECK(ncclCalloc(&mem, sizeof(struct ncclXmlArenaChunk)+chunkSize));
+    chunk = (struct ncclXmlArenaChunk*)mem;
+    chunk->size = chunkSize;
+    chunk->used = 0;
+    chunk->next = xml->arena;
+    xml->arena = chunk;
+  }
+  *ptr = ((char*)(chunk+1))+chunk->used;
+  chunk->used += size;
+  return ncclSuccess;
+}
+
+static uint32_t xmlHash(const char* str) {
+  uint32_t h = 2166136261u;
+  for (int i=0; i<MAX_STR_LEN && str[i]; i++) h = (h ^ (uint8_t)str[i]) * 16777619u;
+  return h;
+}
+
+ncclResult_t xmlIntern(struct ncclXml* xml, const char* str, const char** interned) {
+  // Open addressing, kept at most half full
+  if (2*(xml->nStrings+1) > xml->maxStrings) {
+    int maxStrings = xml->maxStrings ? 2*xml->maxStrings : 128;
+    const char** strings;
+    NCCLCHECK(ncclCalloc(&strings, maxStrings));
+    for (int i=0; i<xml->maxStrings; i++) {
+      if (xml->strings[i] == NULL) continue;
+      uint32_t h = xmlHash(xml->strings[i]) & (maxStrings-1);
+      while (strings[h]) h = (h+1) & (maxStrings-1);
+      strings[h] = xml->strings[i];
+    }
+    free(xml->strings);
+    xml->strings = strings;
+    xml->maxStrings = maxStrings;
+  }
+  uint32_t h = xmlHash(str) & (xml->maxStrings-1);
+  while (xml->strings[h]) {
+    if (strncmp(xml->strings[h], str, MAX_STR_LEN) == 0) {
+      *interned = xml->strings[h];
+      return ncclSuccess;
+    }
+    h = (h+1) & (xml->maxStrings-1);
+  }
+  size_t len = strnlen(str, MAX_STR_LEN);
+  char* copy;
+  NCCLCHECK(xmlArenaAlloc(xml, len+1, (void**)&copy));
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  xml->strings[h] = copy;
+  xml->nStrings++;
+  *interned = copy;
+  return ncclSuccess;
+}
+
+ncclResult_t xmlAppendAttr(struct ncclXmlNode* node, const char* attrName, int* index) {
+  if (node->nAttrs == node->maxAttrs) {
+    int maxAttrs = node->maxAttrs ? 2*node->maxAttrs : 4;
+    struct ncclXmlAttr* attrs;
+    NCCLCHECK(xmlArenaAlloc(node->xml, maxAttrs*sizeof(struct ncclXmlAttr), (void**)&attrs));
+    if (node->nAttrs) memcpy(attrs, node->attrs, node->nAttrs*sizeof(struct ncclXmlAttr));
+    node->attrs = attrs;
+    node->maxAttrs = maxAttrs;
+  }
+  struct ncclXmlAttr* attr = node->attrs+node->nAttrs;
+  NCCLCHECK(xmlIntern(node->xml, attrName, &attr->key));
+  // The slot may still alias a value buffer shifted down by xmlUnsetAttr
+  attr->value = NULL;
+  attr->valueSize = 0;
+  *index = node->nAttrs++;
+  return ncclSuccess;
+}
+
+ncclResult_t xmlSetAttrValue(struct ncclXmlNode* node, int index, const char* value) {
+  struct ncclXmlAttr* attr = node->attrs+index;
+  int len = strnlen(value, MAX_STR_LEN);
+  if (len+1 > attr->valueSize) {
+    // Round up small values so that most updates can be done in place
+    int size = len+1 < 16 ? 16 : len+1;
+    NCCLCHECK(xmlArenaAlloc(node->xml, size, (void**)&attr->value));
+    attr->valueSize = size;
+  }
+  memmove(attr->value, value, len);
+  attr->value[len] = '\0';
+  return ncclSuccess;
+}
+
+// Get a node which is not part of the tree yet. The parser reuses it until
+// it gets linked, so that closing tags don't consume arena space.
+static ncclResult_t xmlNodeAlloc(struct ncclXml* xml, struct ncclXmlNode** node) {
+  struct ncclXmlNode* n = xml->spare;
+  if (n == NULL) {
+    NCCLCHECK(xmlArenaAlloc(xml, sizeof(struct ncclXmlNode), (void**)&n));
+    n->xml = xml;
+    xml->spare = n;
+  }
+  n->name = NULL;
+  n->nAttrs = 0;
+  n->nSubs = 0;
+  n->type = NODE_TYPE_NONE;
+  n->parent = NULL;
+  *node = n;
+  return ncclSuccess;
+}
+
+// Append node to the subs of parent, growing them in the arena
+static ncclResult_t xmlAddSub(struct ncclXml* xml, struct ncclXmlNode* parent, struct ncclXmlNode* node) {
+  if (parent->nSubs == parent->maxSubs) {
+    int maxSubs = parent->maxSubs ? 2*parent->maxSubs : 4;
+    struct ncclXmlNode** subs;
+    NCCLCHECK(xmlArenaAlloc(xml, maxSubs*sizeof(struct ncclXmlNode*), (void**)&subs));
+    if (parent->nSubs) memcpy(subs, parent->subs, parent->nSubs*sizeof(struct ncclXmlNode*));
+    parent->subs = subs;
+    parent->maxSubs = maxSubs;
+  }
+  parent->subs[parent->nSubs++] = node;
+  node->parent = parent;
+  return ncclSuccess;
+}
+
+static ncclResult_t xmlLinkNode(struct ncclXml* xml, struct ncclXmlNode* parent, struct ncclXmlNode* node) {
+  if (xml->spare == node) xml->spare = NULL;
+  if (xml->maxIndex == xml->maxNodes) {
+    int maxNodes = xml->maxNodes ? 2*xml->maxNodes : 64;
+    if (xml->nodes == NULL) {
+      NCCLCHECK(ncclCalloc(&xml->nodes, maxNodes));
+    } else {
+      NCCLCHECK(ncclRealloc(&xml->nodes, xml->maxNodes, maxNodes));
+    }
+    xml->maxNodes = maxNodes;
+  }
+  xml->nodes[xml->maxIndex++] = node;
+  node->parent = parent;
+  if (parent == NULL) return ncclSuccess;
+  return xmlAddSub(xml, parent, node);
+}
+
+ncclResult_t xmlAddNode(struct ncclXml* xml, struct ncclXmlNode* parent, const char* subName, struct ncclXmlNode** sub) {
+  struct ncclXmlNode* s;
+  NCCLCHECK(xmlNodeAlloc(xml, &s));
+  NCCLCHECK(xmlIntern(xml, subName, &s->name));
+  NCCLCHECK(xmlLinkNode(xml, parent, s));
+  *sub = s;
+  return ncclSuccess;
+}
+
+ncclResult_t xmlFree(struct ncclXml* xml) {
+  if (xml == NULL) return ncclSuccess;
+  struct ncclXmlArenaChunk* chunk = xml->arena;
+  while (chunk) {
+    struct ncclXmlArenaChunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(xml->nodes);
+  free(xml->strings);
+  free(xml);
+  return ncclSuccess;
+}
+
 /*******************/
 /* XML File Parser */
 /*******************/
 
-ncclResult_t xmlGetChar(FILE* file, char* c) {
-  if (fread(c, 1, 1, file) == 0) {
-    WARN("XML Parse : Unexpected EOF");
+// The whole file is mapped (or read) in memory and tokenized from there.
+// The current line and column are tracked for error messages.
+struct xmlReader {
+  const char* fileName;
+  char* data;
+  size_t size;
+  size_t pos;
+  int line;
+  int col;
+  int mapped;
+};
+
+#define XML_PARSE_WARN(reader, fmt, ...) \
+  WARN("XML Parse error at %s:%d:%d : " fmt, (reader)->fileName, (reader)->line, (reader)->col, ##__VA_ARGS__)
+
+static void xmlReaderClose(struct xmlReader* reader) {
+  if (reader->mapped) munmap(reader->data, reader->size);
+  else free(reader->data);
+  reader->data = NULL;
+}
+
+// Returns ncclSystemError with errno set if the file can't be opened.
+static ncclResult_t xmlReaderOpen(const char* fileName, struct xmlReader* reader) {
+  ncclResult_t ret = ncclSuccess;
+  size_t maxSize = 0;
+  memset(reader, 0, sizeof(struct xmlReader));
+  reader->fileName = fileName;
+  reader->line = reader->col = 1;
+  int fd = open(fileName, O_RDONLY);
+  if (fd == -1) return ncclSystemError;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      reader->data = (char*)data;
+      reader->size = st.st_size;
+      reader->mapped = 1;
+      close(fd);
+      return ncclSuccess;
+    }
+  }
+  // Not a regular file, or mmap failed : read it whole
+  while (1) {
+    if (reader->size == maxSize) {
+      size_t newSize = maxSize ? 2*maxSize : 1<<16;
+      if (maxSize == 0) {
+        NCCLCHECKGOTO(ncclCalloc(&reader->data, newSize), ret, fail);
+      } else {
+        NCCLCHECKGOTO(ncclRealloc(&reader->data, maxSize, newSize), ret, fail);
+      }
+      maxSize = newSize;
+    }
+    ssize_t n = read(fd, reader->data+reader->size, maxSize-reader->size);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) {
+      WARN("Could not read XML file %s : %s", fileName, strerror(errno));
+      ret = ncclSystemError;
+      goto fail;
+    }
+    if (n == 0) break;
+    reader->size += n;
+  }
+  close(fd);
+  return ncclSuccess;
+fail:
+  close(fd);
+  xmlReaderClose(reader);
+  return ret;
+}
+
+static void xmlAdvance(struct xmlReader* reader, size_t n) {
+  for (size_t i=0; i<n; i++) {
+    if (reader->data[reader->pos++] == '\n') {
+      reader->line++;
+      reader->col = 1;
+    } else {
+      reader->col++;
+    }
+  }
+}
+
+static ncclResult_t xmlGetChar(struct xmlReader* reader, char* c) {
+  if (reader->pos == reader->size) {
+    XML_PARSE_WARN(reader, "unexpected EOF");
     return ncclInternalError;
   }
+  *c = reader->data[reader->pos];
+  xmlAdvance(reader, 1);
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetValue(FILE* file, char* value, char* last) {
+static ncclResult_t xmlGetValue(struct xmlReader* reader, char* value, char* last) {
   char c;
-  NCCLCHECK(xmlGetChar(file, &c));
+  NCCLCHECK(xmlGetChar(reader, &c));
   if (c != '"' && c != '\'') {
 #if INT_OK
     int o = 0;
     do {
+      if (o == MAX_STR_LEN) {
+        XML_PARSE_WARN(reader, "value too long (max %d)", MAX_STR_LEN);
+        return ncclInternalError;
+      }
       value[o++] = c;
-      NCCLCHECK(xmlGetChar(file, &c));
+      NCCLCHECK(xmlGetChar(reader, &c));
     } while (c >= '0' && c <= '9');
     value[o] = '\0';
     *last = c;
     return ncclSuccess;
 #else
-    WARN("XML Parse : Expected (double) quote.");
+    XML_PARSE_WARN(reader, "expected (double) quote");
     return ncclInternalError;
 #endif
   }
-  int o = 0;
-  do {
-    NCCLCHECK(xmlGetChar(file, &c));
-    value[o++] = c;
-  } while (c != '"');
-  value[o-1] = '\0';
-  NCCLCHECK(xmlGetChar(file, last));
+  const char* start = reader->data+reader->pos;
+  const char* end = (const char*)memchr(start, '"', reader->size-reader->pos);
+  if (end == NULL) {
+    XML_PARSE_WARN(reader, "unterminated value");
+    return ncclInternalError;
+  }
+  size_t len = end-start;
+  if (len > MAX_STR_LEN) {
+    XML_PARSE_WARN(reader, "value too long (max %d)", MAX_STR_LEN);
+    return ncclInternalError;
+  }
+  memcpy(value, start, len);
+  value[len] = '\0';
+  xmlAdvance(reader, len+1);
+  NCCLCHECK(xmlGetChar(reader, last));
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetToken(FILE* file, char* name, char* value, char* last) {
+// Read a name up to a separator. If the separator is '=', read the value
+// that follows and return the character after it in *last.
+static ncclResult_t xmlGetToken(struct xmlReader* reader, char* name, char* value, char* last) {
+  size_t len = 0;
+  const char* start = reader->data+reader->pos;
+  size_t avail = reader->size-reader->pos;
+  while (len < avail) {
+    char c = start[len];
+    if (c == '=' || c == ' ' || c == '>' || c == '/' || c == '\n' || c == '\r') break;
+    len++;
+  }
+  if (len > MAX_STR_LEN) {
+    XML_PARSE_WARN(reader, "name %.*s... too long (max %d)", 32, start, MAX_STR_LEN);
+    return ncclInternalError;
+  }
+  memcpy(name, start, len);
+  name[len] = '\0';
+  xmlAdvance(reader, len);
   char c;
-  char* ptr = name;
-  int o = 0;
-  do {
-    NCCLCHECK(xmlGetChar(file, &c));
-    if (c == '=') {
-      ptr[o] = '\0';
-      if (value == NULL) {
-        WARN("XML Parse : Unexpected value with name %s", ptr);
-        return ncclInternalError;
-      }
-      return xmlGetValue(file, value, last);
-    }
-    ptr[o] = c;
-    if (o == MAX_STR_LEN-1) {
-      ptr[o] = '\0';
-      WARN("Error : name %s too long (max %d)", ptr, MAX_STR_LEN);
+  NCCLCHECK(xmlGetChar(reader, &c));
+  if (c == '=') {
+    if (value == NULL) {
+      XML_PARSE_WARN(reader, "unexpected value with name %s", name);
       return ncclInternalError;
     }
-    o++;
-  } while (c != ' ' && c != '>' && c != '/' && c != '\n' && c != '\r');
-  ptr[o-1] = '\0';
+    return xmlGetValue(reader, value, last);
+  }
   *last = c;
   return ncclSuccess;
 }
 
 // Shift the 3-chars string by one char and append c at the end
 #define SHIFT_APPEND(s, c) do { s[0]=s[1]; s[1]=s[2]; s[2]=c; } while(0)
-ncclResult_t xmlSkipComment(FILE* file, char* start, char next) {
+static ncclResult_t xmlSkipComment(struct xmlReader* reader, char* start, char next) {
   // Start from something neutral with \0 at the end.
   char end[4] = "...";
 
@@ -93,91 +363,94 @@ ncclResult_t xmlSkipComment(FILE* file, char* start, char next) {
 
   // Stop when we find "-->"
   while (strcmp(end, "-->") != 0) {
-    int c;
-    if (fread(&c, 1, 1, file) != 1) {
-      WARN("XML Parse error : unterminated comment");
+    char c;
+    if (reader->pos == reader->size) {
+      XML_PARSE_WARN(reader, "unterminated comment");
       return ncclInternalError;
     }
+    NCCLCHECK(xmlGetChar(reader, &c));
     SHIFT_APPEND(end, c);
   }
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
+static ncclResult_t xmlGetNode(struct xmlReader* reader, struct ncclXmlNode* node) {
   node->type = NODE_TYPE_NONE;
   char c = ' ';
   while (c == ' ' || c == '\n' || c == '\r') {
-    if (fread(&c, 1, 1, file) == 0) return ncclSuccess;
+    if (reader->pos == reader->size) return ncclSuccess;
+    NCCLCHECK(xmlGetChar(reader, &c));
   }
   if (c != '<') {
-    WARN("XML Parse error : expecting '<', got '%c'", c);
+    XML_PARSE_WARN(reader, "expecting '<', got '%c'", c);
     return ncclInternalError;
   }
   // Read XML element name
-  NCCLCHECK(xmlGetToken(file, node->name, NULL, &c));
+  char name[MAX_STR_LEN+1];
+  NCCLCHECK(xmlGetToken(reader, name, NULL, &c));
 
   // Check for comments
-  if (strncmp(node->name, "!--", 3) == 0) {
-    NCCLCHECK(xmlSkipComment(file, node->name+3, c));
-    return xmlGetNode(file, node);
+  if (strncmp(name, "!--", 3) == 0) {
+    NCCLCHECK(xmlSkipComment(reader, name+3, c));
+    return xmlGetNode(reader, node);
   }
 
   // Check for closing tag
-  if (node->name[0] == '\0' && c == '/') {
+  if (name[0] == '\0' && c == '/') {
     node->type = NODE_TYPE_CLOSE;
     // Re-read the name, we got '/' in the first call
-    NCCLCHECK(xmlGetToken(file, node->name, NULL, &c));
+    NCCLCHECK(xmlGetToken(reader, name, NULL, &c));
     if (c != '>') {
-      WARN("XML Parse error : unexpected trailing %c in closing tag %s", c, node->name);
+      XML_PARSE_WARN(reader, "unexpected trailing %c in closing tag %s", c, name);
       return ncclInternalError;
     }
+    NCCLCHECK(xmlIntern(node->xml, name, &node->name));
     return ncclSuccess;
   }
 
   node->type = NODE_TYPE_OPEN;
+  NCCLCHECK(xmlIntern(node->xml, name, &node->name));
 
   // Get Attributes
-  int a = 0;
   while (c == ' ') {
-    NCCLCHECK(xmlGetToken(file, node->attrs[a].key, node->attrs[a].value, &c));
-    if (a == MAX_ATTR_COUNT) {
-      INFO(NCCL_GRAPH, "XML Parse : Ignoring extra attributes (max %d)", MAX_ATTR_COUNT);
-      // Actually we need to still consume the extra attributes so we have an extra one.
-    } else a++;
+    char key[MAX_STR_LEN+1];
+    char value[MAX_STR_LEN+1];
+    value[0] = '\0';
+    NCCLCHECK(xmlGetToken(reader, key, value, &c));
+    // Skip empty tokens, e.g. the space in <node attr="x" />
+    if (key[0] == '\0') continue;
+    int index;
+    NCCLCHECK(xmlAppendAttr(node, key, &index));
+    NCCLCHECK(xmlSetAttrValue(node, index, value));
   }
-  node->nAttrs = a;
   if (c == '/') {
     node->type = NODE_TYPE_SINGLE;
-    char str[MAX_STR_LEN];
-    NCCLCHECK(xmlGetToken(file, str, NULL, &c));
+    char str[MAX_STR_LEN+1];
+    NCCLCHECK(xmlGetToken(reader, str, NULL, &c));
   }
   if (c != '>') {
-    WARN("XML Parse : expected >, got '%c'", c);
+    XML_PARSE_WARN(reader, "expected >, got '%c'", c);
     return ncclInternalError;
   }
   return ncclSuccess;
 }
 
-typedef ncclResult_t (*xmlHandlerFunc_t)(FILE*, struct ncclXml*, struct ncclXmlNode*);
+typedef ncclResult_t (*xmlHandlerFunc_t)(struct xmlReader*, struct ncclXml*, struct ncclXmlNode*);
 
 struct xmlHandler {
   const char * name;
   xmlHandlerFunc_t func;
 };
 
-ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head, struct xmlHandler handlers[], int nHandlers) {
+static ncclResult_t xmlLoadSub(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head, struct xmlHandler handlers[], int nHandlers) {
   if (head && head->type == NODE_TYPE_SINGLE) return ncclSuccess;
   while (1) {
-    if (xml->maxIndex == MAX_NODES) {
-      WARN("Error : XML parser is limited to 1024 nodes");
-      return ncclInternalError;
-    }
-    struct ncclXmlNode* node = xml->nodes+xml->maxIndex;
-    memset(node, 0, sizeof(struct ncclXmlNode));
-    NCCLCHECK(xmlGetNode(file, node));
+    struct ncclXmlNode* node;
+    NCCLCHECK(xmlNodeAlloc(xml, &node));
+    NCCLCHECK(xmlGetNode(reader, node));
     if (node->type == NODE_TYPE_NONE) {
       if (head) {
-        WARN("XML Parse : unterminated %s", head->name);
+        XML_PARSE_WARN(reader, "unterminated %s", head->name);
         return ncclInternalError;
       } else {
         // All done
@@ -186,7 +459,7 @@ ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* hea
     }
     if (head && node->type == NODE_TYPE_CLOSE) {
       if (strcmp(node->name, head->name) != 0) {
-        WARN("XML Mismatch : %s / %s", head->name, node->name);
+        XML_PARSE_WARN(reader, "mismatch %s / %s", head->name, node->name);
         return ncclInternalError;
       }
       return ncclSuccess;
@@ -194,18 +467,17 @@ ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* hea
     int found = 0;
     for (int h=0; h<nHandlers; h++) {
       if (strcmp(node->name, handlers[h].name) == 0) {
-        if (head) head->subs[head->nSubs++] = node;
-        node->parent = head;
-        node->nSubs = 0;
-        xml->maxIndex++;
-        NCCLCHECK(handlers[h].func(file, xml, node));
+        NCCLCHECK(xmlLinkNode(xml, head, node));
+        NCCLCHECK(handlers[h].func(reader, xml, node));
         found = 1;
         break;
       }
     }
     if (!found) {
       if (nHandlers) INFO(NCCL_GRAPH, "Ignoring element %s", node->name);
-      NCCLCHECK(xmlLoadSub(file, xml, node, NULL, 0));
+      // The ignored element is the head of its own parse, keep it aside
+      xml->spare = NULL;
+      NCCLCHECK(xmlLoadSub(reader, xml, node, NULL, 0));
     }
   }
 }
@@ -214,34 +486,53 @@ ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* hea
 /* XML Writer */
 /**************/
 
+static void xmlIndent(int indent, FILE* file) {
+  static const char spaces[] = "                                ";
+  while (indent > 0) {
+    int n = indent < (int)sizeof(spaces)-1 ? indent : (int)sizeof(spaces)-1;
+    fwrite(spaces, 1, n, file);
+    indent -= n;
+  }
+}
+
 ncclResult_t ncclTopoDumpXmlRec(int indent, FILE* file, struct ncclXmlNode* node) {
-  for (int i=0; i<indent; i++) fprintf(file, " ");
-  fprintf(file, "<%s", node->name);
+  xmlIndent(indent, file);
+  fputc('<', file);
+  fputs(node->name, file);
 
   for (int a=0; a<node->nAttrs; a++) {
-    fprintf(file, " %s=\"%s\"", node->attrs[a].key, node->attrs[a].value);
+    fputc(' ', file);
+    fputs(node->attrs[a].key, file);
+    fputs("=\"", file);
+    fputs(node->attrs[a].value, file);
+    fputc('"', file);
   }
   if (node->nSubs == 0) {
-    fprintf(file, "/>\n");
+    fputs("/>\n", file);
   } else {
-    fprintf(file, ">\n");
+    fputs(">\n", file);
     for (int s=0; s<node->nSubs; s++) {
       NCCLCHECK(ncclTopoDumpXmlRec(indent+2, file, node->subs[s]));
     }
-    for (int i=0; i<indent; i++) fprintf(file, " ");
-    fprintf(file, "</%s>\n", node->name);
+    xmlIndent(indent, file);
+    fputs("</", file);
+    fputs(node->name, file);
+    fputs(">\n", file);
   }
   return ncclSuccess;
 }
 
 ncclResult_t ncclTopoDumpXmlToFile(const char* xmlTopoFile, struct ncclXml* xml) {
+  if (xml->maxIndex == 0) return ncclSuccess;
   FILE* file = fopen(xmlTopoFile, "w");
   if (file == NULL) {
     WARN("Unable to open %s, not dumping topology.", xmlTopoFile);
     return ncclSuccess;
   }
-  NCCLCHECK(ncclTopoDumpXmlRec(0, file, xml->nodes));
-  fclose(file);
+  // Write the whole tree with a few large writes
+  setvbuf(file, NULL, _IOFBF, 1<<16);
+  NCCLCHECK(ncclTopoDumpXmlRec(0, file, xml->nodes[0]));
+  if (fclose(file) != 0) WARN("Error writing topology to %s : %s", xmlTopoFile, strerror(errno));
   return ncclSuccess;
 }
 
@@ -249,41 +540,41 @@ ncclResult_t ncclTopoDumpXmlToFile(const char* xmlTopoFile, struct ncclXml* xml)
 /* Parser rules for our specific format */
 /****************************************/
 
-ncclResult_t ncclTopoXmlLoadNvlink(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlLoadNvlink(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadGpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadGpu(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "nvlink", ncclTopoXmlLoadNvlink } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadNet(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlLoadNet(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadNic(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadNic(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "net", ncclTopoXmlLoadNet } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadPci(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadPci(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "pci", ncclTopoXmlLoadPci }, { "gpu", ncclTopoXmlLoadGpu }, { "nic", ncclTopoXmlLoadNic} };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 3));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 3));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadCpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadCpu(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "pci", ncclTopoXmlLoadPci }, { "nic", ncclTopoXmlLoadNic } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 2));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 2));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadSystem(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadSystem(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   int version;
   NCCLCHECK(xmlGetAttrInt(head, "version", &version));
   if (version != NCCL_TOPO_XML_VERSION) {
@@ -296,13 +587,14 @@ ncclResult_t ncclTopoXmlLoadSystem(FILE* file, struct ncclXml* xml, struct ncclX
   else INFO(NCCL_GRAPH, "Loading unnamed topology");
 
   struct xmlHandler handlers[] = { { "cpu", ncclTopoXmlLoadCpu } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
 ncclResult_t ncclTopoGetXmlFromFile(const char* xmlTopoFile, struct ncclXml* xml, int warn) {
-  FILE* file = fopen(xmlTopoFile, "r");
-  if (file == NULL) {
+  struct xmlReader reader;
+  ncclResult_t ret = ncclSuccess;
+  if (xmlReaderOpen(xmlTopoFile, &reader) != ncclSuccess) {
     if (warn) {
       WARN("Could not open XML topology file %s : %s", xmlTopoFile, strerror(errno));
     }
@@ -311,9 +603,10 @@ ncclResult_t ncclTopoGetXmlFromFile(const char* xmlTopoFile, struct ncclXml* xml
   INFO(NCCL_GRAPH, "Loading topology file %s", xmlTopoFile);
   struct xmlHandler handlers[] = { { "system", ncclTopoXmlLoadSystem } };
   xml->maxIndex = 0;
-  NCCLCHECK(xmlLoadSub(file, xml, NULL, handlers, 1));
-  fclose(file);
-  return ncclSuccess;
+  NCCLCHECKGOTO(xmlLoadSub(&reader, xml, NULL, handlers, 1), ret, exit);
+exit:
+  xmlReaderClose(&reader);
+  return ret;
 }
 
 /**********************/
@@ -575,8 +868,7 @@ ncclResult_t ncclTopoGetXmlFromSys(struct ncclXmlNode* pciNode, struct ncclXml*
         NCCLCHECK(ncclTopoGetXmlFromCpu(parent, xml));
       }
     }
-    pciNode->parent = parent;
-    parent->subs[parent->nSubs++] = pciNode;
+    NCCLCHECK(xmlAddSub(xml, parent, pciNode));
   }
   if (strcmp(parent->name, "pci") == 0) {
     NCCLCHECK(ncclTopoGetXmlFromSys(parent, xml));
@@ -778,25 +1070,31 @@ ncclResult_t ncclTopoFillNet(struct ncclXml* xml, const char* pciPath, const cha
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoTrimXmlRec(struct ncclXmlNode* node) {
+// Returns in *keep whether the node survived. Subs are compacted in a single
+// pass instead of removing them one by one from their parent.
+ncclResult_t ncclTopoTrimXmlRec(struct ncclXmlNode* node, int* keep) {
   const char* str;
   NCCLCHECK(xmlGetAttr(node, "keep", &str));
   if (str && strcmp(str, "1") == 0) {
     NCCLCHECK(xmlUnsetAttr(node, "keep"));
-  } else {
-    // Copy nSubs and subs as they could change as we trim recursively.
-    struct ncclXmlNode* subs[MAX_SUBS];
-    int nSubs = node->nSubs;
-    memcpy(subs, node->subs, node->nSubs*sizeof(struct ncclXmlNode*));
-    for (int s=0; s<nSubs; s++) {
-      NCCLCHECK(ncclTopoTrimXmlRec(subs[s]));
-    }
-    if (node->nSubs == 0) NCCLCHECK(xmlRemoveNode(node));
+    *keep = 1;
+    return ncclSuccess;
+  }
+  int nSubs = 0;
+  for (int s=0; s<node->nSubs; s++) {
+    int subKeep;
+    NCCLCHECK(ncclTopoTrimXmlRec(node->subs[s], &subKeep));
+    if (subKeep) node->subs[nSubs++] = node->subs[s];
   }
+  node->nSubs = nSubs;
+  *keep = nSubs > 0;
+  if (*keep == 0) node->type = NODE_TYPE_NONE;
   return ncclSuccess;
 }
 ncclResult_t ncclTopoTrimXml(struct ncclXml* xml) {
-  NCCLCHECK(ncclTopoTrimXmlRec(xml->nodes));
+  if (xml->maxIndex == 0) return ncclSuccess;
+  int keep;
+  NCCLCHECK(ncclTopoTrimXmlRec(xml->nodes[0], &keep));
   return ncclSuccess;
 }
 
@@ -804,29 +1102,29 @@ ncclResult_t ncclTopoTrimXml(struct ncclXml* xml) {
 /* Parser rules for the user-defined graph search */
 /**************************************************/
 
-ncclResult_t ncclTopoXmlGraphLoadGpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlGraphLoadGpu(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadNet(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlGraphLoadNet(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadChannel(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadChannel(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "net", ncclTopoXmlGraphLoadNet }, { "gpu", ncclTopoXmlGraphLoadGpu } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 2));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 2));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadGraph(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadGraph(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "channel", ncclTopoXmlGraphLoadChannel } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadGraphs(FILE* file, struct ncclXml* xmlGraph, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadGraphs(struct xmlReader* reader, struct ncclXml* xmlGraph, struct ncclXmlNode* head) {
   int version;
   NCCLCHECK(xmlGetAttrInt(head, "version", &version));
   if (version != NCCL_GRAPH_XML_VERSION) {
@@ -839,19 +1137,21 @@ ncclResult_t ncclTopoXmlGraphLoadGraphs(FILE* file, struct ncclXml* xmlGraph, st
   else INFO(NCCL_GRAPH, "Loading graphs");
 
   struct xmlHandler handlers[] = { { "graph", ncclTopoXmlGraphLoadGraph } };
-  NCCLCHECK(xmlLoadSub(file, xmlGraph, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xmlGraph, head, handlers, 1));
   return ncclSuccess;
 }
 
 ncclResult_t ncclTopoGetXmlGraphFromFile(const char* xmlGraphFile, struct ncclXml* xml) {
-  FILE* file = fopen(xmlGraphFile, "r");
-  if (file == NULL) {
+  struct xmlReader reader;
+  ncclResult_t ret = ncclSuccess;
+  if (xmlReaderOpen(xmlGraphFile, &reader) != ncclSuccess) {
     WARN("Could not open XML graph file %s : %s", xmlGraphFile, strerror(errno));
     return ncclSystemError;
   }
   struct xmlHandler handlers[] = { { "graphs", ncclTopoXmlGraphLoadGraphs } };
   xml->maxIndex = 0;
-  NCCLCHECK(xmlLoadSub(file, xml, NULL, handlers, 1));
-  fclose(file);
-  return ncclSuccess;
+  NCCLCHECKGOTO(xmlLoadSub(&reader, xml, NULL, handlers, 1), ret, exit);
+exit:
+  xmlReaderClose(&reader);
+  return ret;
 }
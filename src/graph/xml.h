@@ -12,35 +12,61 @@
 #include "checks.h"
 #include <stdlib.h>
 
-// A few constraints to make the implementation easy
+// Maximum length of names and values. Longer strings are truncated.
 #define MAX_STR_LEN 255
-#define MAX_ATTR_COUNT 16
-#define MAX_SUBS 32
-#define MAX_NODES 1024
 
 #define NODE_TYPE_NONE 0
 #define NODE_TYPE_OPEN 1
 #define NODE_TYPE_CLOSE 2
 #define NODE_TYPE_SINGLE 3
 
+struct ncclXmlAttr {
+  const char* key; // Interned
+  char* value;     // Arena-allocated, valueSize bytes available
+  int valueSize;
+};
+
 struct ncclXmlNode {
-  char name[MAX_STR_LEN+1];
-  struct {
-    char key[MAX_STR_LEN+1];
-    char value[MAX_STR_LEN+1];
-  } attrs[MAX_ATTR_COUNT+1]; // Need an extra one to consume extra params
+  const char* name; // Interned
+  struct ncclXmlAttr* attrs;
   int nAttrs;
+  int maxAttrs;
   int type;
   struct ncclXmlNode* parent;
-  struct ncclXmlNode* subs[MAX_SUBS];
+  struct ncclXmlNode** subs;
   int nSubs;
+  int maxSubs;
+  struct ncclXml* xml;
 };
 
+struct ncclXmlArenaChunk {
+  struct ncclXmlArenaChunk* next;
+  size_t size;
+  size_t used;
+};
+
+// All nodes, attribute arrays and strings live in a chunked arena owned by
+// the ncclXml and are released at once by xmlFree. Keys and node names come
+// from a small vocabulary and are interned. A zeroed ncclXml is a valid
+// empty tree, so it can be allocated with ncclCalloc.
 struct ncclXml {
-  struct ncclXmlNode nodes[MAX_NODES];
+  struct ncclXmlNode** nodes;
   int maxIndex;
+  int maxNodes;
+  struct ncclXmlArenaChunk* arena;
+  const char** strings; // Intern hash table
+  int nStrings;
+  int maxStrings;
+  struct ncclXmlNode* spare; // Parsed but unlinked node, reused by the parser
 };
 
+ncclResult_t xmlFree(struct ncclXml* xml);
+ncclResult_t xmlArenaAlloc(struct ncclXml* xml, size_t size, void** ptr);
+ncclResult_t xmlIntern(struct ncclXml* xml, const char* str, const char** interned);
+ncclResult_t xmlAppendAttr(struct ncclXmlNode* node, const char* attrName, int* index);
+ncclResult_t xmlSetAttrValue(struct ncclXmlNode* node, int index, const char* value);
+ncclResult_t xmlAddNode(struct ncclXml* xml, struct ncclXmlNode* parent, const char* subName, struct ncclXmlNode** sub);
+
 /* File functions */
 #define NCCL_TOPO_XML_VERSION 1
 ncclResult_t ncclTopoGetXmlFromFile(const char* xmlTopoFile, struct ncclXml* xml, int warn);
@@ -64,7 +90,8 @@ static ncclResult_t xmlGetAttrIndex(struct ncclXmlNode* node, const char* attrNa
   *index = -1;
   const int nAttrs = node->nAttrs;
   for (int a=0; a<nAttrs; a++) {
-    if (strncmp(node->attrs[a].key, attrName, MAX_STR_LEN) == 0) {
+    const char* key = node->attrs[a].key;
+    if (key == attrName || strncmp(key, attrName, MAX_STR_LEN) == 0) {
       *index = a;
       return ncclSuccess;
     }
@@ -112,7 +139,7 @@ static ncclResult_t xmlGetAttrFloat(struct ncclXmlNode* node, const char* attrNa
 static ncclResult_t xmlFindTag(struct ncclXml* xml, const char* tagName, struct ncclXmlNode** node) {
   *node = NULL;
   for (int i=0; i<xml->maxIndex; i++) {
-    struct ncclXmlNode* n = xml->nodes+i;
+    struct ncclXmlNode* n = xml->nodes[i];
     if (strcmp(n->name, tagName) == 0) {
       *node = n;
       return ncclSuccess;
@@ -124,7 +151,7 @@ static ncclResult_t xmlFindTag(struct ncclXml* xml, const char* tagName, struct
 static ncclResult_t xmlFindTagKv(struct ncclXml* xml, const char* tagName, struct ncclXmlNode** node, const char* attrName, const char* attrValue) {
   *node = NULL;
   for (int i=0; i<xml->maxIndex; i++) {
-    struct ncclXmlNode* n = xml->nodes+i;
+    struct ncclXmlNode* n = xml->nodes[i];
     if (strcmp(n->name, tagName) == 0) {
       const char* value;
       NCCLCHECK(xmlGetAttr(n, attrName, &value));
@@ -140,13 +167,8 @@ static ncclResult_t xmlFindTagKv(struct ncclXml* xml, const char* tagName, struc
 static ncclResult_t xmlSetAttr(struct ncclXmlNode* node, const char* attrName, const char* value) {
   int index;
   NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
-  if (index == -1) {
-    index = node->nAttrs++;
-    strncpy(node->attrs[index].key, attrName, MAX_STR_LEN);
-    node->attrs[index].key[MAX_STR_LEN] = '\0';
-  }
-  strncpy(node->attrs[index].value, value, MAX_STR_LEN);
-  node->attrs[index].value[MAX_STR_LEN] = '\0';
+  if (index == -1) NCCLCHECK(xmlAppendAttr(node, attrName, &index));
+  NCCLCHECK(xmlSetAttrValue(node, index, value));
   return ncclSuccess;
 }
 
@@ -154,37 +176,22 @@ static ncclResult_t xmlSetAttrIfUnset(struct ncclXmlNode* node, const char* attr
   int index;
   NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
   if (index != -1) return ncclSuccess;
-  index = node->nAttrs++;
-  strncpy(node->attrs[index].key, attrName, MAX_STR_LEN);
-  node->attrs[index].key[MAX_STR_LEN] = '\0';
-  strncpy(node->attrs[index].value, value, MAX_STR_LEN);
-  node->attrs[index].value[MAX_STR_LEN] = '\0';
+  NCCLCHECK(xmlAppendAttr(node, attrName, &index));
+  NCCLCHECK(xmlSetAttrValue(node, index, value));
   return ncclSuccess;
 }
 
 static ncclResult_t xmlSetAttrInt(struct ncclXmlNode* node, const char* attrName, const int value) {
-  int index;
-  NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
-  if (index == -1) {
-    index = node->nAttrs++;
-    strncpy(node->attrs[index].key, attrName, MAX_STR_LEN);
-    node->attrs[index].key[MAX_STR_LEN] = '\0';
-  }
-  snprintf(node->attrs[index].value, MAX_STR_LEN, "%d", value);
-  node->attrs[index].value[MAX_STR_LEN] = '\0';
+  char strValue[MAX_STR_LEN+1];
+  snprintf(strValue, MAX_STR_LEN, "%d", value);
+  NCCLCHECK(xmlSetAttr(node, attrName, strValue));
   return ncclSuccess;
 }
 
 static ncclResult_t xmlSetAttrFloat(struct ncclXmlNode* node, const char* attrName, const float value) {
-  int index;
-  NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
-  if (index == -1) {
-    index = node->nAttrs++;
-    strncpy(node->attrs[index].key, attrName, MAX_STR_LEN);
-    node->attrs[index].key[MAX_STR_LEN] = '\0';
-  }
-  snprintf(node->attrs[index].value, MAX_STR_LEN, "%g", value);
-  node->attrs[index].value[MAX_STR_LEN] = '\0';
+  char strValue[MAX_STR_LEN+1];
+  snprintf(strValue, MAX_STR_LEN, "%g", value);
+  NCCLCHECK(xmlSetAttr(node, attrName, strValue));
   return ncclSuccess;
 }
 
@@ -192,10 +199,7 @@ static ncclResult_t xmlUnsetAttr(struct ncclXmlNode* node, const char* attrName)
   int index;
   NCCLCHECK(xmlGetAttrIndex(node, attrName, &index));
   if (index == -1) return ncclSuccess;
-  for (int i=index+1; i<node->nAttrs; i++) {
-    strcpy(node->attrs[i-1].key, node->attrs[i].key);
-    strcpy(node->attrs[i-1].value, node->attrs[i].value);
-  }
+  for (int i=index+1; i<node->nAttrs; i++) node->attrs[i-1] = node->attrs[i];
   node->nAttrs--;
   return ncclSuccess;
 }
@@ -233,22 +237,6 @@ static ncclResult_t xmlGetSubKvInt(struct ncclXmlNode* node, const char* subName
   return ncclSuccess;
 }
 
-static ncclResult_t xmlAddNode(struct ncclXml* xml, struct ncclXmlNode* parent, const char* subName, struct ncclXmlNode** sub) {
-  if (xml->maxIndex == MAX_NODES) {
-    WARN("Error : too many XML nodes (max %d)", MAX_NODES);
-    return ncclInternalError;
-  }
-  struct ncclXmlNode* s = xml->nodes+xml->maxIndex++;
-  s->nSubs = 0;
-  s->nAttrs = 0;
-  *sub = s;
-  s->parent = parent;
-  if (parent) parent->subs[parent->nSubs++] = s;
-  strncpy(s->name, subName, MAX_STR_LEN);
-  s->name[MAX_STR_LEN] = '\0';
-  return ncclSuccess;
-}
-
 static ncclResult_t xmlRemoveNode(struct ncclXmlNode* node) {
   node->type = NODE_TYPE_NONE;
   struct ncclXmlNode* parent = node->parent;
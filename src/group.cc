@@ -241,6 +241,7 @@ static void groupCleanup(struct ncclComm** groupCommHeadPtr, struct ncclComm** g
       ncclIntruQueueConstruct(&comm->tasks.peers[i].sendQueue);
       ncclIntruQueueConstruct(&comm->tasks.peers[i].recvQueue);
     }
+    memset(comm->tasks.p2pActiveSteps, 0, DIVUP(comm->nRanks, 64)*sizeof(uint64_t));
 
     if (!comm->blocking)
       (void) ncclCommSetAsyncError(comm, error);
@@ -0,0 +1,33 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_AUTOTUNE_H_
+#define NCCL_AUTOTUNE_H_
+
+#include "nccl.h"
+#include <cuda_runtime.h>
+
+struct ncclComm;
+struct ncclInfo;
+struct ncclKernelPlan;
+
+// Online tuning of the algorithm/protocol choice, enabled with NCCL_AUTOTUNE=1.
+// Operations are timed per collective, size range and algorithm/protocol. The
+// candidates of each range are halved after each round of measurements, with
+// the decision agreed across ranks, until one remains and is pinned.
+ncclResult_t ncclAutotuneInit(struct ncclComm* comm);
+ncclResult_t ncclAutotuneFree(struct ncclComm* comm);
+
+// Used instead of ncclTopoGetAlgoInfo for operations which are not aggregated.
+ncclResult_t ncclAutotuneGetAlgoInfo(struct ncclInfo* info, int collNetTypeSupport);
+
+// Time the kernel of a plan made of a single operation being explored.
+ncclResult_t ncclAutotuneTimerStart(struct ncclComm* comm, struct ncclKernelPlan* plan, cudaStream_t stream);
+ncclResult_t ncclAutotuneTimerStop(struct ncclComm* comm, struct ncclKernelPlan* plan, cudaStream_t stream);
+// Called once per launch : account for the timers which completed, without waiting.
+ncclResult_t ncclAutotunePoll(struct ncclComm* comm);
+
+#endif
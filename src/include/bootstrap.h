@@ -25,6 +25,10 @@ ncclResult_t bootstrapSend(void* commState, int peer, int tag, void* data, int s
 ncclResult_t bootstrapRecv(void* commState, int peer, int tag, void* data, int size);
 ncclResult_t bootstrapBarrier(void* commState, int *ranks, int rank, int nranks, int tag);
 ncclResult_t bootstrapIntraNodeAllGather(void* commState, int *ranks, int rank, int nranks, void* allData, int size);
+struct bootstrapRing;
+ncclResult_t bootstrapRingCreate(void* commState, struct bootstrapRing** ring);
+ncclResult_t bootstrapRingAllGather(struct bootstrapRing* ring, void* allData, int size);
+ncclResult_t bootstrapRingClose(struct bootstrapRing* ring);
 ncclResult_t bootstrapClose(void* commState);
 ncclResult_t bootstrapAbort(void* commState);
 #endif
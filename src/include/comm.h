@@ -140,6 +140,10 @@ struct ncclKernelPlan {
   struct ncclWork* workHead;
 
   int collOpCount; // zero based for this plan
+  // NCCL_AUTOTUNE timing of single operation plans
+  int autotuneTag;
+  int autotuneTimer;
+  size_t autotuneBytes;
 
   struct ncclIntruQueue<struct ncclPointerList, &ncclPointerList::next> ipcMemQueue;
 
@@ -218,6 +222,10 @@ struct ncclComm {
   float latencies[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   float bandwidths[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   int maxThreads[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  struct ncclTuningProfile* tuningProfile; // NCCL_TUNING_FILE, NULL if not set
+  struct ncclAlgoDecision algoTable[NCCL_NUM_FUNCTIONS][2/*collNet*/][NCCL_ALGO_TABLE_BUCKETS];
+  struct ncclAutotune* autotune; // NCCL_AUTOTUNE, NULL if disabled
+  struct ncclPlanCache* planCache; // NCCL_PLAN_CACHE, allocated on first use
 
   /* This attribute can indicate the states of communicators and return code of
    * asynchronous NCCL operations. */
@@ -239,6 +247,9 @@ struct ncclComm {
   uint32_t* workFifoDone/*[MAXCHANNELS]*/; // in cudaHost memory
   uint32_t workFifoSent; // Monotonic (mod 1<<32) index of next unused fifo slot.
   uint32_t workFifoAckdMin; // Monotonic index of least unprocessed fifo slot over all channels.
+  uint64_t workFifoPendingMask; // Channels with fifo work not acked yet.
+  uint64_t workFifoStalls; // Number of times the fifo was full
+  uint64_t workFifoStallNs; // Time spent waiting for it
 
   // Intra-process sync
   struct ncclComm* intraComm0; // leader of intra-process comms (self possible)
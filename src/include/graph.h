@@ -108,8 +108,39 @@ ncclResult_t ncclTopoPreset(struct ncclComm* comm,
 ncclResult_t ncclTopoPostset(struct ncclComm* comm, int* firstRanks, int* treePatterns,
     struct ncclTopoRanks** allTopoRanks, int* rings, struct ncclTopoGraph* collNetGraph);
 
+// Calibrated latency/bandwidth of a (collective, algorithm, protocol) for a
+// range of message sizes, loaded from NCCL_TUNING_FILE. They replace the
+// model, correction factors included, in ncclTopoGetAlgoTime.
+struct ncclTuningBucket {
+  size_t minBytes;
+  size_t maxBytes;
+  float lat; // us
+  float bw;  // GB/s, as comm->bandwidths
+};
+
+struct ncclTuningProfile {
+  int nBuckets[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  struct ncclTuningBucket* buckets[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+};
+ncclResult_t ncclTopoTuningProfileFree(struct ncclTuningProfile* profile);
+
 ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCompCap, struct ncclTopoGraph* treeGraph, struct ncclTopoGraph* ringGraph, struct ncclTopoGraph* collNetGraph);
 #include "info.h"
 ncclResult_t ncclTopoGetAlgoTime(struct ncclInfo* info, int algorithm, int protocol, int numPipeOps, float* time);
 
+// Algorithm, protocol, nChannels and nThreads for a power-of-two range of sizes,
+// precomputed so that enqueue does not search all algorithms and protocols.
+#define NCCL_ALGO_TABLE_BUCKETS 64
+struct ncclAlgoDecision {
+  int8_t valid; // 0 if the choice changes within the range
+  int8_t algorithm;
+  int8_t protocol;
+  int16_t nChannels;
+  int16_t nThreads;
+};
+ncclResult_t ncclTopoInitAlgoTable(struct ncclComm* comm);
+ncclResult_t ncclTopoGetAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps);
+// Set nChannels/nThreads for the algorithm and protocol already chosen in info
+ncclResult_t ncclTopoGetAlgoThreads(struct ncclInfo* info);
+
 #endif
@@ -93,6 +93,8 @@ inline void ncclGroupCommJoin(struct ncclComm* comm) {
     // Comms gets a new memory stack scope upon joining. Each task batched for
     // this comm is allocated there.
     ncclMemoryStackPush(&comm->memScoped);
+    comm->tasks.collSlabLeft = 0;
+    comm->tasks.p2pSlabLeft = 0;
   }
 
   ncclGroupBlocking = comm->blocking;
@@ -0,0 +1,77 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_HOSTREDUCE_H_
+#define NCCL_HOSTREDUCE_H_
+
+#include "nccl.h"
+#include "collectives.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Host implementation of the reductions of collectives/device/reduce_kernel.h,
+// for every datatype and ncclDevRedOp_t, with the same rounding: half and
+// bfloat16 results are rounded after each operation, as the device does.
+//
+//   dst = postOp(op(op(preOp(srcs[0]), preOp(srcs[1])), ...))
+//
+// preOp is only applied to the first nPreOpSrcs sources, and postOp only if
+// postOp is set, so that a staged reduction applies them once per element as
+// the device primitives do. dst may alias any of the sources. When
+// opFull.scalarArgIsPtr is set, the scalar must be readable from the host.
+ncclResult_t ncclHostReduce(void* dst, const void* const* srcs, int nSrcs, size_t count, ncclDataType_t datatype,
+    struct ncclDevRedOpFull opFull, int nPreOpSrcs, bool postOp);
+
+// Round to nearest even conversions, matching __float2half and __float2bfloat16.
+// Half and bfloat16 values are passed in the low 16 bits of a uint32_t : loops
+// which convert back and forth only vectorize when the width does not change.
+union ncclFloatBits {
+  float f;
+  uint32_t u;
+};
+
+static inline float ncclHalfToFloat(uint32_t h) {
+  union ncclFloatBits v;
+  v.u = (h & 0x7fff) << 13;
+  v.f *= 5.192296858534828e+33f; // 2^112 rebiases the exponent, denormals included
+  if ((h & 0x7c00) == 0x7c00) v.u |= 0x7f800000; // Inf/NaN
+  v.u |= (h & 0x8000) << 16;
+  return v.f;
+}
+
+// All cases are computed then selected, without branches.
+static inline uint32_t ncclFloatToHalf(float f) {
+  union ncclFloatBits v, magic;
+  v.f = f;
+  uint32_t sign = v.u & 0x80000000;
+  uint32_t u = v.u ^ sign;
+  // Normal : rebias the exponent and round the mantissa to nearest even
+  uint32_t normal = (u + ((uint32_t)(15-127) << 23) + 0xfff + ((u >> 13) & 1)) >> 13;
+  // Denormal : let the FPU round by adding a magic number
+  magic.u = (uint32_t)((127-15)+(23-10)+1) << 23;
+  v.u = u;
+  v.f += magic.f;
+  uint32_t denormal = v.u - magic.u;
+  // NaN, or overflow to Inf
+  uint32_t special = u > 0x7f800000 ? 0x7e00 : 0x7c00;
+  uint32_t h = u >= (uint32_t)(127+16) << 23 ? special : u < (uint32_t)(127-14) << 23 ? denormal : normal;
+  return h | (sign >> 16);
+}
+
+static inline float ncclBfloat16ToFloat(uint32_t b) {
+  union ncclFloatBits v;
+  v.u = b << 16;
+  return v.f;
+}
+
+static inline uint32_t ncclFloatToBfloat16(float f) {
+  union ncclFloatBits v;
+  v.f = f;
+  uint32_t rounded = (v.u + 0x7fff + ((v.u >> 16) & 1)) >> 16;
+  return (v.u & 0x7fffffff) > 0x7f800000 ? (v.u >> 16) | 0x40 : rounded; // Quiet NaN
+}
+
+#endif
@@ -56,6 +56,7 @@ struct ncclInfo {
   int nchunksPerLoop;
   int chunkSize;
   int channelId;
+  int autotuneTag; // Candidate timed by NCCL_AUTOTUNE, 0 if none
 };
 
 inline ncclResult_t ncclInfoSetDerived(struct ncclInfo* info, int nRanks) {
@@ -103,7 +104,16 @@ struct ncclTasks {
   size_t collBytesTotal;
   struct Peer* peers/*[nRanks]*/;
   int *p2pSendOrder/*[nRanks]*/, *p2pRecvOrder/*[nRanks]*/;
+  // Inverse of the orders above : step at which each peer is sent to/received from.
+  int *p2pSendStep/*[nRanks]*/, *p2pRecvStep/*[nRanks]*/;
+  // Bit i set when step i may have a send or a recv queued (see tasks.h).
+  uint64_t* p2pActiveSteps/*[DIVUP(nRanks,64)]*/;
   int nTasksColl, nTasksP2p;
+  // Blocks the next tasks are taken from, in comm->memScoped. Emptied when the
+  // comm joins a group.
+  struct ncclTaskColl* collSlab;
+  struct ncclTaskP2p* p2pSlab;
+  int collSlabLeft, p2pSlabLeft;
 
   // The list of user streams aggregated over all tasks present.
   struct ncclCudaStreamList* streams;
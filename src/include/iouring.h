@@ -0,0 +1,55 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_IOURING_H_
+#define NCCL_IOURING_H_
+
+#include "nccl.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Minimal io_uring wrapper built on the raw syscalls, so that we don't
+// depend on liburing being installed. Only the operations needed by the
+// socket transport are exposed.
+struct ncclIoUring {
+  int fd;
+  unsigned entries;
+  // Submission queue
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  void* sqes;
+  unsigned sqLocalTail;
+  unsigned toSubmit;
+  // Completion queue
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  void* cqes;
+  // Mappings
+  void* sqRing;
+  size_t sqRingSize;
+  void* cqRing;
+  size_t cqRingSize;
+  size_t sqesSize;
+};
+
+// Returns ncclSystemError if io_uring, or one of the operations below, is not available on this system.
+ncclResult_t ncclIoUringInit(struct ncclIoUring* ring, unsigned entries);
+// Queue a send or recv (op is NCCL_SOCKET_SEND/NCCL_SOCKET_RECV) on a socket.
+ncclResult_t ncclIoUringPrepSocket(struct ncclIoUring* ring, int op, int fd, void* data, int size, uint64_t userData);
+// Queue a poll for readiness of fd (op is NCCL_SOCKET_SEND/NCCL_SOCKET_RECV).
+ncclResult_t ncclIoUringPrepPoll(struct ncclIoUring* ring, int op, int fd, uint64_t userData);
+// Queue a read, e.g. of an eventfd used to wake up the ring owner.
+ncclResult_t ncclIoUringPrepRead(struct ncclIoUring* ring, int fd, void* data, int size, uint64_t userData);
+// Submit all queued entries and block until at least waitNr completions are available.
+ncclResult_t ncclIoUringSubmit(struct ncclIoUring* ring, unsigned waitNr);
+// Pop one completion. Sets *found to 0 if the completion queue is empty.
+ncclResult_t ncclIoUringReap(struct ncclIoUring* ring, uint64_t* userData, int* res, int* found);
+ncclResult_t ncclIoUringClose(struct ncclIoUring* ring);
+
+#endif
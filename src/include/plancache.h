@@ -0,0 +1,72 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_PLANCACHE_H_
+#define NCCL_PLANCACHE_H_
+
+#include "devcomm.h"
+#include "info.h"
+#include "proxy.h"
+
+struct ncclComm;
+
+// Cache of the scheduling decisions of collective groups, enabled with
+// NCCL_PLAN_CACHE=1 (default). Groups issuing the same collectives as a
+// previous group (same functions, counts, types, ops and roots, in the same
+// order) reuse the work element and proxy op computed for each collective,
+// with only the buffer pointers patched. Channels are still assigned per plan.
+
+// What computeColl() produced for one collective of the group.
+struct ncclPlanCacheOp {
+  int workFuncIndex;
+  int nChannels;
+  int nThreads;
+  size_t nBytes;
+  struct ncclWorkElem workElem;
+  struct ncclProxyOp proxyOp;
+};
+
+struct ncclPlanCacheEntry {
+  uint64_t hash;
+  bool valid;
+  int nOps;
+  int maxOps;
+  struct ncclTaskColl* keys; // Only the fields describing the operation are compared
+  struct ncclPlanCacheOp* ops;
+};
+
+struct ncclPlanCache {
+  int nEntries;
+  struct ncclPlanCacheEntry* entries; // Direct mapped on the hash
+  struct ncclPlanCacheEntry* current; // Group being scheduled, NULL if not cached
+  bool replay;
+  int cursor;
+  uint64_t hits, misses;
+};
+
+// Look comm->tasks up before scheduling its collectives. On a hit the cached
+// ops are replayed, otherwise the group is recorded as it is scheduled.
+ncclResult_t ncclPlanCacheBegin(struct ncclComm* comm, bool persistent);
+// Record the next collective of the group. No-op if not recording.
+ncclResult_t ncclPlanCacheRecord(struct ncclComm* comm, int workFuncIndex, struct ncclWorkElem const* workElem,
+    struct ncclProxyOp const* proxyOp, int nChannels, int nThreads, size_t nBytes);
+// Drop the group being recorded, if it cannot be replayed as it was scheduled.
+void ncclPlanCacheAbort(struct ncclComm* comm);
+// All collectives were scheduled : validate the group recorded.
+void ncclPlanCacheEnd(struct ncclComm* comm);
+ncclResult_t ncclPlanCacheFree(struct ncclComm* comm);
+
+// Next collective to replay, NULL if not replaying.
+static inline struct ncclPlanCacheOp* ncclPlanCacheReplayPeek(struct ncclPlanCache* cache) {
+  if (cache == NULL || cache->current == NULL || !cache->replay) return NULL;
+  return cache->current->ops + cache->cursor;
+}
+
+static inline void ncclPlanCacheReplayPop(struct ncclPlanCache* cache) {
+  cache->cursor++;
+}
+
+#endif
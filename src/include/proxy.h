@@ -96,13 +96,29 @@ struct ncclProxyArgs {
 // Otherwise we'd be unable to post half of them to free new elements.
 #define MAX_OPS_PER_PEER (2*MAXCHANNELS*NCCL_MAX_WORK_ELEMENTS_P2P)
 #define NCCL_MAX_LOCAL_RANKS 64
+
+// Chains of ops posted by one local rank. Each local rank is the only producer of its ring and the
+// progress thread the only consumer, so posting needs no lock. A chain holds at least one of the
+// MAX_OPS_PER_PEER ops of that rank and ops are only freed once consumed, so the ring can't overflow.
+#define NCCL_PROXY_POST_RING_SIZE MAX_OPS_PER_PEER
+struct ncclProxyPostedChain {
+  int first;
+  int last;
+};
+struct ncclProxyPostRing {
+  alignas(64) volatile uint64_t tail; // Written by the posting rank
+  alignas(64) volatile uint64_t head; // Written by the progress thread
+  alignas(64) struct ncclProxyPostedChain chains[NCCL_PROXY_POST_RING_SIZE];
+};
+
 struct ncclProxyOpsPool {
   struct ncclProxyOp ops[MAX_OPS_PER_PEER*NCCL_MAX_LOCAL_RANKS];
-  volatile int nextOps;
-  volatile int nextOpsEnd;
   volatile int freeOps[NCCL_MAX_LOCAL_RANKS];
-  pthread_mutex_t mutex;
-  pthread_cond_t cond;
+  struct ncclProxyPostRing posted[NCCL_MAX_LOCAL_RANKS];
+  // Futex word the progress thread sleeps on. Posters only bump it when the progress thread
+  // advertises it is sleeping.
+  alignas(64) volatile uint32_t doorbell;
+  volatile int sleeping;
 };
 
 struct ncclProxyOps {
@@ -144,20 +160,43 @@ struct ncclSharedNetComms {
 };
 
 struct ncclProxyPool;
+// Operations progressed by one progress thread. With NCCL_PROXY_NTHREADS > 1, connections are split
+// in shards; shard 0 pulls posted ops from the ops pool and routes them to the owning shard.
+struct ncclProxyProgressShard {
+  pthread_t thread;
+  int id;
+  struct ncclComm* comm;
+  struct ncclProxyArgs* active;
+  struct ncclProxyArgs* pool;
+  struct ncclProxyPool* pools;
+
+  // Ops routed to this shard by shard 0, protected by mutex
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct ncclProxyOp* routed;
+  int nRouted;
+  int maxRouted;
+  // Only used by this shard's thread, to consume routed ops outside of the lock
+  struct ncclProxyOp* consumed;
+  int maxConsumed;
+  // Only used by shard 0, to stage ops until a full batch is routed
+  struct ncclProxyOp* staged;
+  int nStaged;
+  int maxStaged;
+};
+
 struct ncclProxyProgressState {
   // Used by main threads to send work to progress thread
   struct ncclProxyOpsPool* opsPool;
   ncclShmHandle_t handle;
   char opsPoolShmSuffix[6];
 
-  pthread_t thread;
   bool stop;
   struct ncclProxyPeer** localPeers;
   struct ncclSharedNetComms* netComms[NCCL_MAX_NETDEVS];
   struct ncclProxySharedCollNet collNet;
-  struct ncclProxyArgs* active;
-  struct ncclProxyArgs* pool;
-  struct ncclProxyPool* pools;
+  struct ncclProxyProgressShard* shards;
+  int nShards;
   int nextOps;
 };
 
@@ -165,6 +204,7 @@ struct ncclProxyState {
   // Service thread
   pthread_t thread;
   struct ncclSocket* listenSock;
+  int wakeFd; // eventfd used to wake up the service thread on abort
   int stop;
   CUcontext cudaCtx;
 
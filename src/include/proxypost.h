@@ -0,0 +1,33 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_PROXYPOST_H_
+#define NCCL_PROXYPOST_H_
+
+#include "nccl.h"
+#include <stdint.h>
+
+struct ncclProxyOpsPool;
+
+// Posting of proxy ops to the progress thread. Each local rank posts chains of
+// its ops to its own ring in the shared ncclProxyOpsPool : one producer per
+// ring, and the progress thread is the only consumer. The progress thread
+// sleeps on a futex doorbell, which posters only ring while it sleeps.
+
+// Post the chain of ops from index first to index last, linked through next.
+ncclResult_t ncclProxyPost(struct ncclProxyOpsPool* pool, int localRank, int first, int last);
+
+// Take all chains posted by the nRanks local ranks and link them into one
+// chain. Returns the index of its first op, -1 if nothing was posted.
+int ncclProxyGetPostedChains(struct ncclProxyOpsPool* pool, int nRanks);
+
+void ncclProxyRingDoorbell(struct ncclProxyOpsPool* pool);
+
+// Sleep until ops are posted, *stop is set, or timeoutUsec expires (never if
+// timeoutUsec < 0). Setting *stop must be followed by ncclProxyRingDoorbell.
+void ncclProxyWaitDoorbell(struct ncclProxyOpsPool* pool, int nRanks, bool* stop, int64_t timeoutUsec);
+
+#endif
@@ -93,5 +93,10 @@ ncclResult_t ncclSocketWait(int op, struct ncclSocket* sock, void* ptr, int size
 ncclResult_t ncclSocketSend(struct ncclSocket* sock, void* ptr, int size);
 ncclResult_t ncclSocketRecv(struct ncclSocket* sock, void* ptr, int size);
 ncclResult_t ncclSocketTryRecv(struct ncclSocket* sock, void* ptr, int size, int* closed);
+// MSG_ZEROCOPY sends. Send buffers must not be modified until ncclSocketZeroCopyReap() reports
+// that the completion ids consumed by ncclSocketProgressZeroCopy() (counted in zcSeq) are done.
+ncclResult_t ncclSocketSetZeroCopy(struct ncclSocket* sock, int* enabled);
+ncclResult_t ncclSocketProgressZeroCopy(struct ncclSocket* sock, void* ptr, int size, int* offset, uint32_t* zcSeq);
+ncclResult_t ncclSocketZeroCopyReap(struct ncclSocket* sock, uint32_t* zcDone);
 ncclResult_t ncclSocketClose(struct ncclSocket* sock);
 #endif
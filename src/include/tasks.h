@@ -0,0 +1,35 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_TASKS_H_
+#define NCCL_TASKS_H_
+
+#include "info.h"
+
+struct ncclComm;
+
+// Staging of the operations of a group into comm->tasks, until ncclGroupEnd()
+// schedules them. Tasks live in comm->memScoped, in the frame pushed when the
+// comm joins the thread's group.
+
+// Stage a send (coll == ncclFuncSend) or a receive from/to peer.
+ncclResult_t ncclTaskP2pAppend(struct ncclComm* comm, ncclFunc_t coll, int peer, void* buff, size_t bytes);
+// Stage a collective, with its reduction op already resolved.
+ncclResult_t ncclTaskCollAppend(struct ncclComm* comm, struct ncclInfo const* info, struct ncclDevRedOpFull opFull);
+
+// The p2p schedule pairs at step i the send to p2pSendOrder[i] with the recv
+// from p2pRecvOrder[i]. Steps with tasks queued are flagged so that scheduling
+// only visits those, in step order, whatever the number of ranks : scan the
+// words of p2pActiveSteps, then the bits set in each.
+static inline void ncclTaskP2pMarkStep(struct ncclTasks* tasks, int step) {
+  tasks->p2pActiveSteps[step/64] |= 1ULL<<(step%64);
+}
+
+static inline void ncclTaskP2pClearStep(struct ncclTasks* tasks, int step) {
+  tasks->p2pActiveSteps[step/64] &= ~(1ULL<<(step%64));
+}
+
+#endif
@@ -0,0 +1,25 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_WORKFIFO_H_
+#define NCCL_WORKFIFO_H_
+
+#include <stdint.h>
+
+struct ncclComm;
+
+// Host side flow control of the work fifo. Each channel acks back in
+// comm->workFifoDone[c] the index+1 of the last fifo slot it consumed.
+
+// Record that channel c was given fifo slots from ixFirst, the last one
+// being acked with doneAcks.
+void ncclWorkFifoPost(struct ncclComm* comm, int c, uint32_t ixFirst, uint32_t doneAcks);
+
+// Wait until it is safe to increase comm->workFifoSent to desiredSent : spin,
+// then yield, then sleep with exponential backoff.
+void ncclWorkFifoWaitAvailable(struct ncclComm* comm, uint32_t desiredSent);
+
+#endif
@@ -15,6 +15,8 @@
 #include "coll_net.h"
 #include "enqueue.h"
 #include "graph.h"
+#include "autotune.h"
+#include "plancache.h"
 #include "argcheck.h"
 #include <fcntl.h>
 #include <string.h>
@@ -181,8 +183,14 @@ static ncclResult_t commFree(ncclComm_t comm) {
   /* in commReclaim, we have guaranteed only last rank which calls ncclCommDestroy() will
    * free all intra-process communicators; therefore, we only need to focus on local
    * resource cleanup in commFree(). */
-  if (comm->proxyState.thread)
+  if (comm->workFifoStalls)
+    INFO(NCCL_INIT, "comm %p rank %d work fifo was full %lu times, waiting %.3f ms in total", comm, comm->rank,
+        comm->workFifoStalls, comm->workFifoStallNs/1e6);
+
+  if (comm->proxyState.thread) {
     pthread_join(comm->proxyState.thread, nullptr);
+    if (comm->proxyState.wakeFd >= 0) close(comm->proxyState.wakeFd);
+  }
 
   delete[] comm->userRedOps;
 
@@ -198,7 +206,11 @@ static ncclResult_t commFree(ncclComm_t comm) {
   }
   free(comm->rankToNode);
   free(comm->rankToLocalRank);
+  if (comm->tuningProfile)
+    ncclTopoTuningProfileFree(comm->tuningProfile);
 
+  NCCLCHECK(ncclAutotuneFree(comm));
+  NCCLCHECK(ncclPlanCacheFree(comm));
   if (comm->bootstrap)
     NCCLCHECK(bootstrapClose(comm->bootstrap));
 
@@ -387,6 +399,7 @@ static ncclResult_t devCommSetup(ncclComm_t comm) {
   ncclCommPushCudaHostFree(comm, comm->workFifoDone);
   comm->workFifoSent = 0;
   comm->workFifoAckdMin = 0;
+  comm->workFifoPendingMask = 0;
 
   for (int c=0; c < MAXCHANNELS; c++) {
     tmpCommAndChans.channels[c].peers = comm->channels[c].devPeers;
@@ -933,6 +946,8 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, ncclUniqueId* comm
       maxCompCap = std::max(comm->peerInfo[i].cudaCompCap, maxCompCap);
     }
     NCCLCHECKGOTO(ncclTopoTuneModel(comm, minCompCap, maxCompCap, &treeGraph, &ringGraph, &collNetGraph), ret, fail);
+    NCCLCHECKGOTO(ncclTopoInitAlgoTable(comm), ret, fail);
+    NCCLCHECKGOTO(ncclAutotuneInit(comm), ret, fail);
   } while(0);
 
   // Compute nChannels per peer for p2p
@@ -982,6 +997,13 @@ static ncclResult_t initTransportsRank(struct ncclComm* comm, ncclUniqueId* comm
       }
     }
     assert(s == nRanks && r == nRanks);
+    tasks->p2pSendStep = ncclMemoryStackAlloc<int>(&comm->memPermanent, nRanks);
+    tasks->p2pRecvStep = ncclMemoryStackAlloc<int>(&comm->memPermanent, nRanks);
+    for (int i=0; i < nRanks; i++) {
+      tasks->p2pSendStep[tasks->p2pSendOrder[i]] = i;
+      tasks->p2pRecvStep[tasks->p2pRecvOrder[i]] = i;
+    }
+    tasks->p2pActiveSteps = ncclMemoryStackAlloc<uint64_t>(&comm->memPermanent, DIVUP(nRanks, 64));
   } while (0);
 
   if (ncclParamNvbPreconnect()) {
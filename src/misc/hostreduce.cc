@@ -0,0 +1,235 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "hostreduce.h"
+#include "debug.h"
+#include <string.h>
+#include <algorithm>
+
+// Elements are processed in blocks small enough to stay in L1, in the
+// accumulation type. Every loop is a plain element-wise loop over a block so
+// that the compiler vectorizes it for each ISA hostReduceRun is built for.
+#define HOST_REDUCE_BLOCK 512
+
+// The library is built for the baseline ISA (SSE2 on x86-64). hostReduceRun
+// is also cloned for AVX2 and AVX-512, the widest the CPU supports being
+// picked at load time; hostReduceLoad is inlined so that its loops are cloned
+// with it. Other architectures and compilers only build the baseline loops.
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define HOST_REDUCE_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#endif
+#endif
+#ifndef HOST_REDUCE_CLONES
+#define HOST_REDUCE_CLONES
+#endif
+
+struct HostHalf {};
+struct HostBfloat16 {};
+
+// Storage type in memory and accumulation type of each datatype
+template<typename T>
+struct HostReduceTraits {
+  typedef T Storage;
+  typedef T Acc;
+  static const bool IsFloat = false;
+  static Acc load(Storage x) { return x; }
+  static Storage store(Acc x) { return x; }
+  static Acc round(Acc x) { return x; }
+};
+template<>
+struct HostReduceTraits<float> {
+  typedef float Storage;
+  typedef float Acc;
+  static const bool IsFloat = true;
+  static Acc load(Storage x) { return x; }
+  static Storage store(Acc x) { return x; }
+  static Acc round(Acc x) { return x; }
+};
+template<>
+struct HostReduceTraits<double> {
+  typedef double Storage;
+  typedef double Acc;
+  static const bool IsFloat = true;
+  static Acc load(Storage x) { return x; }
+  static Storage store(Acc x) { return x; }
+  static Acc round(Acc x) { return x; }
+};
+template<>
+struct HostReduceTraits<HostHalf> {
+  typedef uint16_t Storage;
+  typedef float Acc;
+  static const bool IsFloat = true;
+  static Acc load(Storage x) { return ncclHalfToFloat(x); }
+  static Storage store(Acc x) { return ncclFloatToHalf(x); }
+  static Acc round(Acc x) { return ncclHalfToFloat(ncclFloatToHalf(x)); }
+};
+template<>
+struct HostReduceTraits<HostBfloat16> {
+  typedef uint16_t Storage;
+  typedef float Acc;
+  static const bool IsFloat = true;
+  static Acc load(Storage x) { return ncclBfloat16ToFloat(x); }
+  static Storage store(Acc x) { return ncclFloatToBfloat16(x); }
+  static Acc round(Acc x) { return ncclBfloat16ToFloat(ncclFloatToBfloat16(x)); }
+};
+
+template<typename A>
+struct HostFuncSum {
+  static const bool IsPreOpIdentity = true;
+  static const bool IsPostOpIdentity = true;
+  A operator()(A x, A y) const { return x + y; }
+  A preOp(A x) const { return x; }
+  A postOp(A x) const { return x; }
+};
+
+template<typename A>
+struct HostFuncProd: HostFuncSum<A> {
+  A operator()(A x, A y) const { return x * y; }
+};
+
+template<typename A>
+struct HostFuncMax: HostFuncSum<A> {
+  A operator()(A x, A y) const { return (x < y) ? y : x; }
+};
+
+template<typename A>
+struct HostFuncMin: HostFuncSum<A> {
+  A operator()(A x, A y) const { return (x < y) ? x : y; }
+};
+
+// fmax/fmin semantics (a NaN operand is ignored) as on the device, written
+// as selects so that they vectorize.
+template<>
+struct HostFuncMax<float>: HostFuncSum<float> {
+  float operator()(float x, float y) const { return (x < y || x != x) ? y : x; }
+};
+template<>
+struct HostFuncMax<double>: HostFuncSum<double> {
+  double operator()(double x, double y) const { return (x < y || x != x) ? y : x; }
+};
+template<>
+struct HostFuncMin<float>: HostFuncSum<float> {
+  float operator()(float x, float y) const { return (y < x || x != x) ? y : x; }
+};
+template<>
+struct HostFuncMin<double>: HostFuncSum<double> {
+  double operator()(double x, double y) const { return (y < x || x != x) ? y : x; }
+};
+
+template<typename A>
+struct HostFuncPreMulSum: HostFuncSum<A> {
+  static const bool IsPreOpIdentity = false;
+  A scale;
+  HostFuncPreMulSum(A scale): scale(scale) {}
+  A preOp(A x) const { return x*scale; }
+};
+
+template<typename A>
+struct HostFuncSumPostDiv: HostFuncSum<A> {
+  static const bool IsPostOpIdentity = false;
+  int n;
+  HostFuncSumPostDiv(int n): n(n) {}
+  A postOp(A x) const { return A(x/n); }
+};
+
+template<typename Tr, typename Fn>
+static inline __attribute__((always_inline)) void hostReduceLoad(Fn fn, typename Tr::Acc* __restrict__ a, const typename Tr::Storage* __restrict__ src, int n, bool preOp) {
+  if (preOp) {
+    for (int i=0; i<n; i++) a[i] = Tr::round(fn.preOp(Tr::load(src[i])));
+  } else {
+    for (int i=0; i<n; i++) a[i] = Tr::load(src[i]);
+  }
+}
+
+template<typename T, typename Fn>
+HOST_REDUCE_CLONES static void hostReduceRun(Fn fn, void* dstPtr, const void* const* srcPtrs, int nSrcs, size_t count, int nPreOpSrcs, bool postOp) {
+  typedef HostReduceTraits<T> Tr;
+  typedef typename Tr::Storage S;
+  typedef typename Tr::Acc A;
+  S* dst = (S*)dstPtr;
+  if (Fn::IsPreOpIdentity) nPreOpSrcs = 0;
+  if (Fn::IsPostOpIdentity) postOp = false;
+  A acc[HOST_REDUCE_BLOCK], in[HOST_REDUCE_BLOCK];
+  for (size_t offset=0; offset<count; offset+=HOST_REDUCE_BLOCK) {
+    int n = (int)std::min((size_t)HOST_REDUCE_BLOCK, count-offset);
+    hostReduceLoad<Tr>(fn, acc, (const S*)srcPtrs[0]+offset, n, nPreOpSrcs > 0);
+    for (int s=1; s<nSrcs; s++) {
+      hostReduceLoad<Tr>(fn, in, (const S*)srcPtrs[s]+offset, n, s < nPreOpSrcs);
+      for (int i=0; i<n; i++) acc[i] = Tr::round(fn(acc[i], in[i]));
+    }
+    if (postOp) {
+      for (int i=0; i<n; i++) dst[offset+i] = Tr::store(fn.postOp(acc[i]));
+    } else {
+      for (int i=0; i<n; i++) dst[offset+i] = Tr::store(acc[i]);
+    }
+  }
+}
+
+template<typename T>
+static ncclResult_t hostReduceType(void* dst, const void* const* srcs, int nSrcs, size_t count,
+    struct ncclDevRedOpFull opFull, int nPreOpSrcs, bool postOp) {
+  typedef HostReduceTraits<T> Tr;
+  typedef typename Tr::Storage S;
+  typedef typename Tr::Acc A;
+  switch (opFull.op) {
+  case ncclDevSum:
+    hostReduceRun<T>(HostFuncSum<A>(), dst, srcs, nSrcs, count, nPreOpSrcs, postOp);
+    break;
+  case ncclDevProd:
+    hostReduceRun<T>(HostFuncProd<A>(), dst, srcs, nSrcs, count, nPreOpSrcs, postOp);
+    break;
+  case ncclDevMax:
+    hostReduceRun<T>(HostFuncMax<A>(), dst, srcs, nSrcs, count, nPreOpSrcs, postOp);
+    break;
+  case ncclDevMin:
+    hostReduceRun<T>(HostFuncMin<A>(), dst, srcs, nSrcs, count, nPreOpSrcs, postOp);
+    break;
+  case ncclDevPreMulSum: {
+    // The scalar is stored in the low bytes of scalarArg, or pointed to by it
+    S scale;
+    memcpy(&scale, opFull.scalarArgIsPtr ? (void*)opFull.scalarArg : (void*)&opFull.scalarArg, sizeof(S));
+    hostReduceRun<T>(HostFuncPreMulSum<A>(Tr::load(scale)), dst, srcs, nSrcs, count, nPreOpSrcs, postOp);
+    break;
+  }
+  case ncclDevSumPostDiv:
+    if (Tr::IsFloat) {
+      WARN("Host reduce : SumPostDiv is only defined for integral types");
+      return ncclInvalidArgument;
+    }
+    hostReduceRun<T>(HostFuncSumPostDiv<A>((int)opFull.scalarArg), dst, srcs, nSrcs, count, nPreOpSrcs, postOp);
+    break;
+  default:
+    WARN("Host reduce : invalid reduction operation %d", opFull.op);
+    return ncclInvalidArgument;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclHostReduce(void* dst, const void* const* srcs, int nSrcs, size_t count, ncclDataType_t datatype,
+    struct ncclDevRedOpFull opFull, int nPreOpSrcs, bool postOp) {
+  if (nSrcs < 1) {
+    WARN("Host reduce : at least one source is needed");
+    return ncclInvalidArgument;
+  }
+  switch (datatype) {
+  case ncclInt8:    return hostReduceType<int8_t>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclUint8:   return hostReduceType<uint8_t>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclInt32:   return hostReduceType<int32_t>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclUint32:  return hostReduceType<uint32_t>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclInt64:   return hostReduceType<int64_t>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclUint64:  return hostReduceType<uint64_t>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclFloat16: return hostReduceType<HostHalf>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclFloat32: return hostReduceType<float>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+  case ncclFloat64: return hostReduceType<double>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+#if defined(__CUDA_BF16_TYPES_EXIST__)
+  case ncclBfloat16: return hostReduceType<HostBfloat16>(dst, srcs, nSrcs, count, opFull, nPreOpSrcs, postOp);
+#endif
+  default:
+    WARN("Host reduce : invalid datatype %d", datatype);
+    return ncclInvalidArgument;
+  }
+}
@@ -0,0 +1,211 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "iouring.h"
+#include "checks.h"
+#include "socket.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define NCCL_HAVE_IO_URING_H
+#endif
+#endif
+
+// IO_URING_OP_SUPPORTED comes with the probe interface and IORING_OP_SEND/RECV (Linux 5.6).
+#if defined(NCCL_HAVE_IO_URING_H) && defined(IO_URING_OP_SUPPORTED) && \
+    defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+
+static int ioUringSetup(unsigned entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+// Kernels 5.1 to 5.5 have io_uring but not the socket operations : io_uring_setup succeeds, then each
+// send/recv completes with -EINVAL. Check that every operation we use is supported. The probe itself
+// appeared with IORING_OP_SEND/RECV, so it failing also means they are missing.
+static ncclResult_t ioUringProbe(int fd) {
+  const int ops[] = { IORING_OP_SEND, IORING_OP_RECV, IORING_OP_POLL_ADD, IORING_OP_READ };
+  const int nOps = 256;
+  struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, sizeof(struct io_uring_probe)+nOps*sizeof(struct io_uring_probe_op));
+  if (probe == NULL) return ncclSystemError;
+  ncclResult_t ret = ncclSuccess;
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nOps) < 0) {
+    INFO(NCCL_NET, "io_uring probe failed : %s", strerror(errno));
+    ret = ncclSystemError;
+    goto exit;
+  }
+  for (int i=0; i<sizeof(ops)/sizeof(ops[0]); i++) {
+    if (ops[i] > probe->last_op || (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) == 0) {
+      INFO(NCCL_NET, "io_uring operation %d not supported by the kernel", ops[i]);
+      ret = ncclSystemError;
+      goto exit;
+    }
+  }
+exit:
+  free(probe);
+  return ret;
+}
+
+ncclResult_t ncclIoUringInit(struct ncclIoUring* ring, unsigned entries) {
+  struct io_uring_params p;
+  memset(ring, 0, sizeof(struct ncclIoUring));
+  memset(&p, 0, sizeof(p));
+  ring->fd = ioUringSetup(entries, &p);
+  if (ring->fd < 0) {
+    INFO(NCCL_NET, "io_uring_setup failed : %s", strerror(errno));
+    ring->fd = -1;
+    return ncclSystemError;
+  }
+  if (ioUringProbe(ring->fd) != ncclSuccess) {
+    ncclIoUringClose(ring);
+    return ncclSystemError;
+  }
+  ring->entries = p.sq_entries;
+  ring->sqRingSize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  ring->cqRingSize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  ring->sqesSize = p.sq_entries*sizeof(struct io_uring_sqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+    ring->cqRingSize = ring->sqRingSize;
+  }
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cqRing = ring->sqRing;
+  } else {
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) goto fail;
+  }
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) goto fail;
+
+  ring->sqHead = (unsigned*)((char*)ring->sqRing + p.sq_off.head);
+  ring->sqTail = (unsigned*)((char*)ring->sqRing + p.sq_off.tail);
+  ring->sqMask = (unsigned*)((char*)ring->sqRing + p.sq_off.ring_mask);
+  ring->sqArray = (unsigned*)((char*)ring->sqRing + p.sq_off.array);
+  ring->cqHead = (unsigned*)((char*)ring->cqRing + p.cq_off.head);
+  ring->cqTail = (unsigned*)((char*)ring->cqRing + p.cq_off.tail);
+  ring->cqMask = (unsigned*)((char*)ring->cqRing + p.cq_off.ring_mask);
+  ring->cqes = (char*)ring->cqRing + p.cq_off.cqes;
+  ring->sqLocalTail = *ring->sqTail;
+  return ncclSuccess;
+fail:
+  WARN("io_uring mmap failed : %s", strerror(errno));
+  ncclIoUringClose(ring);
+  return ncclSystemError;
+}
+
+static ncclResult_t ioUringGetSqe(struct ncclIoUring* ring, struct io_uring_sqe** sqe) {
+  unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+  if (ring->sqLocalTail - head >= ring->entries) {
+    WARN("io_uring submission queue full (%d entries)", ring->entries);
+    return ncclInternalError;
+  }
+  unsigned index = ring->sqLocalTail & *ring->sqMask;
+  *sqe = ((struct io_uring_sqe*)ring->sqes)+index;
+  memset(*sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sqArray[index] = index;
+  ring->sqLocalTail++;
+  ring->toSubmit++;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIoUringPrepSocket(struct ncclIoUring* ring, int op, int fd, void* data, int size, uint64_t userData) {
+  struct io_uring_sqe* sqe;
+  NCCLCHECK(ioUringGetSqe(ring, &sqe));
+  sqe->opcode = op == NCCL_SOCKET_SEND ? IORING_OP_SEND : IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)data;
+  sqe->len = size;
+  sqe->msg_flags = op == NCCL_SOCKET_SEND ? MSG_NOSIGNAL : 0;
+  sqe->user_data = userData;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIoUringPrepPoll(struct ncclIoUring* ring, int op, int fd, uint64_t userData) {
+  struct io_uring_sqe* sqe;
+  NCCLCHECK(ioUringGetSqe(ring, &sqe));
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll_events = op == NCCL_SOCKET_SEND ? POLLOUT : POLLIN;
+  sqe->user_data = userData;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIoUringPrepRead(struct ncclIoUring* ring, int fd, void* data, int size, uint64_t userData) {
+  struct io_uring_sqe* sqe;
+  NCCLCHECK(ioUringGetSqe(ring, &sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)data;
+  sqe->len = size;
+  sqe->off = (uint64_t)-1;
+  sqe->user_data = userData;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIoUringSubmit(struct ncclIoUring* ring, unsigned waitNr) {
+  __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+  while (1) {
+    int ret = ioUringEnter(ring->fd, ring->toSubmit, waitNr, waitNr ? IORING_ENTER_GETEVENTS : 0);
+    if (ret >= 0) {
+      ring->toSubmit -= ret;
+      return ncclSuccess;
+    }
+    if (errno != EINTR) {
+      WARN("io_uring_enter failed : %s", strerror(errno));
+      return ncclSystemError;
+    }
+  }
+}
+
+ncclResult_t ncclIoUringReap(struct ncclIoUring* ring, uint64_t* userData, int* res, int* found) {
+  unsigned head = *ring->cqHead;
+  *found = 0;
+  if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) return ncclSuccess;
+  struct io_uring_cqe* cqe = ((struct io_uring_cqe*)ring->cqes)+(head & *ring->cqMask);
+  *userData = cqe->user_data;
+  *res = cqe->res;
+  *found = 1;
+  __atomic_store_n(ring->cqHead, head+1, __ATOMIC_RELEASE);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclIoUringClose(struct ncclIoUring* ring) {
+  if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqRing && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+  if (ring->sqRing && ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+  if (ring->fd >= 0) close(ring->fd);
+  memset(ring, 0, sizeof(struct ncclIoUring));
+  ring->fd = -1;
+  return ncclSuccess;
+}
+
+#else
+
+ncclResult_t ncclIoUringInit(struct ncclIoUring* ring, unsigned entries) {
+  memset(ring, 0, sizeof(struct ncclIoUring));
+  ring->fd = -1;
+  INFO(NCCL_NET, "io_uring not supported by this build");
+  return ncclSystemError;
+}
+ncclResult_t ncclIoUringPrepSocket(struct ncclIoUring* ring, int op, int fd, void* data, int size, uint64_t userData) { return ncclInternalError; }
+ncclResult_t ncclIoUringPrepPoll(struct ncclIoUring* ring, int op, int fd, uint64_t userData) { return ncclInternalError; }
+ncclResult_t ncclIoUringPrepRead(struct ncclIoUring* ring, int fd, void* data, int size, uint64_t userData) { return ncclInternalError; }
+ncclResult_t ncclIoUringSubmit(struct ncclIoUring* ring, unsigned waitNr) { return ncclInternalError; }
+ncclResult_t ncclIoUringReap(struct ncclIoUring* ring, uint64_t* userData, int* res, int* found) { *found = 0; return ncclInternalError; }
+ncclResult_t ncclIoUringClose(struct ncclIoUring* ring) { return ncclSuccess; }
+
+#endif
@@ -0,0 +1,131 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "plancache.h"
+#include "comm.h"
+
+NCCL_PARAM(PlanCache, "PLAN_CACHE", 1);
+NCCL_PARAM(PlanCacheEntries, "PLAN_CACHE_ENTRIES", 16);
+
+static inline uint64_t hashMix(uint64_t h, uint64_t v) {
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+// Sendbuff and recvbuff are not part of the key, they are patched on replay.
+static inline bool taskKeyEqual(struct ncclTaskColl const* a, struct ncclTaskColl const* b) {
+  return a->func == b->func && a->count == b->count && a->root == b->root && a->datatype == b->datatype &&
+    a->op.op == b->op.op && a->op.scalarArgIsPtr == b->op.scalarArgIsPtr && a->op.scalarArg == b->op.scalarArg &&
+    a->chunkSteps == b->chunkSteps && a->sliceSteps == b->sliceSteps;
+}
+
+ncclResult_t ncclPlanCacheBegin(struct ncclComm* comm, bool persistent) {
+  struct ncclPlanCache* cache = comm->planCache;
+  if (cache) cache->current = NULL;
+  // Graphs already replay their plans, and the autotuner changes its decisions.
+  if (persistent || comm->autotune || !ncclParamPlanCache()) return ncclSuccess;
+  if (cache == NULL) {
+    int nEntries = ncclParamPlanCacheEntries();
+    if (nEntries <= 0) return ncclSuccess;
+    NCCLCHECK(ncclCalloc(&cache, 1));
+    NCCLCHECK(ncclCalloc(&cache->entries, nEntries));
+    cache->nEntries = nEntries;
+    comm->planCache = cache;
+  }
+
+  struct ncclTasks* tasks = &comm->tasks;
+  uint64_t hash = tasks->nTasksColl;
+  for (struct ncclTaskColl* t = ncclIntruQueueHead(&tasks->collQueue); t; t = t->next) {
+    hash = hashMix(hash, t->func | (uint64_t)t->datatype<<8 | (uint64_t)t->op.op<<16 | (uint64_t)(uint32_t)t->root<<32);
+    hash = hashMix(hash, t->count);
+    hash = hashMix(hash, t->op.scalarArg);
+    hash = hashMix(hash, t->chunkSteps | (uint64_t)t->sliceSteps<<32);
+  }
+
+  struct ncclPlanCacheEntry* entry = cache->entries + hash%cache->nEntries;
+  cache->current = entry;
+  cache->cursor = 0;
+  if (entry->valid && entry->hash == hash && entry->nOps == tasks->nTasksColl) {
+    struct ncclTaskColl* t = ncclIntruQueueHead(&tasks->collQueue);
+    int i = 0;
+    while (t && taskKeyEqual(t, entry->keys+i)) { t = t->next; i++; }
+    if (t == NULL) {
+      cache->replay = true;
+      cache->hits++;
+      return ncclSuccess;
+    }
+  }
+
+  // Miss : record this group in place of the entry
+  cache->replay = false;
+  cache->misses++;
+  entry->valid = false;
+  entry->hash = hash;
+  entry->nOps = tasks->nTasksColl;
+  if (entry->maxOps < entry->nOps) {
+    free(entry->keys);
+    free(entry->ops);
+    entry->keys = NULL;
+    entry->ops = NULL;
+    entry->maxOps = 0;
+    NCCLCHECK(ncclCalloc(&entry->keys, entry->nOps));
+    NCCLCHECK(ncclCalloc(&entry->ops, entry->nOps));
+    entry->maxOps = entry->nOps;
+  }
+  int i = 0;
+  for (struct ncclTaskColl* t = ncclIntruQueueHead(&tasks->collQueue); t; t = t->next) {
+    entry->keys[i] = *t;
+    entry->keys[i].next = NULL;
+    i++;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclPlanCacheRecord(struct ncclComm* comm, int workFuncIndex, struct ncclWorkElem const* workElem,
+    struct ncclProxyOp const* proxyOp, int nChannels, int nThreads, size_t nBytes) {
+  struct ncclPlanCache* cache = comm->planCache;
+  if (cache == NULL || cache->current == NULL || cache->replay) return ncclSuccess;
+  if (cache->cursor >= cache->current->nOps) {
+    WARN("Plan cache : recorded more operations than the %d of the group", cache->current->nOps);
+    return ncclInternalError;
+  }
+  struct ncclPlanCacheOp* op = cache->current->ops + cache->cursor++;
+  op->workFuncIndex = workFuncIndex;
+  op->nChannels = nChannels;
+  op->nThreads = nThreads;
+  op->nBytes = nBytes;
+  op->workElem = *workElem;
+  op->proxyOp = *proxyOp;
+  return ncclSuccess;
+}
+
+void ncclPlanCacheAbort(struct ncclComm* comm) {
+  struct ncclPlanCache* cache = comm->planCache;
+  if (cache == NULL || cache->current == NULL || cache->replay) return;
+  cache->current = NULL;
+}
+
+void ncclPlanCacheEnd(struct ncclComm* comm) {
+  struct ncclPlanCache* cache = comm->planCache;
+  if (cache == NULL || cache->current == NULL) return;
+  struct ncclPlanCacheEntry* entry = cache->current;
+  if (!cache->replay && cache->cursor == entry->nOps) entry->valid = true;
+  cache->current = NULL;
+}
+
+ncclResult_t ncclPlanCacheFree(struct ncclComm* comm) {
+  struct ncclPlanCache* cache = comm->planCache;
+  if (cache == NULL) return ncclSuccess;
+  INFO(NCCL_INIT, "comm %p rank %d plan cache %lu hits %lu misses", comm, comm->rank, cache->hits, cache->misses);
+  for (int e=0; e<cache->nEntries; e++) {
+    free(cache->entries[e].keys);
+    free(cache->entries[e].ops);
+  }
+  free(cache->entries);
+  free(cache);
+  comm->planCache = NULL;
+  return ncclSuccess;
+}
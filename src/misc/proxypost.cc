@@ -0,0 +1,72 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "proxypost.h"
+#include "proxy.h"
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static bool proxyHasPostedOps(struct ncclProxyOpsPool* pool, int nRanks) {
+  for (int r=0; r<nRanks; r++) {
+    if (__atomic_load_n(&pool->posted[r].tail, __ATOMIC_ACQUIRE) != pool->posted[r].head) return true;
+  }
+  return false;
+}
+
+// The pool lives in shared memory and may be posted to from other processes, hence no FUTEX_PRIVATE_FLAG.
+// Posters publish their ops before checking sleeping, and the progress thread sets sleeping before
+// checking for ops, so one of them always sees the other.
+void ncclProxyRingDoorbell(struct ncclProxyOpsPool* pool) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->sleeping, __ATOMIC_RELAXED)) {
+    __atomic_add_fetch(&pool->doorbell, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &pool->doorbell, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+void ncclProxyWaitDoorbell(struct ncclProxyOpsPool* pool, int nRanks, bool* stop, int64_t timeoutUsec) {
+  uint32_t doorbell = __atomic_load_n(&pool->doorbell, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!proxyHasPostedOps(pool, nRanks) && __atomic_load_n(stop, __ATOMIC_SEQ_CST) == false) {
+    struct timespec ts;
+    ts.tv_sec = timeoutUsec / 1000000;
+    ts.tv_nsec = (timeoutUsec % 1000000) * 1000;
+    syscall(SYS_futex, &pool->doorbell, FUTEX_WAIT, doorbell, timeoutUsec < 0 ? NULL : &ts, NULL, 0);
+  }
+  __atomic_store_n(&pool->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+ncclResult_t ncclProxyPost(struct ncclProxyOpsPool* pool, int localRank, int first, int last) {
+  struct ncclProxyPostRing* ring = pool->posted+localRank;
+  uint64_t tail = ring->tail;
+  ring->chains[tail%NCCL_PROXY_POST_RING_SIZE].first = first;
+  ring->chains[tail%NCCL_PROXY_POST_RING_SIZE].last = last;
+  __atomic_store_n(&ring->tail, tail+1, __ATOMIC_RELEASE);
+  ncclProxyRingDoorbell(pool);
+  return ncclSuccess;
+}
+
+int ncclProxyGetPostedChains(struct ncclProxyOpsPool* pool, int nRanks) {
+  int first = -1, last = -1;
+  for (int r=0; r<nRanks; r++) {
+    struct ncclProxyPostRing* ring = pool->posted+r;
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) continue;
+    for (; head<tail; head++) {
+      struct ncclProxyPostedChain* chain = ring->chains+head%NCCL_PROXY_POST_RING_SIZE;
+      if (first == -1) first = chain->first;
+      else pool->ops[last].next = chain->first;
+      last = chain->last;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+  }
+  return first;
+}
@@ -12,25 +12,41 @@
 #include <ifaddrs.h>
 #include <net/if.h>
 
-static ncclResult_t socketProgressOpt(int op, struct ncclSocket* sock, void* ptr, int size, int* offset, int block, int* closed) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(__has_include)
+#if __has_include(<linux/errqueue.h>)
+#include <linux/errqueue.h>
+#define NCCL_SOCKET_ZEROCOPY
+#endif
+#endif
+
+// zcSeq != NULL requests a MSG_ZEROCOPY send. Each successful send() call consumes one
+// completion id, which we count in *zcSeq so the caller can match error queue notifications.
+static ncclResult_t socketProgressOpt(int op, struct ncclSocket* sock, void* ptr, int size, int* offset, int block, int* closed, uint32_t* zcSeq = NULL) {
   int bytes = 0;
   *closed = 0;
   char* data = (char*)ptr;
   char line[SOCKET_NAME_MAXLEN+1];
+  int sendFlags = block ? MSG_NOSIGNAL : MSG_DONTWAIT | MSG_NOSIGNAL;
+#ifdef NCCL_SOCKET_ZEROCOPY
+  if (zcSeq) sendFlags |= MSG_ZEROCOPY;
+#endif
   do {
     if (op == NCCL_SOCKET_RECV) bytes = recv(sock->fd, data+(*offset), size-(*offset), block ? 0 : MSG_DONTWAIT);
-    if (op == NCCL_SOCKET_SEND) bytes = send(sock->fd, data+(*offset), size-(*offset), block ? MSG_NOSIGNAL : MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (op == NCCL_SOCKET_SEND) bytes = send(sock->fd, data+(*offset), size-(*offset), sendFlags);
     if (op == NCCL_SOCKET_RECV && bytes == 0) {
       *closed = 1;
       return ncclSuccess;
     }
     if (bytes == -1) {
-      if (errno != EINTR && errno != EWOULDBLOCK && errno != EAGAIN) {
+      // ENOBUFS means we exceeded the optmem limit with pinned zero-copy pages; retry once completions are reaped.
+      if (errno != EINTR && errno != EWOULDBLOCK && errno != EAGAIN && !(zcSeq && errno == ENOBUFS)) {
         WARN("socketProgressOpt: Call to recv from %s failed : %s", ncclSocketToString(&sock->addr, line), strerror(errno));
         return ncclRemoteError;
       } else {
         bytes = 0;
       }
+    } else if (zcSeq) {
+      (*zcSeq)++;
     }
     (*offset) += bytes;
     if (sock->abortFlag && *sock->abortFlag != 0) {
@@ -747,6 +763,62 @@ ncclResult_t ncclSocketProgress(int op, struct ncclSocket* sock, void* ptr, int
   return ncclSuccess;
 }
 
+ncclResult_t ncclSocketSetZeroCopy(struct ncclSocket* sock, int* enabled) {
+  *enabled = 0;
+  if (sock == NULL) {
+    WARN("ncclSocketSetZeroCopy: pass NULL socket");
+    return ncclInvalidArgument;
+  }
+#ifdef NCCL_SOCKET_ZEROCOPY
+  int opt = 1;
+  if (setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) == 0) {
+    *enabled = 1;
+  } else {
+    INFO(NCCL_NET, "ncclSocketSetZeroCopy: setsockopt(SO_ZEROCOPY) failed : %s", strerror(errno));
+  }
+#endif
+  return ncclSuccess;
+}
+
+ncclResult_t ncclSocketProgressZeroCopy(struct ncclSocket* sock, void* ptr, int size, int* offset, uint32_t* zcSeq) {
+  int closed;
+  if (sock == NULL) {
+    WARN("ncclSocketProgressZeroCopy: pass NULL socket");
+    return ncclInvalidArgument;
+  }
+  NCCLCHECK(socketProgressOpt(NCCL_SOCKET_SEND, sock, ptr, size, offset, 0, &closed, zcSeq));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclSocketZeroCopyReap(struct ncclSocket* sock, uint32_t* zcDone) {
+  if (sock == NULL) {
+    WARN("ncclSocketZeroCopyReap: pass NULL socket");
+    return ncclInvalidArgument;
+  }
+#ifdef NCCL_SOCKET_ZEROCOPY
+  while (1) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return ncclSuccess;
+      char line[SOCKET_NAME_MAXLEN+1];
+      WARN("ncclSocketZeroCopyReap: Call to recvmsg(MSG_ERRQUEUE) on %s failed : %s", ncclSocketToString(&sock->addr, line), strerror(errno));
+      return ncclSystemError;
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+      // Notifications cover the range [ee_info, ee_data] of completion ids
+      if ((int32_t)(serr->ee_data + 1 - *zcDone) > 0) *zcDone = serr->ee_data + 1;
+    }
+  }
+#endif
+  return ncclSuccess;
+}
+
 ncclResult_t ncclSocketWait(int op, struct ncclSocket* sock, void* ptr, int size, int* offset) {
   if (sock == NULL) {
     WARN("ncclSocketWait: pass NULL socket");
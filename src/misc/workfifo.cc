@@ -0,0 +1,80 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "workfifo.h"
+#include "comm.h"
+#include <sched.h>
+#include <time.h>
+
+// Waiting for the fifo : spin for WAIT_SPIN us, then yield until WAIT_YIELD us,
+// then sleep, doubling the sleep up to WAIT_MAX_SLEEP us (0 : always yield).
+NCCL_PARAM(WorkFifoWaitSpin, "WORK_FIFO_WAIT_SPIN", 5);
+NCCL_PARAM(WorkFifoWaitYield, "WORK_FIFO_WAIT_YIELD", 100);
+NCCL_PARAM(WorkFifoWaitMaxSleep, "WORK_FIFO_WAIT_MAX_SLEEP", 64);
+
+static inline bool rollingLess32(uint32_t a, uint32_t b) {
+  constexpr uint32_t PositiveMax = uint32_t(-1)>>1;
+  return a-b > PositiveMax;
+}
+
+static inline uint32_t rollingMin32(uint32_t a, uint32_t b) {
+  constexpr uint32_t PositiveMax = uint32_t(-1)>>1;
+  return (b-a <= PositiveMax) ? a : b;
+}
+
+void ncclWorkFifoPost(struct ncclComm* comm, int c, uint32_t ixFirst, uint32_t doneAcks) {
+  uint64_t bit = 1ULL<<c;
+  if ((comm->workFifoPendingMask & bit) == 0) {
+    // The channel acked all its previous work, so the device will not write its
+    // counter before reading this new work. Restart the counter from here so
+    // that it never lags far enough behind to get lost in 32-bit wraparound.
+    __atomic_store_n(&comm->workFifoDone[c], ixFirst, __ATOMIC_RELAXED);
+    comm->workFifoPendingMask |= bit;
+  }
+  comm->channels[c].workFifoSent = doneAcks;
+}
+
+void ncclWorkFifoWaitAvailable(struct ncclComm* comm, uint32_t desiredSent) {
+  if (__builtin_expect(!rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent), true)) return;
+  uint64_t t0 = clockNano();
+  uint64_t spinNs = ncclParamWorkFifoWaitSpin()*1000;
+  uint64_t yieldNs = ncclParamWorkFifoWaitYield()*1000;
+  uint64_t maxSleepNs = ncclParamWorkFifoWaitMaxSleep()*1000;
+  uint64_t sleepNs = 1000;
+  while (1) {
+    // Only the channels with work in flight need to be polled.
+    uint32_t* doneLive = comm->workFifoDone;
+    uint64_t pending = comm->workFifoPendingMask;
+    uint32_t ackdAll = comm->workFifoSent;
+    for (uint64_t mask = pending; mask; mask &= mask-1) {
+      int c = __builtin_ctzll(mask);
+      uint32_t ackd = __atomic_load_n(&doneLive[c], __ATOMIC_RELAXED);
+      if (ackd == comm->channels[c].workFifoSent) {
+        pending ^= 1ULL<<c; // Quiesced
+      } else {
+        ackdAll = rollingMin32(ackdAll, ackd);
+      }
+    }
+    comm->workFifoPendingMask = pending;
+    comm->workFifoAckdMin = ackdAll;
+
+    // See if that was enough.
+    if (!rollingLess32(comm->workFifoAckdMin + comm->workFifoDepth, desiredSent)) break;
+    uint64_t waited = clockNano() - t0;
+    if (waited < spinNs) continue;
+    if (waited < yieldNs || maxSleepNs == 0) {
+      sched_yield();
+    } else {
+      struct timespec ts = { 0, (long)sleepNs };
+      nanosleep(&ts, NULL);
+      sleepNs = std::min(2*sleepNs, maxSleepNs);
+    }
+  }
+  uint64_t waited = clockNano() - t0;
+  comm->workFifoStalls++;
+  comm->workFifoStallNs += waited;
+  TRACE(NCCL_INIT, "Work fifo full, waited %lu ns for slot %u", waited, desiredSent);
+}
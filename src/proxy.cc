@@ -10,6 +10,7 @@
 #include "socket.h"
 #include "shm.h"
 #include "profiler.h"
+#include "proxypost.h"
 #define ENABLE_TIMER 0
 #include "timer.h"
 
@@ -37,9 +38,9 @@ struct ncclProxyPool {
   struct ncclProxyArgs elems[PROXYARGS_ALLOCATE_SIZE];
 };
 
-static ncclResult_t allocateArgs(struct ncclProxyProgressState* state, struct ncclProxyArgs** argsptr) {
+static ncclResult_t allocateArgs(struct ncclProxyProgressShard* shard, struct ncclProxyArgs** argsptr) {
   struct ncclProxyArgs* elem;
-  if (state->pool == NULL) {
+  if (shard->pool == NULL) {
     // Allocate a new pool of elements. Make sure we allocate the memory close
     // to the network thread
     struct ncclProxyPool* newPool;
@@ -51,13 +52,13 @@ static ncclResult_t allocateArgs(struct ncclProxyProgressState* state, struct nc
       if (i+1 < PROXYARGS_ALLOCATE_SIZE) newElems[i].next = newElems+i+1;
     }
     // Add them all to the pool list
-    state->pool = newElems;
+    shard->pool = newElems;
     // Save the pool memory block for later resource release
-    newPool->next = state->pools;
-    state->pools = newPool;
+    newPool->next = shard->pools;
+    shard->pools = newPool;
   }
-  elem = state->pool;
-  state->pool = state->pool->next;
+  elem = shard->pool;
+  shard->pool = shard->pool->next;
   elem->next = elem->nextPeer = NULL;
   *argsptr = elem;
   return ncclSuccess;
@@ -70,11 +71,11 @@ static ncclResult_t allocateArgs(struct ncclProxyProgressState* state, struct nc
 #define DEBUG_PROXY_PRINT(...)
 #endif
 
-#define OP_INDEX(op) ((op) ? (op)-state->pools->elems : -1)
+#define OP_INDEX(op) ((op) ? (op)-shard->pools->elems : -1)
 #define OP_SEEN 0x100000
 
-ncclResult_t getOpIndex(struct ncclProxyArgs* op, struct ncclProxyProgressState* state, int* poolIndex, int* opIndex) {
-  struct ncclProxyPool* pool = state->pools;
+ncclResult_t getOpIndex(struct ncclProxyArgs* op, struct ncclProxyProgressShard* shard, int* poolIndex, int* opIndex) {
+  struct ncclProxyPool* pool = shard->pools;
   int p = 0;
   while (pool) {
     uint64_t o = op-pool->elems;
@@ -117,12 +118,12 @@ ncclResult_t printProxyOp(struct ncclProxyArgs* op, int poolIndex, int opIndex)
   printf("]");
   return ncclSuccess;
 }
-ncclResult_t dumpProxyState(struct ncclProxyProgressState* state) {
-  struct ncclProxyArgs* op = state->active;
+ncclResult_t dumpProxyState(struct ncclProxyProgressShard* shard) {
+  struct ncclProxyArgs* op = shard->active;
   int poolIndex, opIndex;
   printf("ACTIVE OPS\n");
   while (op) {
-    NCCLCHECK(getOpIndex(op, state, &poolIndex, &opIndex));
+    NCCLCHECK(getOpIndex(op, shard, &poolIndex, &opIndex));
     if (op->state & OP_SEEN) {
       WARN("List loop at element %d-%d", poolIndex, opIndex);
     }
@@ -131,7 +132,7 @@ ncclResult_t dumpProxyState(struct ncclProxyProgressState* state) {
     printf("\n");
     struct ncclProxyArgs* nextOp = op->nextPeer;
     while (nextOp) {
-      NCCLCHECK(getOpIndex(nextOp, state, &poolIndex, &opIndex));
+      NCCLCHECK(getOpIndex(nextOp, shard, &poolIndex, &opIndex));
       if (nextOp->state & OP_SEEN) {
         WARN("List loop at element %d-%d", poolIndex, opIndex);
       }
@@ -152,9 +153,9 @@ ncclResult_t dumpProxyState(struct ncclProxyProgressState* state) {
 
 # if 0
   printf("FREE OPS\n");
-  op = state->pool;
+  op = shard->pool;
   while (op) {
-    NCCLCHECK(getOpIndex(op, state, &poolIndex, &opIndex));
+    NCCLCHECK(getOpIndex(op, shard, &poolIndex, &opIndex));
     if (op->state & OP_SEEN) {
       WARN("List loop at element %d-%d", poolIndex, opIndex);
     }
@@ -165,9 +166,9 @@ ncclResult_t dumpProxyState(struct ncclProxyProgressState* state) {
   }
   printf("[X]\n");
 #else
-  op = state->pool;
+  op = shard->pool;
   while (op) {
-    NCCLCHECK(getOpIndex(op, state, &poolIndex, &opIndex));
+    NCCLCHECK(getOpIndex(op, shard, &poolIndex, &opIndex));
     if (op->state & OP_SEEN) {
       WARN("List loop at element %d-%d", poolIndex, opIndex);
     }
@@ -176,7 +177,7 @@ ncclResult_t dumpProxyState(struct ncclProxyProgressState* state) {
   }
 #endif
 
-  struct ncclProxyPool* pool = state->pools;
+  struct ncclProxyPool* pool = shard->pools;
   poolIndex = 0;
   while (pool) {
     struct ncclProxyArgs* elem = pool->elems;
@@ -240,7 +241,30 @@ static ncclResult_t ncclProxyOpToArgs(struct ncclProxyOp* op, struct ncclProxyAr
   return ncclSuccess;
 }
 
-static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncclProxyOp* op) {
+// Max number of steps of a send/recv for it to be coalesced with the previous one on the same connection. 0 disables.
+NCCL_PARAM(ProxyP2pCoalesceSteps, "PROXY_P2P_COALESCE_STEPS", NCCL_STEPS);
+
+/* Consecutive small sends/recvs to the same peer would otherwise each get their own args, and each would
+ * only start once the previous one completed, costing a full network round trip per message. Instead,
+ * extend the sub of the previous op (if not started yet) so that both are pipelined. P2p ops use
+ * sliceSteps=chunkSteps=1, so the steps of consecutive ops on a connection are contiguous.
+ */
+static bool proxyCoalesceP2p(struct ncclProxyArgs* args, struct ncclProxyOp* op) {
+  if (op->pattern != ncclPatternSend && op->pattern != ncclPatternRecv) return false;
+  if (op->nsteps > ncclParamProxyP2pCoalesceSteps()) return false;
+  if (args->state != ncclProxyOpReady || args->pattern != op->pattern || args->protocol != op->protocol) return false;
+  if (op->sliceSteps != 1 || op->chunkSteps != 1 || args->sliceSteps != 1 || args->chunkSteps != 1) return false;
+  for (int s=0; s<args->nsubs; s++) {
+    struct ncclProxySubArgs* sub = args->subs+s;
+    if (sub->connection == op->connection && sub->nbytes == op->nbytes) {
+      sub->nsteps += op->nsteps;
+      return true;
+    }
+  }
+  return false;
+}
+
+static ncclResult_t ProxyAppend(struct ncclProxyProgressShard* shard, struct ncclProxyOp* op) {
   struct ncclProxyConnection* connection = op->connection;
   int shared = connection->shared;
   struct ncclProxyArgs* args = *connection->proxyAppendPtr;
@@ -249,9 +273,11 @@ static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncc
     if (shared && args->opCount == op->opCount) {
       NCCLCHECK(ncclProxyOpToArgs(op, args, args->nsubs));
       DEBUG_PROXY_PRINT("Insert (%d/%5ld/%5ld) as group with %5ld\n", shared, args->opCount, op->opCount, OP_INDEX(args));
+    } else if (proxyCoalesceP2p(args, op)) {
+      DEBUG_PROXY_PRINT("Coalesce (%d/%5ld/%5ld) into %5ld\n", shared, args->opCount, op->opCount, OP_INDEX(args));
     } else {
       struct ncclProxyArgs* prevArgs = args;
-      NCCLCHECK(allocateArgs(state, &args));
+      NCCLCHECK(allocateArgs(shard, &args));
       NCCLCHECK(ncclProxyOpToArgs(op, args, 0));
       prevArgs->nextPeer = args;
       DEBUG_PROXY_PRINT("Insert  %5ld (%d/%5ld/%5ld) as nextPeer of %5ld\n", OP_INDEX(args), shared, prevArgs->opCount, args->opCount, OP_INDEX(prevArgs));
@@ -259,15 +285,15 @@ static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncc
     }
   } else {
     // Nothing running for that peer. Add to the list
-    NCCLCHECK(allocateArgs(state, &args));
+    NCCLCHECK(allocateArgs(shard, &args));
     NCCLCHECK(ncclProxyOpToArgs(op, args, 0));
-    if (state->active == NULL) {
+    if (shard->active == NULL) {
       // Create the list
       DEBUG_PROXY_PRINT("Insert  %5ld (%d/%5ld) as first element\n", OP_INDEX(args), shared, args->opCount);
-      state->active = args;
+      shard->active = args;
     } else {
       // Append element at the end of the list
-      struct ncclProxyArgs* last = state->active;
+      struct ncclProxyArgs* last = shard->active;
       while (last->next) last = last->next;
       last->next = args;
       DEBUG_PROXY_PRINT("Insert  %5ld (%d/%5ld) as last element\n", OP_INDEX(args), shared, args->opCount);
@@ -277,19 +303,6 @@ static ncclResult_t ProxyAppend(struct ncclProxyProgressState* state, struct ncc
   return ncclSuccess;
 }
 
-ncclResult_t ncclProxyPost(struct ncclProxyOpsPool* pool, int nextOps, int nextOpsEnd) {
-  pthread_mutex_lock(&pool->mutex);
-  if (pool->nextOps == -1) {
-    pool->nextOps = nextOps;
-    pthread_cond_signal(&pool->cond);
-  } else {
-    pool->ops[pool->nextOpsEnd].next = nextOps;
-  }
-  pool->nextOpsEnd = nextOpsEnd;
-  pthread_mutex_unlock(&pool->mutex);
-  return ncclSuccess;
-}
-
 ncclResult_t ncclLocalOpAppend(struct ncclComm* comm, struct ncclProxyConnector* proxyConn, struct ncclProxyOp* proxyOp) {
   struct ncclProxyOps* proxyOps = proxyConn->comm->proxyState.proxyOps;
   if (proxyOps == NULL) return ncclInternalError;
@@ -344,7 +357,7 @@ ncclResult_t ncclLocalOpAppend(struct ncclComm* comm, struct ncclProxyConnector*
     int nextOps = proxyOps->nextOps;
     proxyOps->nextOps = pool->ops[lastOp].next;
     pool->ops[lastOp].next = -1;
-    NCCLCHECK(ncclProxyPost(proxyOps->pool, nextOps, lastOp));
+    NCCLCHECK(ncclProxyPost(proxyOps->pool, comm->localRank, nextOps, lastOp));
     proxyOps->count -= toSend;
   }
   TIME_STOP(0);
@@ -478,7 +491,7 @@ ncclResult_t ncclProxyComputeP2p(struct ncclInfo* info, struct ncclProxyOp* op)
   return ncclSuccess;
 }
 
-static ncclResult_t removeOp(struct ncclProxyProgressState* state, struct ncclProxyArgs** opPtr, struct ncclProxyArgs** prevOpPtr) {
+static ncclResult_t removeOp(struct ncclProxyProgressShard* shard, struct ncclProxyArgs** opPtr, struct ncclProxyArgs** prevOpPtr) {
   struct ncclProxyArgs* freeOp = *opPtr;
   struct ncclProxyArgs* next = freeOp->next;
   DEBUG_PROXY_PRINT("Remove %ld -> %ld -> %ld\n", OP_INDEX(*prevOpPtr), OP_INDEX(freeOp), OP_INDEX(next));
@@ -489,7 +502,7 @@ static ncclResult_t removeOp(struct ncclProxyProgressState* state, struct ncclPr
     if (*prevOpPtr) {
       (*prevOpPtr)->next = nextPeer;
     } else {
-      state->active = nextPeer;
+      shard->active = nextPeer;
     }
     nextPeer->next = next;
     *(prevOpPtr) = nextPeer;
@@ -498,19 +511,19 @@ static ncclResult_t removeOp(struct ncclProxyProgressState* state, struct ncclPr
     if (*prevOpPtr) {
       (*prevOpPtr)->next = next;
     } else {
-      state->active = next;
+      shard->active = next;
     }
   }
-  freeOp->next = state->pool;
-  state->pool = freeOp;
+  freeOp->next = shard->pool;
+  shard->pool = freeOp;
   DEBUG_PROXY_PRINT("Removed %5ld (%5ld) : ", OP_INDEX(freeOp), OP_INDEX(*freeOp->proxyAppendPtr));
 #ifdef DEBUG_PROXY
-  NCCLCHECK(dumpProxyState(state));
+  NCCLCHECK(dumpProxyState(shard));
 #endif
   return ncclSuccess;
 }
 
-static ncclResult_t progressOps(struct ncclComm* comm, struct ncclProxyProgressState* state, struct ncclProxyArgs* opStart, int* idle) {
+static ncclResult_t progressOps(struct ncclComm* comm, struct ncclProxyProgressShard* shard, struct ncclProxyArgs* opStart, int* idle) {
   struct ncclProxyArgs* prevOp = NULL;
   struct ncclProxyArgs* op = opStart;
   while (op) {
@@ -521,7 +534,7 @@ static ncclResult_t progressOps(struct ncclComm* comm, struct ncclProxyProgressS
     *idle &= op->idle;
     if (op->state == ncclProxyOpNone) {
       TIME_START(2);
-      NCCLCHECK(removeOp(state, &op, &prevOp));
+      NCCLCHECK(removeOp(shard, &op, &prevOp));
       TIME_STOP(2);
     } else {
       prevOp = op;
@@ -532,6 +545,90 @@ static ncclResult_t progressOps(struct ncclComm* comm, struct ncclProxyProgressS
 }
 
 NCCL_PARAM(ProxyAppendBatchSize, "PROXY_APPEND_BATCH_SIZE", 16);
+NCCL_PARAM(ProxyNThreads, "PROXY_NTHREADS", 1);
+
+// Connections sharing an append slot (shared net buffers are per channel, collnet per netDev) are
+// aggregated into the same args, so they need to be progressed by the same thread.
+static int proxyOpShard(struct ncclProxyProgressState* state, struct ncclProxyOp* op) {
+  if (state->nShards == 1) return 0;
+  struct ncclProxyConnection* connection = op->connection;
+  if (connection->proxyAppendPtr != &connection->proxyAppend) {
+    return ((uintptr_t)connection->proxyAppendPtr / sizeof(struct ncclProxyArgs*)) % state->nShards;
+  }
+  return op->channelId % state->nShards;
+}
+
+static ncclResult_t proxyOpsAppend(struct ncclProxyOp** ops, int* nOps, int* maxOps, struct ncclProxyOp* newOps, int nNewOps) {
+  if (*nOps + nNewOps > *maxOps) {
+    int newMax = std::max(std::max(2*(*maxOps), *nOps+nNewOps), 64);
+    NCCLCHECK(ncclRealloc(ops, *maxOps, newMax));
+    *maxOps = newMax;
+  }
+  memcpy(*ops+*nOps, newOps, nNewOps*sizeof(struct ncclProxyOp));
+  *nOps += nNewOps;
+  return ncclSuccess;
+}
+
+static ncclResult_t proxyRouteOp(struct ncclProxyProgressState* state, struct ncclProxyOp* op) {
+  int s = proxyOpShard(state, op);
+  if (s == 0) return ProxyAppend(state->shards, op);
+  struct ncclProxyProgressShard* shard = state->shards+s;
+  NCCLCHECK(proxyOpsAppend(&shard->staged, &shard->nStaged, &shard->maxStaged, op, 1));
+  return ncclSuccess;
+}
+
+// Hand staged ops over to their shard. Only called once a whole batch has been read, so that ops
+// which are aggregated together (same opCount) are never split across two hand-overs.
+static ncclResult_t proxyPublishRoutedOps(struct ncclProxyProgressState* state) {
+  for (int s=1; s<state->nShards; s++) {
+    struct ncclProxyProgressShard* shard = state->shards+s;
+    if (shard->nStaged == 0) continue;
+    pthread_mutex_lock(&shard->mutex);
+    ncclResult_t ret = proxyOpsAppend(&shard->routed, &shard->nRouted, &shard->maxRouted, shard->staged, shard->nStaged);
+    pthread_cond_signal(&shard->cond);
+    pthread_mutex_unlock(&shard->mutex);
+    NCCLCHECK(ret);
+    shard->nStaged = 0;
+  }
+  return ncclSuccess;
+}
+
+// Get ops routed to a secondary shard. Same logic as ncclProxyGetPostedOps : only block if we have nothing to progress.
+static ncclResult_t proxyShardGetRoutedOps(struct ncclProxyProgressState* state, struct ncclProxyProgressShard* shard, int* added) {
+  if (shard->active != NULL && (__atomic_load_n(&shard->nRouted, __ATOMIC_RELAXED) == 0 || pthread_mutex_trylock(&shard->mutex) != 0)) return ncclSuccess;
+
+  if (shard->active == NULL) {
+    pthread_mutex_lock(&shard->mutex);
+    while (shard->nRouted == 0 && !state->stop) pthread_cond_wait(&shard->cond, &shard->mutex);
+  }
+  // Swap buffers so that we append ops outside of the lock
+  struct ncclProxyOp* ops = shard->routed;
+  int nOps = shard->nRouted;
+  int maxOps = shard->maxRouted;
+  shard->routed = shard->consumed;
+  shard->maxRouted = shard->maxConsumed;
+  shard->nRouted = 0;
+  shard->consumed = ops;
+  shard->maxConsumed = maxOps;
+  pthread_mutex_unlock(&shard->mutex);
+
+  for (int i=0; i<nOps; i++) {
+    NCCLCHECK(ProxyAppend(shard, ops+i));
+    (*added)++;
+  }
+  return ncclSuccess;
+}
+
+static void proxyShardWait(struct ncclProxyProgressState* state, struct ncclProxyProgressShard* shard, int64_t timeoutUsec) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += timeoutUsec / 1000000;
+  ts.tv_nsec += (timeoutUsec % 1000000) * 1000;
+  if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+  pthread_mutex_lock(&shard->mutex);
+  if (shard->nRouted == 0 && !state->stop) pthread_cond_timedwait(&shard->cond, &shard->mutex, &ts);
+  pthread_mutex_unlock(&shard->mutex);
+}
 
 static ncclResult_t ncclProxyGetPostedOps(struct ncclComm* comm, int* added) {
   struct ncclProxyProgressState* state = &comm->proxyState.progressState;
@@ -541,29 +638,20 @@ static ncclResult_t ncclProxyGetPostedOps(struct ncclComm* comm, int* added) {
   struct ncclProxyArgs profArgs; // Only used for profiling purposes
   if (state->nextOps != -1) goto process_nextops;
 
-  // If we have ops to progress, no need to block waiting for something to arrive or even wait for the lock
-  // to be available. Exit, continue progress, and come back later.
-  if (state->active != NULL && (pool->nextOps == -1 || pthread_mutex_trylock(&pool->mutex) != 0)) return ncclSuccess;
-
-  if (state->active == NULL) {
-    pthread_mutex_lock(&pool->mutex);
-    while (pool->nextOps == -1 && !state->stop) {
-      struct ncclProxyArgs profArgs; // Only used for profiling purposes
-      ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileSleep);
-      pthread_cond_wait(&pool->cond, &pool->mutex);
-      ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileWakeup);
-    }
-    if (state->stop) { // We might have been woken up to stop.
-      pthread_mutex_unlock(&pool->mutex);
-      return ncclSuccess;
-    }
+  // If we have ops to progress, no need to block waiting for something to arrive.
+  // Exit, continue progress, and come back later.
+  state->nextOps = ncclProxyGetPostedChains(pool, comm->localRanks);
+  if (state->nextOps == -1 && state->shards[0].active != NULL) return ncclSuccess;
+
+  while (state->nextOps == -1) {
+    if (__atomic_load_n(&state->stop, __ATOMIC_SEQ_CST)) return ncclSuccess; // We might have been woken up to stop.
+    struct ncclProxyArgs profArgs; // Only used for profiling purposes
+    ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileSleep);
+    ncclProxyWaitDoorbell(pool, comm->localRanks, &state->stop, -1);
+    ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileWakeup);
+    state->nextOps = ncclProxyGetPostedChains(pool, comm->localRanks);
   }
 
-  state->nextOps = pool->nextOps;
-  pool->nextOps = pool->nextOpsEnd = -1;
-  pthread_mutex_unlock(&pool->mutex);
-  if (state->nextOps == -1) return ncclInternalError;
-
 process_nextops:
   ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileAppend);
   TIME_START(2);
@@ -583,7 +671,7 @@ process_nextops:
     lastPeer = peer;
     if (peerOp->connection == NULL) return ncclInternalError;
     if (peerOp->next != -1) __builtin_prefetch(pool->ops+peerOp->next);
-    NCCLCHECK(ProxyAppend(state, peerOp));
+    NCCLCHECK(proxyRouteOp(state, peerOp));
     (*added)++;
     int lastOpIndex = opIndex;
     opIndex = peerOp->next;
@@ -616,6 +704,7 @@ process_nextops:
       }
     }
   }
+  NCCLCHECK(proxyPublishRoutedOps(state));
   profArgs.opCount = *added;
   ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileAppendEnd);
   TIME_STOP(2);
@@ -625,7 +714,10 @@ process_nextops:
 #include <signal.h>
 static ncclProxyProgressState* ncclLastProxyState;
 void ncclDumpProxyState(int signal) {
-  dumpProxyState(ncclLastProxyState);
+  for (int s=0; s<ncclLastProxyState->nShards; s++) {
+    if (ncclLastProxyState->nShards > 1) printf("SHARD %d\n", s);
+    dumpProxyState(ncclLastProxyState->shards+s);
+  }
 }
 
 NCCL_PARAM(CreateThreadContext, "CREATE_THREAD_CONTEXT", 0);
@@ -664,9 +756,15 @@ ncclResult_t ncclSetThreadContext(struct ncclComm* comm) {
 // Set to SIGUSR1 or SIGUSR2 to help debug proxy state during hangs
 NCCL_PARAM(ProxyDumpSignal, "PROXY_DUMP_SIGNAL", -1);
 NCCL_PARAM(ProgressAppendOpFreq, "PROGRESS_APPENDOP_FREQ", 8);
-
-void* ncclProxyProgress(void *comm_) {
-  struct ncclComm* comm = (struct ncclComm*)comm_;
+// Time (usec) the progress thread keeps spinning on idle ops before it starts sleeping on the doorbell.
+// -1 disables sleeping (always spin).
+NCCL_PARAM(ProxySpinTime, "PROXY_SPIN_TIME", -1);
+// Maximum time (usec) to sleep between two polls of idle ops. Sleep time doubles from 1us up to this value.
+NCCL_PARAM(ProxyMaxSleepTime, "PROXY_MAX_SLEEP_TIME", 200);
+
+void* ncclProxyProgress(void *shard_) {
+  struct ncclProxyProgressShard* shard = (struct ncclProxyProgressShard*)shard_;
+  struct ncclComm* comm = shard->comm;
   if (ncclSetThreadContext(comm) != ncclSuccess) {
     WARN("[Proxy Progress] Failed to set CUDA context on device %d", comm->cudaDev);
   } else if (cudaSetDevice(comm->cudaDev) != cudaSuccess) {
@@ -675,10 +773,12 @@ void* ncclProxyProgress(void *comm_) {
   if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
 
   struct ncclProxyProgressState* state = &comm->proxyState.progressState;
-  state->nextOps = -1;
-  const int sig = ncclParamProxyDumpSignal();
-  if (sig != -1) signal(sig, ncclDumpProxyState);
-  ncclLastProxyState = state;
+  if (shard->id == 0) {
+    state->nextOps = -1;
+    const int sig = ncclParamProxyDumpSignal();
+    if (sig != -1) signal(sig, ncclDumpProxyState);
+    ncclLastProxyState = state;
+  }
   char threadName[NCCL_THREAD_NAMELEN];
   snprintf(threadName, NCCL_THREAD_NAMELEN, "NCCL Progress%2d", comm->cudaDev);
   nvtxNameOsThreadA(syscall(SYS_gettid), threadName);
@@ -691,9 +791,16 @@ void* ncclProxyProgress(void *comm_) {
    * frequency of calling ncclProxyGetPostedOps() and reduce the perf impact. */
   int proxyOpAppendCounter = 0;
   struct ncclProxyArgs profArgs; // Only used for profiling purposes
-  while ((state->stop == false || (state->stop == true && state->active)) && *comm->abortFlag == 0) {
+  /* Adaptive mode : once ops have been idle for ncclParamProxySpinTime(), sleep on the doorbell instead
+   * of yielding. We still need to poll the active ops (GPU and network progress do not ring the doorbell),
+   * so the sleep is bounded and grows exponentially while we stay idle. */
+  const int64_t spinTime = ncclParamProxySpinTime();
+  const int64_t maxSleepTime = std::max<int64_t>(1, ncclParamProxyMaxSleepTime());
+  uint64_t idleStart = 0;
+  int64_t sleepTime = 1;
+  while ((state->stop == false || (state->stop == true && shard->active)) && *comm->abortFlag == 0) {
     int idle = 1;
-    ncclResult_t ret = progressOps(comm, state, state->active, &idle);
+    ncclResult_t ret = progressOps(comm, shard, shard->active, &idle);
     if (ret != ncclSuccess) {
       (void) ncclCommSetAsyncError(comm, ret);
       INFO(NCCL_ALL,"%s:%d -> %d [Proxy Thread]", __FILE__, __LINE__, ret);
@@ -706,16 +813,37 @@ void* ncclProxyProgress(void *comm_) {
       proxyOpAppendCounter = 0;
       TIME_START(3);
       if (state->stop == false)
-        ret = ncclProxyGetPostedOps(comm, &added);
+        ret = shard->id == 0 ? ncclProxyGetPostedOps(comm, &added) : proxyShardGetRoutedOps(state, shard, &added);
       if (added) { TIME_STOP(3); } else { TIME_CANCEL(3); }
       if (ret != ncclSuccess) {
         (void) ncclCommSetAsyncError(comm, ret);
         INFO(NCCL_ALL,"%s:%d -> %d [Proxy Thread]", __FILE__, __LINE__, ret);
       }
       if (added == 0) {
-        sched_yield(); // No request progressed. Let others run.
+        bool sleep = false;
+        if (spinTime >= 0 && idle && state->stop == false) {
+          uint64_t now = clockNano();
+          if (idleStart == 0) idleStart = now;
+          sleep = now - idleStart >= spinTime*1000;
+        }
+        if (sleep) {
+          ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileSleep);
+          if (shard->id == 0) ncclProxyWaitDoorbell(state->opsPool, comm->localRanks, &state->stop, sleepTime);
+          else proxyShardWait(state, shard, sleepTime);
+          ncclProfilingRecord(&profArgs, 0, 0, ncclProxyProfileWakeup);
+          sleepTime = std::min(2*sleepTime, maxSleepTime);
+        } else {
+          sched_yield(); // No request progressed. Let others run.
+        }
+      } else {
+        idleStart = 0;
+        sleepTime = 1;
       }
     }
+    if (idle == 0) {
+      idleStart = 0;
+      sleepTime = 1;
+    }
     lastIdle = idle;
   }
   return NULL;
@@ -728,7 +856,7 @@ ncclResult_t ncclProxyStart(struct ncclComm* comm) {
   for (int r=0; r<comm->localRanks; r++) {
     struct ncclProxyOps* ops = proxyOps+r;
     if (ops->pool == NULL || ops->nextOps == -1) continue;
-    NCCLCHECK(ncclProxyPost(ops->pool, ops->nextOps, ops->nextOpsEnd));
+    NCCLCHECK(ncclProxyPost(ops->pool, comm->localRank, ops->nextOps, ops->nextOpsEnd));
     ops->nextOps = ops->nextOpsEnd = -1;
     ops->count = 0;
   }
@@ -739,9 +867,20 @@ ncclResult_t ncclProxyStart(struct ncclComm* comm) {
 
 ncclResult_t ncclProxyProgressCreate(struct ncclComm* comm) {
   struct ncclProxyProgressState* state = &comm->proxyState.progressState;
-  if (!state->thread) {
-    pthread_create(&state->thread, NULL, ncclProxyProgress, comm);
-    ncclSetThreadName(state->thread, "NCCL Progress%2d", comm->cudaDev);
+  if (state->shards == NULL) {
+    int nShards = std::min(std::max((int)ncclParamProxyNThreads(), 1), MAXCHANNELS);
+    NCCLCHECK(ncclCalloc(&state->shards, nShards));
+    state->nShards = nShards;
+    for (int s=0; s<nShards; s++) {
+      struct ncclProxyProgressShard* shard = state->shards+s;
+      shard->id = s;
+      shard->comm = comm;
+      pthread_mutex_init(&shard->mutex, NULL);
+      pthread_cond_init(&shard->cond, NULL);
+      pthread_create(&shard->thread, NULL, ncclProxyProgress, shard);
+      ncclSetThreadName(shard->thread, "NCCL Progress%2d", comm->cudaDev);
+    }
+    if (nShards > 1) INFO(NCCL_INIT, "Using %d proxy progress threads", nShards);
   }
   return ncclSuccess;
 }
@@ -751,19 +890,33 @@ ncclResult_t ncclProxyProgressDestroy(struct ncclComm* comm) {
 
   // Request the proxy to stop and then wake it
   if (state->opsPool) {
-    pthread_mutex_lock(&state->opsPool->mutex);
-    state->stop = true;
-    pthread_cond_signal(&state->opsPool->cond);
-    pthread_mutex_unlock(&state->opsPool->mutex);
-    pthread_join(state->thread, NULL);
+    __atomic_store_n(&state->stop, true, __ATOMIC_SEQ_CST);
+    ncclProxyRingDoorbell(state->opsPool);
+    for (int s=1; s<state->nShards; s++) {
+      pthread_mutex_lock(&state->shards[s].mutex);
+      pthread_cond_signal(&state->shards[s].cond);
+      pthread_mutex_unlock(&state->shards[s].mutex);
+    }
+    for (int s=0; s<state->nShards; s++) pthread_join(state->shards[s].thread, NULL);
   }
 
-  // Free off any memory allocated for the proxy arg pools
-  while (state->pools != NULL) {
-    struct ncclProxyPool *next = state->pools->next;
-    free(state->pools);
-    state->pools = next;
+  for (int s=0; s<state->nShards; s++) {
+    struct ncclProxyProgressShard* shard = state->shards+s;
+    // Free off any memory allocated for the proxy arg pools
+    while (shard->pools != NULL) {
+      struct ncclProxyPool *next = shard->pools->next;
+      free(shard->pools);
+      shard->pools = next;
+    }
+    free(shard->routed);
+    free(shard->consumed);
+    free(shard->staged);
+    pthread_mutex_destroy(&shard->mutex);
+    pthread_cond_destroy(&shard->cond);
   }
+  free(state->shards);
+  state->shards = NULL;
+  state->nShards = 0;
 
   ncclProfilingDump();
   TIME_PRINT("Proxy");
@@ -779,6 +932,7 @@ struct ncclProxyAsyncOp {
 
 struct ncclProxyLocalPeer {
   struct ncclSocket sock;
+  int fd; // -1 when the slot is free
   int localRank;
   struct ncclProxyAsyncOp asyncOps;
 };
@@ -921,22 +1075,12 @@ static ncclResult_t proxyProgressInit(struct ncclComm* comm) {
     shmPath[0] = '\0';
     NCCLCHECK(ncclShmOpen(shmPath, size, (void**)&pool, NULL, comm->localRanks + 1, &state->handle));
     // Init pool
-    pool->nextOps = -1;
-
     for (int r=0; r<comm->localRanks; r++) {
       pool->freeOps[r] = r*MAX_OPS_PER_PEER;
       for (int i=0; i<MAX_OPS_PER_PEER-1; i++) pool->ops[r*MAX_OPS_PER_PEER+i].next = r*MAX_OPS_PER_PEER+i+1;
       pool->ops[(r+1)*MAX_OPS_PER_PEER-1].next = -1;
+      pool->posted[r].head = pool->posted[r].tail = 0;
     }
-
-    // Setup mutex/cond to work inter-process
-    pthread_mutexattr_t mutexAttr;
-    pthread_mutexattr_init(&mutexAttr);
-    pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&pool->mutex, &mutexAttr);
-    pthread_condattr_t condAttr;
-    pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
-    pthread_cond_init(&pool->cond, &condAttr);
     state->opsPool = pool;
 
     memcpy(state->opsPoolShmSuffix, shmPath+sizeof("/dev/shm/nccl-")-1, sizeof("XXXXXX")-1);
@@ -1055,7 +1199,105 @@ static ncclResult_t proxyConnSetupConnect(int type, struct ncclProxyLocalPeer* p
   return ncclSuccess;
 }
 
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define PROXY_EVENT_LISTEN ((uint64_t)-1)
+#define PROXY_EVENT_WAKEUP ((uint64_t)-2)
+#define PROXY_MAX_EVENTS 64
+
+// Handle a request from a local peer, or progress its pending async operation.
+static void proxyServicePeer(struct ncclComm* comm, struct ncclProxyLocalPeer* peer, uint32_t events, struct ncclProxyConnectionPool* connectionPool,
+    int* asyncOpCount, int* stop, int* npeers) {
+  struct ncclSocket* sock = &peer->sock;
+  struct ncclProxyAsyncOp* op = &peer->asyncOps;
+  int closeConn = 0;
+  int type = 0;
+  ncclResult_t res = ncclSuccess;
+
+  if (op->type != 0) {
+    res = proxyProgressAsync(op, comm, asyncOpCount);
+    type = op->type;
+    if (res != ncclSuccess) closeConn = 1;
+  } else if (events & EPOLLIN) {
+    int closed;
+    if (ncclSocketTryRecv(sock, &type, sizeof(int), &closed) != ncclSuccess) {
+      WARN("[Service thread] Could not receive type from localRank %d", peer->localRank);
+      closeConn = 1;
+    } else if (closed) {
+      INFO(NCCL_INIT|NCCL_NET, "[Service thread] Connection closed by localRank %d", peer->localRank);
+      closeConn = 1;
+    } else {
+      if (type == ncclProxyMsgStop) {
+        *stop = 1;
+        closeConn = 1;
+      } else if (type == ncclProxyMsgClose) {
+        closeConn = 1;
+      } else if (type == ncclProxyMsgInit) {
+        res = proxyConnInit(peer, connectionPool, comm);
+      } else if (type == ncclProxyMsgSharedInit) {
+        res = proxyConnSharedInit(peer, connectionPool, comm);
+      } else if (type == ncclProxyMsgSetup || type == ncclProxyMsgConnect) {
+        res = proxyConnSetupConnect(type, peer, connectionPool, comm, asyncOpCount);
+      } else {
+        WARN("[Service thread] Unknown command %d from localRank %d\n", type, peer->localRank);
+        closeConn = 1;
+      }
+    }
+  } else if (events & (EPOLLHUP|EPOLLERR)) {
+    closeConn = 1;
+  }
+  if (res != ncclSuccess) {
+    WARN("[Proxy Service %d] Failed to execute operation %s from rank %d, retcode %d", comm->rank, ncclProxyMsgTypeStr[type], comm->localRankToRank[peer->localRank], res);
+    closeConn = 1;
+  }
+  if (closeConn) {
+    // Closing the fd also removes it from the epoll set
+    ncclSocketClose(sock);
+    if (op->reqBuff) {
+      free(op->reqBuff);
+      op->reqBuff = NULL;
+    }
+    if (op->respBuff) {
+      free(op->respBuff);
+      op->respBuff = NULL;
+    }
+    if (op->type != 0) (*asyncOpCount)--;
+    op->type = 0;
+    peer->fd = -1;
+    (*npeers)--;
+  }
+}
+
+// Accept a new local peer, reusing a free slot or growing the peer table.
+static ncclResult_t proxyServiceAccept(struct ncclComm* comm, int epollFd, struct ncclProxyLocalPeer*** peers, int* maxPeers, int* npeers) {
+  int s = 0;
+  while (s < *maxPeers && (*peers)[s]->fd >= 0) s++;
+  if (s == *maxPeers) {
+    int newMax = std::max(2*(*maxPeers), NCCL_MAX_LOCAL_RANKS);
+    NCCLCHECK(ncclRealloc(peers, *maxPeers, newMax));
+    for (int p=*maxPeers; p<newMax; p++) {
+      NCCLCHECK(ncclCalloc((*peers)+p, 1));
+      (*peers)[p]->fd = -1;
+    }
+    *maxPeers = newMax;
+  }
+  struct ncclProxyLocalPeer* peer = (*peers)[s];
+  memset(&peer->asyncOps, 0, sizeof(struct ncclProxyAsyncOp));
+  NCCLCHECK(ncclSocketInit(&peer->sock));
+  if (ncclSocketAccept(&peer->sock, comm->proxyState.listenSock) != ncclSuccess) {
+    WARN("[Service thread] Accept failed %s", strerror(errno));
+    return ncclSuccess;
+  }
+  NCCLCHECK(ncclSocketGetFd(&peer->sock, &peer->fd));
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = s;
+  SYSCHECK(epoll_ctl(epollFd, EPOLL_CTL_ADD, peer->fd, &ev), "epoll_ctl");
+  peer->localRank = -1;
+  (*npeers)++;
+  return ncclSuccess;
+}
 
 void* ncclProxyService(void* _args) {
   struct ncclComm* comm =  (struct ncclComm *) _args;
@@ -1067,26 +1309,43 @@ void* ncclProxyService(void* _args) {
   }
   if (CPU_COUNT(&comm->cpuAffinity)) sched_setaffinity(0, sizeof(cpu_set_t), &comm->cpuAffinity);
 
-  // Prepare poll descriptor
   struct ncclProxyConnectionPool connectionPool;
   connectionPool.pools = NULL;
   connectionPool.banks = 0;
   connectionPool.offset = NCCL_PROXY_CONN_POOL_SIZE;
 
-  struct pollfd pollfds[NCCL_MAX_LOCAL_RANKS+1];
-  struct ncclProxyLocalPeer peers[NCCL_MAX_LOCAL_RANKS];
-  memset(&peers, 0, sizeof(struct ncclProxyLocalPeer)*NCCL_MAX_LOCAL_RANKS);
-  for (int s=0; s<NCCL_MAX_LOCAL_RANKS; s++) {
-    pollfds[s].fd = -1;
-    pollfds[s].events = POLLHUP|POLLIN;
+  // Prepare epoll set, with the listening socket and the wakeup eventfd
+  struct ncclProxyLocalPeer** peers = NULL;
+  int maxPeers = 0;
+  struct epoll_event ev, events[PROXY_MAX_EVENTS];
+  int listenFd;
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    WARN("[Proxy Service] epoll_create1 failed : %s", strerror(errno));
+    return NULL;
   }
-  if (ncclSocketGetFd(comm->proxyState.listenSock, &pollfds[NCCL_MAX_LOCAL_RANKS].fd) != ncclSuccess) {
+  if (ncclSocketGetFd(comm->proxyState.listenSock, &listenFd) != ncclSuccess) {
     WARN("[Proxy Service] Get listenSock fd fails\n");
+    close(epollFd);
     return NULL;
   };
-  pollfds[NCCL_MAX_LOCAL_RANKS].events = POLLIN;
+  ev.events = EPOLLIN;
+  ev.data.u64 = PROXY_EVENT_LISTEN;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) != 0) {
+    WARN("[Proxy Service] epoll_ctl failed : %s", strerror(errno));
+    close(epollFd);
+    return NULL;
+  }
+  if (comm->proxyState.wakeFd >= 0) {
+    ev.events = EPOLLIN;
+    ev.data.u64 = PROXY_EVENT_WAKEUP;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, comm->proxyState.wakeFd, &ev) != 0) {
+      WARN("[Proxy Service] epoll_ctl failed : %s", strerror(errno));
+      close(epollFd);
+      return NULL;
+    }
+  }
 
-  int maxnpeers = 0;
   int npeers = 0;
   int stop = 0;
   int asyncOpCount = 0;
@@ -1095,96 +1354,41 @@ void* ncclProxyService(void* _args) {
      * connections. Need to wait until all other related comms call abort and safely exit
      * together, or we could face segmentation fault. */
     if (*comm->abortFlag != 0) stop = 1;
-    /* never let proxy service thread blocks in poll, or it cannot receive abortFlag. */
-    int ret;
+    /* Abort wakes us up through wakeFd; the timeout is only a safety net in case abortFlag is set
+     * without going through ncclProxyDestroy. */
+    int nEvents;
     do {
-      ret = poll(pollfds, NCCL_MAX_LOCAL_RANKS+1, asyncOpCount ? 0 : 500);
-    } while (ret < 0 && errno == EINTR);
-    if (ret < 0) {
-      WARN("[Proxy Service] Poll failed: %s", strerror(errno));
-      return NULL;
+      nEvents = epoll_wait(epollFd, events, PROXY_MAX_EVENTS, asyncOpCount ? 0 : 500);
+    } while (nEvents < 0 && errno == EINTR);
+    if (nEvents < 0) {
+      WARN("[Proxy Service] epoll_wait failed: %s", strerror(errno));
+      break;
     }
-    if (pollfds[NCCL_MAX_LOCAL_RANKS].revents) {
-      int s = 0;
-      while (s < NCCL_MAX_LOCAL_RANKS && pollfds[s].fd >= 0) s++;
-      if (s == NCCL_MAX_LOCAL_RANKS) {
-        WARN("[Proxy service] Too many connections (%d max)", NCCL_MAX_LOCAL_RANKS);
-        return NULL;
-      }
-      if (maxnpeers < s+1) maxnpeers = s+1;
-      if (ncclSocketInit(&peers[s].sock) != ncclSuccess) {
-        WARN("[Service thread] Initialize peers[%d].sock fails\n", s);
-        return NULL;
-      }
-      if (ncclSocketAccept(&peers[s].sock, comm->proxyState.listenSock) != ncclSuccess) {
-        WARN("[Service thread] Accept failed %s", strerror(errno));
+    int newConn = 0;
+    for (int e=0; e<nEvents; e++) {
+      uint64_t id = events[e].data.u64;
+      if (id == PROXY_EVENT_LISTEN) {
+        newConn = 1;
+      } else if (id == PROXY_EVENT_WAKEUP) {
+        uint64_t val;
+        (void) !read(comm->proxyState.wakeFd, &val, sizeof(uint64_t));
       } else {
-        if (ncclSocketGetFd(&peers[s].sock, &pollfds[s].fd) != ncclSuccess) {
-          WARN("[Service thread] Get peers[%d].sock fd fails\n", s);
-          return NULL;
-        }
-        npeers++;
-        peers[s].localRank = -1;
+        struct ncclProxyLocalPeer* peer = peers[id];
+        // Peers with a pending async op are progressed below
+        if (peer->fd == -1 || peer->asyncOps.type != 0) continue;
+        proxyServicePeer(comm, peer, events[e].events, &connectionPool, &asyncOpCount, &stop, &npeers);
       }
     }
-    for (int s=0; s<maxnpeers; s++) {
-      struct ncclProxyLocalPeer* peer = peers+s;
-      struct ncclSocket* sock = &peer->sock;
-      struct ncclProxyAsyncOp* op = &peer->asyncOps;
-      int closeConn = 0;
-      int type = 0;
-      ncclResult_t res = ncclSuccess;
-
-      if (pollfds[s].fd == -1) continue;
-      if (op->type != 0) {
-        res = proxyProgressAsync(op, comm, &asyncOpCount);
-        type = op->type;
-        if (res != ncclSuccess) closeConn = 1;
-      } else if (pollfds[s].revents & POLLIN) {
-        int closed;
-        if (ncclSocketTryRecv(sock, &type, sizeof(int), &closed) != ncclSuccess) {
-          WARN("[Service thread] Could not receive type from localRank %d", peer->localRank);
-          closeConn = 1;
-        } else if (closed) {
-          INFO(NCCL_INIT|NCCL_NET, "[Service thread] Connection closed by localRank %d", peer->localRank);
-          closeConn = 1;
-        } else {
-          if (type == ncclProxyMsgStop) {
-            stop = 1;
-            closeConn = 1;
-          } else if (type == ncclProxyMsgClose) {
-            closeConn = 1;
-          } else if (type == ncclProxyMsgInit) {
-            res = proxyConnInit(peers+s, &connectionPool, comm);
-          } else if (type == ncclProxyMsgSharedInit) {
-            res = proxyConnSharedInit(peers+s, &connectionPool, comm);
-          } else if (type == ncclProxyMsgSetup || type == ncclProxyMsgConnect) {
-            res = proxyConnSetupConnect(type, peers+s, &connectionPool, comm, &asyncOpCount);
-          } else {
-            WARN("[Service thread] Unknown command %d from localRank %d\n", type, peer->localRank);
-            closeConn = 1;
-          }
-        }
-      } else if (pollfds[s].revents & POLLHUP) {
-        closeConn = 1;
-      } 
-      if (res != ncclSuccess) {
-        WARN("[Proxy Service %d] Failed to execute operation %s from rank %d, retcode %d", comm->rank, ncclProxyMsgTypeStr[type], comm->localRankToRank[peer->localRank], res);
-        closeConn = 1;
-      }
-      if (closeConn) {
-        ncclSocketClose(sock);
-        if (op->reqBuff) {
-          free(op->reqBuff);
-          op->reqBuff = NULL;
-        }
-        if (op->respBuff) {
-          free(op->respBuff);
-          op->respBuff = NULL;
-        }
-        op->type = 0;
-        pollfds[s].fd = -1;
-        npeers--;
+    // Accept after handling all events, so that a slot freed above can't receive events meant for the old peer
+    if (newConn && proxyServiceAccept(comm, epollFd, &peers, &maxPeers, &npeers) != ncclSuccess) {
+      WARN("[Service thread] Failed to accept new local peer");
+      break;
+    }
+    if (asyncOpCount) {
+      for (int s=0; s<maxPeers; s++) {
+        struct ncclProxyLocalPeer* peer = peers[s];
+        if (peer->fd == -1 || peer->asyncOps.type == 0) continue;
+        proxyServicePeer(comm, peer, 0, &connectionPool, &asyncOpCount, &stop, &npeers);
       }
     }
   }
@@ -1193,9 +1397,12 @@ void* ncclProxyService(void* _args) {
   if (ncclProxyProgressDestroy(comm) != ncclSuccess) {
     WARN("[Proxy Service] proxyDestroy failed");
   }
-  for (int s=0; s<maxnpeers; s++) {
-    ncclSocketClose(&peers[s].sock);
+  for (int s=0; s<maxPeers; s++) {
+    ncclSocketClose(&peers[s]->sock);
+    free(peers[s]);
   }
+  free(peers);
+  close(epollFd);
   ncclProxyFreeConnections(&connectionPool, comm);
   ncclSocketClose(comm->proxyState.listenSock);
   proxyOpsFree(comm);
@@ -1209,7 +1416,10 @@ ncclResult_t ncclProxyInit(struct ncclComm* comm, struct ncclSocket* sock, union
 }
 
 ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
-  // comm->proxyState.thread is pthread_join()'d by commFree() in init.cc
+  // Used to wake up the service thread on abort. If it fails, the service thread will notice the abort on its poll timeout.
+  comm->proxyState.wakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (comm->proxyState.wakeFd < 0) INFO(NCCL_INIT, "[Proxy Service] eventfd failed : %s", strerror(errno));
+  // comm->proxyState.thread is pthread_join()'d by commFree() in init.cc, which also closes wakeFd
   pthread_create(&comm->proxyState.thread, NULL, ncclProxyService, comm);
   ncclSetThreadName(comm->proxyState.thread, "NCCL Service %2d", comm->cudaDev);
   return ncclSuccess;
@@ -1227,6 +1437,9 @@ ncclResult_t ncclProxyDestroy(struct ncclComm* comm) {
       NCCLCHECK(ncclSocketConnect(&sock));
       NCCLCHECK(ncclSocketSend(&sock, &type, sizeof(int)));
       NCCLCHECK(ncclSocketClose(&sock));
+    } else if (state->thread && state->wakeFd >= 0) {
+      uint64_t val = 1;
+      (void) !write(state->wakeFd, &val, sizeof(uint64_t));
     }
     free(state->peerAddresses);
   }
@@ -0,0 +1,90 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "tasks.h"
+#include "comm.h"
+#include "group.h"
+#include "channel.h"
+#include <algorithm>
+
+// Tasks are carved out of blocks, to keep the memory stack bookkeeping off the
+// per-operation path. Blocks grow with the number of tasks already staged so
+// that small groups do not clear memory they will not use, up to a size which
+// the memory stack still serves from its hunks rather than with malloc().
+#define NCCL_TASK_SLAB_MIN 8
+#define NCCL_TASK_SLAB_MAX_BYTES 4096
+
+template<typename T>
+static inline T* taskAlloc(struct ncclComm* comm, T** slab, int* slabLeft, int nTasks) {
+  if (*slabLeft == 0) {
+    int n = std::min<int>(NCCL_TASK_SLAB_MAX_BYTES/sizeof(T), std::max(NCCL_TASK_SLAB_MIN, nTasks));
+    *slab = ncclMemoryStackAlloc<T>(&comm->memScoped, n);
+    *slabLeft = n;
+  }
+  *slabLeft -= 1;
+  return (*slab)++;
+}
+
+ncclResult_t ncclTaskP2pAppend(struct ncclComm* comm, ncclFunc_t coll, int peer, void* buff, size_t bytes) {
+  struct ncclTasks* tasks = &comm->tasks;
+  bool isSendNotRecv = coll == ncclFuncSend;
+
+  // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
+  ncclGroupCommJoin(comm);
+  struct ncclTaskP2p* p2p = taskAlloc(comm, &tasks->p2pSlab, &tasks->p2pSlabLeft, tasks->nTasksP2p);
+  p2p->buff = buff;
+  p2p->bytes = bytes;
+  p2p->chunk = 0;
+  ncclIntruQueueEnqueue(
+    isSendNotRecv ? &tasks->peers[peer].sendQueue : &tasks->peers[peer].recvQueue,
+    p2p);
+  tasks->nTasksP2p += 1;
+  ncclTaskP2pMarkStep(tasks, isSendNotRecv ? tasks->p2pSendStep[peer] : tasks->p2pRecvStep[peer]);
+
+  // Mark channels that need pre-connect, once per peer and direction
+  bool* seen = isSendNotRecv ? &tasks->peers[peer].sendSeen : &tasks->peers[peer].recvSeen;
+  if (comm->rank != peer && !*seen) {
+    *seen = true;
+    int channelBaseId;
+    NCCLCHECK(ncclChannelComputeBase(comm, peer, coll, &channelBaseId));
+    for (int c=0; c < comm->p2pnChannelsPerPeer; c++) {
+      int channelId;
+      NCCLCHECK(ncclChannelComputeFromBase(comm, channelBaseId, c, &channelId));
+      if (isSendNotRecv) {
+        if (comm->channels[channelId].peers[peer].send[1].connected == 0) { // P2P uses only 1 connector
+          comm->connectSend[peer] |= (1UL<<channelId);
+          ncclGroupCommPreconnect(comm);
+        }
+      } else {
+        if (comm->channels[channelId].peers[peer].recv[1].connected == 0) { // P2P uses only 1 connector
+          comm->connectRecv[peer] |= (1UL<<channelId);
+          ncclGroupCommPreconnect(comm);
+        }
+      }
+    }
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTaskCollAppend(struct ncclComm* comm, struct ncclInfo const* info, struct ncclDevRedOpFull opFull) {
+  struct ncclTasks* tasks = &comm->tasks;
+  // Must be in thread local group before tasks can be alloc'd in `comm->memScoped`.
+  ncclGroupCommJoin(comm);
+  struct ncclTaskColl* t = taskAlloc(comm, &tasks->collSlab, &tasks->collSlabLeft, tasks->nTasksColl);
+  t->func = info->coll;
+  t->sendbuff = info->sendbuff;
+  t->recvbuff = info->recvbuff;
+  t->count = info->count;
+  t->root = info->root;
+  t->datatype = info->datatype;
+  t->op = opFull; // C++ struct assignment
+  t->chunkSteps = info->chunkSteps;
+  t->sliceSteps = info->sliceSteps;
+  ncclIntruQueueEnqueue(&tasks->collQueue, t);
+  tasks->collBytesTotal += t->count*ncclTypeSize(t->datatype);
+  tasks->nTasksColl += 1;
+  return ncclSuccess;
+}
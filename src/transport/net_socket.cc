@@ -9,12 +9,14 @@
 #include "socket.h"
 #include "net.h"
 #include "param.h"
+#include "iouring.h"
 
 #include <pthread.h>
 #include <stdlib.h>
 #include <poll.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 
 /* Init functions */
 static int ncclNetIfs = -1;
@@ -113,6 +115,9 @@ ncclResult_t ncclNetSocketGetProperties(int dev, ncclNetProperties_t* props) {
 
 NCCL_PARAM(SocketNsocksPerThread, "NSOCKS_PERTHREAD", -2);
 NCCL_PARAM(SocketNthreads, "SOCKET_NTHREADS", -2);
+NCCL_PARAM(SocketIoUring, "SOCKET_IO_URING", 0);
+NCCL_PARAM(SocketZeroCopy, "SOCKET_ZEROCOPY", 0);
+NCCL_PARAM(SocketZeroCopyThreshold, "SOCKET_ZEROCOPY_THRESHOLD", 128*1024);
 
 enum ncclNetSocketCommState {
   ncclNetSocketCommStateStart = 0,
@@ -144,6 +149,9 @@ struct ncclNetSocketTask {
   struct ncclSocket* sock;
   int offset;
   int used;
+  int inflight;
+  int zcopy;      // Set while a MSG_ZEROCOPY send still has buffers referenced by the kernel
+  uint32_t zcSeq; // Completion id following the last send of this task
   ncclResult_t result;
 };
 
@@ -171,6 +179,12 @@ struct ncclNetSocketThreadResources {
   struct ncclNetSocketComm* comm;
   pthread_mutex_t threadLock;
   pthread_cond_t  threadCond;
+  int useUring;
+  struct ncclIoUring ring;
+  int eventFd;
+  uint64_t eventVal;
+  int sleeping;         // io_uring thread is blocked in io_uring_enter; new tasks must write eventFd
+  ncclResult_t error;   // io_uring thread exited on this error
 };
 
 struct ncclNetSocketListenComm {
@@ -189,13 +203,130 @@ struct ncclNetSocketComm {
   int nSocks;
   int nThreads;
   int nextSock;
+  int zcopy;
+  uint32_t zcSent[MAX_SOCKETS];
+  uint32_t zcDone[MAX_SOCKETS];
   struct ncclNetSocketRequest requests[MAX_REQUESTS];
   pthread_t helperThread[MAX_THREADS];
   struct ncclNetSocketThreadResources threadResources[MAX_THREADS];
 };
 
+#define URING_WAKEUP (~0ULL)
+#define URING_POLL (1ULL<<62)
+
+static inline int socketTaskPending(struct ncclNetSocketTask* r) {
+  return __atomic_load_n(&r->used, __ATOMIC_ACQUIRE) == 1 && r->offset < r->size;
+}
+
+// The io_uring thread is exiting : fail every task it still owns, and the ones posted later, so that
+// ncclNetSocketTest returns the error instead of waiting forever.
+static void* socketUringFail(struct ncclNetSocketThreadResources* resource, ncclResult_t error) {
+  struct ncclNetSocketTaskQueue* myQueue = &resource->threadTaskQueue;
+  __atomic_store_n(&resource->error, error, __ATOMIC_SEQ_CST);
+  for (int t=0; t<myQueue->len; t++) {
+    struct ncclNetSocketTask* r = myQueue->tasks+t;
+    if (socketTaskPending(r) && r->result == ncclSuccess) r->result = error;
+  }
+  return NULL;
+}
+
+// io_uring engine : instead of spinning on non-blocking send/recv, post one SQE per pending task and
+// sleep in io_uring_enter until something completes. Tasks sharing a socket are posted one at a time,
+// in queue order, so that the byte stream on each socket stays ordered.
+static void* persistentSocketUringThread(struct ncclNetSocketThreadResources* resource) {
+  struct ncclNetSocketComm* comm = resource->comm;
+  struct ncclNetSocketTaskQueue* myQueue = &resource->threadTaskQueue;
+  struct ncclIoUring* ring = &resource->ring;
+  int head = 0;
+  if (ncclIoUringPrepRead(ring, resource->eventFd, &resource->eventVal, sizeof(uint64_t), URING_WAKEUP) != ncclSuccess) goto fail;
+  while (1) {
+    // Move head to the oldest pending task. If there is none, the next task will be posted at myQueue->next.
+    int next = __atomic_load_n(&myQueue->next, __ATOMIC_ACQUIRE);
+    int i;
+    for (i=0; i<myQueue->len; i++) {
+      if (socketTaskPending(myQueue->tasks+head)) break;
+      head = (head+1)%myQueue->len;
+    }
+    if (i == myQueue->len) head = next;
+
+    uint64_t sockPosted = 0;
+    for (i=0; i<myQueue->len; i++) {
+      int t = (head+i)%myQueue->len;
+      struct ncclNetSocketTask* r = myQueue->tasks+t;
+      if (!socketTaskPending(r)) continue;
+      uint64_t sockMask = 1ULL << (r->sock - comm->socks);
+      if (sockPosted & sockMask) continue;
+      sockPosted |= sockMask;
+      if (r->inflight) continue;
+      if (ncclIoUringPrepSocket(ring, r->op, r->sock->fd, (char*)r->data+r->offset, r->size-r->offset, t) != ncclSuccess) goto fail;
+      r->inflight = 1;
+    }
+
+    // Producers only write the eventfd while we sleep : announce it, then make sure no task was posted
+    // since the scan above.
+    __atomic_store_n(&resource->sleeping, 1, __ATOMIC_SEQ_CST);
+    int wait = (__atomic_load_n(&myQueue->next, __ATOMIC_SEQ_CST) == next && resource->stop == 0) ? 1 : 0;
+    ncclResult_t ret = ncclIoUringSubmit(ring, wait);
+    __atomic_store_n(&resource->sleeping, 0, __ATOMIC_SEQ_CST);
+    if (ret != ncclSuccess) goto fail;
+
+    uint64_t userData;
+    int res, found;
+    while (ncclIoUringReap(ring, &userData, &res, &found) == ncclSuccess && found) {
+      if (userData == URING_WAKEUP) {
+        if (resource->stop) return NULL;
+        if (ncclIoUringPrepRead(ring, resource->eventFd, &resource->eventVal, sizeof(uint64_t), URING_WAKEUP) != ncclSuccess) goto fail;
+        continue;
+      }
+      struct ncclNetSocketTask* r = myQueue->tasks+(userData & ~URING_POLL);
+      if (userData & URING_POLL) {
+        // Socket is ready again, the task will be reposted on the next iteration
+        r->inflight = 0;
+        if (res < 0) {
+          WARN("NET/Socket : io_uring poll error : %s", strerror(-res));
+          r->result = ncclSystemError;
+          return socketUringFail(resource, ncclSystemError);
+        }
+        continue;
+      }
+      if (res == -EAGAIN || res == -EINTR) {
+        // Older kernels don't arm a poll internally for non-blocking sockets
+        if (ncclIoUringPrepPoll(ring, r->op, r->sock->fd, userData | URING_POLL) != ncclSuccess) goto fail;
+        continue;
+      }
+      r->inflight = 0;
+      if (res < 0 || (res == 0 && r->op == NCCL_SOCKET_RECV)) {
+        char line[SOCKET_NAME_MAXLEN+1];
+        WARN("NET/Socket : io_uring %s from %s failed : %s", r->op == NCCL_SOCKET_RECV ? "recv" : "send",
+            ncclSocketToString(&r->sock->addr, line), res < 0 ? strerror(-res) : "connection closed by remote peer");
+        r->result = ncclRemoteError;
+        return socketUringFail(resource, ncclRemoteError);
+      }
+      __atomic_store_n(&r->offset, r->offset+res, __ATOMIC_RELEASE);
+    }
+    if (resource->stop) return NULL;
+  }
+fail:
+  WARN("NET/Socket : io_uring progress error");
+  return socketUringFail(resource, ncclSystemError);
+}
+
+// Progress a MSG_ZEROCOPY send. The task is only marked complete (zcopy reset to 0) once the
+// error queue has notified the completion ids of all its sends, i.e. the kernel released the buffer.
+static ncclResult_t socketProgressZeroCopyTask(struct ncclNetSocketComm* comm, struct ncclNetSocketTask* r) {
+  int s = r->sock - comm->socks;
+  if (r->offset < r->size) {
+    NCCLCHECK(ncclSocketProgressZeroCopy(r->sock, r->data, r->size, &r->offset, comm->zcSent+s));
+    if (r->offset == r->size) r->zcSeq = comm->zcSent[s];
+  }
+  NCCLCHECK(ncclSocketZeroCopyReap(r->sock, comm->zcDone+s));
+  if (r->offset == r->size && (int32_t)(comm->zcDone[s] - r->zcSeq) >= 0) __atomic_store_n(&r->zcopy, 0, __ATOMIC_RELEASE);
+  return ncclSuccess;
+}
+
 void* persistentSocketThread(void *args_) {
   struct ncclNetSocketThreadResources* resource = (struct ncclNetSocketThreadResources*)args_;
+  if (resource->useUring) return persistentSocketUringThread(resource);
   struct ncclNetSocketComm* comm = resource->comm;
   struct ncclNetSocketTaskQueue* myQueue = &resource->threadTaskQueue;
   int nSocksPerThread = comm->nSocks / comm->nThreads;
@@ -208,8 +339,8 @@ void* persistentSocketThread(void *args_) {
         repeat = 0;
         for (int j=0; j<nSocksPerThread; j++) {
           struct ncclNetSocketTask* r = myQueue->tasks+i+j;
-          if (r != NULL && r->used == 1 && r->offset < r->size) {
-            r->result = ncclSocketProgress(r->op, r->sock, r->data, r->size, &r->offset);
+          if (r != NULL && r->used == 1 && (r->offset < r->size || r->zcopy)) {
+            r->result = r->zcopy ? socketProgressZeroCopyTask(comm, r) : ncclSocketProgress(r->op, r->sock, r->data, r->size, &r->offset);
             if (r->result != ncclSuccess) {
               WARN("NET/Socket : socket progress error");
               return NULL;
@@ -277,6 +408,16 @@ end:
   *ns = nSocks;
   *nt = nThreads;
   if (nSocks > 0) INFO(NCCL_INIT, "NET/Socket: Using %d threads and %d sockets per thread", nThreads, nSocksPerThread);
+  // io_uring and zero-copy only apply to the helper threads : without them all data goes through the main thread
+  if (nSocks == 0 && (ncclParamSocketIoUring() || ncclParamSocketZeroCopy())) {
+    static bool warned = false;
+    if (warned == false) {
+      INFO(NCCL_INIT|NCCL_NET, "NET/Socket : %s ignored, no helper threads (set NCCL_SOCKET_NTHREADS and NCCL_NSOCKS_PERTHREAD)",
+          ncclParamSocketIoUring() && ncclParamSocketZeroCopy() ? "NCCL_SOCKET_IO_URING and NCCL_SOCKET_ZEROCOPY" :
+          ncclParamSocketIoUring() ? "NCCL_SOCKET_IO_URING" : "NCCL_SOCKET_ZEROCOPY");
+      warned = true;
+    }
+  }
   return ncclSuccess;
 }
 
@@ -342,6 +483,16 @@ socket_send:
     NCCLCHECK(ncclSocketProgress(NCCL_SOCKET_SEND, sock, &i, sizeof(uint8_t), &done));
     if (done == 0) return ncclSuccess;
   }
+  // Zero-copy sends are only issued by the helper threads, on the data sockets they own
+  if (ncclParamSocketZeroCopy() && comm->nSocks) {
+    comm->zcopy = 1;
+    for (int s=0; s<comm->nSocks; s++) {
+      int enabled;
+      NCCLCHECK(ncclSocketSetZeroCopy(comm->socks+s, &enabled));
+      if (!enabled) comm->zcopy = 0;
+    }
+    if (!comm->zcopy) INFO(NCCL_NET, "NET/Socket : MSG_ZEROCOPY unavailable, using regular sends");
+  }
   *sendComm = comm;
   return ncclSuccess;
 }
@@ -434,6 +585,18 @@ ncclResult_t ncclNetSocketGetTask(struct ncclNetSocketComm* comm, int op, void*
     res->comm = comm;
     pthread_mutex_init(&res->threadLock, NULL);
     pthread_cond_init(&res->threadCond, NULL);
+    res->eventFd = -1;
+    if (ncclParamSocketIoUring()) {
+      // Fall back to the polling engine if io_uring is unavailable (old kernel, seccomp, ...)
+      res->eventFd = eventfd(0, EFD_CLOEXEC);
+      if (res->eventFd != -1 && ncclIoUringInit(&res->ring, queue->len+1) == ncclSuccess) {
+        res->useUring = 1;
+      } else {
+        INFO(NCCL_NET, "NET/Socket : io_uring unavailable, falling back to polling helper threads");
+        if (res->eventFd != -1) close(res->eventFd);
+        res->eventFd = -1;
+      }
+    }
     pthread_create(comm->helperThread+tid, NULL, persistentSocketThread, res);
     ncclSetThreadName(comm->helperThread[tid], "NCCL Sock%c%1u%2u%2u", op == NCCL_SOCKET_SEND ? 'S' : 'R', comm->dev, tid, comm->cudaDev);
   }
@@ -444,12 +607,26 @@ ncclResult_t ncclNetSocketGetTask(struct ncclNetSocketComm* comm, int op, void*
     r->size = size;
     r->sock = comm->socks + comm->nextSock;
     r->offset = 0;
+    r->inflight = 0;
+    // Zero-copy only pays off for large sends; it is not supported by the io_uring engine.
+    r->zcopy = (op == NCCL_SOCKET_SEND && comm->zcopy && !res->useUring && size >= ncclParamSocketZeroCopyThreshold()) ? 1 : 0;
     r->result = ncclSuccess;
     comm->nextSock = (comm->nextSock + 1) % comm->nSocks;
-    r->used = 1;
+    __atomic_store_n(&r->used, 1, __ATOMIC_RELEASE);
     *req = r;
+    if (res->useUring) {
+      // Only wake the thread up if it sleeps in io_uring_enter; otherwise it sees the task on its next scan.
+      __atomic_store_n(&queue->next, (queue->next+1)%queue->len, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&res->sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&res->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        SYSCHECK(write(res->eventFd, &one, sizeof(uint64_t)), "write");
+      }
+      ncclResult_t error = __atomic_load_n(&res->error, __ATOMIC_SEQ_CST);
+      if (error != ncclSuccess) r->result = error;
+      return ncclSuccess;
+    }
     pthread_mutex_lock(&res->threadLock);
-    queue->next = (queue->next+1)%queue->len;
+    __atomic_store_n(&queue->next, (queue->next+1)%queue->len, __ATOMIC_RELEASE);
     pthread_cond_signal(&res->threadCond);
     pthread_mutex_unlock(&res->threadLock);
     return ncclSuccess;
@@ -507,7 +684,7 @@ ncclResult_t ncclNetSocketTest(void* request, int* done, int* size) {
       for (int i=0; i<r->nSubs; i++) {
         struct ncclNetSocketTask* sub = r->tasks[i];
         if (sub->result != ncclSuccess) return sub->result;
-        if (sub->offset == sub->size) nCompleted++;
+        if (sub->offset == sub->size && __atomic_load_n(&sub->zcopy, __ATOMIC_ACQUIRE) == 0) nCompleted++;
       }
       if (nCompleted == r->nSubs) {
         if (size) *size = r->size;
@@ -576,8 +753,16 @@ ncclResult_t ncclNetSocketClose(void* opaqueComm) {
         res->stop = 1;
         pthread_cond_signal(&res->threadCond);
         pthread_mutex_unlock(&res->threadLock);
+        if (res->useUring) {
+          uint64_t one = 1;
+          SYSCHECK(write(res->eventFd, &one, sizeof(uint64_t)), "write");
+        }
         pthread_join(comm->helperThread[i], NULL);
       }
+      if (res->useUring) {
+        ncclIoUringClose(&res->ring);
+        close(res->eventFd);
+      }
       free(res->threadTaskQueue.tasks);
     }
     int ready;
@@ -0,0 +1,177 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Bootstrap time at scale on a single host. Each rank is a process which runs
+// bootstrapInit against a root started by the parent, then allgathers through
+// bootstrapAllGather and through a bootstrap ring, checks that both give every
+// rank's slice at its place, and runs barriers.
+
+#include "bootstrap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define BENCHCHECK(cmd) do { \
+  ncclResult_t res = (cmd); \
+  if (res != ncclSuccess) { \
+    fprintf(stderr, "%s:%d '%s' failed : %d\n", __FILE__, __LINE__, #cmd, res); \
+    exit(1); \
+  } \
+} while (0)
+
+struct rankResult {
+  double initUs;
+  double allGatherUs;
+  double ringUs;
+  double barrierUs;
+  int fds;
+  int errors;
+};
+
+static uint8_t slicePattern(int rank, int i) { return (uint8_t)(rank*31 + i*7 + 1); }
+
+static void sliceFill(char* data, int rank, int size) {
+  for (int i=0; i<size; i++) data[(size_t)rank*size+i] = slicePattern(rank, i);
+}
+
+// Number of bytes not at their place in an allgather output
+static int sliceCheck(char* data, int nranks, int size) {
+  int errors = 0;
+  for (int r=0; r<nranks; r++) {
+    for (int i=0; i<size; i++) errors += (uint8_t)data[(size_t)r*size+i] != slicePattern(r, i);
+  }
+  return errors;
+}
+
+static int countFds() {
+  int n = 0;
+  DIR* dir = opendir("/proc/self/fd");
+  if (dir == NULL) return -1;
+  while (struct dirent* entry = readdir(dir)) n += entry->d_name[0] != '.';
+  closedir(dir);
+  return n-1; // The fd of dir
+}
+
+static void rankMain(struct ncclBootstrapHandle* handle, int rank, int nranks, int size, int iters, struct rankResult* result) {
+  struct ncclComm* comm = (struct ncclComm*)calloc(1, sizeof(struct ncclComm));
+  comm->rank = rank;
+  comm->nRanks = nranks;
+  comm->abortFlag = (uint32_t*)calloc(1, sizeof(uint32_t));
+  uint64_t t0 = clockNano();
+  BENCHCHECK(bootstrapInit(handle, comm));
+  result->initUs = (clockNano()-t0)/1e3;
+
+  char* data = (char*)calloc(nranks, size);
+  sliceFill(data, rank, size);
+  t0 = clockNano();
+  for (int i=0; i<iters; i++) BENCHCHECK(bootstrapAllGather(comm->bootstrap, data, size));
+  result->allGatherUs = (clockNano()-t0)/1e3/iters;
+  result->errors = sliceCheck(data, nranks, size);
+
+  // The ring allgather is the reference layout
+  struct bootstrapRing* ring;
+  BENCHCHECK(bootstrapRingCreate(comm->bootstrap, &ring));
+  memset(data, 0, (size_t)nranks*size);
+  sliceFill(data, rank, size);
+  t0 = clockNano();
+  for (int i=0; i<iters; i++) BENCHCHECK(bootstrapRingAllGather(ring, data, size));
+  result->ringUs = (clockNano()-t0)/1e3/iters;
+  result->errors += sliceCheck(data, nranks, size);
+
+  int* ranks = (int*)malloc(nranks*sizeof(int));
+  for (int r=0; r<nranks; r++) ranks[r] = r;
+  BENCHCHECK(bootstrapBarrier(comm->bootstrap, ranks, rank, nranks, 0));
+  t0 = clockNano();
+  for (int i=0; i<iters; i++) BENCHCHECK(bootstrapBarrier(comm->bootstrap, ranks, rank, nranks, 0));
+  result->barrierUs = (clockNano()-t0)/1e3/iters;
+  result->fds = countFds();
+
+  // Don't exit before our peers are done with us
+  BENCHCHECK(bootstrapBarrier(comm->bootstrap, ranks, rank, nranks, 0));
+  BENCHCHECK(bootstrapRingClose(ring));
+  BENCHCHECK(bootstrapClose(comm->bootstrap));
+  free(ranks);
+  free(data);
+}
+
+int main(int argc, char* argv[]) {
+  int nranks = 64, size = 64, iters = 10;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:i:h")) != -1) {
+    switch (opt) {
+      case 'n': nranks = atoi(optarg); break;
+      case 's': size = atoi(optarg); break;
+      case 'i': iters = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage : %s [-n ranks] [-s allgather bytes per rank] [-i iterations]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (nranks < 2 || size < 1 || iters < 1) {
+    fprintf(stderr, "At least 2 ranks, 1 byte and 1 iteration are needed\n");
+    return 1;
+  }
+  setenv("NCCL_SOCKET_IFNAME", "lo", 0);
+
+  struct rankResult* results = (struct rankResult*)mmap(NULL, nranks*sizeof(struct rankResult),
+      PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (results == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  struct ncclBootstrapHandle handle;
+  BENCHCHECK(bootstrapNetInit());
+  BENCHCHECK(bootstrapGetUniqueId(&handle));
+
+  pid_t* pids = (pid_t*)calloc(nranks, sizeof(pid_t));
+  for (int r=0; r<nranks; r++) {
+    pids[r] = fork();
+    if (pids[r] == -1) {
+      perror("fork");
+      return 1;
+    }
+    if (pids[r] == 0) {
+      rankMain(&handle, r, nranks, size, iters, results+r);
+      _exit(0);
+    }
+  }
+  int failed = 0;
+  for (int r=0; r<nranks; r++) {
+    int status;
+    waitpid(pids[r], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+  }
+  if (failed) {
+    fprintf(stderr, "%d ranks failed\n", failed);
+    return 1;
+  }
+
+  double initMax = 0, initSum = 0, agMax = 0, ringMax = 0, barrierMax = 0, barrierSum = 0;
+  int errors = 0, fdsMax = 0;
+  for (int r=0; r<nranks; r++) {
+    initMax = std::max(initMax, results[r].initUs);
+    initSum += results[r].initUs;
+    agMax = std::max(agMax, results[r].allGatherUs);
+    ringMax = std::max(ringMax, results[r].ringUs);
+    barrierMax = std::max(barrierMax, results[r].barrierUs);
+    barrierSum += results[r].barrierUs;
+    fdsMax = std::max(fdsMax, results[r].fds);
+    errors += results[r].errors;
+  }
+  printf("# %d ranks, allgather of %d bytes per rank, NCCL_BOOTSTRAP_BRUCK_THRESHOLD=%s\n", nranks, size,
+      getenv("NCCL_BOOTSTRAP_BRUCK_THRESHOLD") ? getenv("NCCL_BOOTSTRAP_BRUCK_THRESHOLD") : "32");
+  printf("  init time (ms)          %10.2f max %10.2f avg\n", initMax/1e3, initSum/nranks/1e3);
+  printf("  bootstrapAllGather (us) %10.2f max\n", agMax);
+  printf("  ring allgather (us)     %10.2f max\n", ringMax);
+  printf("  bootstrapBarrier (us)   %10.2f max %10.2f avg\n", barrierMax, barrierSum/nranks);
+  printf("  open fds per rank       %10d max\n", fdsMax);
+  printf("  layout errors           %10d\n", errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+#
+# Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+#
+# See LICENSE.txt for license information
+#
+
+# Rules shared by the host-only tools, built against the mock device. A tool
+# Makefile sets :
+#   TOOL        : name of the tool directory
+#   BINNAME     : name of the binary written to $(BUILDDIR)/bin
+#   SRCFILES    : sources of the tool
+#   LIBSRCFILES : sources of the library it is built with, relative to src/
+# and includes this file.
+
+include ../../makefiles/common.mk
+
+NCCL_SRC := ../../src
+BUILDDIR ?= $(abspath ../../build)
+INCDIR := $(BUILDDIR)/include
+OBJDIR := $(BUILDDIR)/obj/tools/$(TOOL)
+BINDIR := $(BUILDDIR)/bin
+
+include ../mock-device/mock.mk
+
+OBJ := $(SRCFILES:%.cc=$(OBJDIR)/%.o) $(LIBSRCFILES:%.cc=$(OBJDIR)/src/%.o)
+BINTARGET := $(BINDIR)/$(BINNAME)
+# The CUDA runtime is only linked for the device lookups of misc/utils.cc,
+# which the tools never run. The mock runtime of tools/mock-device provides it,
+# so that the tools build without the CUDA toolkit.
+MOCK_CUDALIB := $(MOCK_LIBDIR)/libcuda.so
+LDFLAGS += -L$(MOCK_LIBDIR) -lcuda -lpthread -lrt -ldl -Wl,-rpath,$(MOCK_LIBDIR)
+
+##### rules
+build : $(BINTARGET)
+
+$(BINTARGET) : $(OBJ) $(MOCK_CUDALIB)
+	@printf "Linking    %-35s > %s\n" $(BINNAME) $@
+	mkdir -p $(BINDIR)
+	$(CXX) $(CXXFLAGS) -o $@ $(OBJ) $(LDFLAGS)
+
+$(MOCK_CUDALIB) :
+	$(MAKE) -C ../mock-device cuda BUILDDIR=$(BUILDDIR)
+
+$(INCDIR)/nccl.h :
+	$(MAKE) -C $(NCCL_SRC) $@ BUILDDIR=$(BUILDDIR)
+
+$(OBJDIR)/%.o : %.cc $(INCDIR)/nccl.h
+	@printf "Compiling  %-35s > %s\n" $< $@
+	mkdir -p `dirname $@`
+	$(CXX) -I$(NCCL_SRC) -I$(INCDIR) $(CXXFLAGS) -I$(NCCL_SRC)/include -c $< -o $@
+
+$(OBJDIR)/src/%.o : $(NCCL_SRC)/%.cc $(INCDIR)/nccl.h
+	@printf "Compiling  %-35s > %s\n" $< $@
+	mkdir -p `dirname $@`
+	$(CXX) -I$(NCCL_SRC) -I$(INCDIR) $(CXXFLAGS) -I$(NCCL_SRC)/include -c $< -o $@
+
+clean :
+	rm -rf $(OBJDIR) $(BINTARGET)
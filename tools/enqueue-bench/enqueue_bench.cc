@@ -0,0 +1,108 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Host time spent enqueuing collectives, per collective. Run it with
+// NCCL_PLAN_CACHE=0 and 1 to compare the scheduling with and without the
+// plan cache.
+
+#include "nccl.h"
+#include <cuda_runtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#define CUDACHECK(cmd) do { \
+  cudaError_t err = cmd; \
+  if (err != cudaSuccess) { \
+    fprintf(stderr, "%s:%d CUDA error '%s'\n", __FILE__, __LINE__, cudaGetErrorString(err)); \
+    exit(1); \
+  } \
+} while(0)
+
+#define NCCLCHECK(cmd) do { \
+  ncclResult_t res = cmd; \
+  if (res != ncclSuccess) { \
+    fprintf(stderr, "%s:%d NCCL error '%s'\n", __FILE__, __LINE__, ncclGetErrorString(res)); \
+    exit(1); \
+  } \
+} while(0)
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+int main(int argc, char* argv[]) {
+  int nDev = 0, iters = 1000, groupSize = 1, sync = 16;
+  size_t count = 1024;
+  int opt;
+  while ((opt = getopt(argc, argv, "g:c:n:i:s:h")) != -1) {
+    switch (opt) {
+      case 'g': nDev = atoi(optarg); break;
+      case 'c': count = strtoull(optarg, NULL, 0); break;
+      case 'n': groupSize = atoi(optarg); break;
+      case 'i': iters = atoi(optarg); break;
+      case 's': sync = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage : %s [-g GPUs] [-c count] [-n collectives per group] [-i iterations] [-s iterations between syncs]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (nDev == 0) CUDACHECK(cudaGetDeviceCount(&nDev));
+  if (nDev < 1 || groupSize < 1 || iters < 1 || sync < 1) {
+    fprintf(stderr, "Need at least one GPU, collective and iteration\n");
+    return 1;
+  }
+
+  ncclComm_t* comms = (ncclComm_t*)malloc(nDev*sizeof(ncclComm_t));
+  cudaStream_t* streams = (cudaStream_t*)malloc(nDev*sizeof(cudaStream_t));
+  float** buffs = (float**)malloc(nDev*groupSize*sizeof(float*));
+  NCCLCHECK(ncclCommInitAll(comms, nDev, NULL));
+  for (int d=0; d<nDev; d++) {
+    CUDACHECK(cudaSetDevice(d));
+    CUDACHECK(cudaStreamCreate(streams+d));
+    // One buffer per collective of the group, so that only pointers differ
+    for (int n=0; n<groupSize; n++) CUDACHECK(cudaMalloc(buffs+d*groupSize+n, count*sizeof(float)));
+  }
+
+  double enqueueUs = 0;
+  for (int i=-sync; i<iters; i++) { // The first round is a warm up
+    double start = now();
+    NCCLCHECK(ncclGroupStart());
+    for (int d=0; d<nDev; d++) {
+      for (int n=0; n<groupSize; n++) {
+        float* buff = buffs[d*groupSize+n];
+        NCCLCHECK(ncclAllReduce(buff, buff, count, ncclFloat, ncclSum, comms[d], streams[d]));
+      }
+    }
+    NCCLCHECK(ncclGroupEnd());
+    if (i >= 0) enqueueUs += now()-start;
+    // Keep the work fifo from filling up, which would time the GPU
+    if ((i+1) % sync == 0) {
+      for (int d=0; d<nDev; d++) CUDACHECK(cudaStreamSynchronize(streams[d]));
+    }
+  }
+  for (int d=0; d<nDev; d++) CUDACHECK(cudaStreamSynchronize(streams[d]));
+
+  const char* cache = getenv("NCCL_PLAN_CACHE");
+  printf("# %d GPUs, groups of %d allreduce of %zu floats, %d iterations, NCCL_PLAN_CACHE=%s\n",
+      nDev, groupSize, count, iters, cache ? cache : "1");
+  printf("Host enqueue time : %.3f us per group, %.3f us per collective\n",
+      enqueueUs/iters, enqueueUs/((double)iters*groupSize*nDev));
+
+  for (int d=0; d<nDev; d++) {
+    CUDACHECK(cudaSetDevice(d));
+    for (int n=0; n<groupSize; n++) CUDACHECK(cudaFree(buffs[d*groupSize+n]));
+    CUDACHECK(cudaStreamDestroy(streams[d]));
+    NCCLCHECK(ncclCommDestroy(comms[d]));
+  }
+  free(buffs);
+  free(streams);
+  free(comms);
+  return 0;
+}
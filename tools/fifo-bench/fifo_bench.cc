@@ -0,0 +1,114 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Enqueue throughput under work fifo pressure. A thread plays the device : it
+// consumes plans at a fixed rate and acks them through comm->workFifoDone,
+// while the main thread posts plans as uploadWork() does.
+
+#include "comm.h"
+#include "workfifo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+struct simPlan {
+  uint32_t ixHead;
+  int nChannels;
+};
+
+struct simDevice {
+  struct ncclComm* comm;
+  struct simPlan* plans;
+  int nPlans;
+  uint64_t planNs;
+  volatile int posted;
+};
+
+static void* simDeviceMain(void* arg) {
+  struct simDevice* dev = (struct simDevice*)arg;
+  for (int p=0; p<dev->nPlans; p++) {
+    while (__atomic_load_n(&dev->posted, __ATOMIC_ACQUIRE) <= p) sched_yield();
+    uint64_t t0 = clockNano();
+    while (clockNano() - t0 < dev->planNs);
+    // Each channel consumed one slot and acks it
+    struct simPlan* plan = dev->plans+p;
+    for (int c=0; c<plan->nChannels; c++) {
+      __atomic_store_n(&dev->comm->workFifoDone[c], plan->ixHead+c+1, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+
+static uint64_t threadCpuNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char* argv[]) {
+  int depth = 1024, nChannels = 4, nPlans = 100000;
+  uint64_t planNs = 2000;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:c:n:w:h")) != -1) {
+    switch (opt) {
+      case 'd': depth = atoi(optarg); break;
+      case 'c': nChannels = atoi(optarg); break;
+      case 'n': nPlans = atoi(optarg); break;
+      case 'w': planNs = strtoull(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage : %s [-d fifo depth] [-c channels per plan] [-n plans] [-w device ns per plan]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (depth & (depth-1) || nChannels < 1 || nChannels > MAXCHANNELS || depth < 2*nChannels) {
+    fprintf(stderr, "The fifo depth must be a power of 2, with room for 2 plans of 1 to %d channels\n", MAXCHANNELS);
+    return 1;
+  }
+
+  struct ncclComm* comm = (struct ncclComm*)calloc(1, sizeof(struct ncclComm));
+  comm->workFifoDepth = depth;
+  comm->workFifoDone = (uint32_t*)calloc(MAXCHANNELS, sizeof(uint32_t));
+  struct simDevice dev;
+  dev.comm = comm;
+  dev.plans = (struct simPlan*)calloc(nPlans, sizeof(struct simPlan));
+  dev.nPlans = nPlans;
+  dev.planNs = planNs;
+  dev.posted = 0;
+  pthread_t thread;
+  pthread_create(&thread, NULL, simDeviceMain, &dev);
+
+  uint64_t t0 = clockNano(), cpu0 = threadCpuNs();
+  uint32_t ixMask = depth-1;
+  for (int p=0; p<nPlans; p++) {
+    // Same slot allocation as uploadWork()
+    uint32_t ixSent = comm->workFifoSent;
+    if (((ixSent + nChannels-1) & ixMask) < (ixSent & ixMask)) {
+      ixSent = (ixSent + ixMask) & ~ixMask;
+      comm->workFifoSent = ixSent;
+    }
+    ncclWorkFifoWaitAvailable(comm, ixSent + nChannels);
+    for (int c=0; c<nChannels; c++) ncclWorkFifoPost(comm, c, ixSent+c, ixSent+c+1);
+    comm->workFifoSent = ixSent + nChannels;
+    dev.plans[p].ixHead = ixSent;
+    dev.plans[p].nChannels = nChannels;
+    __atomic_store_n(&dev.posted, p+1, __ATOMIC_RELEASE);
+  }
+  uint64_t cpu = threadCpuNs() - cpu0;
+  pthread_join(thread, NULL);
+  uint64_t total = clockNano() - t0;
+
+  printf("%d plans of %d channels, fifo depth %d, %lu ns per plan on the device\n", nPlans, nChannels, depth, planNs);
+  printf("  throughput        %10.0f plans/s\n", nPlans / (total/1e9));
+  printf("  fifo full         %10lu times, %.3f ms waiting\n", comm->workFifoStalls, comm->workFifoStallNs/1e6);
+  printf("  enqueue CPU time  %10.3f ms (%.1f%% of the run)\n", cpu/1e6, 100.0*cpu/total);
+  free(dev.plans);
+  free(comm->workFifoDone);
+  free(comm);
+  return 0;
+}
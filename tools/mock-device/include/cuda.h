@@ -0,0 +1,67 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Subset of the CUDA driver API used by NCCL, implemented on the host by
+// mock_cuda.cc. Values follow the real header where NCCL depends on them.
+
+#ifndef NCCL_MOCK_CUDA_H_
+#define NCCL_MOCK_CUDA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CUDA 11.6 : recent enough for the versioned driver entry points, old enough
+// to avoid launch attributes and DMA-BUF.
+#define CUDA_VERSION 11060
+
+#define CUDAAPI
+
+typedef enum cudaError_enum {
+  CUDA_SUCCESS = 0,
+  CUDA_ERROR_INVALID_VALUE = 1,
+  CUDA_ERROR_OUT_OF_MEMORY = 2,
+  CUDA_ERROR_NOT_INITIALIZED = 3,
+  CUDA_ERROR_INVALID_DEVICE = 101,
+  CUDA_ERROR_INVALID_CONTEXT = 201,
+  CUDA_ERROR_NOT_FOUND = 500,
+  CUDA_ERROR_NOT_SUPPORTED = 801
+} CUresult;
+
+typedef int CUdevice;
+typedef unsigned long long CUdeviceptr;
+typedef struct CUctx_st* CUcontext;
+typedef uint64_t cuuint64_t;
+
+typedef enum CUdevice_attribute_enum {
+  CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR = 75,
+  CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR = 76,
+  CU_DEVICE_ATTRIBUTE_DMA_BUF_SUPPORTED = 124
+} CUdevice_attribute;
+
+#define CU_CTX_SCHED_SPIN 0x01
+#define CU_CTX_MAP_HOST 0x08
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CUresult cuInit(unsigned int flags);
+CUresult cuDriverGetVersion(int* driverVersion);
+CUresult cuGetProcAddress(const char* symbol, void** pfn, int cudaVersion, cuuint64_t flags);
+CUresult cuGetErrorString(CUresult error, const char** str);
+CUresult cuGetErrorName(CUresult error, const char** str);
+CUresult cuDeviceGet(CUdevice* device, int ordinal);
+CUresult cuDeviceGetAttribute(int* pi, CUdevice_attribute attrib, CUdevice dev);
+CUresult cuMemGetAddressRange(CUdeviceptr* pbase, size_t* psize, CUdeviceptr dptr);
+CUresult cuCtxCreate(CUcontext* pctx, unsigned int flags, CUdevice dev);
+CUresult cuCtxDestroy(CUcontext ctx);
+CUresult cuCtxSetCurrent(CUcontext ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Versioned driver entry points, as cudawrap.h loads them.
+
+#ifndef NCCL_MOCK_CUDATYPEDEFS_H_
+#define NCCL_MOCK_CUDATYPEDEFS_H_
+
+#include "cuda.h"
+
+typedef CUresult (CUDAAPI *PFN_cuInit_v2000)(unsigned int flags);
+typedef CUresult (CUDAAPI *PFN_cuDriverGetVersion_v2020)(int* driverVersion);
+typedef CUresult (CUDAAPI *PFN_cuGetProcAddress_v11030)(const char* symbol, void** pfn, int cudaVersion, cuuint64_t flags);
+typedef CUresult (CUDAAPI *PFN_cuGetErrorString_v6000)(CUresult error, const char** str);
+typedef CUresult (CUDAAPI *PFN_cuGetErrorName_v6000)(CUresult error, const char** str);
+typedef CUresult (CUDAAPI *PFN_cuDeviceGet_v2000)(CUdevice* device, int ordinal);
+typedef CUresult (CUDAAPI *PFN_cuDeviceGetAttribute_v2000)(int* pi, CUdevice_attribute attrib, CUdevice dev);
+typedef CUresult (CUDAAPI *PFN_cuMemGetAddressRange_v3020)(CUdeviceptr* pbase, size_t* psize, CUdeviceptr dptr);
+typedef CUresult (CUDAAPI *PFN_cuCtxCreate_v3020)(CUcontext* pctx, unsigned int flags, CUdevice dev);
+typedef CUresult (CUDAAPI *PFN_cuCtxDestroy_v4000)(CUcontext ctx);
+typedef CUresult (CUDAAPI *PFN_cuCtxSetCurrent_v4000)(CUcontext ctx);
+
+#endif
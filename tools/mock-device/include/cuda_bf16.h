@@ -0,0 +1,30 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Storage and the conversion used by the host code.
+
+#ifndef NCCL_MOCK_CUDA_BF16_H_
+#define NCCL_MOCK_CUDA_BF16_H_
+
+#define __CUDA_BF16_TYPES_EXIST__
+#include <stdint.h>
+
+struct __nv_bfloat16 { unsigned short x; };
+
+// Round to nearest even, NaNs stay quiet NaNs
+static inline struct __nv_bfloat16 __float2bfloat16(float f) {
+  union { float f; uint32_t u; } v;
+  v.f = f;
+  struct __nv_bfloat16 h;
+  if ((v.u & 0x7fffffff) > 0x7f800000) {
+    h.x = ((v.u >> 16) & 0x8000) | 0x7fc0;
+  } else {
+    h.x = (v.u + 0x7fff + ((v.u >> 16) & 1)) >> 16;
+  }
+  return h;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Storage and the conversion used by the host code.
+
+#ifndef NCCL_MOCK_CUDA_FP16_H_
+#define NCCL_MOCK_CUDA_FP16_H_
+
+#include <stdint.h>
+
+struct __half { unsigned short x; };
+typedef struct __half half;
+
+// Round to nearest even, overflow to infinity
+static inline struct __half __float2half(float f) {
+  union { float f; uint32_t u; } v;
+  v.f = f;
+  uint32_t sign = (v.u >> 16) & 0x8000;
+  v.u &= 0x7fffffff;
+  struct __half h;
+  if (v.u >= 0x47800000) { // Inf/NaN, or too large
+    h.x = v.u > 0x7f800000 ? 0x7e00 : 0x7c00;
+  } else if (v.u < 0x38800000) { // Denormal : let the FPU round, adding 0.5
+    v.f += 0.5f;
+    h.x = v.u - 0x3f000000;
+  } else {
+    v.u += 0xc8000fff + ((v.u >> 13) & 1); // Rebias the exponent and round
+    h.x = v.u >> 13;
+  }
+  h.x |= sign;
+  return h;
+}
+
+#endif
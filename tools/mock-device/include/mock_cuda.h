@@ -0,0 +1,33 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Extensions of the mock CUDA library, for the code providing the kernels.
+
+#ifndef NCCL_MOCK_CUDA_EXT_H_
+#define NCCL_MOCK_CUDA_EXT_H_
+
+#include "cuda_runtime.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Host function run in place of a kernel, on the worker thread of the stream
+// it was launched on. args points to copies of the launch arguments, taken
+// when the kernel was launched. The whole grid is run by one call : blocks
+// depending on each other must be interleaved by the function itself.
+typedef void (*mockKernelEntry_t)(void** args, dim3 gridDim, dim3 blockDim);
+
+// Make func launchable with cudaLaunchKernel(), as the registration code
+// generated by nvcc does. argSizes gives the size of each of the nArgs
+// arguments.
+cudaError_t mockCudaRegisterKernel(const void* func, mockKernelEntry_t entry, int nArgs, const size_t* argSizes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
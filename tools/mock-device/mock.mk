@@ -0,0 +1,14 @@
+#
+# Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+#
+# See LICENSE.txt for license information
+#
+
+# Builds against the mock CUDA headers instead of the toolkit : neither nvcc
+# nor a GPU is needed. Included after makefiles/common.mk, with BUILDDIR set.
+MOCK_DIR := $(abspath $(dir $(lastword $(MAKEFILE_LIST))))
+MOCK_LIBDIR := $(BUILDDIR)/lib/mock
+MOCK_CUDA_MAJOR := 11
+MOCK_CUDA_MINOR := 6
+CXXFLAGS := $(filter-out -DCUDA_MAJOR=% -DCUDA_MINOR=% -I $(CUDA_INC),$(CXXFLAGS))
+CXXFLAGS += -DCUDA_MAJOR=$(MOCK_CUDA_MAJOR) -DCUDA_MINOR=$(MOCK_CUDA_MINOR) -I$(MOCK_DIR)/include
@@ -0,0 +1,225 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Host throughput of the whole NCCL pipeline on mock devices : enqueue, host
+// kernels, proxies and the socket network. Each rank is a process with its own
+// host id, so that ranks talk through the network transport over loopback.
+
+#include "nccl.h"
+#include <cuda_runtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define CUDACHECK(cmd) do { \
+  cudaError_t err = cmd; \
+  if (err != cudaSuccess) { \
+    fprintf(stderr, "%s:%d CUDA error '%s'\n", __FILE__, __LINE__, cudaGetErrorString(err)); \
+    exit(1); \
+  } \
+} while(0)
+
+#define NCCLCHECK(cmd) do { \
+  ncclResult_t res = cmd; \
+  if (res != ncclSuccess) { \
+    fprintf(stderr, "%s:%d NCCL error '%s'\n", __FILE__, __LINE__, ncclGetErrorString(res)); \
+    exit(1); \
+  } \
+} while(0)
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+static size_t parseSize(const char* str) {
+  char* end;
+  size_t value = strtoull(str, &end, 0);
+  switch (*end) {
+    case 'G': case 'g': value <<= 10; // fall through
+    case 'M': case 'm': value <<= 10; // fall through
+    case 'K': case 'k': value <<= 10;
+  }
+  return value;
+}
+
+enum { benchSendRecv, benchAllReduce, benchNumOps };
+static const char* opNames[benchNumOps] = { "sendrecv", "allreduce" };
+
+// Small integers, so that float sums are exact
+static float value(int rank, size_t i) { return (float)(rank + i%13); }
+
+static void run(int op, ncclComm_t comm, cudaStream_t stream, float* sendbuff, float* recvbuff, size_t count) {
+  int rank, nRanks;
+  NCCLCHECK(ncclCommUserRank(comm, &rank));
+  NCCLCHECK(ncclCommCount(comm, &nRanks));
+  if (op == benchAllReduce) {
+    NCCLCHECK(ncclAllReduce(sendbuff, recvbuff, count, ncclFloat, ncclSum, comm, stream));
+  } else {
+    // Ring exchange : send to the next rank, receive from the previous one
+    NCCLCHECK(ncclGroupStart());
+    NCCLCHECK(ncclSend(sendbuff, count, ncclFloat, (rank+1)%nRanks, comm, stream));
+    NCCLCHECK(ncclRecv(recvbuff, count, ncclFloat, (rank+nRanks-1)%nRanks, comm, stream));
+    NCCLCHECK(ncclGroupEnd());
+  }
+}
+
+// Returns the number of wrong elements
+static size_t check(int op, int rank, int nRanks, const float* result, size_t count) {
+  size_t errors = 0;
+  for (size_t i=0; i<count; i++) {
+    float expected;
+    if (op == benchAllReduce) {
+      expected = 0;
+      for (int r=0; r<nRanks; r++) expected += value(r, i);
+    } else {
+      expected = value((rank+nRanks-1)%nRanks, i);
+    }
+    if (result[i] != expected) errors++;
+  }
+  return errors;
+}
+
+static int rankMain(int rank, int nRanks, int idFd[2], int op0, int op1, size_t minBytes, size_t maxBytes,
+    int factor, int iters, int warmup, int checks) {
+  char hostId[64];
+  snprintf(hostId, sizeof(hostId), "nccl-mock-bench-%d", rank);
+  setenv("NCCL_HOSTID", hostId, 1);
+  setenv("NCCL_SOCKET_IFNAME", "lo", 0);
+
+  // Rank 0 creates the id and hands it to the other ranks
+  ncclUniqueId id;
+  if (rank == 0) {
+    NCCLCHECK(ncclGetUniqueId(&id));
+    for (int r=1; r<nRanks; r++) {
+      if (write(idFd[1], &id, sizeof(id)) != sizeof(id)) { perror("write"); return 1; }
+    }
+  } else {
+    if (read(idFd[0], &id, sizeof(id)) != sizeof(id)) { perror("read"); return 1; }
+  }
+  close(idFd[0]);
+  close(idFd[1]);
+
+  ncclComm_t comm;
+  cudaStream_t stream;
+  float *sendbuff, *recvbuff;
+  size_t maxCount = maxBytes/sizeof(float);
+  CUDACHECK(cudaSetDevice(0));
+  CUDACHECK(cudaStreamCreate(&stream));
+  CUDACHECK(cudaMalloc(&sendbuff, maxCount*sizeof(float)));
+  CUDACHECK(cudaMalloc(&recvbuff, maxCount*sizeof(float)));
+  float* host = (float*)malloc(maxCount*sizeof(float));
+  for (size_t i=0; i<maxCount; i++) host[i] = value(rank, i);
+  CUDACHECK(cudaMemcpy(sendbuff, host, maxCount*sizeof(float), cudaMemcpyHostToDevice));
+  NCCLCHECK(ncclCommInitRank(&comm, nRanks, id, rank));
+
+  if (rank == 0) {
+    printf("# %d ranks, %d iterations, %d warmup\n", nRanks, iters, warmup);
+    printf("# %10s %10s %12s %12s %10s %10s %8s\n", "op", "bytes", "count", "time(us)", "algbw", "busbw", "errors");
+  }
+  int failed = 0;
+  for (int op=op0; op<=op1; op++) {
+    for (size_t bytes=minBytes; bytes<=maxBytes; bytes*=factor) {
+      size_t count = bytes/sizeof(float);
+      for (int i=0; i<warmup; i++) run(op, comm, stream, sendbuff, recvbuff, count);
+      CUDACHECK(cudaStreamSynchronize(stream));
+      double start = now();
+      for (int i=0; i<iters; i++) run(op, comm, stream, sendbuff, recvbuff, count);
+      CUDACHECK(cudaStreamSynchronize(stream));
+      double us = (now()-start)/iters;
+
+      size_t errors = 0;
+      if (checks) {
+        CUDACHECK(cudaMemcpy(host, recvbuff, count*sizeof(float), cudaMemcpyDeviceToHost));
+        errors = check(op, rank, nRanks, host, count);
+        if (errors) failed = 1;
+      }
+      // Bus bandwidth as nccl-tests computes it
+      double algBw = count*sizeof(float)/us*1e-3;
+      double busBw = op == benchAllReduce ? algBw*2*(nRanks-1)/nRanks : algBw;
+      if (rank == 0) {
+        printf("  %10s %10zu %12zu %12.2f %10.3f %10.3f %8zu\n", opNames[op], count*sizeof(float), count, us, algBw, busBw, errors);
+      } else if (errors) {
+        printf("# rank %d : %zu errors for %s of %zu bytes\n", rank, errors, opNames[op], count*sizeof(float));
+      }
+      fflush(stdout);
+      if (factor <= 1) break;
+    }
+  }
+
+  NCCLCHECK(ncclCommDestroy(comm));
+  CUDACHECK(cudaFree(sendbuff));
+  CUDACHECK(cudaFree(recvbuff));
+  CUDACHECK(cudaStreamDestroy(stream));
+  free(host);
+  return failed;
+}
+
+int main(int argc, char* argv[]) {
+  int nRanks = 2, factor = 2, iters = 20, warmup = 5, checks = 1;
+  int op0 = 0, op1 = benchNumOps-1;
+  size_t minBytes = 8, maxBytes = 32<<20;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:b:e:f:i:w:c:o:h")) != -1) {
+    switch (opt) {
+      case 'n': nRanks = atoi(optarg); break;
+      case 'b': minBytes = parseSize(optarg); break;
+      case 'e': maxBytes = parseSize(optarg); break;
+      case 'f': factor = atoi(optarg); break;
+      case 'i': iters = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 'c': checks = atoi(optarg); break;
+      case 'o':
+        for (op0=0; op0<benchNumOps && strcmp(optarg, opNames[op0]); op0++);
+        if (op0 == benchNumOps && strcmp(optarg, "all") == 0) op0 = 0;
+        else if (op0 == benchNumOps) { fprintf(stderr, "Unknown operation %s\n", optarg); return 1; }
+        else op1 = op0;
+        break;
+      default:
+        fprintf(stderr, "Usage : %s [-n ranks] [-b min bytes] [-e max bytes] [-f factor] [-i iterations] [-w warmup iterations] "
+            "[-c check 0/1] [-o sendrecv|allreduce|all]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (nRanks < 1 || iters < 1 || warmup < 0 || minBytes < sizeof(float) || maxBytes < minBytes) {
+    fprintf(stderr, "Need at least one rank and iteration, and 4 <= min bytes <= max bytes\n");
+    return 1;
+  }
+
+  int idFd[2];
+  if (pipe(idFd) != 0) { perror("pipe"); return 1; }
+  fflush(stdout);
+  pid_t* pids = (pid_t*)malloc(nRanks*sizeof(pid_t));
+  for (int r=0; r<nRanks; r++) {
+    pids[r] = fork();
+    if (pids[r] < 0) { perror("fork"); return 1; }
+    if (pids[r] == 0) exit(rankMain(r, nRanks, idFd, op0, op1, minBytes, maxBytes, factor, iters, warmup, checks));
+  }
+  close(idFd[0]);
+  close(idFd[1]);
+
+  int failed = 0;
+  for (int r=0; r<nRanks; r++) {
+    int status;
+    if (waitpid(pids[r], &status, 0) < 0) {
+      perror("waitpid");
+      failed = 1;
+    } else if (WIFSIGNALED(status)) {
+      fprintf(stderr, "Rank %d killed by signal %d\n", r, WTERMSIG(status));
+      failed = 1;
+    } else if (WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Rank %d failed\n", r);
+      failed = 1;
+    }
+  }
+  free(pids);
+  return failed;
+}
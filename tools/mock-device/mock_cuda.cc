@@ -0,0 +1,796 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Host implementation of the CUDA runtime and driver subset used by NCCL.
+//
+// Device memory is host memory. Each stream is a host thread running the
+// functions queued on it in order : copies, host functions, event records and
+// waits, and kernels, which are host functions registered with
+// mockCudaRegisterKernel(). Graphs and IPC are not supported. The NULL stream
+// is an ordinary stream per device, without the implicit synchronization of
+// the legacy default stream.
+//
+// NCCL_MOCK_DEVICES sets the number of devices (default 1).
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#pragma GCC visibility push(default)
+#include "cuda.h"
+#include "cudaTypedefs.h"
+#include "cuda_runtime.h"
+#include "mock_cuda.h"
+
+#define MOCK_MAX_DEVICES 64
+
+/* Error handling */
+
+static thread_local cudaError_t mockLastError = cudaSuccess;
+
+static cudaError_t mockError(cudaError_t err) {
+  if (err != cudaSuccess) mockLastError = err;
+  return err;
+}
+
+/* Devices */
+
+static thread_local int mockCurrentDevice = 0;
+
+static int mockDeviceCount() {
+  static int count = -1;
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, []() {
+    const char* str = getenv("NCCL_MOCK_DEVICES");
+    count = str ? atoi(str) : 1;
+    if (count < 1) count = 1;
+    if (count > MOCK_MAX_DEVICES) count = MOCK_MAX_DEVICES;
+  });
+  return count;
+}
+
+// Bus IDs which no real device uses, so that topology detection finds nothing
+// in sysfs and attaches the devices to the CPU.
+static void mockBusId(int dev, char* busId, int len) {
+  snprintf(busId, len, "0000:%02x:1f.7", 0xc0+dev);
+}
+
+/* Memory */
+
+struct MockAllocation {
+  size_t size;
+  enum cudaMemoryType type;
+  int device;
+  bool owned;
+};
+
+static std::mutex mockMemMutex;
+static std::map<uintptr_t, struct MockAllocation>& mockMem() {
+  static std::map<uintptr_t, struct MockAllocation>* mem = new std::map<uintptr_t, struct MockAllocation>();
+  return *mem;
+}
+
+static void mockMemInsert(void* ptr, size_t size, enum cudaMemoryType type, bool owned) {
+  std::lock_guard<std::mutex> lock(mockMemMutex);
+  mockMem()[(uintptr_t)ptr] = { size, type, mockCurrentDevice, owned };
+}
+
+// Find the allocation containing ptr. Returns false if there is none.
+static bool mockMemFind(const void* ptr, uintptr_t* base, struct MockAllocation* alloc) {
+  std::lock_guard<std::mutex> lock(mockMemMutex);
+  auto it = mockMem().upper_bound((uintptr_t)ptr);
+  if (it == mockMem().begin()) return false;
+  --it;
+  if ((uintptr_t)ptr >= it->first + (it->second.size ? it->second.size : 1)) return false;
+  *base = it->first;
+  *alloc = it->second;
+  return true;
+}
+
+static cudaError_t mockMemAlloc(void** ptr, size_t size, enum cudaMemoryType type) {
+  if (ptr == NULL) return mockError(cudaErrorInvalidValue);
+  void* p;
+  if (posix_memalign(&p, 4096, size ? size : 1) != 0) return mockError(cudaErrorMemoryAllocation);
+  mockMemInsert(p, size, type, true);
+  *ptr = p;
+  return cudaSuccess;
+}
+
+static cudaError_t mockMemFree(void* ptr, enum cudaMemoryType type) {
+  if (ptr == NULL) return cudaSuccess;
+  std::lock_guard<std::mutex> lock(mockMemMutex);
+  auto it = mockMem().find((uintptr_t)ptr);
+  if (it == mockMem().end() || it->second.type != type || !it->second.owned) return mockError(cudaErrorInvalidValue);
+  mockMem().erase(it);
+  free(ptr);
+  return cudaSuccess;
+}
+
+/* Streams */
+
+struct MockStream {
+  int device;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<std::function<void()>> queue;
+  uint64_t enqueued;
+  uint64_t completed;
+  bool destroyed;
+};
+
+static void mockStreamWorker(struct MockStream* s) {
+  mockCurrentDevice = s->device;
+  std::unique_lock<std::mutex> lock(s->mutex);
+  while (true) {
+    while (s->queue.empty() && !s->destroyed) s->cond.wait(lock);
+    if (s->queue.empty()) break;
+    std::function<void()> fn = std::move(s->queue.front());
+    s->queue.pop_front();
+    lock.unlock();
+    fn();
+    lock.lock();
+    s->completed++;
+    s->cond.notify_all();
+  }
+  lock.unlock();
+  delete s;
+}
+
+static struct MockStream* mockStreamNew(int device) {
+  struct MockStream* s = new MockStream();
+  s->device = device;
+  s->enqueued = s->completed = 0;
+  s->destroyed = false;
+  std::thread(mockStreamWorker, s).detach();
+  return s;
+}
+
+// The NULL stream of each device is created on first use and never destroyed.
+static struct MockStream* mockStreamGet(cudaStream_t stream) {
+  if (stream) return stream;
+  static struct MockStream* nullStreams[MOCK_MAX_DEVICES];
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  int dev = mockCurrentDevice;
+  if (nullStreams[dev] == NULL) nullStreams[dev] = mockStreamNew(dev);
+  return nullStreams[dev];
+}
+
+static void mockStreamEnqueue(cudaStream_t stream, std::function<void()> fn) {
+  struct MockStream* s = mockStreamGet(stream);
+  std::lock_guard<std::mutex> lock(s->mutex);
+  s->queue.push_back(std::move(fn));
+  s->enqueued++;
+  s->cond.notify_all();
+}
+
+static void mockStreamSync(cudaStream_t stream) {
+  struct MockStream* s = mockStreamGet(stream);
+  std::unique_lock<std::mutex> lock(s->mutex);
+  uint64_t target = s->enqueued;
+  while (s->completed < target) s->cond.wait(lock);
+}
+
+/* Events */
+
+struct MockEvent {
+  unsigned int flags;
+  std::mutex mutex;
+  std::condition_variable cond;
+  uint64_t recorded;  // Number of records issued
+  uint64_t completed; // Last record reached by its stream
+  struct timespec time;
+};
+
+static void mockEventWait(struct MockEvent* e, uint64_t record) {
+  std::unique_lock<std::mutex> lock(e->mutex);
+  while (e->completed < record) e->cond.wait(lock);
+}
+
+/* Kernels */
+
+struct MockKernel {
+  mockKernelEntry_t entry;
+  std::vector<size_t> argSizes;
+};
+
+static std::mutex mockKernelMutex;
+static std::unordered_map<const void*, struct MockKernel>& mockKernels() {
+  static std::unordered_map<const void*, struct MockKernel>* kernels = new std::unordered_map<const void*, struct MockKernel>();
+  return *kernels;
+}
+
+static bool mockKernelFind(const void* func, struct MockKernel* kernel) {
+  std::lock_guard<std::mutex> lock(mockKernelMutex);
+  auto it = mockKernels().find(func);
+  if (it == mockKernels().end()) return false;
+  *kernel = it->second;
+  return true;
+}
+
+extern "C" {
+
+cudaError_t mockCudaRegisterKernel(const void* func, mockKernelEntry_t entry, int nArgs, const size_t* argSizes) {
+  if (func == NULL || entry == NULL || nArgs < 0) return mockError(cudaErrorInvalidValue);
+  std::lock_guard<std::mutex> lock(mockKernelMutex);
+  struct MockKernel& kernel = mockKernels()[func];
+  kernel.entry = entry;
+  kernel.argSizes.assign(argSizes, argSizes+nArgs);
+  return cudaSuccess;
+}
+
+/* Runtime API : errors and versions */
+
+const char* cudaGetErrorName(cudaError_t error) {
+  switch (error) {
+  case cudaSuccess: return "cudaSuccess";
+  case cudaErrorInvalidValue: return "cudaErrorInvalidValue";
+  case cudaErrorMemoryAllocation: return "cudaErrorMemoryAllocation";
+  case cudaErrorInitializationError: return "cudaErrorInitializationError";
+  case cudaErrorStubLibrary: return "cudaErrorStubLibrary";
+  case cudaErrorInvalidDeviceFunction: return "cudaErrorInvalidDeviceFunction";
+  case cudaErrorInvalidDevice: return "cudaErrorInvalidDevice";
+  case cudaErrorInvalidResourceHandle: return "cudaErrorInvalidResourceHandle";
+  case cudaErrorNotReady: return "cudaErrorNotReady";
+  case cudaErrorPeerAccessAlreadyEnabled: return "cudaErrorPeerAccessAlreadyEnabled";
+  case cudaErrorNotSupported: return "cudaErrorNotSupported";
+  default: return "cudaErrorUnknown";
+  }
+}
+
+const char* cudaGetErrorString(cudaError_t error) {
+  switch (error) {
+  case cudaSuccess: return "no error";
+  case cudaErrorInvalidValue: return "invalid argument";
+  case cudaErrorMemoryAllocation: return "out of memory";
+  case cudaErrorInitializationError: return "initialization error";
+  case cudaErrorStubLibrary: return "CUDA driver is a stub library";
+  case cudaErrorInvalidDeviceFunction: return "invalid device function";
+  case cudaErrorInvalidDevice: return "invalid device ordinal";
+  case cudaErrorInvalidResourceHandle: return "invalid resource handle";
+  case cudaErrorNotReady: return "device not ready";
+  case cudaErrorPeerAccessAlreadyEnabled: return "peer access is already enabled";
+  case cudaErrorNotSupported: return "operation not supported by the mock device";
+  default: return "unknown error";
+  }
+}
+
+cudaError_t cudaGetLastError(void) {
+  cudaError_t err = mockLastError;
+  mockLastError = cudaSuccess;
+  return err;
+}
+
+cudaError_t cudaPeekAtLastError(void) {
+  return mockLastError;
+}
+
+cudaError_t cudaDriverGetVersion(int* driverVersion) {
+  if (driverVersion == NULL) return mockError(cudaErrorInvalidValue);
+  *driverVersion = CUDA_VERSION;
+  return cudaSuccess;
+}
+
+cudaError_t cudaRuntimeGetVersion(int* runtimeVersion) {
+  if (runtimeVersion == NULL) return mockError(cudaErrorInvalidValue);
+  *runtimeVersion = CUDART_VERSION;
+  return cudaSuccess;
+}
+
+/* Runtime API : devices */
+
+cudaError_t cudaGetDeviceCount(int* count) {
+  if (count == NULL) return mockError(cudaErrorInvalidValue);
+  *count = mockDeviceCount();
+  return cudaSuccess;
+}
+
+cudaError_t cudaGetDevice(int* device) {
+  if (device == NULL) return mockError(cudaErrorInvalidValue);
+  *device = mockCurrentDevice;
+  return cudaSuccess;
+}
+
+cudaError_t cudaSetDevice(int device) {
+  if (device < 0 || device >= mockDeviceCount()) return mockError(cudaErrorInvalidDevice);
+  mockCurrentDevice = device;
+  return cudaSuccess;
+}
+
+cudaError_t cudaDeviceSynchronize(void) {
+  // Streams of all devices are not tracked : only the NULL stream is waited for.
+  mockStreamSync(NULL);
+  return cudaSuccess;
+}
+
+cudaError_t cudaDeviceGetAttribute(int* value, enum cudaDeviceAttr attr, int device) {
+  if (value == NULL) return mockError(cudaErrorInvalidValue);
+  if (device < 0 || device >= mockDeviceCount()) return mockError(cudaErrorInvalidDevice);
+  switch (attr) {
+  case cudaDevAttrMaxThreadsPerBlock: *value = 1024; break;
+  case cudaDevAttrMultiProcessorCount: *value = 108; break;
+  case cudaDevAttrComputeCapabilityMajor: *value = 8; break;
+  case cudaDevAttrComputeCapabilityMinor: *value = 0; break;
+  case cudaDevAttrGPUDirectRDMASupported: *value = 0; break;
+  default: return mockError(cudaErrorInvalidValue);
+  }
+  return cudaSuccess;
+}
+
+cudaError_t cudaGetDeviceProperties(struct cudaDeviceProp* prop, int device) {
+  if (prop == NULL) return mockError(cudaErrorInvalidValue);
+  if (device < 0 || device >= mockDeviceCount()) return mockError(cudaErrorInvalidDevice);
+  memset(prop, 0, sizeof(*prop));
+  snprintf(prop->name, sizeof(prop->name), "NCCL mock device %d", device);
+  prop->totalGlobalMem = 16ULL << 30;
+  prop->major = 8;
+  prop->minor = 0;
+  prop->multiProcessorCount = 108;
+  prop->pciDomainID = 0;
+  prop->pciBusID = 0xc0+device;
+  prop->pciDeviceID = 0x1f;
+  return cudaSuccess;
+}
+
+cudaError_t cudaDeviceGetPCIBusId(char* pciBusId, int len, int device) {
+  if (pciBusId == NULL || len <= 0) return mockError(cudaErrorInvalidValue);
+  if (device < 0 || device >= mockDeviceCount()) return mockError(cudaErrorInvalidDevice);
+  mockBusId(device, pciBusId, len);
+  return cudaSuccess;
+}
+
+cudaError_t cudaDeviceGetByPCIBusId(int* device, const char* pciBusId) {
+  if (device == NULL || pciBusId == NULL) return mockError(cudaErrorInvalidValue);
+  for (int d=0; d<mockDeviceCount(); d++) {
+    char busId[32];
+    mockBusId(d, busId, sizeof(busId));
+    if (strcasecmp(busId, pciBusId) == 0) {
+      *device = d;
+      return cudaSuccess;
+    }
+  }
+  return mockError(cudaErrorInvalidDevice);
+}
+
+// Devices have no peer access : they can only communicate through the host.
+cudaError_t cudaDeviceCanAccessPeer(int* canAccessPeer, int device, int peerDevice) {
+  if (canAccessPeer == NULL) return mockError(cudaErrorInvalidValue);
+  *canAccessPeer = 0;
+  return cudaSuccess;
+}
+
+cudaError_t cudaDeviceEnablePeerAccess(int peerDevice, unsigned int flags) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaDeviceSetLimit(enum cudaLimit limit, size_t value) {
+  return cudaSuccess;
+}
+
+/* Runtime API : memory */
+
+cudaError_t cudaMalloc(void** devPtr, size_t size) {
+  return mockMemAlloc(devPtr, size, cudaMemoryTypeDevice);
+}
+
+cudaError_t cudaFree(void* devPtr) {
+  return mockMemFree(devPtr, cudaMemoryTypeDevice);
+}
+
+cudaError_t cudaHostAlloc(void** pHost, size_t size, unsigned int flags) {
+  return mockMemAlloc(pHost, size, cudaMemoryTypeHost);
+}
+
+cudaError_t cudaMallocHost(void** ptr, size_t size) {
+  return mockMemAlloc(ptr, size, cudaMemoryTypeHost);
+}
+
+cudaError_t cudaFreeHost(void* ptr) {
+  return mockMemFree(ptr, cudaMemoryTypeHost);
+}
+
+cudaError_t cudaHostRegister(void* ptr, size_t size, unsigned int flags) {
+  if (ptr == NULL || size == 0) return mockError(cudaErrorInvalidValue);
+  mockMemInsert(ptr, size, cudaMemoryTypeHost, false);
+  return cudaSuccess;
+}
+
+cudaError_t cudaHostUnregister(void* ptr) {
+  std::lock_guard<std::mutex> lock(mockMemMutex);
+  auto it = mockMem().find((uintptr_t)ptr);
+  if (it == mockMem().end() || it->second.owned) return mockError(cudaErrorInvalidValue);
+  mockMem().erase(it);
+  return cudaSuccess;
+}
+
+cudaError_t cudaHostGetDevicePointer(void** pDevice, void* pHost, unsigned int flags) {
+  if (pDevice == NULL) return mockError(cudaErrorInvalidValue);
+  *pDevice = pHost;
+  return cudaSuccess;
+}
+
+cudaError_t cudaPointerGetAttributes(struct cudaPointerAttributes* attributes, const void* ptr) {
+  if (attributes == NULL) return mockError(cudaErrorInvalidValue);
+  uintptr_t base;
+  struct MockAllocation alloc;
+  memset(attributes, 0, sizeof(*attributes));
+  attributes->device = -2;
+  if (mockMemFind(ptr, &base, &alloc)) {
+    attributes->type = alloc.type;
+    attributes->device = alloc.device;
+    attributes->devicePointer = (void*)ptr;
+    if (alloc.type == cudaMemoryTypeHost) attributes->hostPointer = (void*)ptr;
+  }
+  return cudaSuccess;
+}
+
+cudaError_t cudaMemcpy(void* dst, const void* src, size_t count, enum cudaMemcpyKind kind) {
+  mockStreamSync(NULL);
+  if (count) memcpy(dst, src, count);
+  return cudaSuccess;
+}
+
+cudaError_t cudaMemcpyAsync(void* dst, const void* src, size_t count, enum cudaMemcpyKind kind, cudaStream_t stream) {
+  if (count) mockStreamEnqueue(stream, [=]() { memcpy(dst, src, count); });
+  return cudaSuccess;
+}
+
+cudaError_t cudaMemset(void* devPtr, int value, size_t count) {
+  mockStreamSync(NULL);
+  if (count) memset(devPtr, value, count);
+  return cudaSuccess;
+}
+
+cudaError_t cudaMemsetAsync(void* devPtr, int value, size_t count, cudaStream_t stream) {
+  if (count) mockStreamEnqueue(stream, [=]() { memset(devPtr, value, count); });
+  return cudaSuccess;
+}
+
+cudaError_t cudaIpcGetMemHandle(cudaIpcMemHandle_t* handle, void* devPtr) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaIpcOpenMemHandle(void** devPtr, cudaIpcMemHandle_t handle, unsigned int flags) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaIpcCloseMemHandle(void* devPtr) {
+  return mockError(cudaErrorNotSupported);
+}
+
+/* Runtime API : streams and events */
+
+cudaError_t cudaStreamCreateWithFlags(cudaStream_t* pStream, unsigned int flags) {
+  if (pStream == NULL) return mockError(cudaErrorInvalidValue);
+  *pStream = mockStreamNew(mockCurrentDevice);
+  return cudaSuccess;
+}
+
+cudaError_t cudaStreamCreate(cudaStream_t* pStream) {
+  return cudaStreamCreateWithFlags(pStream, cudaStreamDefault);
+}
+
+// Like CUDA, work already queued still runs : the worker frees the stream
+// once it is done.
+cudaError_t cudaStreamDestroy(cudaStream_t stream) {
+  if (stream == NULL) return mockError(cudaErrorInvalidResourceHandle);
+  std::lock_guard<std::mutex> lock(stream->mutex);
+  stream->destroyed = true;
+  stream->cond.notify_all();
+  return cudaSuccess;
+}
+
+cudaError_t cudaStreamSynchronize(cudaStream_t stream) {
+  mockStreamSync(stream);
+  return cudaSuccess;
+}
+
+cudaError_t cudaStreamQuery(cudaStream_t stream) {
+  struct MockStream* s = mockStreamGet(stream);
+  std::lock_guard<std::mutex> lock(s->mutex);
+  return s->completed == s->enqueued ? cudaSuccess : cudaErrorNotReady;
+}
+
+cudaError_t cudaStreamWaitEvent(cudaStream_t stream, cudaEvent_t event, unsigned int flags) {
+  if (event == NULL) return mockError(cudaErrorInvalidResourceHandle);
+  uint64_t record;
+  {
+    std::lock_guard<std::mutex> lock(event->mutex);
+    record = event->recorded;
+  }
+  if (record) mockStreamEnqueue(stream, [=]() { mockEventWait(event, record); });
+  return cudaSuccess;
+}
+
+cudaError_t cudaLaunchHostFunc(cudaStream_t stream, cudaHostFn_t fn, void* userData) {
+  if (fn == NULL) return mockError(cudaErrorInvalidValue);
+  mockStreamEnqueue(stream, [=]() { fn(userData); });
+  return cudaSuccess;
+}
+
+cudaError_t cudaEventCreateWithFlags(cudaEvent_t* event, unsigned int flags) {
+  if (event == NULL) return mockError(cudaErrorInvalidValue);
+  struct MockEvent* e = new MockEvent();
+  e->flags = flags;
+  e->recorded = e->completed = 0;
+  memset(&e->time, 0, sizeof(e->time));
+  *event = e;
+  return cudaSuccess;
+}
+
+cudaError_t cudaEventCreate(cudaEvent_t* event) {
+  return cudaEventCreateWithFlags(event, cudaEventDefault);
+}
+
+// Streams waiting on the event hold a pointer to it : as with CUDA, the event
+// must not be destroyed before they reach the wait.
+cudaError_t cudaEventDestroy(cudaEvent_t event) {
+  if (event == NULL) return mockError(cudaErrorInvalidResourceHandle);
+  delete event;
+  return cudaSuccess;
+}
+
+cudaError_t cudaEventRecord(cudaEvent_t event, cudaStream_t stream) {
+  if (event == NULL) return mockError(cudaErrorInvalidResourceHandle);
+  uint64_t record;
+  {
+    std::lock_guard<std::mutex> lock(event->mutex);
+    record = ++event->recorded;
+  }
+  mockStreamEnqueue(stream, [=]() {
+    std::lock_guard<std::mutex> lock(event->mutex);
+    if (record > event->completed) {
+      event->completed = record;
+      clock_gettime(CLOCK_MONOTONIC, &event->time);
+    }
+    event->cond.notify_all();
+  });
+  return cudaSuccess;
+}
+
+cudaError_t cudaEventQuery(cudaEvent_t event) {
+  if (event == NULL) return mockError(cudaErrorInvalidResourceHandle);
+  std::lock_guard<std::mutex> lock(event->mutex);
+  return event->completed == event->recorded ? cudaSuccess : cudaErrorNotReady;
+}
+
+cudaError_t cudaEventSynchronize(cudaEvent_t event) {
+  if (event == NULL) return mockError(cudaErrorInvalidResourceHandle);
+  uint64_t record;
+  {
+    std::lock_guard<std::mutex> lock(event->mutex);
+    record = event->recorded;
+  }
+  mockEventWait(event, record);
+  return cudaSuccess;
+}
+
+cudaError_t cudaEventElapsedTime(float* ms, cudaEvent_t start, cudaEvent_t end) {
+  if (ms == NULL || start == NULL || end == NULL) return mockError(cudaErrorInvalidValue);
+  if ((start->flags | end->flags) & cudaEventDisableTiming) return mockError(cudaErrorInvalidResourceHandle);
+  std::lock(start->mutex, end->mutex);
+  std::lock_guard<std::mutex> lockStart(start->mutex, std::adopt_lock);
+  std::lock_guard<std::mutex> lockEnd(end->mutex, std::adopt_lock);
+  if (start->completed == 0 || end->completed == 0) return mockError(cudaErrorInvalidResourceHandle);
+  if (start->completed != start->recorded || end->completed != end->recorded) return cudaErrorNotReady;
+  *ms = (end->time.tv_sec - start->time.tv_sec)*1e3f + (end->time.tv_nsec - start->time.tv_nsec)*1e-6f;
+  return cudaSuccess;
+}
+
+/* Runtime API : kernels */
+
+// Arguments are copied at launch, so that callers can reuse them right away.
+cudaError_t cudaLaunchKernel(const void* func, dim3 gridDim, dim3 blockDim, void** args, size_t sharedMem, cudaStream_t stream) {
+  struct MockKernel kernel;
+  if (!mockKernelFind(func, &kernel)) return mockError(cudaErrorInvalidDeviceFunction);
+  std::vector<size_t> offsets;
+  size_t size = 0;
+  for (size_t a=0; a<kernel.argSizes.size(); a++) {
+    offsets.push_back(size);
+    size += (kernel.argSizes[a] + 15) & ~(size_t)15;
+  }
+  std::shared_ptr<std::vector<char>> copy = std::make_shared<std::vector<char>>(size);
+  for (size_t a=0; a<kernel.argSizes.size(); a++) memcpy(copy->data()+offsets[a], args[a], kernel.argSizes[a]);
+  mockKernelEntry_t entry = kernel.entry;
+  mockStreamEnqueue(stream, [=]() {
+    std::vector<void*> argPtrs;
+    for (size_t a=0; a<offsets.size(); a++) argPtrs.push_back(copy->data()+offsets[a]);
+    entry(argPtrs.data(), gridDim, blockDim);
+  });
+  return cudaSuccess;
+}
+
+cudaError_t cudaFuncGetAttributes(struct cudaFuncAttributes* attr, const void* func) {
+  struct MockKernel kernel;
+  if (attr == NULL) return mockError(cudaErrorInvalidValue);
+  if (!mockKernelFind(func, &kernel)) return mockError(cudaErrorInvalidDeviceFunction);
+  memset(attr, 0, sizeof(*attr));
+  attr->maxThreadsPerBlock = 1024;
+  return cudaSuccess;
+}
+
+cudaError_t cudaFuncSetAttribute(const void* func, enum cudaFuncAttribute attr, int value) {
+  struct MockKernel kernel;
+  if (!mockKernelFind(func, &kernel)) return mockError(cudaErrorInvalidDeviceFunction);
+  return cudaSuccess;
+}
+
+/* Runtime API : graphs. Streams are never captured. */
+
+static thread_local enum cudaStreamCaptureMode mockCaptureMode = cudaStreamCaptureModeGlobal;
+
+cudaError_t cudaThreadExchangeStreamCaptureMode(enum cudaStreamCaptureMode* mode) {
+  if (mode == NULL) return mockError(cudaErrorInvalidValue);
+  enum cudaStreamCaptureMode old = mockCaptureMode;
+  mockCaptureMode = *mode;
+  *mode = old;
+  return cudaSuccess;
+}
+
+cudaError_t cudaStreamGetCaptureInfo(cudaStream_t stream, enum cudaStreamCaptureStatus* captureStatus, unsigned long long* id) {
+  if (captureStatus) *captureStatus = cudaStreamCaptureStatusNone;
+  if (id) *id = 0;
+  return cudaSuccess;
+}
+
+cudaError_t cudaStreamGetCaptureInfo_v2(cudaStream_t stream, enum cudaStreamCaptureStatus* captureStatus,
+    unsigned long long* id, cudaGraph_t* graph, const cudaGraphNode_t** dependencies, size_t* numDependencies) {
+  if (captureStatus) *captureStatus = cudaStreamCaptureStatusNone;
+  if (id) *id = 0;
+  if (graph) *graph = NULL;
+  if (dependencies) *dependencies = NULL;
+  if (numDependencies) *numDependencies = 0;
+  return cudaSuccess;
+}
+
+cudaError_t cudaStreamUpdateCaptureDependencies(cudaStream_t stream, cudaGraphNode_t* dependencies, size_t numDependencies, unsigned int flags) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaGraphAddKernelNode(cudaGraphNode_t* node, cudaGraph_t graph, const cudaGraphNode_t* dependencies,
+    size_t numDependencies, const struct cudaKernelNodeParams* params) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaGraphAddHostNode(cudaGraphNode_t* node, cudaGraph_t graph, const cudaGraphNode_t* dependencies,
+    size_t numDependencies, const struct cudaHostNodeParams* params) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaGraphAddEventRecordNode(cudaGraphNode_t* node, cudaGraph_t graph, const cudaGraphNode_t* dependencies,
+    size_t numDependencies, cudaEvent_t event) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaGraphAddEventWaitNode(cudaGraphNode_t* node, cudaGraph_t graph, const cudaGraphNode_t* dependencies,
+    size_t numDependencies, cudaEvent_t event) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaUserObjectCreate(cudaUserObject_t* object, void* ptr, cudaHostFn_t destroy, unsigned int initialRefcount, unsigned int flags) {
+  return mockError(cudaErrorNotSupported);
+}
+
+cudaError_t cudaGraphRetainUserObject(cudaGraph_t graph, cudaUserObject_t object, unsigned int count, unsigned int flags) {
+  return mockError(cudaErrorNotSupported);
+}
+
+/* Driver API */
+
+CUresult cuInit(unsigned int flags) {
+  return CUDA_SUCCESS;
+}
+
+CUresult cuDriverGetVersion(int* driverVersion) {
+  if (driverVersion == NULL) return CUDA_ERROR_INVALID_VALUE;
+  *driverVersion = CUDA_VERSION;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuGetErrorString(CUresult error, const char** str) {
+  if (str == NULL) return CUDA_ERROR_INVALID_VALUE;
+  *str = cudaGetErrorString((cudaError_t)error);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuGetErrorName(CUresult error, const char** str) {
+  if (str == NULL) return CUDA_ERROR_INVALID_VALUE;
+  *str = cudaGetErrorName((cudaError_t)error);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGet(CUdevice* device, int ordinal) {
+  if (device == NULL) return CUDA_ERROR_INVALID_VALUE;
+  if (ordinal < 0 || ordinal >= mockDeviceCount()) return CUDA_ERROR_INVALID_DEVICE;
+  *device = ordinal;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGetAttribute(int* pi, CUdevice_attribute attrib, CUdevice dev) {
+  if (pi == NULL) return CUDA_ERROR_INVALID_VALUE;
+  if (dev < 0 || dev >= mockDeviceCount()) return CUDA_ERROR_INVALID_DEVICE;
+  switch (attrib) {
+  case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR: *pi = 8; break;
+  case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR: *pi = 0; break;
+  case CU_DEVICE_ATTRIBUTE_DMA_BUF_SUPPORTED: *pi = 0; break;
+  default: return CUDA_ERROR_INVALID_VALUE;
+  }
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemGetAddressRange(CUdeviceptr* pbase, size_t* psize, CUdeviceptr dptr) {
+  uintptr_t base;
+  struct MockAllocation alloc;
+  if (!mockMemFind((const void*)dptr, &base, &alloc) || alloc.type != cudaMemoryTypeDevice) return CUDA_ERROR_NOT_FOUND;
+  if (pbase) *pbase = base;
+  if (psize) *psize = alloc.size;
+  return CUDA_SUCCESS;
+}
+
+// Contexts are only handles : the current device is per thread.
+CUresult cuCtxCreate(CUcontext* pctx, unsigned int flags, CUdevice dev) {
+  if (pctx == NULL) return CUDA_ERROR_INVALID_VALUE;
+  if (dev < 0 || dev >= mockDeviceCount()) return CUDA_ERROR_INVALID_DEVICE;
+  *pctx = (CUcontext)(uintptr_t)(dev+1);
+  mockCurrentDevice = dev;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuCtxDestroy(CUcontext ctx) {
+  return ctx ? CUDA_SUCCESS : CUDA_ERROR_INVALID_CONTEXT;
+}
+
+CUresult cuCtxSetCurrent(CUcontext ctx) {
+  if (ctx) mockCurrentDevice = (int)((uintptr_t)ctx-1);
+  return CUDA_SUCCESS;
+}
+
+#define MOCK_PROC(symbol) { #symbol, (void*)symbol }
+static const struct { const char* name; void* fn; } mockProcs[] = {
+  MOCK_PROC(cuInit),
+  MOCK_PROC(cuDriverGetVersion),
+  MOCK_PROC(cuGetProcAddress),
+  MOCK_PROC(cuGetErrorString),
+  MOCK_PROC(cuGetErrorName),
+  MOCK_PROC(cuDeviceGet),
+  MOCK_PROC(cuDeviceGetAttribute),
+  MOCK_PROC(cuMemGetAddressRange),
+  MOCK_PROC(cuCtxCreate),
+  MOCK_PROC(cuCtxDestroy),
+  MOCK_PROC(cuCtxSetCurrent)
+};
+
+CUresult cuGetProcAddress(const char* symbol, void** pfn, int cudaVersion, cuuint64_t flags) {
+  if (symbol == NULL || pfn == NULL) return CUDA_ERROR_INVALID_VALUE;
+  for (size_t i=0; i<sizeof(mockProcs)/sizeof(mockProcs[0]); i++) {
+    if (strcmp(symbol, mockProcs[i].name) == 0) {
+      *pfn = mockProcs[i].fn;
+      return CUDA_SUCCESS;
+    }
+  }
+  *pfn = NULL;
+  return CUDA_ERROR_NOT_FOUND;
+}
+
+cudaError_t cudaGetDriverEntryPoint(const char* symbol, void** funcPtr, unsigned long long flags) {
+  return cuGetProcAddress(symbol, funcPtr, CUDA_VERSION, flags) == CUDA_SUCCESS ? cudaSuccess : mockError(cudaErrorNotSupported);
+}
+
+}
+
+#pragma GCC visibility pop
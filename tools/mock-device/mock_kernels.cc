@@ -0,0 +1,645 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Host implementation of the NCCL kernels, run by the mock CUDA library.
+//
+// The kernels consume the same ncclWork chains as the device code and follow
+// the same protocols on the connections : step counters, sizes and offsets
+// fifos, and LL flags. The proxies cannot tell them from GPU kernels.
+//
+// Each work element is turned into the list of primitive operations the
+// device algorithm issues (send, recvReduceSend, ...). Operations progress
+// without blocking, and the blocks of a grid are interleaved on the stream
+// thread, so that peers which depend on each other make progress together.
+//
+// Supported : ring algorithm with the LL and Simple protocols, send/recv, and
+// the one-rank reduction. The library defaults NCCL_ALGO and NCCL_PROTO
+// accordingly. Anything else aborts.
+
+#include "devcomm.h"
+#include "collectives.h"
+#include "core.h"
+#include "hostreduce.h"
+#include "mock_cuda.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <deque>
+#include <vector>
+
+struct mockPrims {
+  int proto;
+  int slicePerChunk;
+  int stepPerSlice;
+  int stepSize;        // Elements per step for Simple, lines per step for LL
+  int eltSize;
+  ncclDataType_t type;
+  struct ncclDevRedOpFull op;
+  const char* input;
+  char* output;
+  struct ncclConnInfo* recvConn;
+  struct ncclConnInfo* sendConn;
+  uint64_t recvStep;
+  uint64_t sendStep;
+};
+
+#define MOCK_NONE -1
+#define MOCK_INPUT 0
+#define MOCK_OUTPUT 1
+
+struct mockOp {
+  bool recv;
+  bool send;
+  int src; // MOCK_NONE, MOCK_INPUT or MOCK_OUTPUT
+  int dst;
+  bool postOp;
+  ssize_t srcIx;
+  ssize_t dstIx;
+  ssize_t nelem;
+};
+
+// One primitives object and the operations run on it, in order
+struct mockJob {
+  struct mockPrims prims;
+  bool started;
+  std::vector<struct mockOp> ops;
+  size_t opIx;
+  // Progress within the current operation
+  int slice;
+  ssize_t offset;
+  bool sendReady;
+  int lines;
+  std::vector<uint64_t> recvData;
+  std::vector<uint64_t> sendData;
+};
+
+struct mockBlock {
+  struct ncclDevChannel* channel;
+  struct ncclWork* workPtr; // Next work to load, NULL when done
+  struct ncclWork work;
+  bool concurrent;          // Jobs run together (p2p) or one after the other (coll)
+  std::deque<struct mockJob> jobs;
+};
+
+struct mockGrid {
+  struct ncclDevComm* comm;
+  struct ncclWork* workHead;
+  std::vector<struct mockBlock> blocks;
+  bool moved;
+};
+
+static void mockUnsupported(const char* what) {
+  WARN("Mock device : %s is not supported", what);
+  abort();
+}
+
+static uint64_t mockLoad(volatile uint64_t* ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void mockStore(volatile uint64_t* ptr, uint64_t value) {
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+/* Data movement */
+
+// dsts[0] = postOp(op(preOp(srcs[0]), srcs[1], ...)), other dsts are copies of it
+static void mockReduceCopy(struct mockPrims* p, int nSrcs, const void** srcs, int nDsts, void** dsts, ssize_t nelem,
+    int nPreOpSrcs, bool postOp) {
+  if (nelem <= 0 || nDsts == 0) return;
+  size_t bytes = nelem*p->eltSize;
+  bool preOp = nPreOpSrcs > 0 && p->op.op == ncclDevPreMulSum;
+  postOp = postOp && p->op.op == ncclDevSumPostDiv;
+  if (nSrcs == 1 && !preOp && !postOp) {
+    if (dsts[0] != srcs[0]) memcpy(dsts[0], srcs[0], bytes);
+  } else {
+    if (ncclHostReduce(dsts[0], srcs, nSrcs, nelem, p->type, p->op, nPreOpSrcs, postOp) != ncclSuccess) mockUnsupported("reduction");
+  }
+  for (int d=1; d<nDsts; d++) memcpy(dsts[d], dsts[0], bytes);
+}
+
+static char* mockUserPtr(struct mockPrims* p, int buf, ssize_t ix) {
+  return (buf == MOCK_INPUT ? (char*)p->input : p->output) + ix*p->eltSize;
+}
+
+/* Simple protocol */
+
+static char* mockSimpleSlot(struct mockPrims* p, struct ncclConnInfo* conn, uint64_t step) {
+  size_t offset = conn->offsFifo ? conn->offsFifo[step%NCCL_STEPS] : (step%NCCL_STEPS)*p->stepSize*p->eltSize;
+  return conn->buffs[NCCL_PROTO_SIMPLE] + offset;
+}
+
+static bool mockSimpleProgress(struct mockGrid* grid, struct mockJob* job, struct mockOp* op) {
+  struct mockPrims* p = &job->prims;
+  ssize_t nelem = op->nelem < 0 ? 0 : op->nelem;
+  ssize_t sliceSize = std::max<ssize_t>(DIVUP(nelem, 16*p->slicePerChunk)*16, p->stepSize*p->stepPerSlice/32);
+  // Empty slices still wait and post, as on the device
+  for (; job->slice < p->slicePerChunk; job->slice++) {
+    ssize_t size = std::max<ssize_t>(0, std::min(sliceSize, nelem-job->offset));
+    if (op->recv && mockLoad(p->recvConn->tail) < p->recvStep + p->stepPerSlice) return false;
+    if (op->send && mockLoad(p->sendConn->head) + NCCL_STEPS < p->sendStep + p->stepPerSlice) return false;
+    if (op->send && p->sendConn->sizesFifo) {
+      __atomic_store_n(p->sendConn->sizesFifo+p->sendStep%NCCL_STEPS, (int)(size*p->eltSize), __ATOMIC_RELEASE);
+    }
+    const void* srcs[2];
+    void* dsts[2];
+    int nSrcs = 0, nDsts = 0;
+    if (op->src != MOCK_NONE) srcs[nSrcs++] = mockUserPtr(p, op->src, op->srcIx+job->offset);
+    if (op->recv) srcs[nSrcs++] = mockSimpleSlot(p, p->recvConn, p->recvStep);
+    if (op->dst != MOCK_NONE) dsts[nDsts++] = mockUserPtr(p, op->dst, op->dstIx+job->offset);
+    if (op->send) dsts[nDsts++] = mockSimpleSlot(p, p->sendConn, p->sendStep);
+    mockReduceCopy(p, nSrcs, srcs, nDsts, dsts, size, op->src == MOCK_INPUT ? 1 : 0, op->postOp);
+    if (op->recv) mockStore(p->recvConn->head, p->recvStep += p->stepPerSlice);
+    if (op->send) mockStore(p->sendConn->tail, p->sendStep += p->stepPerSlice);
+    job->offset += size;
+    grid->moved = true;
+  }
+  return true;
+}
+
+/* LL protocol */
+
+static union ncclLLFifoLine* mockLLLines(struct mockPrims* p, struct ncclConnInfo* conn, uint64_t step) {
+  return (union ncclLLFifoLine*)conn->buffs[NCCL_PROTO_LL] + (step%NCCL_STEPS)*p->stepSize;
+}
+
+static void mockLLStore(union ncclLLFifoLine* lines, int begin, int end, const uint64_t* data, uint32_t flag) {
+  // Flags have to be visible after the data they cover
+  for (int l=begin; l<end; l++) {
+    uint64_t v = data ? data[l] : 0;
+    lines[l].data1 = (uint32_t)v;
+    lines[l].data2 = (uint32_t)(v >> 32);
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (int l=begin; l<end; l++) {
+    __atomic_store_n(&lines[l].flag1, flag, __ATOMIC_RELAXED);
+    __atomic_store_n(&lines[l].flag2, flag, __ATOMIC_RELAXED);
+  }
+}
+
+static bool mockLLProgress(struct mockGrid* grid, struct mockJob* job, struct mockOp* op) {
+  struct mockPrims* p = &job->prims;
+  ssize_t nelem = op->nelem < 0 ? 0 : op->nelem;
+  int eltPerLine = sizeof(uint64_t)/p->eltSize;
+  int nLines = DIVUP(nelem, eltPerLine);
+  bool clean = (p->sendStep & NCCL_LL_CLEAN_MASK) == NCCL_LL_CLEAN_MASK;
+  if (op->send && !job->sendReady) {
+    if (mockLoad(p->sendConn->head) + NCCL_STEPS < p->sendStep + 1) return false;
+    if (p->sendConn->sizesFifo) {
+      int size = (clean ? p->stepSize : nLines)*sizeof(union ncclLLFifoLine);
+      __atomic_store_n(p->sendConn->sizesFifo+p->sendStep%NCCL_STEPS, size, __ATOMIC_RELEASE);
+    }
+    job->sendReady = true;
+    grid->moved = true;
+  }
+  if (op->recv) {
+    union ncclLLFifoLine* lines = mockLLLines(p, p->recvConn, p->recvStep);
+    uint32_t flag = NCCL_LL_FLAG(p->recvStep+1);
+    for (; job->lines < nLines; job->lines++) {
+      if (__atomic_load_n(&lines[job->lines].flag1, __ATOMIC_ACQUIRE) != flag ||
+          __atomic_load_n(&lines[job->lines].flag2, __ATOMIC_ACQUIRE) != flag) return false;
+      grid->moved = true;
+    }
+    job->recvData.resize(nLines);
+    for (int l=0; l<nLines; l++) job->recvData[l] = lines[l].data1 + ((uint64_t)lines[l].data2 << 32);
+  }
+
+  const void* srcs[2];
+  void* dsts[2];
+  int nSrcs = 0, nDsts = 0;
+  if (op->src != MOCK_NONE) srcs[nSrcs++] = mockUserPtr(p, op->src, op->srcIx);
+  if (op->recv) srcs[nSrcs++] = job->recvData.data();
+  if (op->dst != MOCK_NONE) dsts[nDsts++] = mockUserPtr(p, op->dst, op->dstIx);
+  if (op->send) {
+    // The tail of the last line is sent as zeros
+    job->sendData.assign(nLines, 0);
+    dsts[nDsts++] = job->sendData.data();
+  }
+  mockReduceCopy(p, nSrcs, srcs, nDsts, dsts, nelem, op->src == MOCK_INPUT ? 1 : 0, op->postOp);
+
+  if (op->recv) {
+    p->recvStep++;
+    mockStore(p->recvConn->head, p->recvStep);
+  }
+  if (op->send) {
+    union ncclLLFifoLine* lines = mockLLLines(p, p->sendConn, p->sendStep);
+    uint32_t flag = NCCL_LL_FLAG(p->sendStep+1);
+    mockLLStore(lines, 0, nLines, job->sendData.data(), flag);
+    // LL cleanup : rewrite the flags of the whole step before they wrap around
+    if (clean) mockLLStore(lines, nLines, p->stepSize, NULL, flag);
+    p->sendStep++;
+  }
+  grid->moved = true;
+  return true;
+}
+
+/* Jobs */
+
+static void mockJobInit(struct mockJob* job, struct mockGrid* grid, struct ncclDevChannel* channel, int proto,
+    int slicePerChunk, int stepPerSlice, ncclDataType_t type, struct ncclDevRedOpFull op,
+    const void* input, void* output, int recvPeer, int sendPeer, int connIndex) {
+  struct mockPrims* p = &job->prims;
+  p->proto = proto;
+  p->slicePerChunk = slicePerChunk;
+  p->stepPerSlice = stepPerSlice;
+  p->eltSize = ncclTypeSize(type);
+  p->stepSize = proto == NCCL_PROTO_LL ?
+    grid->comm->buffSizes[NCCL_PROTO_LL]/NCCL_STEPS/sizeof(union ncclLLFifoLine) :
+    grid->comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS/p->eltSize;
+  p->type = type;
+  p->op = op;
+  p->input = (const char*)input;
+  p->output = (char*)output;
+  p->recvConn = recvPeer >= 0 ? &channel->peers[recvPeer].recv[connIndex] : NULL;
+  p->sendConn = sendPeer >= 0 ? &channel->peers[sendPeer].send[connIndex] : NULL;
+  job->started = false;
+  job->opIx = 0;
+  job->slice = 0;
+  job->offset = 0;
+  job->sendReady = false;
+  job->lines = 0;
+}
+
+static void mockJobAddOp(struct mockJob* job, bool recv, bool send, int src, int dst, ssize_t srcIx, ssize_t dstIx,
+    ssize_t nelem, bool postOp) {
+  struct mockOp op = { recv, send, src, dst, postOp, srcIx, dstIx, nelem };
+  job->ops.push_back(op);
+}
+
+// Load the connection steps, as the primitives constructor does
+static void mockJobStart(struct mockJob* job) {
+  struct mockPrims* p = &job->prims;
+  const int direct = NCCL_DIRECT_READ|NCCL_DIRECT_WRITE;
+  if ((p->recvConn && (p->recvConn->direct & direct)) || (p->sendConn && (p->sendConn->direct & direct))) {
+    mockUnsupported("Direct read or write between devices");
+  }
+  if (p->recvConn) {
+    p->recvStep = p->recvConn->step;
+    if (p->proto == NCCL_PROTO_SIMPLE) {
+      p->recvStep = ROUNDUP(p->recvStep, p->slicePerChunk*p->stepPerSlice);
+      mockStore(p->recvConn->head, p->recvStep); // Return credits in case we rounded up
+    }
+  }
+  if (p->sendConn) {
+    p->sendStep = p->sendConn->step;
+    if (p->proto == NCCL_PROTO_SIMPLE) p->sendStep = ROUNDUP(p->sendStep, p->slicePerChunk*p->stepPerSlice);
+  }
+  job->started = true;
+}
+
+// Returns true once all operations are done and the steps saved for the next job
+static bool mockJobProgress(struct mockGrid* grid, struct mockJob* job) {
+  if (!job->started) mockJobStart(job);
+  while (job->opIx < job->ops.size()) {
+    struct mockOp* op = &job->ops[job->opIx];
+    bool done = job->prims.proto == NCCL_PROTO_LL ? mockLLProgress(grid, job, op) : mockSimpleProgress(grid, job, op);
+    if (!done) return false;
+    job->opIx++;
+    job->slice = 0;
+    job->offset = 0;
+    job->sendReady = false;
+    job->lines = 0;
+  }
+  if (job->prims.recvConn) job->prims.recvConn->step = job->prims.recvStep;
+  if (job->prims.sendConn) job->prims.sendConn->step = job->prims.sendStep;
+  return true;
+}
+
+/* Ring algorithms, as in collectives/device/<func>.h */
+
+static void mockRingOps(struct mockGrid* grid, struct mockJob* job, ncclFunc_t func, int proto, struct ncclWorkElem* e,
+    struct ncclRing* ring) {
+  const int es = job->prims.eltSize;
+  const int nthreads = e->nWarps*WARP_SIZE;
+  const int bid = e->bid;
+  const int nChannels = e->nChannels;
+  const int nranks = grid->comm->nRanks;
+  const int* ringRanks = ring->userRanks;
+  const ssize_t size = e->count;
+  const bool simple = proto == NCCL_PROTO_SIMPLE;
+  const int chunkSteps = func == ncclFuncBroadcast ? BROADCAST_CHUNKSTEPS : func == ncclFuncReduce ? REDUCE_CHUNKSTEPS : ALLREDUCE_CHUNKSTEPS;
+  const ssize_t bytePerStep = simple ? grid->comm->buffSizes[NCCL_PROTO_SIMPLE]/NCCL_STEPS : grid->comm->buffSizes[NCCL_PROTO_LL]/NCCL_STEPS/2;
+  const ssize_t chunkSize = int(bytePerStep/es*(simple ? chunkSteps : 1));
+  const ssize_t simpleGrain = (nthreads-WARP_SIZE)*sizeof(uint64_t)/es;
+
+  if (func == ncclFuncAllReduce) {
+    const int ringIx = ring->index;
+    const ssize_t loopSize = nChannels*nranks*chunkSize;
+    const ssize_t minChunkSize = nthreads*(sizeof(uint64_t)/es);
+    for (ssize_t gridOffset = 0; gridOffset < size; gridOffset += loopSize) {
+      ssize_t realChunkSize;
+      if (simple) {
+        realChunkSize = std::min(chunkSize, DIVUP(size-gridOffset, nChannels*nranks));
+        realChunkSize = ROUNDUP(realChunkSize, simpleGrain);
+      } else {
+        realChunkSize = std::min(chunkSize, DIVUP(size-gridOffset, nChannels*nranks*minChunkSize)*minChunkSize);
+      }
+      realChunkSize = int(realChunkSize);
+      auto calcOffset = [&](int chunk)->ssize_t {
+        return simple ? gridOffset + bid*nranks*realChunkSize + chunk*realChunkSize : gridOffset + (chunk*nChannels + bid)*realChunkSize;
+      };
+      auto modRanks = [&](int r)->int { return r - (r >= nranks ? nranks : 0); };
+      ssize_t offset = calcOffset(modRanks(ringIx + nranks-1));
+      mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_NONE, offset, 0, std::min(realChunkSize, size-offset), false);
+      for (int j=2; j<nranks; ++j) {
+        offset = calcOffset(modRanks(ringIx + nranks-j));
+        mockJobAddOp(job, true, true, MOCK_INPUT, MOCK_NONE, offset, 0, std::min(realChunkSize, size-offset), false);
+      }
+      offset = calcOffset(ringIx);
+      mockJobAddOp(job, true, true, MOCK_INPUT, MOCK_OUTPUT, offset, offset, std::min(realChunkSize, size-offset), true);
+      for (int j=1; j<nranks-1; ++j) {
+        offset = calcOffset(modRanks(ringIx + nranks-j));
+        mockJobAddOp(job, true, true, MOCK_NONE, MOCK_OUTPUT, 0, offset, std::min(realChunkSize, size-offset), false);
+      }
+      offset = calcOffset(modRanks(ringIx + 1));
+      mockJobAddOp(job, true, false, MOCK_NONE, MOCK_OUTPUT, 0, offset, std::min(realChunkSize, size-offset), false);
+    }
+    return;
+  }
+
+  const ssize_t loopSize = nChannels*chunkSize;
+  for (ssize_t gridOffset = 0; gridOffset < size; gridOffset += loopSize) {
+    ssize_t realChunkSize;
+    if (simple) {
+      realChunkSize = std::min(chunkSize, DIVUP(size-gridOffset, nChannels));
+      realChunkSize = ROUNDUP(realChunkSize, simpleGrain);
+    } else {
+      realChunkSize = size-gridOffset < loopSize ? e->lastChunkSize : chunkSize;
+    }
+    realChunkSize = int(realChunkSize);
+    ssize_t chunkOffset = gridOffset + int(bid*realChunkSize);
+    ssize_t nelem = std::min(realChunkSize, size-chunkOffset);
+    ssize_t offset;
+    switch (func) {
+    case ncclFuncAllGather:
+      offset = chunkOffset + ringRanks[0]*size;
+      if ((const char*)e->sendbuff + chunkOffset*es == (const char*)e->recvbuff + offset*es) {
+        mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_NONE, chunkOffset, 0, nelem, false);
+      } else {
+        mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_OUTPUT, chunkOffset, offset, nelem, false);
+      }
+      for (int j=1; j<nranks-1; ++j) {
+        offset = chunkOffset + ringRanks[nranks-j]*size;
+        mockJobAddOp(job, true, true, MOCK_NONE, MOCK_OUTPUT, 0, offset, nelem, false);
+      }
+      offset = chunkOffset + ringRanks[1]*size;
+      mockJobAddOp(job, true, false, MOCK_NONE, MOCK_OUTPUT, 0, offset, nelem, false);
+      break;
+    case ncclFuncReduceScatter:
+      offset = chunkOffset + ringRanks[nranks-1]*size;
+      mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_NONE, offset, 0, nelem, false);
+      for (int j=2; j<nranks; ++j) {
+        offset = chunkOffset + ringRanks[nranks-j]*size;
+        mockJobAddOp(job, true, true, MOCK_INPUT, MOCK_NONE, offset, 0, nelem, false);
+      }
+      offset = chunkOffset + ringRanks[0]*size;
+      mockJobAddOp(job, true, false, MOCK_INPUT, MOCK_OUTPUT, offset, chunkOffset, nelem, true);
+      break;
+    case ncclFuncBroadcast:
+      if (ringRanks[0] == (int)e->root) {
+        if (e->sendbuff == e->recvbuff) {
+          mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_NONE, chunkOffset, 0, nelem, false);
+        } else {
+          mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_OUTPUT, chunkOffset, chunkOffset, nelem, false);
+        }
+      } else if (ringRanks[1] == (int)e->root) {
+        mockJobAddOp(job, true, false, MOCK_NONE, MOCK_OUTPUT, 0, chunkOffset, nelem, false);
+      } else {
+        mockJobAddOp(job, true, true, MOCK_NONE, MOCK_OUTPUT, 0, chunkOffset, nelem, false);
+      }
+      break;
+    case ncclFuncReduce:
+      if (ringRanks[nranks-1] == (int)e->root) {
+        mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_NONE, chunkOffset, 0, nelem, false);
+      } else if (grid->comm->rank == (int)e->root) {
+        mockJobAddOp(job, true, false, MOCK_INPUT, MOCK_OUTPUT, chunkOffset, chunkOffset, nelem, true);
+      } else {
+        mockJobAddOp(job, true, true, MOCK_INPUT, MOCK_NONE, chunkOffset, 0, nelem, false);
+      }
+      break;
+    default:
+      mockUnsupported(ncclFuncStr[func]);
+    }
+  }
+}
+
+/* Works */
+
+// Each block gets a roughly equal segment of 16 byte packs
+static void mockOneRankReduce(struct ncclWorkElem* e, ncclDataType_t type) {
+  int es = ncclTypeSize(type);
+  ssize_t eltPerPack = 16/es;
+  ssize_t packN = DIVUP((ssize_t)e->count, eltPerPack);
+  int bid = e->bid, bn = e->nChannels;
+  ssize_t i0 = (bid+0)*(packN/bn) + std::min<ssize_t>(bid+0, packN%bn);
+  ssize_t i1 = (bid+1)*(packN/bn) + std::min<ssize_t>(bid+1, packN%bn);
+  i0 = std::min<ssize_t>(i0*eltPerPack, e->count);
+  i1 = std::min<ssize_t>(i1*eltPerPack, e->count);
+  if (i1 <= i0) return;
+  const void* src = (const char*)e->sendbuff + i0*es;
+  struct ncclDevRedOpFull op = { ncclDevPreMulSum, false, e->redOpArg };
+  if (ncclHostReduce((char*)e->recvbuff + i0*es, &src, 1, i1-i0, type, op, 1, true) != ncclSuccess) mockUnsupported("reduction");
+}
+
+static void mockP2pJobs(struct mockGrid* grid, struct mockBlock* block) {
+  struct ncclWorkElemP2p* elems = block->work.p2pElems;
+  struct ncclDevChannel* channel = block->channel;
+  struct ncclDevRedOpFull op = { ncclDevSum, false, 0 };
+  int ngroups = elems[0].ngroups;
+  for (int g=0; g<ngroups; g++) {
+    struct ncclWorkElemP2p* e = elems+g;
+    if (e->p2pType == ncclWorkP2pTypeUnused || e->peer == -1 || e->nWarps == 0) continue;
+    void* buff = (void*)((uintptr_t)e->buffHi32<<32 | e->buffLo32);
+    size_t count = (size_t)e->countHi32<<32 | e->countLo32;
+    bool recv = g%2 == 0;
+    if (e->peer == grid->comm->rank) {
+      if (recv) continue;
+      struct ncclWorkElemP2p* r = e-1;
+      void* recvBuff = (void*)((uintptr_t)r->buffHi32<<32 | r->buffLo32);
+      if (buff != recvBuff && count) memcpy(recvBuff, buff, count);
+      continue;
+    }
+    int chunkSize = e->chunkSize;
+    int proto = e->proto == NCCL_PROTO_LL ? NCCL_PROTO_LL : NCCL_PROTO_SIMPLE;
+    if (proto == NCCL_PROTO_LL) chunkSize /= 2;
+    block->jobs.emplace_back();
+    struct mockJob* job = &block->jobs.back();
+    mockJobInit(job, grid, channel, proto, 1, 1, ncclInt8, op, recv ? NULL : buff, recv ? buff : NULL,
+        recv ? e->peer : -1, recv ? -1 : e->peer, 1);
+    size_t offset = 0;
+    do {
+      ssize_t nelem = std::min((size_t)chunkSize, count-offset);
+      if (recv) mockJobAddOp(job, true, false, MOCK_NONE, MOCK_OUTPUT, 0, offset, nelem, false);
+      else mockJobAddOp(job, false, true, MOCK_INPUT, MOCK_NONE, offset, 0, nelem, false);
+      offset += nelem;
+    } while (offset < count);
+  }
+  block->concurrent = true;
+}
+
+static void mockCollJobs(struct mockGrid* grid, struct mockBlock* block) {
+  int funcIndex = block->work.header.funcIndex;
+  for (int i=0; i<NCCL_MAX_WORK_ELEMENTS && block->work.elems[i].isUsed; i++) {
+    struct ncclWorkElem* e = block->work.elems+i;
+    if (funcIndex < 1+ncclNumTypes) {
+      mockOneRankReduce(e, (ncclDataType_t)(funcIndex-1));
+      continue;
+    }
+    // Inverse of FUNC_INDEX()
+    int idx = funcIndex-(1+ncclNumTypes);
+    int proto = idx%NCCL_NUM_PROTOCOLS; idx /= NCCL_NUM_PROTOCOLS;
+    int algo = idx%NCCL_NUM_ALGORITHMS; idx /= NCCL_NUM_ALGORITHMS;
+    ncclDataType_t type = (ncclDataType_t)(idx%ncclNumTypes); idx /= ncclNumTypes;
+    ncclDevRedOp_t devRedOp = (ncclDevRedOp_t)(idx%ncclNumDevRedOps);
+    ncclFunc_t func = (ncclFunc_t)(idx/ncclNumDevRedOps);
+    if (algo != NCCL_ALGO_RING) mockUnsupported(ncclAlgoStr[algo]);
+    if (proto == NCCL_PROTO_LL128) mockUnsupported(ncclProtoStr[proto]);
+    bool twoSteps = func == ncclFuncAllReduce || func == ncclFuncAllGather || func == ncclFuncReduceScatter;
+    struct ncclDevRedOpFull op = { devRedOp, false, e->redOpArg };
+    struct ncclRing* ring = &block->channel->ring;
+    block->jobs.emplace_back();
+    struct mockJob* job = &block->jobs.back();
+    mockJobInit(job, grid, block->channel, proto, twoSteps ? ALLREDUCE_CHUNKSTEPS/ALLREDUCE_SLICESTEPS : 1,
+        twoSteps ? ALLREDUCE_SLICESTEPS : 1, type, op, e->sendbuff, e->recvbuff, ring->prev, ring->next, 0);
+    mockRingOps(grid, job, func, proto, e, ring);
+  }
+  block->concurrent = false;
+}
+
+static void mockLoadWork(struct mockGrid* grid, struct mockBlock* block) {
+  memcpy(&block->work, block->workPtr, sizeof(struct ncclWork));
+  struct ncclWorkHeader* header = &block->work.header;
+  // Notify host that all fifo reads are complete
+  if (header->isLast && header->inFifo) __atomic_store_n(block->channel->workFifoDone, header->doneAcks, __ATOMIC_RELEASE);
+  block->workPtr = header->isLast ? NULL : grid->workHead + header->workNext;
+  grid->moved = true;
+
+  switch (header->type) {
+  case ncclWorkTypeColl:
+    for (int i=0; i<NCCL_MAX_WORK_ELEMENTS; i++) {
+      struct ncclWorkElem* e = block->work.elems+i;
+      if (!e->isUsed || !e->redOpArgIsPtr) continue;
+      // The scalar type is not known here : read the largest one the alignment allows
+      if (e->redOpArg%2 != 0) e->redOpArg = *(uint8_t*)e->redOpArg;
+      else if (e->redOpArg%4 != 0) e->redOpArg = *(uint16_t*)e->redOpArg;
+      else if (e->redOpArg%8 != 0) e->redOpArg = *(uint32_t*)e->redOpArg;
+      else e->redOpArg = *(uint64_t*)e->redOpArg;
+    }
+    mockCollJobs(grid, block);
+    break;
+  case ncclWorkTypeP2p:
+    mockP2pJobs(grid, block);
+    break;
+  case ncclWorkTypeRegColl:
+    mockUnsupported("Registered buffers");
+    break;
+  default:
+    break;
+  }
+}
+
+// Returns true when the block is done with all its works
+static bool mockBlockProgress(struct mockGrid* grid, struct mockBlock* block) {
+  while (true) {
+    if (block->jobs.empty()) {
+      if (block->workPtr == NULL) return true;
+      mockLoadWork(grid, block);
+      continue;
+    }
+    if (block->concurrent) {
+      for (auto it = block->jobs.begin(); it != block->jobs.end(); ) {
+        if (mockJobProgress(grid, &*it)) it = block->jobs.erase(it);
+        else ++it;
+      }
+      if (!block->jobs.empty()) return false;
+    } else {
+      if (!mockJobProgress(grid, &block->jobs.front())) return false;
+      block->jobs.pop_front();
+    }
+  }
+}
+
+static void mockKernelRun(void** args, dim3 gridDim, dim3 blockDim) {
+  struct mockGrid grid;
+  grid.comm = *(struct ncclDevComm**)args[0];
+  uint64_t channelMask = *(uint64_t*)args[1];
+  grid.workHead = *(struct ncclWork**)args[2];
+  grid.blocks.resize(gridDim.x);
+  // Block b runs the channel of the b-th bit set in the mask
+  int c = 0;
+  for (unsigned b=0; b<gridDim.x; b++, c++) {
+    while (!(channelMask & (1ull<<c))) c++;
+    grid.blocks[b].channel = &((struct ncclDevCommAndChannels*)grid.comm)->channels[c];
+    grid.blocks[b].workPtr = grid.workHead + b;
+  }
+
+  size_t nActive = grid.blocks.size();
+  std::vector<bool> done(nActive, false);
+  while (nActive) {
+    grid.moved = false;
+    for (size_t b=0; b<grid.blocks.size(); b++) {
+      if (done[b] || !mockBlockProgress(&grid, &grid.blocks[b])) continue;
+      done[b] = true;
+      nActive--;
+    }
+    if (grid.moved) continue;
+    if (*grid.comm->abortFlag) return;
+    sched_yield();
+  }
+}
+
+/* Kernel symbols referenced by enqueue.cc */
+
+#define MOCK_KERNS_ALGOS(X, func, type) \
+  X(func, TREE, LL, type) \
+  X(func, RING, LL, type) \
+  X(func, COLLNET_DIRECT, LL, type) \
+  X(func, COLLNET_CHAIN, LL, type)
+
+#define MOCK_KERNS_TYPES(X, func) \
+  MOCK_KERNS_ALGOS(X, func, int8_t) \
+  MOCK_KERNS_ALGOS(X, func, uint8_t) \
+  MOCK_KERNS_ALGOS(X, func, int32_t) \
+  MOCK_KERNS_ALGOS(X, func, uint32_t) \
+  MOCK_KERNS_ALGOS(X, func, int64_t) \
+  MOCK_KERNS_ALGOS(X, func, uint64_t) \
+  MOCK_KERNS_ALGOS(X, func, half) \
+  MOCK_KERNS_ALGOS(X, func, float) \
+  MOCK_KERNS_ALGOS(X, func, double) \
+  MOCK_KERNS_ALGOS(X, func, __nv_bfloat16)
+
+#define MOCK_KERNS(X) \
+  X(SendRecv, RING, SIMPLE, int8_t) \
+  MOCK_KERNS_ALGOS(X, Broadcast, int8_t) \
+  MOCK_KERNS_TYPES(X, Reduce) \
+  MOCK_KERNS_ALGOS(X, AllGather, int8_t) \
+  MOCK_KERNS_TYPES(X, ReduceScatter) \
+  MOCK_KERNS_TYPES(X, AllReduce)
+
+// Only the address of the kernels matters : they are launched through
+// cudaLaunchKernel, which runs mockKernelRun.
+static void mockKernelCalled(const char* name) {
+  WARN("Mock device : kernel %s was called directly", name);
+  abort();
+}
+
+#define MOCK_KERN_DEFINE(func, algo, proto, type) \
+  __global__ void NCCL_KERN_NAME(func, algo, proto, Sum, type)(struct ncclDevComm* comm, uint64_t channelMask, struct ncclWork* workHead) { \
+    mockKernelCalled(__func__); \
+  }
+MOCK_KERNS(MOCK_KERN_DEFINE)
+
+#define MOCK_KERN_ADDRESS(func, algo, proto, type) (const void*)NCCL_KERN_NAME(func, algo, proto, Sum, type),
+
+__attribute__((constructor)) static void mockKernelsInit() {
+  static const void* const kernels[] = { MOCK_KERNS(MOCK_KERN_ADDRESS) };
+  static const size_t argSizes[] = { sizeof(struct ncclDevComm*), sizeof(uint64_t), sizeof(struct ncclWork*) };
+  for (size_t k=0; k<sizeof(kernels)/sizeof(kernels[0]); k++) {
+    if (mockCudaRegisterKernel(kernels[k], mockKernelRun, 3, argSizes) != cudaSuccess) abort();
+  }
+  // Only run what the host kernels implement, unless told otherwise
+  setenv("NCCL_ALGO", "Ring", 0);
+  setenv("NCCL_PROTO", "LL,Simple", 0);
+}
@@ -0,0 +1,178 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Network plugin which moves no data, to measure the proxy rather than a
+// network. Connections are established without contacting the peer, and
+// sends and receives complete on their own, with the size they were posted
+// with. Only the Simple protocol works on it : the LL protocols wait for flags
+// carried by the data.
+//
+// NCCL_MOCK_NET_LATENCY sets the time (us) from posting a request to its
+// completion (default 0). NCCL_MOCK_NET_OVERHEAD sets the CPU time (ns) each
+// isend, irecv and test spends, as the driver of a NIC would (default 0).
+//
+// Loaded with NCCL_NET_PLUGIN=mock.
+
+#include "nccl_net.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MOCK_NET_MAX_REQUESTS (NCCL_NET_MAX_REQUESTS*8)
+#define MOCK_NET_MAX_RECVS 8
+
+static uint64_t mockNetLatencyNs;
+static uint64_t mockNetOverheadNs;
+
+static uint64_t mockNetClock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void mockNetOverhead() {
+  if (mockNetOverheadNs == 0) return;
+  uint64_t end = mockNetClock() + mockNetOverheadNs;
+  while (mockNetClock() < end);
+}
+
+struct mockNetRequest {
+  struct mockNetComm* comm;
+  uint64_t doneTime;
+  int n;
+  int sizes[MOCK_NET_MAX_RECVS];
+};
+
+// Send and receive comms. Requests are only ever used by the thread which progresses the comm.
+struct mockNetComm {
+  struct mockNetRequest requests[MOCK_NET_MAX_REQUESTS];
+  struct mockNetRequest* freeRequests[MOCK_NET_MAX_REQUESTS];
+  int nFree;
+};
+
+static ncclResult_t mockNetCommAlloc(void** comm) {
+  struct mockNetComm* c = (struct mockNetComm*)calloc(1, sizeof(struct mockNetComm));
+  if (c == NULL) return ncclSystemError;
+  for (int i=0; i<MOCK_NET_MAX_REQUESTS; i++) c->freeRequests[i] = c->requests+i;
+  c->nFree = MOCK_NET_MAX_REQUESTS;
+  *comm = c;
+  return ncclSuccess;
+}
+
+// Leaves *request NULL when all requests are in flight : NCCL tries again later.
+static void mockNetPost(void* comm, int n, int* sizes, void** request) {
+  struct mockNetComm* c = (struct mockNetComm*)comm;
+  mockNetOverhead();
+  *request = NULL;
+  if (c->nFree == 0) return;
+  struct mockNetRequest* r = c->freeRequests[--c->nFree];
+  r->comm = c;
+  r->doneTime = mockNetClock() + mockNetLatencyNs;
+  r->n = n;
+  memcpy(r->sizes, sizes, n*sizeof(int));
+  *request = r;
+}
+
+static ncclResult_t mockNetInit(ncclDebugLogger_t logFunction) {
+  const char* str = getenv("NCCL_MOCK_NET_LATENCY");
+  mockNetLatencyNs = str ? strtoull(str, NULL, 0)*1000 : 0;
+  str = getenv("NCCL_MOCK_NET_OVERHEAD");
+  mockNetOverheadNs = str ? strtoull(str, NULL, 0) : 0;
+  return ncclSuccess;
+}
+
+static ncclResult_t mockNetDevices(int* ndev) {
+  *ndev = 1;
+  return ncclSuccess;
+}
+
+static ncclResult_t mockNetGetProperties(int dev, ncclNetProperties_v6_t* props) {
+  props->name = (char*)"mock0";
+  props->pciPath = NULL;
+  props->guid = dev;
+  props->ptrSupport = NCCL_PTR_HOST;
+  props->speed = 400000;
+  props->port = 0;
+  props->latency = 0;
+  props->maxComms = 65536;
+  props->maxRecvs = MOCK_NET_MAX_RECVS;
+  return ncclSuccess;
+}
+
+static ncclResult_t mockNetListen(int dev, void* handle, void** listenComm) {
+  memset(handle, 0, NCCL_NET_HANDLE_MAXSIZE);
+  *listenComm = calloc(1, sizeof(int));
+  return *listenComm ? ncclSuccess : ncclSystemError;
+}
+
+static ncclResult_t mockNetConnect(int dev, void* handle, void** sendComm) {
+  return mockNetCommAlloc(sendComm);
+}
+
+static ncclResult_t mockNetAccept(void* listenComm, void** recvComm) {
+  return mockNetCommAlloc(recvComm);
+}
+
+static ncclResult_t mockNetRegMr(void* comm, void* data, int size, int type, void** mhandle) {
+  *mhandle = comm;
+  return type == NCCL_PTR_HOST ? ncclSuccess : ncclInternalError;
+}
+
+static ncclResult_t mockNetDeregMr(void* comm, void* mhandle) {
+  return ncclSuccess;
+}
+
+static ncclResult_t mockNetIsend(void* sendComm, void* data, int size, int tag, void* mhandle, void** request) {
+  mockNetPost(sendComm, 1, &size, request);
+  return ncclSuccess;
+}
+
+static ncclResult_t mockNetIrecv(void* recvComm, int n, void** data, int* sizes, int* tags, void** mhandles, void** request) {
+  if (n > MOCK_NET_MAX_RECVS) return ncclInternalError;
+  mockNetPost(recvComm, n, sizes, request);
+  return ncclSuccess;
+}
+
+// Host memory : nothing to flush
+static ncclResult_t mockNetIflush(void* recvComm, int n, void** data, int* sizes, void** mhandles, void** request) {
+  *request = NULL;
+  return ncclSuccess;
+}
+
+static ncclResult_t mockNetTest(void* request, int* done, int* sizes) {
+  struct mockNetRequest* r = (struct mockNetRequest*)request;
+  mockNetOverhead();
+  *done = mockNetLatencyNs == 0 || mockNetClock() >= r->doneTime;
+  if (*done == 0) return ncclSuccess;
+  if (sizes) memcpy(sizes, r->sizes, r->n*sizeof(int));
+  r->comm->freeRequests[r->comm->nFree++] = r;
+  return ncclSuccess;
+}
+
+static ncclResult_t mockNetClose(void* comm) {
+  free(comm);
+  return ncclSuccess;
+}
+
+extern "C" __attribute__((visibility("default"))) const ncclNet_v6_t ncclNetPlugin_v6 = {
+  "Mock",
+  mockNetInit,
+  mockNetDevices,
+  mockNetGetProperties,
+  mockNetListen,
+  mockNetConnect,
+  mockNetAccept,
+  mockNetRegMr,
+  NULL, // No DMA-BUF support
+  mockNetDeregMr,
+  mockNetIsend,
+  mockNetIrecv,
+  mockNetIflush,
+  mockNetTest,
+  mockNetClose,
+  mockNetClose,
+  mockNetClose
+};
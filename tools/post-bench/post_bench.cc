@@ -0,0 +1,175 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Throughput and stress test of the rings local ranks post proxy ops through.
+// Each producer thread plays a local rank : it posts chains of its ops as
+// ncclProxyStart does, and waits for ops to be freed when it runs out of them.
+// The consumer thread plays the progress thread : it takes the posted chains,
+// sleeping on the doorbell when there are none, checks that the ops of each
+// producer arrive in order, and frees them.
+
+#include "proxy.h"
+#include "proxypost.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+struct benchProducer {
+  alignas(64) volatile uint64_t consumed; // Written by the consumer
+  alignas(64) int rank;
+  struct benchState* state;
+};
+
+struct benchState {
+  struct ncclProxyOpsPool* pool;
+  int nProducers;
+  int chainOps;
+  uint64_t nOps; // Per producer
+  int sleep;
+  struct benchProducer producers[NCCL_MAX_LOCAL_RANKS];
+  volatile uint64_t nConsumed;
+  uint64_t nWaits;
+  uint64_t errors;
+  bool stop;
+};
+
+// Op slot of the seq-th op of a producer. Slots are reused once consumed, as freed ops are.
+static int opIndex(int rank, uint64_t seq) { return rank*MAX_OPS_PER_PEER + seq%MAX_OPS_PER_PEER; }
+
+static void* producerMain(void* arg) {
+  struct benchProducer* producer = (struct benchProducer*)arg;
+  struct benchState* state = producer->state;
+  struct ncclProxyOpsPool* pool = state->pool;
+  for (uint64_t seq=0; seq<state->nOps; ) {
+    uint64_t n = std::min<uint64_t>(state->chainOps, state->nOps-seq);
+    while (seq+n - __atomic_load_n(&producer->consumed, __ATOMIC_ACQUIRE) > MAX_OPS_PER_PEER) sched_yield();
+    for (uint64_t i=seq; i<seq+n; i++) {
+      struct ncclProxyOp* op = pool->ops+opIndex(producer->rank, i);
+      op->opCount = i;
+      op->next = i+1 < seq+n ? opIndex(producer->rank, i+1) : -1;
+    }
+    ncclProxyPost(pool, producer->rank, opIndex(producer->rank, seq), opIndex(producer->rank, seq+n-1));
+    seq += n;
+  }
+  return NULL;
+}
+
+static void* consumerMain(void* arg) {
+  struct benchState* state = (struct benchState*)arg;
+  struct ncclProxyOpsPool* pool = state->pool;
+  uint64_t expected[NCCL_MAX_LOCAL_RANKS] = { 0 };
+  uint64_t total = state->nOps*state->nProducers, nConsumed = 0;
+  while (nConsumed < total) {
+    int index = ncclProxyGetPostedChains(pool, state->nProducers);
+    if (index == -1) {
+      state->nWaits++;
+      if (state->sleep) ncclProxyWaitDoorbell(pool, state->nProducers, &state->stop, -1);
+      continue;
+    }
+    while (index != -1) {
+      struct ncclProxyOp* op = pool->ops+index;
+      int rank = index/MAX_OPS_PER_PEER;
+      if (op->opCount != expected[rank]) state->errors++;
+      expected[rank] = op->opCount+1;
+      index = op->next;
+      // The producer may reuse the op from here
+      struct benchProducer* producer = state->producers+rank;
+      __atomic_store_n(&producer->consumed, producer->consumed+1, __ATOMIC_RELEASE);
+      nConsumed++;
+    }
+    __atomic_store_n(&state->nConsumed, nConsumed, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+// Returns false if the consumer got stuck, e.g. on a missed wake-up
+static bool benchRun(struct benchState* state, double* seconds) {
+  memset(state->pool, 0, sizeof(struct ncclProxyOpsPool));
+  state->nConsumed = state->nWaits = state->errors = 0;
+  pthread_t consumer, producers[NCCL_MAX_LOCAL_RANKS];
+  uint64_t t0 = clockNano();
+  pthread_create(&consumer, NULL, consumerMain, state);
+  for (int p=0; p<state->nProducers; p++) {
+    state->producers[p].consumed = 0;
+    state->producers[p].rank = p;
+    state->producers[p].state = state;
+    pthread_create(producers+p, NULL, producerMain, state->producers+p);
+  }
+  uint64_t total = state->nOps*state->nProducers, last = 0, lastTime = clockNano();
+  while (__atomic_load_n(&state->nConsumed, __ATOMIC_RELAXED) < total) {
+    struct timespec ts = { 0, 10000000 };
+    nanosleep(&ts, NULL);
+    uint64_t nConsumed = __atomic_load_n(&state->nConsumed, __ATOMIC_RELAXED);
+    if (nConsumed != last) {
+      last = nConsumed;
+      lastTime = clockNano();
+    } else if (clockNano() - lastTime > 5000000000ULL) {
+      fprintf(stderr, "Stuck after %lu of %lu ops\n", nConsumed, total);
+      return false;
+    }
+  }
+  pthread_join(consumer, NULL);
+  for (int p=0; p<state->nProducers; p++) pthread_join(producers[p], NULL);
+  *seconds = (clockNano()-t0)/1e9;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  struct benchState state;
+  memset(&state, 0, sizeof(state));
+  state.chainOps = 1;
+  state.nOps = 100000;
+  state.sleep = 1;
+  char defaultProducers[] = "8,16,32,64";
+  char* producers = defaultProducers;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:n:c:s:h")) != -1) {
+    switch (opt) {
+      case 'p': producers = optarg; break;
+      case 'n': state.nOps = strtoull(optarg, NULL, 0); break;
+      case 'c': state.chainOps = atoi(optarg); break;
+      case 's': state.sleep = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage : %s [-p producers, e.g. 8,16,32,64] [-n ops per producer] [-c ops per chain] [-s consumer sleeps 0/1]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (state.nOps < 1 || state.chainOps < 1 || state.chainOps > MAX_OPS_PER_PEER) {
+    fprintf(stderr, "Need at least 1 op per producer, and chains of 1 to %d ops\n", MAX_OPS_PER_PEER);
+    return 1;
+  }
+  if (posix_memalign((void**)&state.pool, 64, sizeof(struct ncclProxyOpsPool)) != 0) {
+    fprintf(stderr, "Could not allocate the ops pool\n");
+    return 1;
+  }
+
+  printf("# %lu ops per producer, chains of %d ops, the consumer %s\n", state.nOps, state.chainOps,
+      state.sleep ? "sleeps on the doorbell" : "spins");
+  printf("# %10s %12s %12s %12s %12s %10s\n", "producers", "time(ms)", "Mposts/s", "Mops/s", "empty polls", "errors");
+  int failed = 0;
+  for (char* str = strtok(producers, ","); str; str = strtok(NULL, ",")) {
+    state.nProducers = atoi(str);
+    if (state.nProducers < 1 || state.nProducers > NCCL_MAX_LOCAL_RANKS) {
+      fprintf(stderr, "Producers must be between 1 and %d\n", NCCL_MAX_LOCAL_RANKS);
+      return 1;
+    }
+    double seconds;
+    if (!benchRun(&state, &seconds)) return 1;
+    uint64_t nOps = state.nOps*state.nProducers;
+    uint64_t nPosts = state.nProducers*((state.nOps+state.chainOps-1)/state.chainOps);
+    printf("  %10d %12.2f %12.3f %12.3f %12lu %10lu\n", state.nProducers, seconds*1e3, nPosts/seconds/1e6, nOps/seconds/1e6,
+        state.nWaits, state.errors);
+    fflush(stdout);
+    if (state.errors) failed = 1;
+  }
+  free(state.pool);
+  return failed;
+}
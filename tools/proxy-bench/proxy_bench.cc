@@ -0,0 +1,387 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Host benchmarks of the proxy progress thread on mock devices. Each rank is a
+// process with its own host id, so that ranks talk through the network
+// transport and the proxies run as they would with GPUs. Every setting runs in
+// new processes, since NCCL reads its parameters once.
+//
+// wakeup : rank 0 posts a small receive, rank 1 sends it after a gap. The
+// receive sits idle on the proxy of rank 0 in the meantime, which spins or
+// sleeps on its doorbell depending on NCCL_PROXY_SPIN_TIME.
+//
+// progress : allreduce on many channels over the mock network plugin, which
+// moves no data, so that the proxy is the bottleneck. Runs for each number of
+// progress threads (NCCL_PROXY_NTHREADS).
+//
+// msgrate : each rank sends many small messages to the other in a group, and
+// receives as many, over the mock network. Runs for each
+// NCCL_PROXY_P2P_COALESCE_STEPS, 0 disabling the coalescing of these ops.
+
+#include "comm.h"
+#include <cuda_runtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define BENCHCUDACHECK(cmd) do { \
+  cudaError_t err = cmd; \
+  if (err != cudaSuccess) { \
+    fprintf(stderr, "%s:%d CUDA error '%s'\n", __FILE__, __LINE__, cudaGetErrorString(err)); \
+    exit(1); \
+  } \
+} while(0)
+
+#define BENCHCHECK(cmd) do { \
+  ncclResult_t res = (cmd); \
+  if (res != ncclSuccess) { \
+    fprintf(stderr, "%s:%d '%s' failed : %s\n", __FILE__, __LINE__, #cmd, ncclGetErrorString(res)); \
+    exit(1); \
+  } \
+} while (0)
+
+static size_t parseSize(const char* str) {
+  char* end;
+  size_t value = strtoull(str, &end, 0);
+  switch (*end) {
+    case 'G': case 'g': value <<= 10; // fall through
+    case 'M': case 'm': value <<= 10; // fall through
+    case 'K': case 'k': value <<= 10;
+  }
+  return value;
+}
+
+static void* sharedAlloc(size_t size) {
+  void* ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return ptr;
+}
+
+// CPU time of the proxy progress threads of comm
+static uint64_t proxyCpuNs(ncclComm_t comm) {
+  struct ncclProxyProgressState* state = &comm->proxyState.progressState;
+  uint64_t total = 0;
+  for (int s=0; s<state->nShards; s++) {
+    clockid_t clock;
+    struct timespec ts;
+    if (pthread_getcpuclockid(state->shards[s].thread, &clock) != 0 || clock_gettime(clock, &ts) != 0) continue;
+    total += ts.tv_sec*1000000000ULL + ts.tv_nsec;
+  }
+  return total;
+}
+
+struct benchRank {
+  int rank;
+  int nRanks;
+  ncclComm_t comm;
+  cudaStream_t stream;
+  char* buff;
+};
+
+static void rankInit(struct benchRank* r, int idFd[2], size_t bytes) {
+  char hostId[64];
+  snprintf(hostId, sizeof(hostId), "nccl-proxy-bench-%d", r->rank);
+  setenv("NCCL_HOSTID", hostId, 1);
+
+  // Rank 0 creates the id and hands it to the other ranks
+  ncclUniqueId id;
+  if (r->rank == 0) {
+    BENCHCHECK(ncclGetUniqueId(&id));
+    for (int i=1; i<r->nRanks; i++) {
+      if (write(idFd[1], &id, sizeof(id)) != sizeof(id)) { perror("write"); exit(1); }
+    }
+  } else {
+    if (read(idFd[0], &id, sizeof(id)) != sizeof(id)) { perror("read"); exit(1); }
+  }
+  close(idFd[0]);
+  close(idFd[1]);
+
+  BENCHCUDACHECK(cudaSetDevice(0));
+  BENCHCUDACHECK(cudaStreamCreate(&r->stream));
+  BENCHCUDACHECK(cudaMalloc(&r->buff, bytes));
+  BENCHCHECK(ncclCommInitRank(&r->comm, r->nRanks, id, r->rank));
+}
+
+static void rankFree(struct benchRank* r) {
+  BENCHCHECK(ncclCommDestroy(r->comm));
+  BENCHCUDACHECK(cudaFree(r->buff));
+  BENCHCUDACHECK(cudaStreamDestroy(r->stream));
+}
+
+// Run rankMain(rank, idFd, arg) in nRanks processes. Returns the number of ranks which failed.
+static int forkRanks(int nRanks, void (*rankMain)(int rank, int idFd[2], void* arg), void* arg) {
+  int idFd[2];
+  if (pipe(idFd) != 0) { perror("pipe"); return nRanks; }
+  fflush(stdout);
+  pid_t* pids = (pid_t*)malloc(nRanks*sizeof(pid_t));
+  for (int r=0; r<nRanks; r++) {
+    pids[r] = fork();
+    if (pids[r] < 0) { perror("fork"); exit(1); }
+    if (pids[r] == 0) {
+      rankMain(r, idFd, arg);
+      exit(0);
+    }
+  }
+  close(idFd[0]);
+  close(idFd[1]);
+  int failed = 0;
+  for (int r=0; r<nRanks; r++) {
+    int status;
+    if (waitpid(pids[r], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Rank %d failed\n", r);
+      failed++;
+    }
+  }
+  free(pids);
+  return failed;
+}
+
+struct wakeupArgs {
+  size_t bytes;
+  int gapUs;
+  int iters;
+  int warmup;
+  // Shared with the ranks
+  uint64_t* sendTime;
+  uint64_t* recvTime;
+  uint64_t* proxyCpuNs;
+  uint64_t* timeNs;
+};
+
+static void wakeupRank(int rank, int idFd[2], void* arg) {
+  struct wakeupArgs* args = (struct wakeupArgs*)arg;
+  struct benchRank r = { rank, 2 };
+  rankInit(&r, idFd, args->bytes);
+  uint64_t cpu0 = 0, t0 = 0;
+  for (int i=-args->warmup; i<args->iters; i++) {
+    if (i == 0) {
+      cpu0 = proxyCpuNs(r.comm);
+      t0 = clockNano();
+    }
+    if (rank == 1) {
+      struct timespec gap = { args->gapUs/1000000, (args->gapUs%1000000)*1000L };
+      nanosleep(&gap, NULL);
+      if (i >= 0) args->sendTime[i] = clockNano();
+      BENCHCHECK(ncclSend(r.buff, args->bytes, ncclInt8, 0, r.comm, r.stream));
+    } else {
+      BENCHCHECK(ncclRecv(r.buff, args->bytes, ncclInt8, 1, r.comm, r.stream));
+    }
+    BENCHCUDACHECK(cudaStreamSynchronize(r.stream));
+    if (rank == 0 && i >= 0) args->recvTime[i] = clockNano();
+  }
+  args->proxyCpuNs[rank] = proxyCpuNs(r.comm)-cpu0;
+  args->timeNs[rank] = clockNano()-t0;
+  rankFree(&r);
+}
+
+// Wake-up latency and proxy CPU time for each NCCL_PROXY_SPIN_TIME in spinTimes (comma separated)
+static int wakeupBench(char* spinTimes, size_t bytes, int gapUs, int iters, int warmup) {
+  struct wakeupArgs args = { bytes, gapUs, iters, warmup };
+  args.sendTime = (uint64_t*)sharedAlloc(iters*sizeof(uint64_t));
+  args.recvTime = (uint64_t*)sharedAlloc(iters*sizeof(uint64_t));
+  args.proxyCpuNs = (uint64_t*)sharedAlloc(2*sizeof(uint64_t));
+  args.timeNs = (uint64_t*)sharedAlloc(2*sizeof(uint64_t));
+  double* latency = (double*)malloc(iters*sizeof(double));
+
+  printf("# wakeup : %zu bytes sent %d us after the receive is posted, %d iterations, NCCL_PROXY_MAX_SLEEP_TIME=%s\n",
+      bytes, gapUs, iters, getenv("NCCL_PROXY_MAX_SLEEP_TIME") ? getenv("NCCL_PROXY_MAX_SLEEP_TIME") : "200");
+  printf("# %10s %12s %12s %12s %12s %12s\n", "spin(us)", "avg(us)", "p50(us)", "max(us)", "recv CPU", "send CPU");
+  int failed = 0;
+  for (char* spinTime = strtok(spinTimes, ","); spinTime; spinTime = strtok(NULL, ",")) {
+    setenv("NCCL_PROXY_SPIN_TIME", spinTime, 1);
+    if (forkRanks(2, wakeupRank, &args)) {
+      failed = 1;
+      continue;
+    }
+    double sum = 0;
+    for (int i=0; i<iters; i++) {
+      latency[i] = (args.recvTime[i]-args.sendTime[i])/1e3;
+      sum += latency[i];
+    }
+    std::sort(latency, latency+iters);
+    // Busy time of the progress threads, in cores
+    printf("  %10s %12.2f %12.2f %12.2f %12.3f %12.3f\n", spinTime, sum/iters, latency[iters/2], latency[iters-1],
+        (double)args.proxyCpuNs[0]/args.timeNs[0], (double)args.proxyCpuNs[1]/args.timeNs[1]);
+    fflush(stdout);
+  }
+  free(latency);
+  return failed;
+}
+
+struct progressArgs {
+  size_t bytes;
+  int iters;
+  int warmup;
+  // Shared with the ranks
+  uint64_t* proxyCpuNs;
+  uint64_t* timeNs;
+};
+
+static void progressRank(int rank, int idFd[2], void* arg) {
+  struct progressArgs* args = (struct progressArgs*)arg;
+  struct benchRank r = { rank, 2 };
+  rankInit(&r, idFd, 2*args->bytes);
+  size_t count = args->bytes/sizeof(float);
+  float* sendbuff = (float*)r.buff;
+  float* recvbuff = sendbuff+count;
+  for (int i=0; i<args->warmup; i++) BENCHCHECK(ncclAllReduce(sendbuff, recvbuff, count, ncclFloat, ncclSum, r.comm, r.stream));
+  BENCHCUDACHECK(cudaStreamSynchronize(r.stream));
+  uint64_t cpu0 = proxyCpuNs(r.comm), t0 = clockNano();
+  for (int i=0; i<args->iters; i++) BENCHCHECK(ncclAllReduce(sendbuff, recvbuff, count, ncclFloat, ncclSum, r.comm, r.stream));
+  BENCHCUDACHECK(cudaStreamSynchronize(r.stream));
+  args->proxyCpuNs[rank] = proxyCpuNs(r.comm)-cpu0;
+  args->timeNs[rank] = clockNano()-t0;
+  rankFree(&r);
+}
+
+// Allreduce time and proxy CPU time for each NCCL_PROXY_NTHREADS in nThreads (comma separated)
+static int progressBench(char* nThreads, int nChannels, size_t bytes, int iters, int warmup) {
+  struct progressArgs args = { bytes, iters, warmup };
+  args.proxyCpuNs = (uint64_t*)sharedAlloc(2*sizeof(uint64_t));
+  args.timeNs = (uint64_t*)sharedAlloc(2*sizeof(uint64_t));
+  char channels[16];
+  snprintf(channels, sizeof(channels), "%d", nChannels);
+  setenv("NCCL_MIN_NCHANNELS", channels, 1);
+  setenv("NCCL_MAX_NCHANNELS", channels, 1);
+  // The mock network moves no data, which only the Simple protocol copes with
+  setenv("NCCL_NET_PLUGIN", "mock", 1);
+  setenv("NCCL_PROTO", "Simple", 1);
+  setenv("NCCL_MOCK_NET_OVERHEAD", "1000", 0);
+
+  printf("# progress : allreduce of %zu bytes on %d channels, %d iterations, NCCL_MOCK_NET_OVERHEAD=%s NCCL_MOCK_NET_LATENCY=%s\n",
+      bytes, nChannels, iters, getenv("NCCL_MOCK_NET_OVERHEAD"), getenv("NCCL_MOCK_NET_LATENCY") ? getenv("NCCL_MOCK_NET_LATENCY") : "0");
+  printf("# %10s %12s %12s %12s\n", "threads", "time(us)", "algbw", "proxy CPU");
+  int failed = 0;
+  for (char* n = strtok(nThreads, ","); n; n = strtok(NULL, ",")) {
+    setenv("NCCL_PROXY_NTHREADS", n, 1);
+    if (forkRanks(2, progressRank, &args)) {
+      failed = 1;
+      continue;
+    }
+    double us = std::max(args.timeNs[0], args.timeNs[1])/1e3/iters;
+    // Busy time of the progress threads of a rank, in cores
+    printf("  %10s %12.2f %12.3f %12.3f\n", n, us, bytes/us/1e3, (double)args.proxyCpuNs[0]/args.timeNs[0]);
+    fflush(stdout);
+  }
+  return failed;
+}
+
+struct msgRateArgs {
+  size_t bytes;
+  int nMsgs;
+  int iters;
+  int warmup;
+  // Shared with the ranks
+  uint64_t* timeNs;
+};
+
+static void msgRateGroup(struct benchRank* r, struct msgRateArgs* args) {
+  int peer = 1-r->rank;
+  BENCHCHECK(ncclGroupStart());
+  for (int m=0; m<args->nMsgs; m++) {
+    BENCHCHECK(ncclSend(r->buff+m*args->bytes, args->bytes, ncclInt8, peer, r->comm, r->stream));
+    BENCHCHECK(ncclRecv(r->buff+(args->nMsgs+m)*args->bytes, args->bytes, ncclInt8, peer, r->comm, r->stream));
+  }
+  BENCHCHECK(ncclGroupEnd());
+}
+
+static void msgRateRank(int rank, int idFd[2], void* arg) {
+  struct msgRateArgs* args = (struct msgRateArgs*)arg;
+  struct benchRank r = { rank, 2 };
+  rankInit(&r, idFd, 2*args->nMsgs*args->bytes);
+  for (int i=0; i<args->warmup; i++) msgRateGroup(&r, args);
+  BENCHCUDACHECK(cudaStreamSynchronize(r.stream));
+  uint64_t t0 = clockNano();
+  for (int i=0; i<args->iters; i++) msgRateGroup(&r, args);
+  BENCHCUDACHECK(cudaStreamSynchronize(r.stream));
+  args->timeNs[rank] = clockNano()-t0;
+  rankFree(&r);
+}
+
+// Messages per second for each NCCL_PROXY_P2P_COALESCE_STEPS in coalesceSteps (comma separated)
+static int msgRateBench(char* coalesceSteps, size_t bytes, int nMsgs, int iters, int warmup) {
+  struct msgRateArgs args = { bytes, nMsgs, iters, warmup };
+  args.timeNs = (uint64_t*)sharedAlloc(2*sizeof(uint64_t));
+  // The mock network moves no data, which only the Simple protocol copes with
+  setenv("NCCL_NET_PLUGIN", "mock", 1);
+  setenv("NCCL_PROTO", "Simple", 1);
+  setenv("NCCL_MOCK_NET_LATENCY", "10", 0);
+
+  printf("# msgrate : %d messages of %zu bytes each way per group, %d iterations, NCCL_MOCK_NET_LATENCY=%s NCCL_MOCK_NET_OVERHEAD=%s\n",
+      nMsgs, bytes, iters, getenv("NCCL_MOCK_NET_LATENCY"), getenv("NCCL_MOCK_NET_OVERHEAD") ? getenv("NCCL_MOCK_NET_OVERHEAD") : "0");
+  printf("# %10s %12s %12s\n", "coalesce", "group(us)", "Mmsgs/s");
+  int failed = 0;
+  for (char* steps = strtok(coalesceSteps, ","); steps; steps = strtok(NULL, ",")) {
+    setenv("NCCL_PROXY_P2P_COALESCE_STEPS", steps, 1);
+    if (forkRanks(2, msgRateRank, &args)) {
+      failed = 1;
+      continue;
+    }
+    double us = std::max(args.timeNs[0], args.timeNs[1])/1e3/iters;
+    // Messages sent by a rank
+    printf("  %10s %12.2f %12.3f\n", steps, us, nMsgs/us);
+    fflush(stdout);
+  }
+  return failed;
+}
+
+enum { benchWakeup, benchProgress, benchMsgRate, benchNumModes };
+static const char* modeNames[benchNumModes] = { "wakeup", "progress", "msgrate" };
+
+int main(int argc, char* argv[]) {
+  int mode = benchWakeup;
+  size_t bytes = 0;
+  int gapUs = 1000, iters = 100, warmup = 10, nChannels = 16, nMsgs = 64;
+  char defaultSpinTimes[] = "-1,0,100,1000";
+  char defaultNThreads[] = "1,2,4,8";
+  char defaultCoalesceSteps[] = "0,8";
+  char* spinTimes = defaultSpinTimes;
+  char* nThreads = defaultNThreads;
+  char* coalesceSteps = defaultCoalesceSteps;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:b:g:i:w:t:c:p:m:k:h")) != -1) {
+    switch (opt) {
+      case 'o':
+        for (mode=0; mode<benchNumModes && strcmp(optarg, modeNames[mode]); mode++);
+        if (mode == benchNumModes) { fprintf(stderr, "Unknown benchmark %s\n", optarg); return 1; }
+        break;
+      case 'b': bytes = parseSize(optarg); break;
+      case 'g': gapUs = atoi(optarg); break;
+      case 'i': iters = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 't': spinTimes = optarg; break;
+      case 'c': nChannels = atoi(optarg); break;
+      case 'p': nThreads = optarg; break;
+      case 'm': nMsgs = atoi(optarg); break;
+      case 'k': coalesceSteps = optarg; break;
+      default:
+        fprintf(stderr, "Usage : %s [-o wakeup|progress|msgrate] [-b bytes] [-i iterations] [-w warmup iterations]\n"
+            "        wakeup : [-g gap us] [-t spin times, e.g. -1,0,100]\n"
+            "        progress : [-c channels] [-p progress threads, e.g. 1,2,4]\n"
+            "        msgrate : [-m messages per group] [-k coalesce steps, e.g. 0,8]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (bytes == 0) bytes = mode == benchWakeup ? 8 : mode == benchProgress ? 4<<20 : 64;
+  // The first operation connects the peers : never time it
+  if (gapUs < 0 || iters < 1 || warmup < 1 || nChannels < 1 || nMsgs < 1 || (mode == benchProgress && bytes < sizeof(float))) {
+    fprintf(stderr, "Need at least 1 iteration, 1 warmup iteration, 1 channel and 1 message, 4 bytes to allreduce, and a gap >= 0\n");
+    return 1;
+  }
+  setenv("NCCL_SOCKET_IFNAME", "lo", 0);
+  if (mode == benchWakeup) return wakeupBench(spinTimes, bytes, gapUs, iters, warmup);
+  if (mode == benchProgress) return progressBench(nThreads, nChannels, bytes, iters, warmup);
+  return msgRateBench(coalesceSteps, bytes, nMsgs, iters, warmup);
+}
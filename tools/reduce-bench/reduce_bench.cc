@@ -0,0 +1,255 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Throughput of ncclHostReduce for every datatype and reduction operation,
+// and a check of its floating point results against reduce_kernel.h.
+
+#include "hostreduce.h"
+#include "core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+#include <algorithm>
+
+static const char* typeNames[] = { "int8", "uint8", "int32", "uint32", "int64", "uint64", "half", "float", "double", "bfloat16" };
+static const char* opNames[ncclNumDevRedOps] = { "sum", "prod", "max", "min", "premulsum", "sumpostdiv" };
+
+static size_t parseSize(const char* str) {
+  char* end;
+  size_t value = strtoull(str, &end, 0);
+  switch (*end) {
+    case 'G': case 'g': value <<= 10; // fall through
+    case 'M': case 'm': value <<= 10; // fall through
+    case 'K': case 'k': value <<= 10;
+  }
+  return value;
+}
+
+// Values close to 1 so that long products neither overflow nor vanish
+static void fill(void* buff, size_t count, int type, int seed) {
+  srand(seed);
+  for (size_t i=0; i<count; i++) {
+    int r = rand() % 8;
+    double v = 1.0 + (r-4)/64.0;
+    switch (type) {
+      case ncclInt8: case ncclUint8: ((uint8_t*)buff)[i] = r; break;
+      case ncclInt32: case ncclUint32: ((uint32_t*)buff)[i] = r; break;
+      case ncclInt64: case ncclUint64: ((uint64_t*)buff)[i] = r; break;
+      case ncclFloat16: ((uint16_t*)buff)[i] = ncclFloatToHalf(v); break;
+      case ncclFloat32: ((float*)buff)[i] = v; break;
+      case ncclFloat64: ((double*)buff)[i] = v; break;
+      default: ((uint16_t*)buff)[i] = ncclFloatToBfloat16(v); break;
+    }
+  }
+}
+
+// Scale used by ncclAvg, as set up by hostToDevRedOp
+static uint64_t avgScalar(int type, int nRanks) {
+  union { uint16_t u16; float f32; double f64; uint64_t u64; };
+  u64 = 0;
+  switch (type) {
+    case ncclFloat16: u16 = ncclFloatToHalf(1.0f/nRanks); break;
+    case ncclFloat32: f32 = 1.0f/nRanks; break;
+    case ncclFloat64: f64 = 1.0/nRanks; break;
+    case ncclInt8: case ncclUint8: case ncclInt32: case ncclUint32: case ncclInt64: case ncclUint64: u64 = nRanks; break;
+    default: u16 = ncclFloatToBfloat16(1.0f/nRanks); break;
+  }
+  return u64;
+}
+
+// Elements of each source used by the check
+#define CHECK_COUNT 4096
+
+// Reference of the device reductions, written independently of the engine.
+// Each operation is computed in double and rounded once to the datatype,
+// which is what __hadd/__hmul and the float operations of reduce_kernel.h
+// return : going through float first, as the older architectures do, rounds
+// twice but float is wide enough for that not to change the result.
+struct RefFormat {
+  int mantBits;  // Explicit mantissa bits, 0 for double
+  int minExp;    // Exponent of the smallest normal value
+  double max;    // Largest finite value
+};
+static const RefFormat refHalf = { 10, -14, 65504.0 };
+static const RefFormat refBfloat16 = { 7, -126, 3.38953138925153547590470800371487866880e+38 };
+static const RefFormat refFloat = { 23, -126, 3.40282346638528859811704183484516925440e+38 };
+static const RefFormat refDouble = { 0, 0, 0 };
+
+static const RefFormat* refFormat(int type) {
+  switch (type) {
+    case ncclFloat16: return &refHalf;
+    case ncclFloat32: return &refFloat;
+    case ncclFloat64: return &refDouble;
+    default: return &refBfloat16;
+  }
+}
+
+// Round to nearest even, with denormals and overflow to Inf
+static double refRound(double x, const RefFormat* f) {
+  if (f->mantBits == 0 || x != x || x == 0 || isinf(x)) return x;
+  int e;
+  frexp(x, &e);
+  double ulp = ldexp(1.0, std::max(e-1, f->minExp) - f->mantBits);
+  double r = rint(x/ulp)*ulp;
+  return fabs(r) > f->max ? copysign(INFINITY, x) : r;
+}
+
+// Value of a half or bfloat16 bit pattern
+static double refDecode16(uint16_t bits, const RefFormat* f) {
+  int expBits = 15 - f->mantBits;
+  int e = (bits >> f->mantBits) & ((1 << expBits)-1);
+  int m = bits & ((1 << f->mantBits)-1);
+  double v;
+  if (e == (1 << expBits)-1) v = m ? NAN : INFINITY;
+  else if (e == 0) v = ldexp(m, f->minExp - f->mantBits);
+  else v = ldexp((1 << f->mantBits) + m, e - 1 + f->minExp - f->mantBits);
+  return (bits & 0x8000) ? -v : v;
+}
+
+static double refLoad(const void* buff, size_t i, int type) {
+  switch (type) {
+    case ncclFloat32: return ((const float*)buff)[i];
+    case ncclFloat64: return ((const double*)buff)[i];
+    default: return refDecode16(((const uint16_t*)buff)[i], refFormat(type));
+  }
+}
+
+// Mostly values around 1 so that sums and products round, with one element in
+// four drawn from all the bit patterns : NaN, Inf, zeros, denormals, overflows.
+static void fillCheck(void* buff, size_t count, int type, int seed) {
+  srand(seed);
+  for (size_t i=0; i<count; i++) {
+    uint64_t r = ((uint64_t)rand() << 32) ^ ((uint64_t)rand() << 16) ^ rand();
+    bool any = i%4 == 0;
+    switch (type) {
+      case ncclFloat32: {
+        uint32_t u = any ? (uint32_t)r : ((uint32_t)r & 0x807fffff) | (uint32_t)(127-4+(r>>40)%8) << 23;
+        memcpy((float*)buff+i, &u, sizeof(u));
+        break;
+      }
+      case ncclFloat64: {
+        uint64_t u = any ? r : (r & 0x800fffffffffffffULL) | (uint64_t)(1023-4+(r>>56)%8) << 52;
+        memcpy((double*)buff+i, &u, sizeof(u));
+        break;
+      }
+      default: {
+        int mantBits = refFormat(type)->mantBits;
+        int bias = (1 << (14-mantBits))-1;
+        uint16_t m = (r & ((1 << mantBits)-1)) | (r & 0x8000);
+        ((uint16_t*)buff)[i] = any ? (uint16_t)r : m | (uint16_t)((bias-4+(r>>20)%8) << mantBits);
+        break;
+      }
+    }
+  }
+}
+
+// Number of elements of dst which differ from the reference, NaN matching NaN
+static int checkReduce(const void* dst, void* const* srcs, int nSrcs, int type, int op, uint64_t scalar) {
+  const RefFormat* f = refFormat(type);
+  // The scalar is stored in the low bytes, as set up by avgScalar
+  double scale;
+  if (type == ncclFloat64) {
+    memcpy(&scale, &scalar, sizeof(double));
+  } else if (type == ncclFloat32) {
+    float f32;
+    memcpy(&f32, &scalar, sizeof(float));
+    scale = f32;
+  } else {
+    scale = refDecode16((uint16_t)scalar, f);
+  }
+  int errors = 0;
+  for (size_t i=0; i<CHECK_COUNT; i++) {
+    double acc = 0;
+    for (int s=0; s<nSrcs; s++) {
+      double x = refLoad(srcs[s], i, type);
+      if (op == ncclDevPreMulSum) x = refRound(x*scale, f);
+      if (s == 0) { acc = x; continue; }
+      switch (op) {
+        case ncclDevProd: acc = refRound(acc*x, f); break;
+        case ncclDevMax: acc = fmax(acc, x); break;
+        case ncclDevMin: acc = fmin(acc, x); break;
+        default: acc = refRound(acc+x, f); break;
+      }
+    }
+    double res = refLoad(dst, i, type);
+    if (res != acc && !(res != res && acc != acc)) errors++;
+  }
+  return errors;
+}
+
+int main(int argc, char* argv[]) {
+  size_t bytes = 32<<20;
+  int nSrcs = 2, iters = 20;
+  const char* typeFilter = NULL;
+  const char* opFilter = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:s:i:d:o:h")) != -1) {
+    switch (opt) {
+      case 'b': bytes = parseSize(optarg); break;
+      case 's': nSrcs = atoi(optarg); break;
+      case 'i': iters = atoi(optarg); break;
+      case 'd': typeFilter = optarg; break;
+      case 'o': opFilter = optarg; break;
+      default:
+        fprintf(stderr, "Usage : %s [-b bytes per buffer] [-s sources] [-i iterations] [-d datatype] [-o op]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (nSrcs < 1 || iters < 1) {
+    fprintf(stderr, "Need at least one source and one iteration\n");
+    return 1;
+  }
+
+  void** srcs = (void**)malloc(nSrcs*sizeof(void*));
+  for (int s=0; s<nSrcs; s++) srcs[s] = malloc(bytes);
+  void* dst = malloc(bytes);
+  void** checkSrcs = (void**)malloc(nSrcs*sizeof(void*));
+  for (int s=0; s<nSrcs; s++) checkSrcs[s] = malloc(CHECK_COUNT*sizeof(double));
+  void* checkDst = malloc(CHECK_COUNT*sizeof(double));
+  int totalErrors = 0;
+  printf("# %d sources of %zu bytes, %d iterations\n", nSrcs, bytes, iters);
+  printf("# %-9s %-11s %12s %10s %10s %8s\n", "type", "op", "count", "time(us)", "GB/s", "errors");
+  for (int type=0; type<ncclNumTypes; type++) {
+    if (typeFilter && strcmp(typeFilter, typeNames[type])) continue;
+    size_t count = bytes / ncclTypeSize((ncclDataType_t)type);
+    for (int s=0; s<nSrcs; s++) fill(srcs[s], count, type, s);
+    if (type >= ncclFloat16) {
+      for (int s=0; s<nSrcs; s++) fillCheck(checkSrcs[s], CHECK_COUNT, type, s);
+    }
+    for (int op=0; op<ncclNumDevRedOps; op++) {
+      if (opFilter && strcmp(opFilter, opNames[op])) continue;
+      bool isFloat = type >= ncclFloat16;
+      if (op == ncclDevSumPostDiv && isFloat) continue;
+      struct ncclDevRedOpFull opFull;
+      opFull.op = (ncclDevRedOp_t)op;
+      opFull.scalarArgIsPtr = false;
+      opFull.scalarArg = avgScalar(type, nSrcs);
+      // Warm up, then time
+      if (ncclHostReduce(dst, srcs, nSrcs, count, (ncclDataType_t)type, opFull, nSrcs, true) != ncclSuccess) return 1;
+      uint64_t start = clockNano();
+      for (int i=0; i<iters; i++) ncclHostReduce(dst, srcs, nSrcs, count, (ncclDataType_t)type, opFull, nSrcs, true);
+      double usec = (clockNano()-start) / 1000.0 / iters;
+      // Integral operations are exact, only the floating point ones are checked
+      char errors[16] = "-";
+      if (isFloat) {
+        if (ncclHostReduce(checkDst, checkSrcs, nSrcs, CHECK_COUNT, (ncclDataType_t)type, opFull, nSrcs, true) != ncclSuccess) return 1;
+        int n = checkReduce(checkDst, checkSrcs, nSrcs, type, op, opFull.scalarArg);
+        snprintf(errors, sizeof(errors), "%d", n);
+        totalErrors += n;
+      }
+      // Bytes read from the sources
+      printf("  %-9s %-11s %12zu %10.1f %10.2f %8s\n", typeNames[type], opNames[op], count, usec, nSrcs*(double)bytes / usec / 1000, errors);
+    }
+  }
+  for (int s=0; s<nSrcs; s++) free(srcs[s]);
+  for (int s=0; s<nSrcs; s++) free(checkSrcs[s]);
+  free(srcs);
+  free(checkSrcs);
+  free(dst);
+  free(checkDst);
+  return totalErrors ? 1 : 0;
+}
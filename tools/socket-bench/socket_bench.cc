@@ -0,0 +1,209 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Loopback throughput of the NET/Socket transport, and the CPU time and cycles
+// its helper threads spend on it. The main thread plays the proxy of both peers : it posts
+// sends and receives through ncclNetSocket and tests them until completion.
+
+#include "net.h"
+#include "param.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BENCHCHECK(cmd) do { \
+  ncclResult_t res = (cmd); \
+  if (res != ncclSuccess) { \
+    fprintf(stderr, "%s:%d '%s' failed : %d\n", __FILE__, __LINE__, #cmd, res); \
+    exit(1); \
+  } \
+} while (0)
+
+static size_t parseSize(const char* str) {
+  char* end;
+  size_t value = strtoull(str, &end, 0);
+  switch (*end) {
+    case 'G': case 'g': value <<= 10; // fall through
+    case 'M': case 'm': value <<= 10; // fall through
+    case 'K': case 'k': value <<= 10;
+  }
+  return value;
+}
+
+static uint64_t cpuNs(int who) {
+  struct rusage ru;
+  getrusage(who, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)*1000000000ULL + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)*1000ULL;
+}
+
+// Hardware cycle counters, user and kernel, of all the threads of the process. Opened once the helper
+// threads exist. Needs perf_event_paranoid <= 1; nFds is -1 when they are not available.
+#define MAX_COUNTERS 64
+struct benchCycles {
+  int nFds;
+  int fds[MAX_COUNTERS];
+};
+
+static void cyclesOpen(struct benchCycles* c) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  c->nFds = 0;
+  DIR* dir = opendir("/proc/self/task");
+  struct dirent* entry;
+  while (dir && (entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') continue;
+    int fd = c->nFds < MAX_COUNTERS ? syscall(__NR_perf_event_open, &attr, atoi(entry->d_name), -1, -1, 0) : -1;
+    if (fd == -1) {
+      for (int i=0; i<c->nFds; i++) close(c->fds[i]);
+      c->nFds = -1;
+      break;
+    }
+    c->fds[c->nFds++] = fd;
+  }
+  if (dir) closedir(dir);
+}
+
+static uint64_t cyclesRead(struct benchCycles* c) {
+  uint64_t total = 0;
+  for (int i=0; i<c->nFds; i++) {
+    uint64_t count;
+    if (read(c->fds[i], &count, sizeof(count)) == sizeof(count)) total += count;
+  }
+  return total;
+}
+
+struct benchComms {
+  void* sendComm;
+  void* recvComm;
+  void* sendMh;
+  void* recvMh;
+};
+
+static void benchConnect(struct benchComms* comms, char* sendBuff, char* recvBuff, int bytes) {
+  char handle[NCCL_NET_HANDLE_MAXSIZE];
+  void* listenComm;
+  BENCHCHECK(ncclNetSocket.listen(0, handle, &listenComm));
+  comms->sendComm = comms->recvComm = NULL;
+  while (comms->sendComm == NULL || comms->recvComm == NULL) {
+    if (comms->sendComm == NULL) BENCHCHECK(ncclNetSocket.connect(0, handle, &comms->sendComm));
+    if (comms->recvComm == NULL) BENCHCHECK(ncclNetSocket.accept(listenComm, &comms->recvComm));
+  }
+  BENCHCHECK(ncclNetSocket.closeListen(listenComm));
+  BENCHCHECK(ncclNetSocket.regMr(comms->sendComm, sendBuff, bytes, NCCL_PTR_HOST, &comms->sendMh));
+  BENCHCHECK(ncclNetSocket.regMr(comms->recvComm, recvBuff, bytes, NCCL_PTR_HOST, &comms->recvMh));
+}
+
+// Keep up to window sends and receives in flight until n messages went through. Like the proxy,
+// requests are posted and completed in order.
+static void benchRun(struct benchComms* comms, char* sendBuff, char* recvBuff, int bytes, int window, int n) {
+  void* sendReqs[NCCL_NET_MAX_REQUESTS];
+  void* recvReqs[NCCL_NET_MAX_REQUESTS];
+  int sendPosted = 0, recvPosted = 0, sendDone = 0, recvDone = 0;
+  while (sendDone < n || recvDone < n) {
+    if (recvPosted < n && recvPosted-recvDone < window) {
+      int w = recvPosted%window, tag = 0;
+      char* recvData = recvBuff+(size_t)w*bytes;
+      BENCHCHECK(ncclNetSocket.irecv(comms->recvComm, 1, (void**)&recvData, &bytes, &tag, &comms->recvMh, recvReqs+w));
+      if (recvReqs[w]) recvPosted++;
+    }
+    if (sendPosted < n && sendPosted-sendDone < window) {
+      int w = sendPosted%window;
+      BENCHCHECK(ncclNetSocket.isend(comms->sendComm, sendBuff+(size_t)w*bytes, bytes, 0, comms->sendMh, sendReqs+w));
+      if (sendReqs[w]) sendPosted++;
+    }
+    int done, size;
+    if (recvDone < recvPosted) {
+      BENCHCHECK(ncclNetSocket.test(recvReqs[recvDone%window], &done, &size));
+      if (done) recvDone++;
+    }
+    if (sendDone < sendPosted) {
+      BENCHCHECK(ncclNetSocket.test(sendReqs[sendDone%window], &done, &size));
+      if (done) sendDone++;
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  size_t minBytes = 64*1024, maxBytes = 16*1024*1024;
+  int factor = 2, iters = 100, warmup = 10, window = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:e:f:i:w:W:u:z:h")) != -1) {
+    switch (opt) {
+      case 'b': minBytes = parseSize(optarg); break;
+      case 'e': maxBytes = parseSize(optarg); break;
+      case 'f': factor = atoi(optarg); break;
+      case 'i': iters = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 'W': window = atoi(optarg); break;
+      case 'u': setenv("NCCL_SOCKET_IO_URING", optarg, 1); break;
+      case 'z': setenv("NCCL_SOCKET_ZEROCOPY", optarg, 1); break;
+      default:
+        fprintf(stderr, "Usage : %s [-b min bytes] [-e max bytes] [-f factor] [-i iters] [-w warmup iters] [-W window] [-u io_uring 0/1] [-z zerocopy 0/1]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (window < 1 || window > NCCL_NET_MAX_REQUESTS || factor < 2 || minBytes < 1 || maxBytes > INT_MAX) {
+    fprintf(stderr, "The window must be between 1 and %d, the factor at least 2, and sizes between 1 and %d bytes\n", NCCL_NET_MAX_REQUESTS, INT_MAX);
+    return 1;
+  }
+  // Helper threads are what we measure : use some unless asked otherwise.
+  setenv("NCCL_SOCKET_IFNAME", "lo", 0);
+  setenv("NCCL_SOCKET_NTHREADS", "2", 0);
+  setenv("NCCL_NSOCKS_PERTHREAD", "2", 0);
+
+  char* sendBuff = (char*)malloc(maxBytes*window);
+  char* recvBuff = (char*)malloc(maxBytes*window);
+  if (sendBuff == NULL || recvBuff == NULL) {
+    fprintf(stderr, "Could not allocate 2 x %zu bytes\n", maxBytes*window);
+    return 1;
+  }
+  memset(sendBuff, 1, maxBytes*window);
+  memset(recvBuff, 0, maxBytes*window);
+  BENCHCHECK(ncclNetSocket.init(ncclDebugLog));
+  struct benchComms comms;
+  benchConnect(&comms, sendBuff, recvBuff, maxBytes*window);
+
+  printf("# NCCL_SOCKET_IO_URING=%s NCCL_SOCKET_ZEROCOPY=%s NCCL_SOCKET_NTHREADS=%s NCCL_NSOCKS_PERTHREAD=%s, window %d\n",
+      getenv("NCCL_SOCKET_IO_URING") ? getenv("NCCL_SOCKET_IO_URING") : "0",
+      getenv("NCCL_SOCKET_ZEROCOPY") ? getenv("NCCL_SOCKET_ZEROCOPY") : "0", getenv("NCCL_SOCKET_NTHREADS"),
+      getenv("NCCL_NSOCKS_PERTHREAD"), window);
+  printf("# %12s %10s %10s %12s %12s %10s %10s\n", "bytes", "time(us)", "GB/s", "helper CPU", "main CPU", "CPU ns/B", "cycles/B");
+  struct benchCycles cycles = { -1 };
+  for (size_t bytes=minBytes; bytes<=maxBytes; bytes*=factor) {
+    benchRun(&comms, sendBuff, recvBuff, bytes, window, warmup);
+    if (bytes == minBytes) cyclesOpen(&cycles);
+    uint64_t cpu0 = cpuNs(RUSAGE_SELF), main0 = cpuNs(RUSAGE_THREAD), cycles0 = cyclesRead(&cycles), t0 = clockNano();
+    benchRun(&comms, sendBuff, recvBuff, bytes, window, iters);
+    uint64_t t1 = clockNano(), cpu1 = cpuNs(RUSAGE_SELF), main1 = cpuNs(RUSAGE_THREAD), cycles1 = cyclesRead(&cycles);
+    double us = (t1-t0)/1e3/iters;
+    // CPU time in cores : 1.0 is one core busy for the whole run
+    double helperCpu = (double)((cpu1-cpu0)-(main1-main0))/(t1-t0);
+    double mainCpu = (double)(main1-main0)/(t1-t0);
+    // Per byte moved, for all threads : both ends of the transfer are counted
+    double nsPerByte = (double)(cpu1-cpu0)/((double)bytes*iters);
+    printf("  %12zu %10.2f %10.3f %12.2f %12.2f %10.3f", bytes, us, bytes/us/1e3, helperCpu, mainCpu, nsPerByte);
+    if (cycles.nFds > 0) printf(" %10.3f\n", (double)(cycles1-cycles0)/((double)bytes*iters));
+    else printf(" %10s\n", "-");
+  }
+  for (int i=0; i<cycles.nFds; i++) close(cycles.fds[i]);
+
+  BENCHCHECK(ncclNetSocket.deregMr(comms.sendComm, comms.sendMh));
+  BENCHCHECK(ncclNetSocket.deregMr(comms.recvComm, comms.recvMh));
+  BENCHCHECK(ncclNetSocket.closeSend(comms.sendComm));
+  BENCHCHECK(ncclNetSocket.closeRecv(comms.recvComm));
+  free(sendBuff);
+  free(recvBuff);
+  return 0;
+}
@@ -0,0 +1,203 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Cost of staging operations into a group, per operation, as ncclSend(),
+// ncclRecv() and collectives do before ncclGroupEnd(), and of the p2p
+// scheduler finding the peers with tasks. The communicators are made up on
+// the host : no GPU is needed.
+
+#include "tasks.h"
+#include "comm.h"
+#include "group.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+// Thread local group state, normally defined in group.cc
+__thread int ncclGroupDepth = 0;
+__thread ncclResult_t ncclGroupError = ncclSuccess;
+__thread struct ncclComm* ncclGroupCommHead = nullptr;
+__thread struct ncclComm* ncclGroupCommPreconnectHead = nullptr;
+__thread int ncclGroupBlocking = -1;
+
+// A communicator with nRanks ranks over nNodes nodes, all connected.
+static struct ncclComm* commCreate(int nRanks, int nNodes, int nChannels) {
+  struct ncclComm* comm = (struct ncclComm*)calloc(1, sizeof(struct ncclComm));
+  comm->rank = 0;
+  comm->nRanks = nRanks;
+  comm->nNodes = nNodes;
+  comm->node = 0;
+  comm->maxLocalRanks = nRanks/nNodes;
+  comm->rankToNode = (int*)calloc(nRanks, sizeof(int));
+  comm->rankToLocalRank = (int*)calloc(nRanks, sizeof(int));
+  for (int r=0; r<nRanks; r++) {
+    comm->rankToNode[r] = r / comm->maxLocalRanks;
+    comm->rankToLocalRank[r] = r % comm->maxLocalRanks;
+  }
+  comm->p2pnChannels = nChannels;
+  comm->p2pnChannelsPerPeer = 2;
+  for (int c=0; c<nChannels; c++) {
+    comm->p2pChannels[c] = c;
+    comm->channels[c].peers = (struct ncclChannelPeer*)calloc(nRanks, sizeof(struct ncclChannelPeer));
+    for (int r=0; r<nRanks; r++) comm->channels[c].peers[r].send[1].connected = comm->channels[c].peers[r].recv[1].connected = 1;
+  }
+  comm->connectSend = (uint64_t*)calloc(nRanks, sizeof(uint64_t));
+  comm->connectRecv = (uint64_t*)calloc(nRanks, sizeof(uint64_t));
+  struct ncclTasks* tasks = &comm->tasks;
+  tasks->peers = (struct ncclTasks::Peer*)calloc(nRanks, sizeof(struct ncclTasks::Peer));
+  tasks->p2pSendOrder = (int*)calloc(nRanks, sizeof(int));
+  tasks->p2pRecvOrder = (int*)calloc(nRanks, sizeof(int));
+  tasks->p2pSendStep = (int*)calloc(nRanks, sizeof(int));
+  tasks->p2pRecvStep = (int*)calloc(nRanks, sizeof(int));
+  for (int i=0; i<nRanks; i++) {
+    tasks->p2pSendOrder[i] = tasks->p2pSendStep[i] = i;
+    tasks->p2pRecvOrder[i] = tasks->p2pRecvStep[i] = (nRanks-i)%nRanks;
+  }
+  tasks->p2pActiveSteps = (uint64_t*)calloc(DIVUP(nRanks, 64), sizeof(uint64_t));
+  ncclMemoryStackConstruct(&comm->memScoped);
+  comm->groupNext = reinterpret_cast<struct ncclComm*>(0x1);
+  comm->preconnectNext = reinterpret_cast<struct ncclComm*>(0x1);
+  comm->intraComm0 = comm;
+  return comm;
+}
+
+static void commFree(struct ncclComm* comm) {
+  struct ncclTasks* tasks = &comm->tasks;
+  for (int c=0; c<comm->p2pnChannels; c++) free(comm->channels[c].peers);
+  free(tasks->peers);
+  free(tasks->p2pSendOrder);
+  free(tasks->p2pRecvOrder);
+  free(tasks->p2pSendStep);
+  free(tasks->p2pRecvStep);
+  free(tasks->p2pActiveSteps);
+  free(comm->connectSend);
+  free(comm->connectRecv);
+  free(comm->rankToNode);
+  free(comm->rankToLocalRank);
+  ncclMemoryStackDestruct(&comm->memScoped);
+  free(comm);
+}
+
+// What the end of a group does to the tasks once they are scheduled
+static void groupReset(struct ncclComm* comm) {
+  struct ncclTasks* tasks = &comm->tasks;
+  for (int r=0; r<comm->nRanks; r++) {
+    tasks->peers[r].sendSeen = tasks->peers[r].recvSeen = false;
+    tasks->peers[r].sendQueue = {};
+    tasks->peers[r].recvQueue = {};
+  }
+  memset(tasks->p2pActiveSteps, 0, DIVUP(comm->nRanks, 64)*sizeof(uint64_t));
+  tasks->collQueue = {};
+  tasks->nTasksP2p = tasks->nTasksColl = 0;
+  tasks->collBytesTotal = 0;
+  ncclGroupCommHead = nullptr;
+  ncclGroupCommLeave(comm);
+}
+
+int main(int argc, char* argv[]) {
+  int nRanks = 64, nNodes = 8, nChannels = 32, iters = 20;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:c:i:h")) != -1) {
+    switch (opt) {
+      case 'r': nRanks = atoi(optarg); break;
+      case 'n': nNodes = atoi(optarg); break;
+      case 'c': nChannels = atoi(optarg); break;
+      case 'i': iters = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage : %s [-r ranks] [-n nodes] [-c p2p channels] [-i iterations]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (nRanks < 1 || nNodes < 1 || nRanks % nNodes || nChannels < 1 || nChannels > MAXCHANNELS || iters < 1) {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+  struct ncclComm* comm = commCreate(nRanks, nNodes, nChannels);
+  struct ncclInfo info = {};
+  info.coll = ncclFuncAllReduce;
+  info.count = 1024;
+  info.datatype = ncclFloat32;
+  info.chunkSteps = info.sliceSteps = 1;
+  struct ncclDevRedOpFull opFull = {};
+
+  printf("# %d ranks on %d nodes, %d p2p channels, %d iterations\n", nRanks, nNodes, nChannels, iters);
+  printf("# %8s %16s %16s\n", "ops", "sendrecv(ns/op)", "allreduce(ns/op)");
+  for (int nOps=1; nOps<=10000; nOps*=10) {
+    double ns[2];
+    for (int kind=0; kind<2; kind++) {
+      uint64_t total = 0;
+      for (int i=-1; i<iters; i++) { // The first group is a warm up
+        uint64_t start = clockNano();
+        for (int o=0; o<nOps; o++) {
+          if (kind == 0) {
+            // All-to-all pattern : alternate sends and receives over all peers
+            int peer = (o/2) % nRanks;
+            if (ncclTaskP2pAppend(comm, o&1 ? ncclFuncRecv : ncclFuncSend, peer, NULL, 4096) != ncclSuccess) return 1;
+          } else {
+            if (ncclTaskCollAppend(comm, &info, opFull) != ncclSuccess) return 1;
+          }
+        }
+        if (i >= 0) total += clockNano()-start;
+        groupReset(comm);
+      }
+      ns[kind] = (double)total/iters/nOps;
+    }
+    printf("  %8d %16.1f %16.1f\n", nOps, ns[0], ns[1]);
+  }
+  commFree(comm);
+
+  // Pass of the p2p scheduler over the steps of its schedule, with a fraction
+  // of the peers sent to : over all steps as it used to, or over the flagged
+  // steps only. The scheduling of the tasks found is the same in both cases.
+  printf("\n# p2p schedule pass, %d iterations\n", iters);
+  printf("# %8s %8s %14s %14s\n", "ranks", "peers", "all(ns)", "flagged(ns)");
+  for (int nRanksPass=64; nRanksPass<=16384; nRanksPass*=4) {
+    int peerCounts[] = { 1, nRanksPass/64, nRanksPass/8, nRanksPass };
+    for (int p=0; p<4; p++) {
+      int nPeers = peerCounts[p];
+      if (nPeers < 1 || (p > 0 && nPeers == peerCounts[p-1])) continue;
+      struct ncclComm* pass = commCreate(nRanksPass, 1, nChannels);
+      struct ncclTasks* tasks = &pass->tasks;
+      ncclGroupCommJoin(pass);
+      // Spread the peers over the schedule
+      for (int k=0; k<nPeers; k++) {
+        int peer = (int)((int64_t)k*nRanksPass/nPeers);
+        if (ncclTaskP2pAppend(pass, ncclFuncSend, peer, NULL, 4096) != ncclSuccess) return 1;
+      }
+      double ns[2];
+      int found[2];
+      for (int kind=0; kind<2; kind++) {
+        uint64_t start = clockNano();
+        for (int i=0; i<iters; i++) {
+          found[kind] = 0;
+          if (kind == 0) {
+            for (int s=0; s<nRanksPass; s++) {
+              if (ncclIntruQueueHead(&tasks->peers[tasks->p2pSendOrder[s]].sendQueue) ||
+                  ncclIntruQueueHead(&tasks->peers[tasks->p2pRecvOrder[s]].recvQueue)) found[kind]++;
+            }
+          } else {
+            for (int w=0; w*64 < nRanksPass; w++) {
+              for (uint64_t bits = tasks->p2pActiveSteps[w]; bits != 0; bits &= bits-1) {
+                int s = w*64 + __builtin_ctzll(bits);
+                if (ncclIntruQueueHead(&tasks->peers[tasks->p2pSendOrder[s]].sendQueue) ||
+                    ncclIntruQueueHead(&tasks->peers[tasks->p2pRecvOrder[s]].recvQueue)) found[kind]++;
+              }
+            }
+          }
+        }
+        ns[kind] = (double)(clockNano()-start)/iters;
+      }
+      if (found[0] != found[1]) {
+        fprintf(stderr, "Steps found differ : %d vs %d\n", found[0], found[1]);
+        return 1;
+      }
+      printf("  %8d %8d %14.1f %14.1f\n", nRanksPass, nPeers, ns[0], ns[1]);
+      groupReset(pass);
+      commFree(pass);
+    }
+  }
+  return 0;
+}
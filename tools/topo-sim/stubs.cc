@@ -0,0 +1,34 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Symbols referenced by src/graph which live in the parts of the library the
+// simulator does not build (NVML, transports, channels). Topology detection
+// is never run by the simulator so most of these are never called.
+
+#include "core.h"
+#include "nvmlwrap.h"
+#include "transport.h"
+#include "channel.h"
+
+const char* ncclFuncStr[NCCL_NUM_FUNCTIONS] = { "Broadcast", "Reduce", "AllGather", "ReduceScatter", "AllReduce" };
+const char* ncclAlgoStr[NCCL_NUM_ALGORITHMS] = { "Tree", "Ring", "CollNetDirect", "CollNetChain" };
+const char* ncclProtoStr[NCCL_NUM_PROTOCOLS] = { "LL", "LL128", "Simple" };
+
+struct ncclTransport* ncclTransports[NTRANSPORTS] = {};
+// Zero-initialized, i.e. NVML_P2P_STATUS_OK between all GPUs.
+ncclNvmlDevicePairInfo ncclNvmlDevicePairs[ncclNvmlMaxDevices][ncclNvmlMaxDevices];
+
+ncclResult_t ncclNvmlEnsureInitialized() { return ncclSuccess; }
+ncclResult_t ncclNvmlDeviceGetHandleByPciBusId(const char* pciBusId, nvmlDevice_t* device) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetIndex(nvmlDevice_t device, unsigned* index) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetCudaComputeCapability(nvmlDevice_t device, int* major, int* minor) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetNvLinkState(nvmlDevice_t device, unsigned int link, nvmlEnableState_t* isActive) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetNvLinkRemotePciInfo(nvmlDevice_t device, unsigned int link, nvmlPciInfo_t* pci) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetNvLinkCapability(nvmlDevice_t device, unsigned int link, nvmlNvLinkCapability_t capability, unsigned int* capResult) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetFieldValues(nvmlDevice_t device, int valuesCount, nvmlFieldValue_t* values) { return ncclSystemError; }
+
+int ncclNetVersion(struct ncclComm* comm) { return 6; }
+ncclResult_t initChannel(struct ncclComm* comm, int channelid) { return ncclInternalError; }
@@ -0,0 +1,368 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Offline topology search and tuning simulator.
+//
+// Loads a topology XML (e.g. produced with NCCL_TOPO_DUMP_FILE), replicates
+// it over N identical nodes and runs the same graph search, channel setup and
+// tuning model as ncclCommInitRank, without any GPU or network. Results are
+// printed on stdout so that they can be diffed across NCCL versions.
+
+#include "comm.h"
+#include "graph.h"
+#include "info.h"
+#include "graph/topo.h"
+#include "graph/xml.h"
+#include <getopt.h>
+#include <time.h>
+
+#define SIMCHECK(call) do { \
+  ncclResult_t res = call; \
+  if (res != ncclSuccess) { \
+    fprintf(stderr, "%s:%d -> %d\n", __FILE__, __LINE__, res); \
+    return 1; \
+  } \
+} while (0)
+
+static const char* patternStr[] = { "", "BALANCED_TREE", "SPLIT_TREE", "TREE", "RING" };
+
+static double timeMs(struct timespec* start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec-start->tv_sec)*1e3 + (end.tv_nsec-start->tv_nsec)*1e-6;
+}
+
+static size_t parseSize(const char* str) {
+  char* end;
+  double size = strtod(str, &end);
+  switch (*end) {
+    case 'G': case 'g': size *= 1024;
+    case 'M': case 'm': size *= 1024;
+    case 'K': case 'k': size *= 1024;
+  }
+  return (size_t)size;
+}
+
+// Hand-written topology files usually do not carry ranks. Give each GPU a
+// rank in document order so that they are all part of the simulated node.
+static ncclResult_t simAssignRanks(struct ncclXml* xml) {
+  int nGpus = 0, nRanked = 0;
+  for (int i=0; i<xml->maxIndex; i++) {
+    struct ncclXmlNode* node = xml->nodes[i];
+    if (strcmp(node->name, "gpu") != 0) continue;
+    int index;
+    NCCLCHECK(xmlGetAttrIndex(node, "rank", &index));
+    nGpus++;
+    if (index != -1) nRanked++;
+  }
+  if (nRanked) return ncclSuccess;
+  int rank = 0;
+  for (int i=0; i<xml->maxIndex; i++) {
+    struct ncclXmlNode* node = xml->nodes[i];
+    if (strcmp(node->name, "gpu") == 0) NCCLCHECK(xmlSetAttrInt(node, "rank", rank++));
+  }
+  return ncclSuccess;
+}
+
+// Renumber the ranks of the local GPUs 0..ngpus-1, keeping their order, so
+// that node n owns global ranks [n*ngpus, (n+1)*ngpus).
+static void simCompactRanks(struct ncclTopoSystem* system) {
+  int ngpus = system->nodes[GPU].count;
+  int ranks[NCCL_TOPO_MAX_NODES];
+  for (int g=0; g<ngpus; g++) ranks[g] = system->nodes[GPU].nodes[g].gpu.rank;
+  for (int g=0; g<ngpus; g++) {
+    int rank = 0;
+    for (int p=0; p<ngpus; p++) if (ranks[p] < ranks[g]) rank++;
+    system->nodes[GPU].nodes[g].gpu.rank = rank;
+  }
+}
+
+static void simPrintGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, const char* name, double ms) {
+  int ngpus = system->nodes[GPU].count;
+  printf("%s : pattern %s, crossNic %d, nChannels %d, bw %.1f/%.1f GB/s, type %s/%s, sameChannels %d, search %.3f ms\n",
+      name, patternStr[graph->pattern], graph->crossNic, graph->nChannels, graph->bwIntra, graph->bwInter,
+      topoPathTypeStr[graph->typeIntra], topoPathTypeStr[graph->typeInter], graph->sameChannels, ms);
+  for (int c=0; c<graph->nChannels; c++) {
+    printf("  %02d :", c);
+    if (system->nodes[NET].count) printf(" NET/%d", graph->inter[2*c]);
+    for (int i=0; i<ngpus; i++) printf(" GPU/%d", graph->intra[c*ngpus+i]);
+    if (system->nodes[NET].count) printf(" NET/%d", graph->inter[2*c+1]);
+    printf("\n");
+  }
+}
+
+static ncclResult_t simComputeGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, const char* name) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  NCCLCHECK(ncclTopoCompute(system, graph));
+  simPrintGraph(system, graph, name, timeMs(&start));
+  return ncclSuccess;
+}
+
+// Graphs are expressed with local ranks; shift them to the ranks of node n.
+static void simShiftGraph(struct ncclTopoGraph* dst, struct ncclTopoGraph* src, int ngpus, int n) {
+  memcpy(dst, src, sizeof(struct ncclTopoGraph));
+  for (int i=0; i<src->nChannels*ngpus; i++) dst->intra[i] += n*ngpus;
+}
+
+static ncclResult_t simSelect(struct ncclComm* comm, int coll, size_t bytes, struct ncclInfo* info) {
+  memset(info, 0, sizeof(struct ncclInfo));
+  info->comm = comm;
+  info->coll = (ncclFunc_t)coll;
+  info->nBytes = bytes;
+  return ncclTopoGetAlgoInfo(info, comm->collNetSupport, 1);
+}
+
+// Host cost per operation of the algorithm selection done at enqueue time,
+// with the precomputed table and with the full search.
+static ncclResult_t simBenchSelection(struct ncclComm* comm, size_t minBytes, size_t maxBytes, int factor, int iters) {
+  struct ncclAlgoDecision (*table)[2][NCCL_ALGO_TABLE_BUCKETS];
+  NCCLCHECK(ncclCalloc(&table, NCCL_NUM_FUNCTIONS));
+  memcpy(table, comm->algoTable, sizeof(comm->algoTable));
+
+  // The table must not change any decision
+  int nOps = 0, mismatches = 0;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    for (size_t bytes=minBytes; bytes<=maxBytes; bytes*=factor) {
+      struct ncclInfo fast, full;
+      NCCLCHECK(simSelect(comm, c, bytes, &fast));
+      memset(comm->algoTable, 0, sizeof(comm->algoTable));
+      NCCLCHECK(simSelect(comm, c, bytes, &full));
+      memcpy(comm->algoTable, table, sizeof(comm->algoTable));
+      if (fast.algorithm != full.algorithm || fast.protocol != full.protocol ||
+          fast.nChannels != full.nChannels || fast.nThreads != full.nThreads) mismatches++;
+      nOps++;
+    }
+  }
+
+  double ns[2];
+  for (int pass=0; pass<2; pass++) {
+    if (pass == 1) memset(comm->algoTable, 0, sizeof(comm->algoTable));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i=0; i<iters; i++) {
+      for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+        for (size_t bytes=minBytes; bytes<=maxBytes; bytes*=factor) {
+          struct ncclInfo info;
+          NCCLCHECK(simSelect(comm, c, bytes, &info));
+        }
+      }
+    }
+    ns[pass] = timeMs(&start)*1e6/((double)iters*nOps);
+  }
+  memcpy(comm->algoTable, table, sizeof(comm->algoTable));
+  free(table);
+  printf("Selection cost : %.1f ns/op with table, %.1f ns/op with full search, %d/%d sizes differ\n",
+      ns[0], ns[1], mismatches, nOps);
+  return ncclSuccess;
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr, "Usage: %s [options] <topo.xml>\n"
+      "  -n <nodes>   number of identical nodes to simulate (default 1)\n"
+      "  -r <rank>    rank whose channels are printed (default 0)\n"
+      "  -b <bytes>   minimum message size (default 8)\n"
+      "  -e <bytes>   maximum message size (default 1G)\n"
+      "  -f <factor>  message size multiplication factor (default 2)\n"
+      "  -c           enable CollNet\n"
+      "  -o <file>    dump the computed graphs, in NCCL_GRAPH_FILE format\n"
+      "  -t <iters>   benchmark the algorithm selection cost over <iters> iterations\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+  int nNodes = 1, viewRank = 0, collNet = 0, factor = 2, benchIters = 0;
+  size_t minBytes = 8, maxBytes = 1UL<<30;
+  const char* graphDumpFile = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:b:e:f:co:t:h")) != -1) {
+    switch (opt) {
+      case 'n': nNodes = atoi(optarg); break;
+      case 'r': viewRank = atoi(optarg); break;
+      case 'b': minBytes = parseSize(optarg); break;
+      case 'e': maxBytes = parseSize(optarg); break;
+      case 'f': factor = atoi(optarg); break;
+      case 'c': collNet = 1; break;
+      case 'o': graphDumpFile = optarg; break;
+      case 't': benchIters = atoi(optarg); break;
+      default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc-1 || nNodes < 1 || factor < 2 || minBytes == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct ncclXml* xml;
+  struct ncclTopoSystem* system;
+  struct ncclComm* comm;
+  SIMCHECK(ncclCalloc(&xml, 1));
+  SIMCHECK(ncclTopoGetXmlFromFile(argv[optind], xml, 1));
+  SIMCHECK(simAssignRanks(xml));
+  SIMCHECK(ncclTopoGetSystemFromXml(xml, &system));
+  SIMCHECK(xmlFree(xml));
+  if (system->nodes[GPU].count == 0) {
+    fprintf(stderr, "No GPU found in %s\n", argv[optind]);
+    return 1;
+  }
+
+  // The transport layer is not available, so P2P/SHM connectivity is not
+  // checked : all GPUs of a node are assumed to be able to talk to each other.
+  SIMCHECK(ncclCalloc(&comm, 1));
+  comm->topo = system;
+  comm->rank = system->nodes[GPU].nodes[0].gpu.rank;
+  for (int g=1; g<system->nodes[GPU].count; g++) comm->rank = std::min(comm->rank, system->nodes[GPU].nodes[g].gpu.rank);
+  SIMCHECK(ncclTopoComputePaths(system, NULL));
+  // First trim unreachable GPUs, then drop NICs if we are alone.
+  comm->nRanks = 0;
+  SIMCHECK(ncclTopoTrimSystem(system, comm));
+  comm->nRanks = nNodes*system->nodes[GPU].count;
+  SIMCHECK(ncclTopoTrimSystem(system, comm));
+  simCompactRanks(system);
+  SIMCHECK(ncclTopoComputePaths(system, NULL));
+  SIMCHECK(ncclTopoSearchInit(system));
+
+  int ngpus = system->nodes[GPU].count;
+  int nRanks = comm->nRanks;
+  if (viewRank < 0 || viewRank >= nRanks) {
+    fprintf(stderr, "Rank %d out of range (%d ranks)\n", viewRank, nRanks);
+    return 1;
+  }
+  if (nNodes > 1 && system->nodes[NET].count == 0) {
+    fprintf(stderr, "No NIC found in %s, cannot simulate %d nodes\n", argv[optind], nNodes);
+    return 1;
+  }
+  printf("Topology %s : %d nodes x %d GPUs, %d NICs per node\n", argv[optind], nNodes, ngpus, system->nodes[NET].count);
+
+  struct ncclTopoGraph ringGraph, treeGraph, collNetGraph;
+  memset(&ringGraph, 0, sizeof(ringGraph));
+  memset(&treeGraph, 0, sizeof(treeGraph));
+  memset(&collNetGraph, 0, sizeof(collNetGraph));
+  ringGraph.id = 0;
+  ringGraph.pattern = NCCL_TOPO_PATTERN_RING;
+  ringGraph.minChannels = 1;
+  ringGraph.maxChannels = MAXCHANNELS/2;
+  SIMCHECK(simComputeGraph(system, &ringGraph, "Ring"));
+  treeGraph.id = 1;
+  treeGraph.pattern = NCCL_TOPO_PATTERN_BALANCED_TREE;
+  treeGraph.minChannels = 1;
+  treeGraph.maxChannels = ringGraph.nChannels;
+  SIMCHECK(simComputeGraph(system, &treeGraph, "Tree"));
+  collNetGraph.id = 2;
+  collNetGraph.pattern = NCCL_TOPO_PATTERN_TREE;
+  collNetGraph.collNet = 1;
+  collNetGraph.minChannels = collNetGraph.maxChannels = ringGraph.nChannels;
+  SIMCHECK(simComputeGraph(system, &collNetGraph, "CollNet"));
+  if (graphDumpFile) {
+    struct ncclTopoGraph* graphs[3] = { &ringGraph, &treeGraph, &collNetGraph };
+    setenv("NCCL_GRAPH_DUMP_FILE", graphDumpFile, 1);
+    SIMCHECK(ncclTopoDumpGraphs(system, 3, graphs));
+  }
+
+  // Replay the AllGather3 exchange of ncclCommInitRank : every rank of every
+  // node presets its channels, then the view rank connects them.
+  comm->collNetSupport = (collNet && collNetGraph.nChannels > 0 && nNodes > 1 && ngpus <= NCCL_MAX_DIRECT_ARITY+1) ? 1 : 0;
+  comm->nNodes = nNodes;
+  comm->localRanks = ngpus;
+  struct ncclTopoRanks* topoRanks;
+  struct ncclTopoRanks** allTopoRanks;
+  struct ncclTopoGraph* nodeGraphs;
+  int *firstRanks, *treePatterns, *rings;
+  SIMCHECK(ncclCalloc(&topoRanks, nRanks));
+  SIMCHECK(ncclCalloc(&allTopoRanks, nRanks));
+  SIMCHECK(ncclCalloc(&nodeGraphs, 3));
+  SIMCHECK(ncclCalloc(&firstRanks, nNodes));
+  SIMCHECK(ncclCalloc(&treePatterns, nNodes));
+  SIMCHECK(ncclCalloc(&rings, nRanks*MAXCHANNELS));
+  comm->nChannels = std::min(treeGraph.nChannels, ringGraph.nChannels);
+  treeGraph.nChannels = ringGraph.nChannels = comm->nChannels;
+  for (int n=0; n<nNodes; n++) {
+    simShiftGraph(nodeGraphs+0, &ringGraph, ngpus, n);
+    simShiftGraph(nodeGraphs+1, &treeGraph, ngpus, n);
+    simShiftGraph(nodeGraphs+2, &collNetGraph, ngpus, n);
+    for (int r=n*ngpus; r<(n+1)*ngpus; r++) {
+      comm->rank = r;
+      SIMCHECK(ncclTopoPreset(comm, nodeGraphs+1, nodeGraphs+0, nodeGraphs+2, topoRanks+r));
+      allTopoRanks[r] = topoRanks+r;
+    }
+    firstRanks[n] = topoRanks[n*ngpus].ringRecv[0];
+    treePatterns[n] = treeGraph.pattern;
+  }
+  comm->rank = viewRank;
+  comm->node = viewRank/ngpus;
+  simShiftGraph(nodeGraphs+0, &ringGraph, ngpus, comm->node);
+  simShiftGraph(nodeGraphs+1, &treeGraph, ngpus, comm->node);
+  simShiftGraph(nodeGraphs+2, &collNetGraph, ngpus, comm->node);
+  SIMCHECK(ncclTopoPreset(comm, nodeGraphs+1, nodeGraphs+0, nodeGraphs+2, topoRanks+viewRank));
+  SIMCHECK(ncclTopoPostset(comm, firstRanks, treePatterns, allTopoRanks, rings, nodeGraphs+2));
+
+  printf("Channels : %d (rank %d)\n", comm->nChannels, viewRank);
+  for (int c=0; c<comm->nChannels; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    struct ncclTree* tree = &channel->tree;
+    printf("  %02d : ring %d -> %d -> %d, tree %d -> %d -> %d/%d/%d, ring order", c,
+        channel->ring.prev, viewRank, channel->ring.next, tree->up, viewRank, tree->down[0], tree->down[1], tree->down[2]);
+    for (int i=0; i<nRanks; i++) printf(" %d", rings[c*nRanks+i]);
+    printf("\n");
+  }
+
+  int minCompCap = INT_MAX, maxCompCap = 0;
+  for (int g=0; g<ngpus; g++) {
+    minCompCap = std::min(system->nodes[GPU].nodes[g].gpu.cudaCompCap, minCompCap);
+    maxCompCap = std::max(system->nodes[GPU].nodes[g].gpu.cudaCompCap, maxCompCap);
+  }
+  comm->rank = 0;
+  SIMCHECK(ncclTopoTuneModel(comm, minCompCap, maxCompCap, &treeGraph, &ringGraph, &collNetGraph));
+  SIMCHECK(ncclTopoInitAlgoTable(comm));
+
+  printf("%13s |", "Latency/AlgBw");
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) printf(" %13s/%6s |", ncclAlgoStr[a], ncclProtoStr[p]);
+  printf("\n");
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    printf("%13s |", ncclFuncStr[c]);
+    for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      printf(" %13.1f/%6.1f |", comm->latencies[c][a][p], comm->bandwidths[c][a][p]);
+    }
+    printf("\n");
+  }
+
+  // Same selection as enqueue for a single operation. Sizes are the total
+  // buffer size, as reported by nccl-tests.
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    printf("%s\n%14s %14s %8s %6s %8s %12s %12s\n", ncclFuncStr[c], "size(B)", "algo", "proto", "nch", "nthr", "time(us)", "algbw(GB/s)");
+    for (size_t bytes=minBytes; bytes<=maxBytes; bytes*=factor) {
+      struct ncclInfo info;
+      memset(&info, 0, sizeof(info));
+      info.comm = comm;
+      info.coll = (ncclFunc_t)c;
+      info.nBytes = bytes;
+      if (ncclTopoGetAlgoInfo(&info, comm->collNetSupport, 1) != ncclSuccess) {
+        printf("%14lu %14s %8s %6s %8s %12s %12s\n", bytes, "-", "-", "-", "-", "-", "-");
+        continue;
+      }
+      float time = 0;
+      if (nRanks > 1) {
+        struct ncclInfo timeInfo = info;
+        timeInfo.nChannels = 0;
+        SIMCHECK(ncclTopoGetAlgoTime(&timeInfo, info.algorithm, info.protocol, 1, &time));
+      }
+      printf("%14lu %14s %8s %6d %8d %12.2f %12.2f\n", bytes, ncclAlgoStr[info.algorithm], ncclProtoStr[info.protocol],
+          info.nChannels, info.nThreads, time, time > 0 ? bytes/(time*1e3) : 0);
+    }
+  }
+
+  if (benchIters) SIMCHECK(simBenchSelection(comm, minBytes, maxBytes, factor, benchIters));
+
+  free(rings);
+  free(treePatterns);
+  free(firstRanks);
+  free(nodeGraphs);
+  free(allTopoRanks);
+  free(topoRanks);
+  if (comm->tuningProfile) ncclTopoTuningProfileFree(comm->tuningProfile);
+  free(comm);
+  ncclTopoFree(system);
+  return 0;
+}
@@ -0,0 +1,171 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Fits NCCL_TUNING_FILE profiles from measured collective timings.
+//
+// Input : one measurement per line, '#' starts a comment.
+//   <coll> <algo> <proto> <nNodes> <bytes> <time (us)>
+// e.g. nccl-tests results run with NCCL_ALGO and NCCL_PROTO forced.
+//
+// For each (coll, algo, proto, nNodes), sizes are split in buckets of a few
+// consecutive measurements and each bucket is fitted with the same model as
+// ncclTopoGetAlgoTime : time = lat + bytes / (1000 * bw).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct sample {
+  std::string key; // coll algo proto
+  int nNodes;
+  size_t bytes;
+  double time;
+};
+
+static bool sampleLess(const struct sample& a, const struct sample& b) {
+  if (a.key != b.key) return a.key < b.key;
+  if (a.nNodes != b.nNodes) return a.nNodes < b.nNodes;
+  return a.bytes < b.bytes;
+}
+
+static int readSamples(FILE* file, const char* name, std::vector<struct sample>* samples) {
+  char line[1024];
+  int lineNum = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNum++;
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    char coll[32], algo[32], proto[32];
+    struct sample s;
+    int n = sscanf(line, "%31s %31s %31s %d %zu %lf", coll, algo, proto, &s.nNodes, &s.bytes, &s.time);
+    if (n <= 0) continue;
+    if (n != 6 || s.nNodes < 1 || s.time < 0) {
+      fprintf(stderr, "%s:%d : invalid measurement\n", name, lineNum);
+      return 1;
+    }
+    s.key = std::string(coll) + " " + algo + " " + proto;
+    samples->push_back(s);
+  }
+  return 0;
+}
+
+// Least squares fit of time = lat + slope*bytes, with lat >= 0 and slope >= 0.
+static void fitBucket(const struct sample* s, int n, double* lat, double* slope, double* err) {
+  double sb = 0, st = 0, sbb = 0, sbt = 0;
+  for (int i=0; i<n; i++) {
+    sb += s[i].bytes; st += s[i].time;
+    sbb += (double)s[i].bytes*s[i].bytes; sbt += s[i].bytes*s[i].time;
+  }
+  double det = n*sbb - sb*sb;
+  *slope = det > 0 ? (n*sbt - sb*st) / det : 0;
+  *lat = (st - *slope*sb) / n;
+  if (*slope < 0) {
+    // Latency bound
+    *slope = 0; *lat = st / n;
+  } else if (*lat < 0) {
+    // Bandwidth bound
+    *lat = 0; *slope = sbb > 0 ? sbt / sbb : 0;
+  }
+  *err = 0;
+  for (int i=0; i<n; i++) {
+    double model = *lat + *slope*s[i].bytes;
+    double e = s[i].time > 0 ? (model - s[i].time) / s[i].time : 0;
+    *err = std::max(*err, e < 0 ? -e : e);
+  }
+}
+
+static void printMax(FILE* out, size_t value) {
+  if (value == (size_t)-1) fprintf(out, " %12s", "*");
+  else fprintf(out, " %12zu", value);
+}
+
+int main(int argc, char* argv[]) {
+  int bucketSize = 4;
+  const char* outName = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:o:h")) != -1) {
+    switch (opt) {
+      case 'p': bucketSize = atoi(optarg); break;
+      case 'o': outName = optarg; break;
+      default:
+        fprintf(stderr, "Usage : %s [-p points per bucket] [-o profile] [measurements ...]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (bucketSize < 2) {
+    fprintf(stderr, "At least 2 points per bucket are needed\n");
+    return 1;
+  }
+
+  std::vector<struct sample> samples;
+  if (optind == argc) {
+    if (readSamples(stdin, "stdin", &samples)) return 1;
+  }
+  for (int i=optind; i<argc; i++) {
+    FILE* file = fopen(argv[i], "r");
+    if (file == NULL) {
+      fprintf(stderr, "Could not open %s\n", argv[i]);
+      return 1;
+    }
+    int ret = readSamples(file, argv[i], &samples);
+    fclose(file);
+    if (ret) return 1;
+  }
+  std::sort(samples.begin(), samples.end(), sampleLess);
+
+  // Average repeated measurements of the same size
+  std::vector<struct sample> points;
+  std::vector<int> counts;
+  for (size_t i=0; i<samples.size(); i++) {
+    struct sample& s = samples[i];
+    if (points.size() && points.back().key == s.key && points.back().nNodes == s.nNodes && points.back().bytes == s.bytes) {
+      points.back().time += s.time;
+      counts.back()++;
+    } else {
+      points.push_back(s);
+      counts.push_back(1);
+    }
+  }
+  for (size_t i=0; i<points.size(); i++) points[i].time /= counts[i];
+
+  FILE* out = outName ? fopen(outName, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Could not open %s\n", outName);
+    return 1;
+  }
+  fprintf(out, "# %-24s %8s %8s %12s %12s %10s %10s\n", "coll algo proto", "minNodes", "maxNodes", "minBytes", "maxBytes", "lat(us)", "bw(GB/s)");
+
+  size_t g = 0;
+  while (g < points.size()) {
+    // [g, end) : one (coll, algo, proto, nNodes)
+    size_t end = g;
+    while (end < points.size() && points[end].key == points[g].key && points[end].nNodes == points[g].nNodes) end++;
+    // Node range extends up to the next measured node count
+    size_t maxNodes = (end < points.size() && points[end].key == points[g].key) ? points[end].nNodes-1 : (size_t)-1;
+
+    for (size_t b=g; b<end; ) {
+      size_t bEnd = std::min(b+bucketSize, end);
+      if (end-bEnd < 2) bEnd = end; // Do not leave a bucket with a single point
+      double lat, slope, err;
+      fitBucket(points.data()+b, bEnd-b, &lat, &slope, &err);
+      // A zero slope is a latency-only bucket : use a bandwidth no link can reach
+      double bw = slope > 0 ? 1.0 / (1000*slope) : 1e6;
+      fprintf(out, "%-26s %8d", points[g].key.c_str(), points[g].nNodes);
+      printMax(out, maxNodes);
+      fprintf(out, " %12zu", b == g ? 0 : points[b].bytes);
+      printMax(out, bEnd == end ? (size_t)-1 : points[bEnd].bytes-1);
+      fprintf(out, " %10.2f %10.2f # max error %.1f%%\n", lat, bw, err*100);
+      b = bEnd;
+    }
+    g = end;
+  }
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,18 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// NVML symbols referenced by the topology detection of src/graph/xml.cc,
+// which the benchmark never runs.
+
+#include "core.h"
+#include "nvmlwrap.h"
+
+ncclResult_t ncclNvmlDeviceGetHandleByPciBusId(const char* pciBusId, nvmlDevice_t* device) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetIndex(nvmlDevice_t device, unsigned* index) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetCudaComputeCapability(nvmlDevice_t device, int* major, int* minor) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetNvLinkState(nvmlDevice_t device, unsigned int link, nvmlEnableState_t* isActive) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetNvLinkRemotePciInfo(nvmlDevice_t device, unsigned int link, nvmlPciInfo_t* pci) { return ncclSystemError; }
+ncclResult_t ncclNvmlDeviceGetNvLinkCapability(nvmlDevice_t device, unsigned int link, nvmlNvLinkCapability_t capability, unsigned int* capResult) { return ncclSystemError; }
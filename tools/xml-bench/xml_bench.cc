@@ -0,0 +1,336 @@
+/*************************************************************************
+ * Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Benchmarks of the XML topology code on large synthetic topologies.
+//
+// tree : time and memory of the tree. Each topology is built through the
+// xmlSetAttr* API as topology detection does, dumped with
+// ncclTopoDumpXmlToFile, loaded back with ncclTopoGetXmlFromFile and trimmed
+// with ncclTopoTrimXml. The dump of the loaded tree must match the original
+// dump.
+//
+// parse : parsing throughput of ncclTopoGetXmlFromFile on generated topology
+// files (or a given one), and of ncclTopoGetXmlGraphFromFile on generated
+// graph files, as NCCL_TOPO_FILE and NCCL_GRAPH_FILE are loaded.
+
+#include "core.h"
+#include "graph/xml.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCHCHECK(cmd) do { \
+  ncclResult_t res = (cmd); \
+  if (res != ncclSuccess) { \
+    fprintf(stderr, "%s:%d '%s' failed : %d\n", __FILE__, __LINE__, #cmd, res); \
+    exit(1); \
+  } \
+} while (0)
+
+// Shape of a DGX-like node : each CPU has 2 PCI switches, each with 2 GPUs
+// and a NIC. GPUs reach each other through NVSwitch.
+#define GPUS_PER_SWITCH 2
+#define SWITCHES_PER_CPU 2
+#define GPUS_PER_CPU (GPUS_PER_SWITCH*SWITCHES_PER_CPU)
+
+static void pciInit(struct ncclXmlNode* pci, int bus, const char* pciClass) {
+  char busId[32];
+  snprintf(busId, sizeof(busId), "%04x:%02x:00.0", bus/256, bus%256);
+  BENCHCHECK(xmlSetAttr(pci, "busid", busId));
+  BENCHCHECK(xmlSetAttr(pci, "class", pciClass));
+  BENCHCHECK(xmlSetAttr(pci, "vendor", "0x10de"));
+  BENCHCHECK(xmlSetAttr(pci, "device", "0x20b0"));
+  BENCHCHECK(xmlSetAttr(pci, "subsystem_vendor", "0x10de"));
+  BENCHCHECK(xmlSetAttr(pci, "subsystem_device", "0x134f"));
+  BENCHCHECK(xmlSetAttr(pci, "link_speed", "16 GT/s"));
+  BENCHCHECK(xmlSetAttrInt(pci, "link_width", 16));
+}
+
+// Every other GPU, and all NICs, are kept by ncclTopoTrimXml
+static struct ncclXml* topoBuild(int nGpus) {
+  struct ncclXml* xml;
+  BENCHCHECK(ncclCalloc(&xml, 1));
+  struct ncclXmlNode* system;
+  BENCHCHECK(xmlAddNode(xml, NULL, "system", &system));
+  BENCHCHECK(xmlSetAttrInt(system, "version", NCCL_TOPO_XML_VERSION));
+  int bus = 0;
+  for (int c=0; c<nGpus/GPUS_PER_CPU; c++) {
+    struct ncclXmlNode* cpu;
+    BENCHCHECK(xmlAddNode(xml, system, "cpu", &cpu));
+    BENCHCHECK(xmlSetAttrInt(cpu, "numaid", c));
+    BENCHCHECK(xmlSetAttr(cpu, "affinity", "ffffffff,00000000,ffffffff"));
+    BENCHCHECK(xmlSetAttr(cpu, "arch", "x86_64"));
+    BENCHCHECK(xmlSetAttr(cpu, "vendor", "AuthenticAMD"));
+    BENCHCHECK(xmlSetAttrInt(cpu, "familyid", 23));
+    BENCHCHECK(xmlSetAttrInt(cpu, "modelid", 49));
+    for (int s=0; s<SWITCHES_PER_CPU; s++) {
+      struct ncclXmlNode* sw;
+      BENCHCHECK(xmlAddNode(xml, cpu, "pci", &sw));
+      pciInit(sw, bus++, "0x060400");
+      for (int g=0; g<GPUS_PER_SWITCH; g++) {
+        int rank = (c*SWITCHES_PER_CPU+s)*GPUS_PER_SWITCH+g;
+        struct ncclXmlNode* pci, *gpu, *nvlink;
+        BENCHCHECK(xmlAddNode(xml, sw, "pci", &pci));
+        pciInit(pci, bus++, "0x030200");
+        BENCHCHECK(xmlAddNode(xml, pci, "gpu", &gpu));
+        BENCHCHECK(xmlSetAttrInt(gpu, "dev", rank%8));
+        BENCHCHECK(xmlSetAttrInt(gpu, "sm", 80));
+        BENCHCHECK(xmlSetAttrInt(gpu, "rank", rank));
+        BENCHCHECK(xmlSetAttrInt(gpu, "gdr", 1));
+        if (rank%2 == 0) BENCHCHECK(xmlSetAttrInt(gpu, "keep", 1));
+        BENCHCHECK(xmlAddNode(xml, gpu, "nvlink", &nvlink));
+        BENCHCHECK(xmlSetAttr(nvlink, "target", "fffffff:ffff:ff"));
+        BENCHCHECK(xmlSetAttrInt(nvlink, "count", 12));
+        BENCHCHECK(xmlSetAttr(nvlink, "tclass", "0x068000"));
+      }
+      struct ncclXmlNode* pci, *nic, *net;
+      BENCHCHECK(xmlAddNode(xml, sw, "pci", &pci));
+      pciInit(pci, bus++, "0x020700");
+      BENCHCHECK(xmlAddNode(xml, pci, "nic", &nic));
+      BENCHCHECK(xmlAddNode(xml, nic, "net", &net));
+      char name[32];
+      snprintf(name, sizeof(name), "mlx5_%d", c*SWITCHES_PER_CPU+s);
+      BENCHCHECK(xmlSetAttr(net, "name", name));
+      BENCHCHECK(xmlSetAttrInt(net, "dev", c*SWITCHES_PER_CPU+s));
+      BENCHCHECK(xmlSetAttrInt(net, "speed", 200000));
+      BENCHCHECK(xmlSetAttrInt(net, "port", 1));
+      BENCHCHECK(xmlSetAttrFloat(net, "latency", 0));
+      BENCHCHECK(xmlSetAttr(net, "guid", "0x1c0eb0003a1420c"));
+      BENCHCHECK(xmlSetAttrInt(net, "maxconn", 131072));
+      BENCHCHECK(xmlSetAttrInt(net, "gdr", 1));
+      BENCHCHECK(xmlSetAttrInt(net, "keep", 1));
+    }
+  }
+  return xml;
+}
+
+static struct ncclXml* topoLoad(const char* fileName) {
+  struct ncclXml* xml;
+  BENCHCHECK(ncclCalloc(&xml, 1));
+  BENCHCHECK(ncclTopoGetXmlFromFile(fileName, xml, 1));
+  if (xml->maxIndex == 0) {
+    fprintf(stderr, "Could not load %s\n", fileName);
+    exit(1);
+  }
+  return xml;
+}
+
+// Heap memory held by a tree
+static size_t topoMemory(struct ncclXml* xml) {
+  size_t bytes = sizeof(struct ncclXml) + xml->maxNodes*sizeof(struct ncclXmlNode*) + xml->maxStrings*sizeof(char*);
+  for (struct ncclXmlArenaChunk* chunk = xml->arena; chunk; chunk = chunk->next) bytes += sizeof(struct ncclXmlArenaChunk)+chunk->size;
+  return bytes;
+}
+
+static char* fileRead(const char* fileName, size_t* size) {
+  FILE* file = fopen(fileName, "r");
+  if (file == NULL) return NULL;
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char* data = (char*)malloc(*size);
+  if (data && fread(data, 1, *size, file) != *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+// Returns 1 if the files differ
+static int fileCompare(const char* name1, const char* name2) {
+  size_t size1, size2;
+  char* data1 = fileRead(name1, &size1);
+  char* data2 = fileRead(name2, &size2);
+  int differ = data1 == NULL || data2 == NULL || size1 != size2 || memcmp(data1, data2, size1) != 0;
+  free(data1);
+  free(data2);
+  return differ;
+}
+
+// A search result over all GPUs for each pattern, as NCCL_GRAPH_DUMP_FILE writes it
+static void graphWrite(const char* fileName, int nGpus, int nChannels) {
+  FILE* file = fopen(fileName, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open %s\n", fileName);
+    exit(1);
+  }
+  fprintf(file, "<graphs version=\"%d\">\n", NCCL_GRAPH_XML_VERSION);
+  for (int pattern=1; pattern<=4; pattern++) {
+    fprintf(file, "  <graph id=\"%d\" pattern=\"%d\" crossnic=\"0\" nchannels=\"%d\" speedintra=\"20\" speedinter=\"20\" "
+        "latencyinter=\"0\" typeintra=\"NVL\" typeinter=\"PIX\" samechannels=\"0\">\n", pattern-1, pattern, nChannels);
+    for (int c=0; c<nChannels; c++) {
+      int nNets = nGpus/GPUS_PER_SWITCH;
+      fprintf(file, "    <channel>\n");
+      fprintf(file, "      <net dev=\"%d\"/>\n", c%nNets);
+      for (int g=0; g<nGpus; g++) fprintf(file, "      <gpu dev=\"%d\"/>\n", (g+c*GPUS_PER_SWITCH)%nGpus);
+      fprintf(file, "      <net dev=\"%d\"/>\n", c%nNets);
+      fprintf(file, "    </channel>\n");
+    }
+    fprintf(file, "  </graph>\n");
+  }
+  fprintf(file, "</graphs>\n");
+  fclose(file);
+}
+
+static size_t fileSize(const char* fileName) {
+  struct stat st;
+  return stat(fileName, &st) == 0 ? st.st_size : 0;
+}
+
+// Prints the size of the file and its parsing time and throughput
+static void parseFile(const char* fileName, int graph, int iters) {
+  size_t size = fileSize(fileName);
+  uint64_t t0 = clockNano();
+  for (int i=0; i<iters; i++) {
+    struct ncclXml* xml;
+    BENCHCHECK(ncclCalloc(&xml, 1));
+    if (graph) BENCHCHECK(ncclTopoGetXmlGraphFromFile(fileName, xml));
+    else BENCHCHECK(ncclTopoGetXmlFromFile(fileName, xml, 1));
+    if (xml->maxIndex == 0) {
+      fprintf(stderr, "Could not load %s\n", fileName);
+      exit(1);
+    }
+    BENCHCHECK(xmlFree(xml));
+  }
+  double us = (clockNano()-t0)/1e3/iters;
+  printf(" %10.1f %10.2f %10.1f", size/1024.0, us, size/us);
+}
+
+static int parseBench(char* gpus, int nChannels, int iters, const char* dir, const char* topoFile) {
+  if (topoFile && access(topoFile, R_OK) != 0) {
+    fprintf(stderr, "Could not open %s : %s\n", topoFile, strerror(errno));
+    return 1;
+  }
+  printf("# %d iterations, %d channels per graph, times per file\n", iters, nChannels);
+  if (topoFile) {
+    printf("# %-30s %10s %10s %10s\n", "topology", "KB", "time(us)", "MB/s");
+    printf("  %-30s", topoFile);
+    parseFile(topoFile, 0, iters);
+    printf("\n");
+    return 0;
+  }
+  char topoName[PATH_MAX], graphName[PATH_MAX];
+  snprintf(topoName, sizeof(topoName), "%s/nccl-xml-bench-%d-topo.xml", dir, getpid());
+  snprintf(graphName, sizeof(graphName), "%s/nccl-xml-bench-%d-graph.xml", dir, getpid());
+  printf("# %8s %10s %10s %10s %10s %10s %10s\n", "GPUs", "topo KB", "time(us)", "MB/s", "graph KB", "time(us)", "MB/s");
+  for (char* str = strtok(gpus, ","); str; str = strtok(NULL, ",")) {
+    int nGpus = atoi(str);
+    if (nGpus < GPUS_PER_CPU || nGpus%GPUS_PER_CPU) {
+      fprintf(stderr, "GPUs must be a multiple of %d\n", GPUS_PER_CPU);
+      return 1;
+    }
+    struct ncclXml* xml = topoBuild(nGpus);
+    BENCHCHECK(ncclTopoDumpXmlToFile(topoName, xml));
+    BENCHCHECK(xmlFree(xml));
+    graphWrite(graphName, nGpus, nChannels);
+    printf("  %8d", nGpus);
+    parseFile(topoName, 0, iters);
+    parseFile(graphName, 1, iters);
+    printf("\n");
+    fflush(stdout);
+  }
+  unlink(topoName);
+  unlink(graphName);
+  return 0;
+}
+
+static int treeBench(char* gpus, int iters, const char* dir) {
+  char dumpFile[PATH_MAX], checkFile[PATH_MAX];
+  snprintf(dumpFile, sizeof(dumpFile), "%s/nccl-xml-bench-%d.xml", dir, getpid());
+  snprintf(checkFile, sizeof(checkFile), "%s/nccl-xml-bench-%d-check.xml", dir, getpid());
+
+  printf("# %d iterations, times per tree, files in %s\n", iters, dir);
+  printf("# %8s %8s %10s %10s %10s %10s %10s %10s %8s\n", "GPUs", "nodes", "file(KB)", "mem(KB)",
+      "build(us)", "dump(us)", "load(us)", "trim(us)", "errors");
+  int failed = 0;
+  for (char* str = strtok(gpus, ","); str; str = strtok(NULL, ",")) {
+    int nGpus = atoi(str);
+    if (nGpus < GPUS_PER_CPU || nGpus%GPUS_PER_CPU) {
+      fprintf(stderr, "GPUs must be a multiple of %d\n", GPUS_PER_CPU);
+      return 1;
+    }
+    uint64_t t0 = clockNano();
+    for (int i=0; i<iters; i++) BENCHCHECK(xmlFree(topoBuild(nGpus)));
+    double buildUs = (clockNano()-t0)/1e3/iters;
+
+    struct ncclXml* xml = topoBuild(nGpus);
+    int nodes = xml->maxIndex;
+    t0 = clockNano();
+    for (int i=0; i<iters; i++) BENCHCHECK(ncclTopoDumpXmlToFile(dumpFile, xml));
+    double dumpUs = (clockNano()-t0)/1e3/iters;
+    BENCHCHECK(xmlFree(xml));
+
+    t0 = clockNano();
+    for (int i=0; i<iters; i++) BENCHCHECK(xmlFree(topoLoad(dumpFile)));
+    double loadUs = (clockNano()-t0)/1e3/iters;
+
+    // What a communicator keeps : the tree loaded from a file, then trimmed
+    uint64_t trimNs = 0;
+    size_t mem = 0;
+    int errors = 0;
+    for (int i=0; i<iters; i++) {
+      xml = topoLoad(dumpFile);
+      if (i == 0) {
+        BENCHCHECK(ncclTopoDumpXmlToFile(checkFile, xml));
+        errors += xml->maxIndex != nodes;
+        errors += fileCompare(dumpFile, checkFile);
+      }
+      t0 = clockNano();
+      BENCHCHECK(ncclTopoTrimXml(xml));
+      trimNs += clockNano()-t0;
+      mem = topoMemory(xml);
+      BENCHCHECK(xmlFree(xml));
+    }
+    size_t fileSize;
+    free(fileRead(dumpFile, &fileSize));
+    printf("  %8d %8d %10.1f %10.1f %10.2f %10.2f %10.2f %10.2f %8d\n", nGpus, nodes, fileSize/1024.0, mem/1024.0,
+        buildUs, dumpUs, loadUs, trimNs/1e3/iters, errors);
+    fflush(stdout);
+    if (errors) failed = 1;
+  }
+  unlink(dumpFile);
+  unlink(checkFile);
+  return failed;
+}
+
+enum { benchTree, benchParse, benchNumModes };
+static const char* modeNames[benchNumModes] = { "tree", "parse" };
+
+int main(int argc, char* argv[]) {
+  int mode = benchTree, iters = 10, nChannels = 32;
+  const char* dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  const char* topoFile = NULL;
+  char defaultGpus[] = "8,64,512,4096";
+  char* gpus = defaultGpus;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:g:i:d:c:f:h")) != -1) {
+    switch (opt) {
+      case 'o':
+        for (mode=0; mode<benchNumModes && strcmp(optarg, modeNames[mode]); mode++);
+        if (mode == benchNumModes) { fprintf(stderr, "Unknown benchmark %s\n", optarg); return 1; }
+        break;
+      case 'g': gpus = optarg; break;
+      case 'i': iters = atoi(optarg); break;
+      case 'd': dir = optarg; break;
+      case 'c': nChannels = atoi(optarg); break;
+      case 'f': topoFile = optarg; break;
+      default:
+        fprintf(stderr, "Usage : %s [-o tree|parse] [-g GPUs, e.g. 8,64,512] [-i iterations] [-d directory for the files]\n"
+            "        parse : [-c channels per graph] [-f topology file to parse instead]\n", argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (iters < 1 || nChannels < 1) {
+    fprintf(stderr, "Need at least 1 iteration and 1 channel\n");
+    return 1;
+  }
+  if (mode == benchTree) return treeBench(gpus, iters, dir);
+  return parseBench(gpus, nChannels, iters, dir, topoFile);
+}